@@ -0,0 +1,99 @@
+#	$OpenBSD$
+#	Placed in the Public Domain.
+
+tid="ssh-keygen -H and -l with worker threads"
+
+# More lines than ssh-keygen keeps in flight, STREAM_WINDOW chunks of
+# STREAM_CHUNK_LINES lines each
+NLINES=`expr 64 \* 256 + 4000`
+NBLOCKS=`expr $NLINES / 8`
+
+KH=$OBJ/kh-stream
+
+rm -f $KH* $OBJ/stream-ed25519 $OBJ/stream-ed25519.pub
+${SSHKEYGEN} -q -N '' -t ed25519 -f $OBJ/stream-ed25519 || \
+	fatal "ssh-keygen for ed25519 failed"
+RSA=`cat $OBJ/rsa.pub`
+RSA1=`cat $OBJ/rsa1.pub`
+ED25519=`cat $OBJ/stream-ed25519.pub`
+LONG=`dd if=/dev/zero bs=1024 count=20 2>/dev/null | tr '\0' x`
+
+# A line whose host name is already hashed
+echo "hashed.example.com $RSA" > $KH
+${SSHKEYGEN} -H -f $KH >/dev/null 2>&1 || fatal "ssh-keygen -H failed"
+HASHED=`cat $KH`
+
+# Writes NLINES known_hosts lines, in blocks of 8; with "bad" an invalid
+# key and an overlong line are added halfway through
+make_known_hosts ()
+{
+	n=0
+	while [ $n -lt $NLINES ]; do
+		echo "# comment $n"
+		echo ""
+		echo "host$n.example.com,addr$n.example.com $RSA"
+		echo "rsa1-$n.example.com $RSA1"
+		echo "@cert-authority *.ca$n.example.com $ED25519"
+		echo "[port$n.example.com]:2222 $ED25519"
+		echo "$HASHED"
+		echo "*.wild$n.example.com $RSA"
+		if [ "x$1" = "xbad" -a $n -eq 10000 ]; then
+			echo "bad$n.example.com ssh-rsa AAAAinvalid"
+			echo "long.example.com $LONG"
+		fi
+		n=`expr $n + 8`
+	done
+}
+
+trace "generating $NLINES lines"
+make_known_hosts > $KH.in
+make_known_hosts bad > $KH.bad
+
+for j in 1 4; do
+	trace "hash known_hosts with -j $j"
+	cp $KH.in $KH
+	rm -f $KH.old
+	${SSHKEYGEN} -j $j -H -f $KH >/dev/null 2>$KH.err$j || \
+	    fail "ssh-keygen -j $j -H failed"
+	cmp $KH.in $KH.old || fail "-j $j -H did not keep the original"
+	for h in host0 addr10000 host`expr $NLINES - 8`; do
+		${SSHKEYGEN} -F $h.example.com -f $KH | \
+		    grep "found: line" >/dev/null || \
+		    fail "-j $j -H: $h.example.com not found"
+	done
+	n=`grep -c -x -F "$HASHED" $KH`
+	[ $n -eq $NBLOCKS ] || fail "-j $j -H: $n of $NBLOCKS hashed lines kept"
+	# The salts are random, so compare everything but the new hashes
+	grep -v -x -F "$HASHED" $KH | sed 's/^|1|[^ ]* /|1|hash /' \
+	    >$KH.out$j
+
+	trace "fingerprint known_hosts with -j $j"
+	${SSHKEYGEN} -j $j -l -f $KH.in >$KH.fp$j 2>$KH.fperr$j || \
+	    fail "ssh-keygen -j $j -l failed"
+	n=`wc -l <$KH.fp$j`
+	[ $n -eq `expr $NBLOCKS \* 5` ] || \
+	    fail "-j $j -l: $n fingerprints for $NBLOCKS blocks"
+
+	trace "hash invalid known_hosts with -j $j"
+	cp $KH.bad $KH
+	rm -f $KH.old
+	${SSHKEYGEN} -j $j -H -f $KH >/dev/null 2>$KH.baderr$j
+	r=$?
+	[ $r -eq 1 ] || fail "-j $j -H on invalid input exited $r"
+	cmp $KH.bad $KH || fail "-j $j -H replaced an invalid file"
+	[ -f $KH.old ] && fail "-j $j -H kept a backup of an invalid file"
+	ls $KH.?????????? >/dev/null 2>&1 && \
+	    fail "-j $j -H left its temporary file"
+	grep "Not replacing existing known_hosts" $KH.baderr$j >/dev/null || \
+	    fail "-j $j -H did not report the invalid file"
+
+	trace "fingerprint invalid known_hosts with -j $j"
+	${SSHKEYGEN} -j $j -l -f $KH.bad >$KH.badfp$j 2>$KH.badfperr$j || \
+	    fail "ssh-keygen -j $j -l failed on invalid input"
+done
+
+for f in err out fp fperr baderr badfp badfperr; do
+	cmp $KH.${f}1 $KH.${f}4 || fail "$f differs between -j 1 and -j 4"
+done
+
+rm -f $KH* $OBJ/stream-ed25519 $OBJ/stream-ed25519.pub
@@ -57,6 +57,7 @@
 #endif
 #include "authfile.h"
 #include "monitor_wrap.h"
+#include "krl.h"
 #include "err.h"
 
 /* import */
@@ -479,6 +480,31 @@ getpwnamallow(const char *user)
 	return (NULL);
 }
 
+/*
+ * Checks a key against a binary revocation list, or against a plain list
+ * of public keys if revoked_keys_file is not a KRL.  Returns 0 if the key
+ * is revoked, SSH_ERR_KEY_NOT_FOUND if it is not, or another error.
+ */
+static int
+revoked_keys_check(struct sshkey *key)
+{
+	struct sshkrl *krl;
+	int r;
+
+	switch ((r = sshkrl_load(options.revoked_keys_file, &krl))) {
+	case 0:
+		r = sshkrl_check_key(krl, key);
+		sshkrl_free(krl);
+		if (r == SSH_ERR_KEY_REVOKED)
+			return 0;
+		return r == 0 ? SSH_ERR_KEY_NOT_FOUND : r;
+	case SSH_ERR_KRL_BAD_MAGIC:
+		return sshkey_in_file(key, options.revoked_keys_file, 0);
+	default:
+		return r;
+	}
+}
+
 /* Returns 1 if key is revoked by revoked_keys_file, 0 otherwise */
 int
 auth_key_is_revoked(struct sshkey *key)
@@ -489,7 +515,7 @@ auth_key_is_revoked(struct sshkey *key)
 	if (options.revoked_keys_file == NULL)
 		return 0;
 
-	switch ((r = sshkey_in_file(key, options.revoked_keys_file, 0))) {
+	switch ((r = revoked_keys_check(key))) {
 	case SSH_ERR_KEY_NOT_FOUND:
 		/* key not revoked */
 		return 0;
@@ -90,7 +90,7 @@ userauth_hostbased(struct ssh *ssh)
 		    __func__, pkalg);
 		goto done;
 	}
-	if ((r = sshkey_from_blob(pkblob, blen, &key)) != 0) {
+	if ((r = sshkey_from_blob_shared(pkblob, blen, &key)) != 0) {
 		error("%s: key_from_blob: %s", __func__, ssh_err(r));
 		goto done;
 	}
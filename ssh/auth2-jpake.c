@@ -169,6 +169,11 @@ derive_rawsalt(const char *username, u_char *rawsalt, u_int len)
 			fatal("%s: ECDSA key missing priv_key", __func__);
 		buffer_put_bignum2(&b, EC_KEY_get0_private_key(k->ecdsa));
 		break;
+	case KEY_ED25519:
+		if (k->ed25519_sk == NULL)
+			fatal("%s: ED25519 key missing private key", __func__);
+		buffer_put_string(&b, k->ed25519_sk, ED25519_SEED_SIZE);
+		break;
 	default:
 		fatal("%s: unknown key type %d", __func__, k->type);
 	}
@@ -49,6 +49,7 @@
 #include "pathnames.h"
 #include "uidswap.h"
 #include "auth-options.h"
+#include "authkeys.h"
 #include "canohost.h"
 #ifdef GSSAPI
 #include "ssh-gss.h"
@@ -101,7 +102,7 @@ userauth_pubkey(struct ssh *ssh)
 		    pkalg);
 		goto done;
 	}
-	if ((r = sshkey_from_blob(pkblob, blen, &key)) != 0) {
+	if ((r = sshkey_from_blob_shared(pkblob, blen, &key)) != 0) {
 		error("%s: could not parse key: %s", __func__, ssh_err(r));
 		goto done;
 	}
@@ -263,12 +264,13 @@ match_principals_file(char *file, struct passwd *pw, struct sshkey_cert *cert)
 static int
 user_key_allowed2(struct passwd *pw, struct sshkey *key, char *file)
 {
-	char line[SSH_MAX_PUBKEY_BYTES];
 	const char *reason;
 	int found_key = 0;
 	FILE *f;
-	u_long linenum = 0;
-	struct sshkey *found = NULL;
+	struct authkeys_entry **matches = NULL;
+	struct sshkey *found;
+	u_long linenum;
+	u_int i, nmatches = 0;
 	char *fp;
 
 	/* Temporarily use the user's uid. */
@@ -283,45 +285,19 @@ user_key_allowed2(struct passwd *pw, struct sshkey *key, char *file)
 	}
 
 	found_key = 0;
-	found = sshkey_new(sshkey_is_cert(key) ? KEY_UNSPEC : key->type);
-	if (found == NULL)
-		goto done;
-
-	while (read_keyfile_line(f, file, line, sizeof(line), &linenum) != -1) {
-		char *cp, *key_options = NULL;
 
-		auth_clear_options();
+	/* The parsed file is cached; only lines holding the key are seen */
+	if (authkeys_lookup(f, file, sshkey_is_cert(key) ?
+	    key->cert->signature_key : key, &matches, &nmatches) != 0)
+		goto done;
 
-		/* Skip leading whitespace, empty and comment lines. */
-		for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
-			;
-		if (!*cp || *cp == '\n' || *cp == '#')
-			continue;
+	auth_clear_options();
+	for (i = 0; i < nmatches; i++) {
+		found = matches[i]->key;
+		linenum = matches[i]->linenum;
 
-		if (sshkey_read(found, &cp) != 0) {
-			/* no key?  check if there are options for this key */
-			int quoted = 0;
-			debug2("user_key_allowed: check options: '%s'", cp);
-			key_options = cp;
-			for (; *cp && (quoted || (*cp != ' ' && *cp != '\t')); cp++) {
-				if (*cp == '\\' && cp[1] == '"')
-					cp++;	/* Skip both */
-				else if (*cp == '"')
-					quoted = !quoted;
-			}
-			/* Skip remaining whitespace. */
-			for (; *cp == ' ' || *cp == '\t'; cp++)
-				;
-			if (sshkey_read(found, &cp) != 0) {
-				debug2("user_key_allowed: advance: '%s'", cp);
-				/* still no key?  advance to next line*/
-				continue;
-			}
-		}
 		if (sshkey_is_cert(key)) {
-			if (!sshkey_equal(found, key->cert->signature_key))
-				continue;
-			if (auth_parse_options(pw, key_options, file,
+			if (auth_parse_options(pw, matches[i]->options, file,
 			    linenum) != 1)
 				continue;
 			if (!key_is_cert_authority)
@@ -360,8 +336,8 @@ user_key_allowed2(struct passwd *pw, struct sshkey *key, char *file)
 			xfree(fp);
 			found_key = 1;
 			break;
-		} else if (sshkey_equal(found, key)) {
-			if (auth_parse_options(pw, key_options, file,
+		} else {
+			if (auth_parse_options(pw, matches[i]->options, file,
 			    linenum) != 1)
 				continue;
 			if (key_is_cert_authority)
@@ -379,8 +355,8 @@ user_key_allowed2(struct passwd *pw, struct sshkey *key, char *file)
  done:
 	restore_uid();
 	fclose(f);
-	if (found != NULL)
-		sshkey_free(found);
+	if (matches != NULL)
+		xfree(matches);
 	if (!found_key)
 		debug2("key not found");
 	return found_key;
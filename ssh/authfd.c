@@ -526,6 +526,18 @@ ssh_encode_identity_ssh2(Buffer *b, struct sshkey *key, const char *comment)
 		    buffer_len(key->cert->certblob));
 		buffer_put_bignum2(b, EC_KEY_get0_private_key(key->ecdsa));
 		break;
+	case KEY_ED25519:
+		buffer_put_string(b, key->ed25519_pk, ED25519_PK_SIZE);
+		buffer_put_string(b, key->ed25519_sk, ED25519_SK_SIZE);
+		break;
+	case KEY_ED25519_CERT:
+		if (key->cert == NULL || buffer_len(key->cert->certblob) == 0)
+			fatal("%s: no cert/certblob", __func__);
+		buffer_put_string(b, buffer_ptr(key->cert->certblob),
+		    buffer_len(key->cert->certblob));
+		buffer_put_string(b, key->ed25519_pk, ED25519_PK_SIZE);
+		buffer_put_string(b, key->ed25519_sk, ED25519_SK_SIZE);
+		break;
 	}
 	buffer_put_cstring(b, comment);
 }
@@ -560,6 +572,8 @@ ssh_add_identity_constrained(AuthenticationConnection *auth, struct sshkey *key,
 	case KEY_DSA_CERT_V00:
 	case KEY_ECDSA:
 	case KEY_ECDSA_CERT:
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
 		type = constrained ?
 		    SSH2_AGENTC_ADD_ID_CONSTRAINED :
 		    SSH2_AGENTC_ADD_IDENTITY;
@@ -609,7 +623,8 @@ ssh_remove_identity(AuthenticationConnection *auth, struct sshkey *key)
 		buffer_put_bignum(&msg, key->rsa->n);
 	} else if (sshkey_type_plain(key->type) == KEY_DSA ||
 	    sshkey_type_plain(key->type) == KEY_RSA ||
-	    sshkey_type_plain(key->type) == KEY_ECDSA) {
+	    sshkey_type_plain(key->type) == KEY_ECDSA ||
+	    sshkey_type_plain(key->type) == KEY_ED25519) {
 		if ((r = sshkey_to_blob(key, &blob, &blen)) != 0) {
 			error("%s: sshkey_to_blob: %s", __func__, ssh_err(r));
 			return 0;
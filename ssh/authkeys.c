@@ -0,0 +1,282 @@
+/* $OpenBSD$ */
+/*
+ * Cache of parsed authorized_keys files for sshd.
+ *
+ * A client usually offers several keys and every key is checked twice,
+ * once when it is offered and again with the signature, so the same
+ * authorized_keys file is read many times during one login.  The cache
+ * keeps the parsed lines of each file, split into key and options, with
+ * a hash table on the key blob, so that finding the lines for a key
+ * does not touch the rest of the file.  A file is parsed again when its
+ * device, inode, size or modification time change.
+ *
+ * The options are only split off, not evaluated: auth_parse_options()
+ * sets the per-connection option state and checks from= against the
+ * client, so it still runs for every matching line.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xmalloc.h"
+#include "ssh.h"
+#include "key.h"
+#include "log.h"
+#include "misc.h"
+#include "authkeys.h"
+
+#define AUTHKEYS_MAX_FILES	8
+
+struct authkeys_line {
+	struct authkeys_entry entry;
+	u_int32_t hash;			/* hash of the key blob */
+	u_int next;			/* next line in the bucket + 1, or 0 */
+};
+
+struct authkeys_file {
+	TAILQ_ENTRY(authkeys_file) next;
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct authkeys_line *lines;
+	u_int nlines;
+	u_int *buckets;			/* first line in the bucket + 1 */
+	u_int nbuckets;
+};
+
+static TAILQ_HEAD(authkeys_files_head, authkeys_file) authkeys_files =
+    TAILQ_HEAD_INITIALIZER(authkeys_files);
+static u_int authkeys_nfiles;
+
+/* FNV-1a over the key blob */
+static int
+authkeys_hash(const struct sshkey *key, u_int32_t *hashp)
+{
+	u_char *blob;
+	u_int i, len;
+	u_int32_t h = 2166136261U;
+
+	if (sshkey_to_blob(key, &blob, &len) != 0)
+		return -1;
+	for (i = 0; i < len; i++) {
+		h ^= blob[i];
+		h *= 16777619U;
+	}
+	xfree(blob);
+	*hashp = h;
+	return 0;
+}
+
+static void
+authkeys_file_free(struct authkeys_file *af)
+{
+	u_int i;
+
+	for (i = 0; i < af->nlines; i++) {
+		sshkey_free(af->lines[i].entry.key);
+		if (af->lines[i].entry.options != NULL)
+			xfree(af->lines[i].entry.options);
+	}
+	if (af->lines != NULL)
+		xfree(af->lines);
+	if (af->buckets != NULL)
+		xfree(af->buckets);
+	xfree(af->path);
+	xfree(af);
+}
+
+static void
+authkeys_add(struct authkeys_file *af, struct sshkey *key, char *options,
+    u_long linenum)
+{
+	struct authkeys_line *l;
+	u_int32_t hash;
+
+	if (authkeys_hash(key, &hash) != 0) {
+		sshkey_free(key);
+		if (options != NULL)
+			xfree(options);
+		return;
+	}
+	af->lines = xrealloc(af->lines, af->nlines + 1, sizeof(*af->lines));
+	l = &af->lines[af->nlines++];
+	l->entry.linenum = linenum;
+	l->entry.key = key;
+	l->entry.options = options;
+	l->hash = hash;
+	l->next = 0;
+}
+
+/* Parses the lines of 'f' exactly as user_key_allowed2() used to. */
+static int
+authkeys_parse(struct authkeys_file *af, FILE *f, const char *file)
+{
+	char line[SSH_MAX_PUBKEY_BYTES], *cp, *opts, *options;
+	u_long linenum = 0;
+	struct sshkey *key;
+	u_int i, b;
+	size_t len;
+	int quoted;
+
+	while (read_keyfile_line(f, file, line, sizeof(line), &linenum) != -1) {
+		/* Skip leading whitespace, empty and comment lines. */
+		for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
+			;
+		if (!*cp || *cp == '\n' || *cp == '#')
+			continue;
+
+		if ((key = sshkey_new(KEY_UNSPEC)) == NULL)
+			fatal("%s: sshkey_new failed", __func__);
+		options = NULL;
+		if (sshkey_read(key, &cp) != 0) {
+			/* no key?  check if there are options for this key */
+			quoted = 0;
+			opts = cp;
+			for (; *cp && (quoted || (*cp != ' ' && *cp != '\t'));
+			    cp++) {
+				if (*cp == '\\' && cp[1] == '"')
+					cp++;	/* Skip both */
+				else if (*cp == '"')
+					quoted = !quoted;
+			}
+			/*
+			 * Keep the whitespace that ends the options, which
+			 * auth_parse_options() expects.
+			 */
+			if (*cp != '\0')
+				cp++;
+			len = cp - opts;
+			options = xmalloc(len + 1);
+			memcpy(options, opts, len);
+			options[len] = '\0';
+			/* Skip remaining whitespace. */
+			for (; *cp == ' ' || *cp == '\t'; cp++)
+				;
+			if (sshkey_read(key, &cp) != 0) {
+				debug2("%s: %s line %lu: no key", __func__,
+				    file, linenum);
+				sshkey_free(key);
+				xfree(options);
+				continue;
+			}
+		}
+		authkeys_add(af, key, options, linenum);
+	}
+	if (ferror(f))
+		return -1;
+
+	/* Chain the lines of each bucket in file order */
+	for (af->nbuckets = 16; af->nbuckets < af->nlines; af->nbuckets <<= 1)
+		;
+	af->buckets = xcalloc(af->nbuckets, sizeof(*af->buckets));
+	for (i = af->nlines; i-- > 0;) {
+		b = af->lines[i].hash & (af->nbuckets - 1);
+		af->lines[i].next = af->buckets[b];
+		af->buckets[b] = i + 1;
+	}
+	return 0;
+}
+
+static struct authkeys_file *
+authkeys_load(FILE *f, const char *file)
+{
+	struct authkeys_file *af;
+	struct stat st;
+
+	if (fstat(fileno(f), &st) == -1) {
+		error("%s: fstat %s: %s", __func__, file, strerror(errno));
+		return NULL;
+	}
+	TAILQ_FOREACH(af, &authkeys_files, next) {
+		if (strcmp(af->path, file) != 0)
+			continue;
+		if (af->dev == st.st_dev && af->ino == st.st_ino &&
+		    af->size == st.st_size &&
+		    af->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    af->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			debug3("%s: using cached %s", __func__, file);
+			/* Most recently used files stay at the head */
+			TAILQ_REMOVE(&authkeys_files, af, next);
+			TAILQ_INSERT_HEAD(&authkeys_files, af, next);
+			return af;
+		}
+		debug3("%s: %s changed", __func__, file);
+		TAILQ_REMOVE(&authkeys_files, af, next);
+		authkeys_nfiles--;
+		authkeys_file_free(af);
+		break;
+	}
+
+	af = xcalloc(1, sizeof(*af));
+	af->path = xstrdup(file);
+	af->dev = st.st_dev;
+	af->ino = st.st_ino;
+	af->size = st.st_size;
+	af->mtime = st.st_mtim;
+	if (authkeys_parse(af, f, file) != 0) {
+		error("%s: error reading %s", __func__, file);
+		authkeys_file_free(af);
+		return NULL;
+	}
+	debug3("%s: parsed %u keys from %s", __func__, af->nlines, file);
+
+	if (authkeys_nfiles >= AUTHKEYS_MAX_FILES) {
+		struct authkeys_file *last;
+
+		last = TAILQ_LAST(&authkeys_files, authkeys_files_head);
+		TAILQ_REMOVE(&authkeys_files, last, next);
+		authkeys_nfiles--;
+		authkeys_file_free(last);
+	}
+	TAILQ_INSERT_HEAD(&authkeys_files, af, next);
+	authkeys_nfiles++;
+	return af;
+}
+
+int
+authkeys_lookup(FILE *f, const char *file, const struct sshkey *key,
+    struct authkeys_entry ***matchesp, u_int *nmatchesp)
+{
+	struct authkeys_file *af;
+	struct authkeys_line *l;
+	u_int32_t hash;
+	u_int i, n = 0;
+
+	*matchesp = NULL;
+	*nmatchesp = 0;
+	if ((af = authkeys_load(f, file)) == NULL)
+		return -1;
+	if (authkeys_hash(key, &hash) != 0)
+		return 0;
+	for (i = af->buckets[hash & (af->nbuckets - 1)]; i != 0; i = l->next) {
+		l = &af->lines[i - 1];
+		if (l->hash != hash || !sshkey_equal(l->entry.key, key))
+			continue;
+		*matchesp = xrealloc(*matchesp, n + 1, sizeof(**matchesp));
+		(*matchesp)[n++] = &l->entry;
+	}
+	*nmatchesp = n;
+	return 0;
+}
+
+void
+authkeys_flush(void)
+{
+	struct authkeys_file *af;
+
+	while ((af = TAILQ_FIRST(&authkeys_files)) != NULL) {
+		TAILQ_REMOVE(&authkeys_files, af, next);
+		authkeys_file_free(af);
+	}
+	authkeys_nfiles = 0;
+}
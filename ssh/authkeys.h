@@ -0,0 +1,33 @@
+/* $OpenBSD$ */
+/*
+ * Cache of parsed authorized_keys files for sshd.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef AUTHKEYS_H
+#define AUTHKEYS_H
+
+struct sshkey;
+
+struct authkeys_entry {
+	u_long		 linenum;
+	struct sshkey	*key;
+	char		*options;	/* key options as written, or NULL */
+};
+
+/*
+ * authkeys_lookup() returns the entries of the authorized keys file 'f',
+ * opened from 'file', whose key equals 'key', in file order.  The file
+ * is parsed once and kept until its device, inode, size or modification
+ * time change.  The entries belong to the cache and stay valid until the
+ * next call; the array in '*matchesp' must be freed by the caller.
+ * Returns 0 on success and -1 if the file could not be read.
+ */
+int	authkeys_lookup(FILE *f, const char *file, const struct sshkey *key,
+    struct authkeys_entry ***matchesp, u_int *nmatchesp);
+
+/* authkeys_flush() drops every cached file. */
+void	authkeys_flush(void);
+
+#endif
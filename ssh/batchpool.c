@@ -0,0 +1,186 @@
+/* $OpenBSD$ */
+/*
+ * Worker threads for ssh-keygen batch operations, completing in order.
+ *
+ * Items are submitted in input order into a ring of 'window' slots.
+ * Workers take the oldest item that has not been started; the submitting
+ * thread completes items from the other end, in the order they were
+ * submitted, as soon as the oldest one is done.  Output written by the
+ * completion callback is therefore in input order, and a full ring makes
+ * the submitter wait instead of reading ahead without limit.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batchpool.h"
+#include "cryptothread.h"
+#include "log.h"
+#include "err.h"
+
+#define BATCHPOOL_WORKERS_MAX	256
+
+struct batch_slot {
+	void	*item;
+	int	done;
+};
+
+struct batch_pool {
+	pthread_mutex_t lock;		/* protects everything below */
+	pthread_cond_t work;		/* items queued, or stopping */
+	pthread_cond_t done;		/* an item is done */
+	struct batch_slot *slots;
+	u_int	window;
+	u_int64_t head;			/* oldest item not completed */
+	u_int64_t next;			/* oldest item not started */
+	u_int64_t tail;			/* next item to be submitted */
+	int	stop;
+	pthread_t *workers;
+	u_int	nworkers;
+	batch_pool_work_fn *work_fn;
+	batch_pool_done_fn *done_fn;
+	void	*ctx;
+};
+
+static void *
+batchpool_worker(void *arg)
+{
+	struct batch_pool *p = arg;
+	struct batch_slot *s;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (p->next == p->tail && !p->stop)
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->next == p->tail)
+			break;
+		s = &p->slots[p->next++ % p->window];
+		pthread_mutex_unlock(&p->lock);
+
+		p->work_fn(s->item, p->ctx);
+
+		pthread_mutex_lock(&p->lock);
+		s->done = 1;
+		pthread_cond_broadcast(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/* Completes the oldest item, waiting for it if 'wait' is set */
+static int
+batchpool_complete(struct batch_pool *p, int wait)
+{
+	struct batch_slot *s;
+	void *item;
+
+	if (p->head == p->tail)
+		return 0;
+	s = &p->slots[p->head % p->window];
+	while (!s->done) {
+		if (!wait)
+			return 0;
+		pthread_cond_wait(&p->done, &p->lock);
+	}
+	item = s->item;
+	s->item = NULL;
+	s->done = 0;
+	p->head++;
+	/* Only this thread submits, so the slot stays free meanwhile */
+	pthread_mutex_unlock(&p->lock);
+	p->done_fn(item, p->ctx);
+	pthread_mutex_lock(&p->lock);
+	return 1;
+}
+
+int
+batch_pool_new(struct batch_pool **pp, u_int nworkers, u_int window,
+    batch_pool_work_fn *work, batch_pool_done_fn *done, void *ctx)
+{
+	struct batch_pool *p;
+	long ncpu;
+	int r;
+
+	*pp = NULL;
+	if (window == 0 || work == NULL || done == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((r = ssh_crypto_thread_init()) != 0)
+		return r;
+	if (nworkers == 0)
+		nworkers = (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ?
+		    ncpu : 1;
+	nworkers = MIN(nworkers, BATCHPOOL_WORKERS_MAX);
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((p->slots = calloc(window, sizeof(*p->slots))) == NULL ||
+	    (p->workers = calloc(nworkers, sizeof(*p->workers))) == NULL) {
+		free(p->slots);
+		free(p);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->window = window;
+	p->work_fn = work;
+	p->done_fn = done;
+	p->ctx = ctx;
+	for (; p->nworkers < nworkers; p->nworkers++) {
+		if ((r = pthread_create(&p->workers[p->nworkers], NULL,
+		    batchpool_worker, p)) != 0) {
+			error("%s: pthread_create: %s", __func__, strerror(r));
+			batch_pool_free(p);
+			return SSH_ERR_SYSTEM_ERROR;
+		}
+	}
+	debug("%s: %u workers, window %u", __func__, nworkers, window);
+	*pp = p;
+	return 0;
+}
+
+void
+batch_pool_submit(struct batch_pool *p, void *item)
+{
+	struct batch_slot *s;
+
+	pthread_mutex_lock(&p->lock);
+	while (batchpool_complete(p, p->tail - p->head >= p->window))
+		;
+	s = &p->slots[p->tail++ % p->window];
+	s->item = item;
+	s->done = 0;
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void
+batch_pool_free(struct batch_pool *p)
+{
+	u_int i;
+
+	if (p == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	while (batchpool_complete(p, 1))
+		;
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->nworkers; i++)
+		pthread_join(p->workers[i], NULL);
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	free(p->workers);
+	free(p->slots);
+	free(p);
+}
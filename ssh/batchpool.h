@@ -0,0 +1,41 @@
+/* $OpenBSD$ */
+/*
+ * Worker threads for ssh-keygen batch operations, completing in order.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef BATCHPOOL_H
+#define BATCHPOOL_H
+
+#include <sys/types.h>
+
+struct batch_pool;
+
+/* called on a worker thread for every submitted item */
+typedef void batch_pool_work_fn(void *item, void *ctx);
+/* called on the submitting thread, in submission order, once done */
+typedef void batch_pool_done_fn(void *item, void *ctx);
+
+/*
+ * batch_pool_new() starts 'nworkers' threads (0: one per online CPU).
+ * at most 'window' items are in flight, so that memory stays bounded
+ * however many items are submitted.  with libcrypto before 1.1 the
+ * locking callbacks are installed unless the application already has.
+ */
+int	batch_pool_new(struct batch_pool **, u_int nworkers, u_int window,
+    batch_pool_work_fn *work, batch_pool_done_fn *done, void *ctx);
+
+/*
+ * batch_pool_submit() queues 'item'.  it first completes the items that
+ * are done, and waits for the oldest one while the window is full.
+ */
+void	batch_pool_submit(struct batch_pool *, void *item);
+
+/*
+ * batch_pool_free() completes all queued items, then stops the workers
+ * and releases the pool.
+ */
+void	batch_pool_free(struct batch_pool *);
+
+#endif
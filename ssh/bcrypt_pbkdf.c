@@ -0,0 +1,129 @@
+/* $OpenBSD$ */
+/*
+ * A password based key derivation function for private key files.
+ *
+ * This is PBKDF2 with bcrypt in place of HMAC: the password and salt are
+ * collapsed with SHA512 and fed through 64 rounds of the expensive
+ * Blowfish key schedule, so that every guess costs memory and time that
+ * does not parallelise well.  Unlike PBKDF2 the output blocks are
+ * interleaved, so that an attacker must compute all of them to recover
+ * any part of the key.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <blf.h>
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#include "bcrypt_pbkdf.h"
+
+#define BCRYPT_WORDS	8
+#define BCRYPT_HASHSIZE	(BCRYPT_WORDS * 4)
+
+static void
+bcrypt_hash(const u_char *sha2pass, const u_char *sha2salt, u_char *out)
+{
+	blf_ctx state;
+	u_char ciphertext[BCRYPT_HASHSIZE] =
+	    "OxychromaticBlowfishSwatDynamite";
+	u_int32_t cdata[BCRYPT_WORDS];
+	u_int16_t j;
+	int i;
+
+	/* key expansion */
+	Blowfish_initstate(&state);
+	Blowfish_expandstate(&state, sha2salt, SHA512_DIGEST_LENGTH,
+	    sha2pass, SHA512_DIGEST_LENGTH);
+	for (i = 0; i < 64; i++) {
+		Blowfish_expand0state(&state, sha2salt, SHA512_DIGEST_LENGTH);
+		Blowfish_expand0state(&state, sha2pass, SHA512_DIGEST_LENGTH);
+	}
+
+	/* encryption */
+	j = 0;
+	for (i = 0; i < BCRYPT_WORDS; i++)
+		cdata[i] = Blowfish_stream2word(ciphertext, sizeof(ciphertext),
+		    &j);
+	for (i = 0; i < 64; i++)
+		blf_enc(&state, cdata, BCRYPT_WORDS / 2);
+
+	/* copy out, little endian */
+	for (i = 0; i < BCRYPT_WORDS; i++) {
+		out[4 * i + 3] = (cdata[i] >> 24) & 0xff;
+		out[4 * i + 2] = (cdata[i] >> 16) & 0xff;
+		out[4 * i + 1] = (cdata[i] >> 8) & 0xff;
+		out[4 * i + 0] = cdata[i] & 0xff;
+	}
+
+	bzero(ciphertext, sizeof(ciphertext));
+	bzero(cdata, sizeof(cdata));
+	bzero(&state, sizeof(state));
+}
+
+int
+bcrypt_pbkdf(const char *pass, size_t passlen, const u_char *salt,
+    size_t saltlen, u_char *key, size_t keylen, u_int rounds)
+{
+	SHA512_CTX ctx;
+	u_char sha2pass[SHA512_DIGEST_LENGTH];
+	u_char sha2salt[SHA512_DIGEST_LENGTH];
+	u_char out[BCRYPT_HASHSIZE], tmpout[BCRYPT_HASHSIZE];
+	u_char countsalt[4];
+	size_t i, j, amt, stride, dest, origkeylen = keylen;
+	u_int32_t count;
+
+	if (rounds < 1 || passlen == 0 || saltlen == 0 || keylen == 0 ||
+	    keylen > sizeof(out) * sizeof(out))
+		return -1;
+	stride = (keylen + sizeof(out) - 1) / sizeof(out);
+	amt = (keylen + stride - 1) / stride;
+
+	/* collapse the password */
+	SHA512((const u_char *)pass, passlen, sha2pass);
+
+	/* generate the key, sizeof(out) at a time */
+	for (count = 1; keylen > 0; count++) {
+		countsalt[0] = (count >> 24) & 0xff;
+		countsalt[1] = (count >> 16) & 0xff;
+		countsalt[2] = (count >> 8) & 0xff;
+		countsalt[3] = count & 0xff;
+
+		/* the first round hashes the salt */
+		SHA512_Init(&ctx);
+		SHA512_Update(&ctx, salt, saltlen);
+		SHA512_Update(&ctx, countsalt, sizeof(countsalt));
+		SHA512_Final(sha2salt, &ctx);
+		bcrypt_hash(sha2pass, sha2salt, tmpout);
+		memcpy(out, tmpout, sizeof(out));
+
+		/* later rounds hash the previous output */
+		for (i = 1; i < rounds; i++) {
+			SHA512(tmpout, sizeof(tmpout), sha2salt);
+			bcrypt_hash(sha2pass, sha2salt, tmpout);
+			for (j = 0; j < sizeof(out); j++)
+				out[j] ^= tmpout[j];
+		}
+
+		/* spread the block over the key, unlike PBKDF2 */
+		amt = MIN(amt, keylen);
+		for (i = 0; i < amt; i++) {
+			dest = i * stride + (count - 1);
+			if (dest >= origkeylen)
+				break;
+			key[dest] = out[i];
+		}
+		keylen -= i;
+	}
+
+	bzero(&ctx, sizeof(ctx));
+	bzero(sha2pass, sizeof(sha2pass));
+	bzero(sha2salt, sizeof(sha2salt));
+	bzero(out, sizeof(out));
+	bzero(tmpout, sizeof(tmpout));
+	return 0;
+}
@@ -0,0 +1,21 @@
+/* $OpenBSD$ */
+/*
+ * A password based key derivation function for private key files.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef BCRYPT_PBKDF_H
+#define BCRYPT_PBKDF_H
+
+#include <sys/types.h>
+
+/*
+ * bcrypt_pbkdf() derives 'keylen' bytes (at most 1024) of 'key' from the
+ * password and salt; every round costs a few milliseconds.  returns 0 on
+ * success and -1 for invalid arguments.
+ */
+int	bcrypt_pbkdf(const char *pass, size_t passlen, const u_char *salt,
+    size_t saltlen, u_char *key, size_t keylen, u_int rounds);
+
+#endif
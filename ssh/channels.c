@@ -73,6 +73,7 @@
 #include "key.h"
 #include "authfd.h"
 #include "pathnames.h"
+#include "probe.h"
 
 /* -- channel core */
 
@@ -255,6 +256,19 @@ channel_register_fds(Channel *c, int rfd, int wfd, int efd,
 	}
 }
 
+/*
+ * Returns the maximum packet size to advertise for a new channel: the
+ * default, or the packet size set with packet_set_maxsize() if that is
+ * larger (large-packet mode).
+ */
+u_int
+channel_maxpacket(u_int def)
+{
+	if (compat20 && packet_get_maxsize() > def)
+		return packet_get_maxsize();
+	return def;
+}
+
 /*
  * Allocate a new channel object and set its type and socket. This will cause
  * remote_name to be freed.
@@ -334,6 +348,7 @@ channel_new(char *ctype, int type, int rfd, int wfd, int efd,
 	c->delayed = 1;		/* prevent call to channel_post handler */
 	TAILQ_INIT(&c->status_confirms);
 	debug("channel %d: new [%s]", found, remote_name);
+	SSH_PROBE4(channel__open, found, type, window, maxpack);
 	return c;
 }
 
@@ -392,6 +407,8 @@ channel_free(Channel *c)
 			n++;
 	debug("channel %d: free: %s, nchannels %u", c->self,
 	    c->remote_name ? c->remote_name : "???", n);
+	SSH_PROBE3(channel__close, c->self, c->local_window,
+	    c->remote_window);
 
 	s = channel_open_message();
 	debug3("channel %d: status: %s", c->self, s);
@@ -509,6 +526,42 @@ channel_not_very_much_buffered_data(void)
 	return 1;
 }
 
+/* Shrinks channel buffers that grew during a burst of data. */
+void
+channel_shrink_all(void)
+{
+	u_int i;
+	Channel *c;
+
+	for (i = 0; i < channels_alloc; i++) {
+		if ((c = channels[i]) == NULL)
+			continue;
+		if (sshbuf_shrink(&c->input) != 0 ||
+		    sshbuf_shrink(&c->output) != 0 ||
+		    sshbuf_shrink(&c->extended) != 0)
+			fatal("%s: sshbuf_shrink failed", __func__);
+	}
+}
+
+/* Returns the memory held by channels and their buffers. */
+size_t
+channel_get_memory(void)
+{
+	u_int i;
+	size_t len;
+	Channel *c;
+
+	len = channels_alloc * sizeof(Channel *);
+	for (i = 0; i < channels_alloc; i++) {
+		if ((c = channels[i]) == NULL)
+			continue;
+		len += sizeof(*c) + sshbuf_allocated(&c->input) +
+		    sshbuf_allocated(&c->output) +
+		    sshbuf_allocated(&c->extended);
+	}
+	return len;
+}
+
 /* Returns true if any channel is still open. */
 int
 channel_still_open(void)
@@ -1783,6 +1836,8 @@ channel_check_window(Channel *c)
 		debug2("channel %d: window %d sent adjust %d",
 		    c->self, c->local_window,
 		    c->local_consumed);
+		SSH_PROBE3(channel__window__send, c->self, c->local_window,
+		    c->local_consumed);
 		c->local_window += c->local_consumed;
 		c->local_consumed = 0;
 	}
@@ -2557,6 +2612,7 @@ channel_input_window_adjust(int type, u_int32_t seq, struct ssh *ssh)
 	adjust = packet_get_int();
 	packet_check_eom();
 	debug2("channel %d: rcvd adjust %u", id, adjust);
+	SSH_PROBE3(channel__window__adjust, id, c->remote_window, adjust);
 	c->remote_window += adjust;
 	return 0;
 }
@@ -162,11 +162,15 @@ struct Channel {
 #define CHAN_EXTENDED_READ		1
 #define CHAN_EXTENDED_WRITE		2
 
-/* default window/packet sizes for tcp/x11-fwd-channel */
-#define CHAN_SES_PACKET_DEFAULT	(32*1024)
-#define CHAN_SES_WINDOW_DEFAULT	(64*CHAN_SES_PACKET_DEFAULT)
-#define CHAN_TCP_PACKET_DEFAULT	(32*1024)
-#define CHAN_TCP_WINDOW_DEFAULT	(64*CHAN_TCP_PACKET_DEFAULT)
+/*
+ * default window/packet sizes for tcp/x11-fwd-channel.  session and tcp
+ * channels use larger packets in large-packet mode, see channel_maxpacket().
+ */
+#define CHAN_PACKET_DEFAULT	(32*1024)
+#define CHAN_SES_PACKET_DEFAULT	channel_maxpacket(CHAN_PACKET_DEFAULT)
+#define CHAN_SES_WINDOW_DEFAULT	(64*CHAN_PACKET_DEFAULT)
+#define CHAN_TCP_PACKET_DEFAULT	channel_maxpacket(CHAN_PACKET_DEFAULT)
+#define CHAN_TCP_WINDOW_DEFAULT	(64*CHAN_PACKET_DEFAULT)
 #define CHAN_X11_PACKET_DEFAULT	(16*1024)
 #define CHAN_X11_WINDOW_DEFAULT	(4*CHAN_X11_PACKET_DEFAULT)
 
@@ -205,6 +209,7 @@ struct Channel {
 Channel	*channel_by_id(int);
 Channel	*channel_lookup(int);
 Channel *channel_new(char *, int, int, int, int, u_int, u_int, int, char *, int);
+u_int	 channel_maxpacket(u_int);
 void	 channel_set_fds(int, int, int, int, int, int, int, u_int);
 void	 channel_free(Channel *);
 void	 channel_free_all(void);
@@ -243,6 +248,8 @@ void     channel_after_select(fd_set *, fd_set *);
 void     channel_output_poll(void);
 
 int      channel_not_very_much_buffered_data(void);
+void	 channel_shrink_all(void);
+size_t	 channel_get_memory(void);
 void     channel_close_all(void);
 int      channel_still_open(void);
 char	*channel_open_message(void);
@@ -44,6 +44,7 @@
 
 #include "err.h"
 #include "cipher.h"
+#include "probe.h"
 
 extern const EVP_CIPHER *evp_ssh1_bf(void);
 extern const EVP_CIPHER *evp_ssh1_3des(void);
@@ -267,11 +268,15 @@ int
 cipher_crypt(struct sshcipher_ctx *cc, u_char *dest,
     const u_char *src, u_int len)
 {
+	int r = 0;
+
 	if (len % cc->cipher->block_size)
 		return SSH_ERR_INVALID_ARGUMENT;
+	SSH_PROBE2(cipher__entry, cc, len);
 	if (EVP_Cipher(&cc->evp, dest, (u_char *)src, len) == 0)
-		return SSH_ERR_LIBCRYPTO_ERROR;
-	return 0;
+		r = SSH_ERR_LIBCRYPTO_ERROR;
+	SSH_PROBE2(cipher__return, cc, r);
+	return r;
 }
 
 int
@@ -0,0 +1,48 @@
+/* $OpenBSD$ */
+/*
+ * Primitives implemented outside of libcrypto.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef CRYPTO_API_H
+#define CRYPTO_API_H
+
+#include <sys/types.h>
+
+#define CURVE25519_SIZE	32
+
+/*
+ * crypto_scalarmult_curve25519() computes the X25519 function of RFC 7748:
+ * q = n * p, where p is a u-coordinate and n a secret scalar, which is
+ * clamped first.  the _base variant multiplies the base point u = 9.
+ * both always return 0; the caller must check q for all zeroes when the
+ * peer can choose p.
+ */
+int	crypto_scalarmult_curve25519(u_char q[CURVE25519_SIZE],
+    const u_char n[CURVE25519_SIZE], const u_char p[CURVE25519_SIZE]);
+int	crypto_scalarmult_curve25519_base(u_char q[CURVE25519_SIZE],
+    const u_char n[CURVE25519_SIZE]);
+
+#define ED25519_SEED_SIZE	32
+#define ED25519_PK_SIZE		32
+#define ED25519_SK_SIZE		64	/* the seed followed by the public key */
+#define ED25519_SIG_SIZE	64
+
+/*
+ * Ed25519 signatures of RFC 8032.  crypto_sign_ed25519_keypair() makes a
+ * key from a random seed, the _seed_ variant from the given one.  the
+ * signature is detached: crypto_sign_ed25519() writes 'sig' only, and
+ * crypto_sign_ed25519_verify() returns 0 for a valid signature and -1
+ * otherwise.
+ */
+int	crypto_sign_ed25519_keypair(u_char pk[ED25519_PK_SIZE],
+    u_char sk[ED25519_SK_SIZE]);
+int	crypto_sign_ed25519_seed_keypair(u_char pk[ED25519_PK_SIZE],
+    u_char sk[ED25519_SK_SIZE], const u_char seed[ED25519_SEED_SIZE]);
+int	crypto_sign_ed25519(u_char sig[ED25519_SIG_SIZE], const u_char *m,
+    size_t mlen, const u_char sk[ED25519_SK_SIZE]);
+int	crypto_sign_ed25519_verify(const u_char sig[ED25519_SIG_SIZE],
+    const u_char *m, size_t mlen, const u_char pk[ED25519_PK_SIZE]);
+
+#endif
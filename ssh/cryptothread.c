@@ -0,0 +1,68 @@
+/* $OpenBSD$ */
+/*
+ * libcrypto locking for the library's worker threads.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <openssl/crypto.h>
+
+#include "cryptothread.h"
+#include "err.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static pthread_once_t crypto_thread_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t *crypto_thread_locks;
+static int crypto_thread_result;
+
+static void
+crypto_thread_lock(int mode, int n, const char *file, int line)
+{
+	if (mode & CRYPTO_LOCK)
+		pthread_mutex_lock(&crypto_thread_locks[n]);
+	else
+		pthread_mutex_unlock(&crypto_thread_locks[n]);
+}
+
+static unsigned long
+crypto_thread_id(void)
+{
+	return (unsigned long)pthread_self();
+}
+
+static void
+crypto_thread_setup(void)
+{
+	int i, n;
+
+	if (CRYPTO_get_locking_callback() != NULL)
+		return;		/* set up by the application */
+	n = CRYPTO_num_locks();
+	if ((crypto_thread_locks = calloc(n,
+	    sizeof(*crypto_thread_locks))) == NULL) {
+		crypto_thread_result = SSH_ERR_ALLOC_FAIL;
+		return;
+	}
+	for (i = 0; i < n; i++)
+		pthread_mutex_init(&crypto_thread_locks[i], NULL);
+	CRYPTO_set_id_callback(crypto_thread_id);
+	CRYPTO_set_locking_callback(crypto_thread_lock);
+}
+#endif
+
+int
+ssh_crypto_thread_init(void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	if (pthread_once(&crypto_thread_once, crypto_thread_setup) != 0)
+		return SSH_ERR_SYSTEM_ERROR;
+	return crypto_thread_result;
+#else
+	return 0;
+#endif
+}
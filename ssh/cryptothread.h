@@ -0,0 +1,20 @@
+/* $OpenBSD$ */
+/*
+ * libcrypto locking for the library's worker threads.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef CRYPTOTHREAD_H
+#define CRYPTOTHREAD_H
+
+/*
+ * ssh_crypto_thread_init() installs pthread locking and thread id
+ * callbacks, which libcrypto before 1.1 needs to be used from several
+ * threads.  Callbacks installed earlier by the application are left
+ * alone.  It is safe to call more than once, from any thread, and does
+ * nothing with libcrypto 1.1 and later.  Returns 0 or an SSH_ERR_* code.
+ */
+int	ssh_crypto_thread_init(void);
+
+#endif
@@ -24,8 +24,10 @@
  */
 
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include <openssl/bn.h>
+#include <openssl/crypto.h>
 #include <openssl/dh.h>
 
 #include <stdio.h>
@@ -113,72 +115,230 @@ parse_prime(int linenum, char *line, struct dhgroup *dhg)
 	return (0);
 }
 
-DH *
-choose_dh(int min, int wantbits, int max)
+/*
+ * The moduli file is parsed once into a table sorted by group size, with
+ * an index of the distinct sizes, and only parsed again when the file
+ * changes.  The table is shared by all threads of a process and guarded
+ * by the libcrypto DH lock, which is a no-op unless the application has
+ * installed locking callbacks (as ssh_engine does).
+ */
+struct dh_moduli_size {
+	int	size;
+	u_int	first, count;		/* range in groups[] */
+};
+
+static struct {
+	int	loaded;
+	const char *path;		/* NULL if no moduli file was found */
+	dev_t	dev;
+	ino_t	ino;
+	off_t	fsize;
+	time_t	mtime;
+	struct dhgroup *groups;
+	u_int	ngroups;
+	struct dh_moduli_size *sizes;
+	u_int	nsizes;
+} moduli;
+
+static int
+moduli_cmp(const void *a, const void *b)
 {
-	FILE *f;
-	char line[4096];
-	int best, bestcount, which;
-	int linenum;
-	struct dhgroup dhg;
+	const struct dhgroup *ga = a, *gb = b;
 
-	if ((f = fopen(_PATH_DH_MODULI, "r")) == NULL &&
-	    (f = fopen(_PATH_DH_PRIMES, "r")) == NULL) {
-		logit("WARNING: %s does not exist, using fixed modulus",
-		    _PATH_DH_MODULI);
-		return (dh_new_group14());
+	return ga->size < gb->size ? -1 : ga->size > gb->size;
+}
+
+static void
+moduli_free(void)
+{
+	u_int i;
+
+	for (i = 0; i < moduli.ngroups; i++) {
+		BN_clear_free(moduli.groups[i].g);
+		BN_clear_free(moduli.groups[i].p);
 	}
+	free(moduli.groups);
+	free(moduli.sizes);
+	moduli.groups = NULL;
+	moduli.sizes = NULL;
+	moduli.ngroups = moduli.nsizes = 0;
+}
+
+static int
+moduli_stat(const char **pathp, struct stat *st)
+{
+	*pathp = _PATH_DH_MODULI;
+	if (stat(*pathp, st) == 0)
+		return 0;
+	*pathp = _PATH_DH_PRIMES;
+	if (stat(*pathp, st) == 0)
+		return 0;
+	*pathp = NULL;
+	return -1;
+}
+
+static int
+moduli_unchanged(const char *path, const struct stat *st)
+{
+	if (!moduli.loaded || moduli.path != path)
+		return 0;
+	return path == NULL || (moduli.dev == st->st_dev &&
+	    moduli.ino == st->st_ino && moduli.fsize == st->st_size &&
+	    moduli.mtime == st->st_mtime);
+}
 
-	linenum = 0;
-	best = bestcount = 0;
+/* called with the DH lock held for writing */
+static void
+moduli_load(const char *path, const struct stat *st)
+{
+	FILE *f = NULL;
+	char line[4096];
+	int linenum = 0;
+	u_int i, alloc = 0;
+	struct dhgroup dhg, *tmp;
+	struct dh_moduli_size *sz;
+
+	moduli_free();
+	moduli.loaded = 1;
+	moduli.path = path;
+	if (path == NULL)
+		return;
+	moduli.dev = st->st_dev;
+	moduli.ino = st->st_ino;
+	moduli.fsize = st->st_size;
+	moduli.mtime = st->st_mtime;
+	if ((f = fopen(path, "r")) == NULL) {
+		moduli.path = NULL;
+		return;
+	}
 	while (fgets(line, sizeof(line), f)) {
 		linenum++;
 		if (!parse_prime(linenum, line, &dhg))
 			continue;
-		BN_clear_free(dhg.g);
-		BN_clear_free(dhg.p);
-
-		if (dhg.size > max || dhg.size < min)
-			continue;
-
-		if ((dhg.size > wantbits && dhg.size < best) ||
-		    (dhg.size > best && best < wantbits)) {
-			best = dhg.size;
-			bestcount = 0;
+		if (moduli.ngroups >= alloc) {
+			alloc = alloc == 0 ? 64 : alloc * 2;
+			if ((tmp = realloc(moduli.groups,
+			    alloc * sizeof(*tmp))) == NULL) {
+				BN_clear_free(dhg.g);
+				BN_clear_free(dhg.p);
+				goto fail;
+			}
+			moduli.groups = tmp;
 		}
-		if (dhg.size == best)
-			bestcount++;
+		moduli.groups[moduli.ngroups++] = dhg;
 	}
-	rewind(f);
-
-	if (bestcount == 0) {
+	fclose(f);
+	f = NULL;
+	if (moduli.ngroups == 0)
+		return;
+
+	qsort(moduli.groups, moduli.ngroups, sizeof(*moduli.groups),
+	    moduli_cmp);
+	if ((moduli.sizes = calloc(moduli.ngroups,
+	    sizeof(*moduli.sizes))) == NULL)
+		goto fail;
+	for (i = 0; i < moduli.ngroups; i++) {
+		sz = moduli.nsizes == 0 ? NULL :
+		    &moduli.sizes[moduli.nsizes - 1];
+		if (sz == NULL || sz->size != moduli.groups[i].size) {
+			sz = &moduli.sizes[moduli.nsizes++];
+			sz->size = moduli.groups[i].size;
+			sz->first = i;
+		}
+		sz->count++;
+	}
+	debug2("%s: %u groups in %u sizes from %s", __func__,
+	    moduli.ngroups, moduli.nsizes, path);
+	return;
+ fail:
+	error("%s: out of memory", __func__);
+	if (f != NULL)
 		fclose(f);
-		logit("WARNING: no suitable primes in %s", _PATH_DH_PRIMES);
+	moduli_free();
+}
+
+/* make sure the table reflects the current moduli file */
+static void
+moduli_refresh(void)
+{
+	struct stat st;
+	const char *path;
+	int ok;
+
+	moduli_stat(&path, &st);
+	CRYPTO_r_lock(CRYPTO_LOCK_DH);
+	ok = moduli_unchanged(path, &st);
+	CRYPTO_r_unlock(CRYPTO_LOCK_DH);
+	if (ok)
+		return;
+	CRYPTO_w_lock(CRYPTO_LOCK_DH);
+	if (!moduli_unchanged(path, &st))
+		moduli_load(path, &st);
+	CRYPTO_w_unlock(CRYPTO_LOCK_DH);
+}
+
+/*
+ * dh_load_moduli() parses the moduli file ahead of the first group
+ * exchange, so processes forked afterwards share the table.
+ */
+u_int
+dh_load_moduli(void)
+{
+	u_int n;
+
+	moduli_refresh();
+	CRYPTO_r_lock(CRYPTO_LOCK_DH);
+	n = moduli.ngroups;
+	CRYPTO_r_unlock(CRYPTO_LOCK_DH);
+	return n;
+}
+
+DH *
+choose_dh(int min, int wantbits, int max)
+{
+	struct dh_moduli_size *sz, *best = NULL;
+	struct dhgroup *dhg;
+	BIGNUM *g, *p;
+	u_int i;
+
+	moduli_refresh();
+	CRYPTO_r_lock(CRYPTO_LOCK_DH);
+	if (moduli.path == NULL) {
+		CRYPTO_r_unlock(CRYPTO_LOCK_DH);
+		logit("WARNING: %s does not exist, using fixed modulus",
+		    _PATH_DH_MODULI);
 		return (dh_new_group14());
 	}
 
-	linenum = 0;
-	which = arc4random_uniform(bestcount);
-	while (fgets(line, sizeof(line), f)) {
-		if (!parse_prime(linenum, line, &dhg))
-			continue;
-		if ((dhg.size > max || dhg.size < min) ||
-		    dhg.size != best ||
-		    linenum++ != which) {
-			BN_clear_free(dhg.g);
-			BN_clear_free(dhg.p);
+	/* the smallest size >= wantbits, otherwise the largest one */
+	for (i = 0; i < moduli.nsizes; i++) {
+		sz = &moduli.sizes[i];
+		if (sz->size > max)
+			break;
+		if (sz->size < min)
 			continue;
-		}
-		break;
+		best = sz;
+		if (sz->size >= wantbits)
+			break;
 	}
-	fclose(f);
-	if (linenum != which+1) {
-		logit("WARNING: line %d disappeared in %s, giving up",
-		    which, _PATH_DH_PRIMES);
+	if (best == NULL) {
+		CRYPTO_r_unlock(CRYPTO_LOCK_DH);
+		logit("WARNING: no suitable primes in %s", _PATH_DH_PRIMES);
 		return (dh_new_group14());
 	}
 
-	return (dh_new_group(dhg.g, dhg.p));
+	dhg = &moduli.groups[best->first + arc4random_uniform(best->count)];
+	g = BN_dup(dhg->g);
+	p = BN_dup(dhg->p);
+	CRYPTO_r_unlock(CRYPTO_LOCK_DH);
+	if (g == NULL || p == NULL) {
+		if (g != NULL)
+			BN_clear_free(g);
+		if (p != NULL)
+			BN_clear_free(p);
+		return NULL;
+	}
+	return (dh_new_group(g, p));
 }
 
 /* diffie-hellman-groupN-sha1 */
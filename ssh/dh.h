@@ -33,6 +33,7 @@ struct dhgroup {
 };
 
 DH	*choose_dh(int, int, int);
+u_int	 dh_load_moduli(void);
 DH	*dh_new_group_asc(const char *, const char *);
 DH	*dh_new_group(BIGNUM *, BIGNUM *);
 DH	*dh_new_group1(void);
@@ -0,0 +1,545 @@
+/* $OpenBSD$ */
+/*
+ * Ed25519 signatures (RFC 8032).
+ *
+ * Points are kept in extended twisted Edwards coordinates (X:Y:Z:T) with
+ * x = X/Z, y = Y/Z and x y = T/Z, using the complete addition and the
+ * doubling formulas of Hisil, Wong, Carter and Dawson as given in RFC
+ * 8032, section 5.1.4.  Multiples of the base point by secret scalars,
+ * the public key and the nonce point of a signature, use a fixed four
+ * bit window whose table entries are picked with conditional moves, so
+ * every scalar costs the same operations.  Verification only handles
+ * public values: it recodes S and k into sparse signed digits (sliding
+ * windows over odd multiples) and computes [S]B - [k]A jointly in one
+ * pass of doublings, which makes it little more expensive than a single
+ * multiplication.
+ *
+ * Scalars modulo the group order L are reduced one bit at a time with a
+ * constant time conditional subtraction.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#include "fe25519.h"
+#include "crypto_api.h"
+
+typedef struct {
+	fe25519 X, Y, Z, T;
+} ge25519;
+
+/* d = -121665 / 121666 and 2d */
+static const fe25519 ed25519_d = {
+	56195235, 13857412, 51736253, 6949390, 114729,
+	24766616, 60832955, 30306712, 48412415, 21499315
+};
+static const fe25519 ed25519_d2 = {
+	45281625, 27714825, 36363642, 13898781, 229458,
+	15978800, 54557047, 27058993, 29715967, 9444199
+};
+/* 2^((p - 1) / 4) */
+static const fe25519 ed25519_sqrtm1 = {
+	34513072, 25610706, 9377949, 3500415, 12389472,
+	33281959, 41962654, 31548777, 326685, 11406482
+};
+/* the base point: y = 4/5 and x even, t = x y */
+static const fe25519 ed25519_bx = {
+	52811034, 25909283, 16144682, 17082669, 27570973,
+	30858332, 40966398, 8378388, 20764389, 8758491
+};
+static const fe25519 ed25519_by = {
+	40265304, 26843545, 13421772, 20132659, 26843545,
+	6710886, 53687091, 13421772, 40265318, 26843545
+};
+static const fe25519 ed25519_bt = {
+	28827043, 27438313, 39759291, 244362, 8635006,
+	11264893, 19351346, 13413597, 16611511, 27139452
+};
+/* L = 2^252 + 27742317777372353535851937790883648493, little endian */
+static const u_char ed25519_l[32] = {
+	0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+	0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+};
+
+static void
+ge25519_0(ge25519 *h)
+{
+	fe25519_0(h->X);
+	fe25519_1(h->Y);
+	fe25519_1(h->Z);
+	fe25519_0(h->T);
+}
+
+static void
+ge25519_base(ge25519 *h)
+{
+	fe25519_copy(h->X, ed25519_bx);
+	fe25519_copy(h->Y, ed25519_by);
+	fe25519_1(h->Z);
+	fe25519_copy(h->T, ed25519_bt);
+}
+
+static void
+ge25519_cmov(ge25519 *h, const ge25519 *p, u_int b)
+{
+	fe25519_cmov(h->X, p->X, b);
+	fe25519_cmov(h->Y, p->Y, b);
+	fe25519_cmov(h->Z, p->Z, b);
+	fe25519_cmov(h->T, p->T, b);
+}
+
+/* h = p + q; h may be p or q */
+static void
+ge25519_add(ge25519 *h, const ge25519 *p, const ge25519 *q)
+{
+	fe25519 a, b, c, d, e, f, g, t;
+
+	fe25519_sub(a, p->Y, p->X);
+	fe25519_sub(t, q->Y, q->X);
+	fe25519_mul(a, a, t);
+	fe25519_add(b, p->Y, p->X);
+	fe25519_add(t, q->Y, q->X);
+	fe25519_mul(b, b, t);
+	fe25519_mul(c, p->T, q->T);
+	fe25519_mul(c, c, ed25519_d2);
+	fe25519_mul(d, p->Z, q->Z);
+	fe25519_mul_small(d, d, 2);
+	fe25519_sub(e, b, a);
+	fe25519_sub(f, d, c);
+	fe25519_add(g, d, c);
+	fe25519_add(t, b, a);
+	fe25519_mul(h->X, e, f);
+	fe25519_mul(h->Y, g, t);
+	fe25519_mul(h->T, e, t);
+	fe25519_mul(h->Z, f, g);
+}
+
+/* h = 2p; 2 Z^2 is carried so that F = C + G stays within fe25519_mul() */
+static void
+ge25519_dbl(ge25519 *h, const ge25519 *p)
+{
+	fe25519 a, b, c, e, f, g, t;
+
+	fe25519_sq(a, p->X);
+	fe25519_sq(b, p->Y);
+	fe25519_sq(c, p->Z);
+	fe25519_mul_small(c, c, 2);
+	fe25519_add(t, p->X, p->Y);
+	fe25519_sq(t, t);
+	fe25519_add(g, a, b);			/* H */
+	fe25519_sub(e, g, t);
+	fe25519_sub(g, a, b);
+	fe25519_add(f, c, g);
+	fe25519_add(t, a, b);
+	fe25519_mul(h->X, e, f);
+	fe25519_mul(h->Y, g, t);
+	fe25519_mul(h->T, e, t);
+	fe25519_mul(h->Z, f, g);
+}
+
+static void
+ge25519_tobytes(u_char s[32], const ge25519 *h)
+{
+	fe25519 recip, x, y;
+
+	fe25519_invert(recip, h->Z);
+	fe25519_mul(x, h->X, recip);
+	fe25519_mul(y, h->Y, recip);
+	fe25519_tobytes(s, y);
+	s[31] ^= fe25519_isnegative(x) << 7;
+}
+
+/*
+ * decode a point, RFC 8032 section 5.1.3; rejects non-canonical y and
+ * encodings that are not on the curve.  not constant time.
+ */
+static int
+ge25519_frombytes(ge25519 *h, const u_char s[32])
+{
+	fe25519 u, v, v3, vxx, check;
+	u_char y[32];
+
+	fe25519_frombytes(h->Y, s);
+	fe25519_tobytes(y, h->Y);
+	y[31] |= s[31] & 0x80;
+	if (memcmp(y, s, sizeof(y)) != 0)
+		return -1;
+	fe25519_1(h->Z);
+	fe25519_sq(u, h->Y);
+	fe25519_mul(v, u, ed25519_d);
+	fe25519_sub(u, u, h->Z);		/* u = y^2 - 1 */
+	fe25519_add(v, v, h->Z);		/* v = d y^2 + 1 */
+
+	/* x = u v^3 (u v^7)^((p - 5) / 8) */
+	fe25519_sq(v3, v);
+	fe25519_mul(v3, v3, v);
+	fe25519_sq(h->X, v3);
+	fe25519_mul(h->X, h->X, v);
+	fe25519_mul(h->X, h->X, u);
+	fe25519_pow22523(h->X, h->X);
+	fe25519_mul(h->X, h->X, v3);
+	fe25519_mul(h->X, h->X, u);
+
+	fe25519_sq(vxx, h->X);
+	fe25519_mul(vxx, vxx, v);
+	fe25519_sub(check, vxx, u);
+	if (fe25519_isnonzero(check)) {
+		fe25519_add(check, vxx, u);
+		if (fe25519_isnonzero(check))
+			return -1;
+		fe25519_mul(h->X, h->X, ed25519_sqrtm1);
+	}
+	if (!fe25519_isnonzero(h->X) && (s[31] >> 7) != 0)
+		return -1;
+	if (fe25519_isnegative(h->X) != (s[31] >> 7))
+		fe25519_neg(h->X, h->X);
+	fe25519_mul(h->T, h->X, h->Y);
+	return 0;
+}
+
+/* table[i] = i p for 0 <= i < 16 */
+static void
+ge25519_table(ge25519 table[16], const ge25519 *p)
+{
+	u_int i;
+
+	ge25519_0(&table[0]);
+	table[1] = *p;
+	for (i = 2; i < 16; i++) {
+		if (i & 1)
+			ge25519_add(&table[i], &table[i - 1], p);
+		else
+			ge25519_dbl(&table[i], &table[i / 2]);
+	}
+}
+
+/* nibble i of a little endian scalar */
+#define NIBBLE(a, i)	(((a)[(i) / 2] >> (4 * ((i) & 1))) & 0xf)
+
+/* h = a B in constant time */
+static void
+ge25519_scalarmult_base(ge25519 *h, const u_char a[32])
+{
+	ge25519 table[16], t;
+	u_int i, j, n;
+	int pos;
+
+	ge25519_base(&t);
+	ge25519_table(table, &t);
+	ge25519_0(h);
+	for (pos = 63; pos >= 0; pos--) {
+		for (j = 0; j < 4; j++)
+			ge25519_dbl(h, h);
+		n = NIBBLE(a, pos);
+		ge25519_0(&t);
+		for (i = 1; i < 16; i++)
+			ge25519_cmov(&t, &table[i], ((i ^ n) - 1) >> 31);
+		ge25519_add(h, h, &t);
+	}
+	bzero(table, sizeof(table));
+	bzero(&t, sizeof(t));
+}
+
+/* h = p - q */
+static void
+ge25519_sub(ge25519 *h, const ge25519 *p, const ge25519 *q)
+{
+	ge25519 t;
+
+	fe25519_neg(t.X, q->X);
+	fe25519_copy(t.Y, q->Y);
+	fe25519_copy(t.Z, q->Z);
+	fe25519_neg(t.T, q->T);
+	ge25519_add(h, p, &t);
+}
+
+/*
+ * recode a public scalar below 2^255 into mostly zero digits, the others
+ * odd and at most 15 in absolute value (the "slide" of ref10)
+ */
+static void
+sc_slide(signed char r[256], const u_char a[32])
+{
+	int i, b, k;
+
+	for (i = 0; i < 256; i++)
+		r[i] = 1 & (a[i >> 3] >> (i & 7));
+	for (i = 0; i < 256; i++) {
+		if (r[i] == 0)
+			continue;
+		for (b = 1; b <= 6 && i + b < 256; b++) {
+			if (r[i + b] == 0)
+				continue;
+			if (r[i] + (r[i + b] << b) <= 15) {
+				r[i] += r[i + b] << b;
+				r[i + b] = 0;
+			} else if (r[i] - (r[i + b] << b) >= -15) {
+				r[i] -= r[i + b] << b;
+				for (k = i + b; k < 256; k++) {
+					if (r[k] == 0) {
+						r[k] = 1;
+						break;
+					}
+					r[k] = 0;
+				}
+			} else
+				break;
+		}
+	}
+}
+
+/* table[i] = (2i + 1) p for 0 <= i < 8 */
+static void
+ge25519_table_odd(ge25519 table[8], const ge25519 *p)
+{
+	ge25519 p2;
+	u_int i;
+
+	ge25519_dbl(&p2, p);
+	table[0] = *p;
+	for (i = 1; i < 8; i++)
+		ge25519_add(&table[i], &table[i - 1], &p2);
+}
+
+/*
+ * h = a A + b B, for public a and b only: one pass of doublings and an
+ * addition or subtraction for every nonzero digit of either scalar
+ */
+static void
+ge25519_double_scalarmult_vartime(ge25519 *h, const u_char a[32],
+    const ge25519 *A, const u_char b[32])
+{
+	signed char aslide[256], bslide[256];
+	ge25519 ta[8], tb[8], base;
+	int i;
+
+	sc_slide(aslide, a);
+	sc_slide(bslide, b);
+	ge25519_table_odd(ta, A);
+	ge25519_base(&base);
+	ge25519_table_odd(tb, &base);
+	ge25519_0(h);
+	for (i = 255; i >= 0; i--) {
+		if (aslide[i] != 0 || bslide[i] != 0)
+			break;
+	}
+	for (; i >= 0; i--) {
+		ge25519_dbl(h, h);
+		if (aslide[i] > 0)
+			ge25519_add(h, h, &ta[aslide[i] / 2]);
+		else if (aslide[i] < 0)
+			ge25519_sub(h, h, &ta[-aslide[i] / 2]);
+		if (bslide[i] > 0)
+			ge25519_add(h, h, &tb[bslide[i] / 2]);
+		else if (bslide[i] < 0)
+			ge25519_sub(h, h, &tb[-bslide[i] / 2]);
+	}
+}
+
+static void
+sc_load(u_int32_t w[8], const u_char s[32])
+{
+	u_int i;
+
+	for (i = 0; i < 8; i++)
+		w[i] = (u_int32_t)s[4 * i] | (u_int32_t)s[4 * i + 1] << 8 |
+		    (u_int32_t)s[4 * i + 2] << 16 |
+		    (u_int32_t)s[4 * i + 3] << 24;
+}
+
+/* out = x mod L for a 512 bit little endian x, in constant time */
+static void
+sc_reduce(u_char out[32], const u_char x[64])
+{
+	u_int32_t r[8], t[8], l[8], borrow, mask;
+	u_int64_t diff;
+	u_int i, j;
+	int pos;
+
+	sc_load(l, ed25519_l);
+	memset(r, 0, sizeof(r));
+	for (pos = 511; pos >= 0; pos--) {
+		/* r = 2r + bit, below 2L < 2^254 */
+		for (j = 7; j > 0; j--)
+			r[j] = r[j] << 1 | r[j - 1] >> 31;
+		r[0] = r[0] << 1 | ((x[pos / 8] >> (pos & 7)) & 1);
+		/* subtract L unless that borrows */
+		borrow = 0;
+		for (j = 0; j < 8; j++) {
+			diff = (u_int64_t)r[j] - l[j] - borrow;
+			t[j] = (u_int32_t)diff;
+			borrow = (diff >> 63) & 1;
+		}
+		mask = borrow - 1;
+		for (j = 0; j < 8; j++)
+			r[j] = (t[j] & mask) | (r[j] & ~mask);
+	}
+	for (i = 0; i < 8; i++) {
+		out[4 * i] = r[i] & 0xff;
+		out[4 * i + 1] = (r[i] >> 8) & 0xff;
+		out[4 * i + 2] = (r[i] >> 16) & 0xff;
+		out[4 * i + 3] = r[i] >> 24;
+	}
+	bzero(r, sizeof(r));
+	bzero(t, sizeof(t));
+}
+
+/* s = (a b + c) mod L, where a b + c must be below 2^512 */
+static void
+sc_muladd(u_char s[32], const u_char a[32], const u_char b[32],
+    const u_char c[32])
+{
+	u_int32_t x[8], y[8], z[8], prod[16], carry;
+	u_int64_t acc;
+	u_char wide[64];
+	u_int i, j;
+
+	sc_load(x, a);
+	sc_load(y, b);
+	sc_load(z, c);
+	memset(prod, 0, sizeof(prod));
+	for (i = 0; i < 8; i++) {
+		carry = 0;
+		for (j = 0; j < 8; j++) {
+			acc = (u_int64_t)x[i] * y[j] + prod[i + j] + carry;
+			prod[i + j] = (u_int32_t)acc;
+			carry = acc >> 32;
+		}
+		prod[i + 8] = carry;
+	}
+	carry = 0;
+	for (i = 0; i < 16; i++) {
+		acc = (u_int64_t)prod[i] + (i < 8 ? z[i] : 0) + carry;
+		prod[i] = (u_int32_t)acc;
+		carry = acc >> 32;
+	}
+	for (i = 0; i < 16; i++) {
+		wide[4 * i] = prod[i] & 0xff;
+		wide[4 * i + 1] = (prod[i] >> 8) & 0xff;
+		wide[4 * i + 2] = (prod[i] >> 16) & 0xff;
+		wide[4 * i + 3] = prod[i] >> 24;
+	}
+	sc_reduce(s, wide);
+	bzero(x, sizeof(x));
+	bzero(y, sizeof(y));
+	bzero(z, sizeof(z));
+	bzero(prod, sizeof(prod));
+	bzero(wide, sizeof(wide));
+}
+
+/* whether s < L; public values only */
+static int
+sc_is_canonical(const u_char s[32])
+{
+	int i;
+
+	for (i = 31; i >= 0; i--) {
+		if (s[i] != ed25519_l[i])
+			return s[i] < ed25519_l[i];
+	}
+	return 0;
+}
+
+/* the secret scalar and the nonce prefix, RFC 8032 section 5.1.5 */
+static void
+ed25519_expand(u_char az[64], const u_char seed[ED25519_SEED_SIZE])
+{
+	SHA512(seed, ED25519_SEED_SIZE, az);
+	az[0] &= 248;
+	az[31] &= 127;
+	az[31] |= 64;
+}
+
+int
+crypto_sign_ed25519_seed_keypair(u_char pk[ED25519_PK_SIZE],
+    u_char sk[ED25519_SK_SIZE], const u_char seed[ED25519_SEED_SIZE])
+{
+	u_char az[64];
+	ge25519 A;
+
+	ed25519_expand(az, seed);
+	ge25519_scalarmult_base(&A, az);
+	ge25519_tobytes(pk, &A);
+	memmove(sk, seed, ED25519_SEED_SIZE);
+	memcpy(sk + ED25519_SEED_SIZE, pk, ED25519_PK_SIZE);
+	bzero(az, sizeof(az));
+	bzero(&A, sizeof(A));
+	return 0;
+}
+
+int
+crypto_sign_ed25519_keypair(u_char pk[ED25519_PK_SIZE],
+    u_char sk[ED25519_SK_SIZE])
+{
+	arc4random_buf(sk, ED25519_SEED_SIZE);
+	return crypto_sign_ed25519_seed_keypair(pk, sk, sk);
+}
+
+int
+crypto_sign_ed25519(u_char sig[ED25519_SIG_SIZE], const u_char *m,
+    size_t mlen, const u_char sk[ED25519_SK_SIZE])
+{
+	SHA512_CTX ctx;
+	u_char az[64], nonce[64], hram[64];
+	ge25519 R;
+
+	ed25519_expand(az, sk);
+
+	/* r = H(prefix || M), R = r B */
+	SHA512_Init(&ctx);
+	SHA512_Update(&ctx, az + 32, 32);
+	SHA512_Update(&ctx, m, mlen);
+	SHA512_Final(nonce, &ctx);
+	sc_reduce(nonce, nonce);
+	ge25519_scalarmult_base(&R, nonce);
+	ge25519_tobytes(sig, &R);
+
+	/* S = r + H(R || A || M) a */
+	SHA512_Init(&ctx);
+	SHA512_Update(&ctx, sig, 32);
+	SHA512_Update(&ctx, sk + ED25519_SEED_SIZE, ED25519_PK_SIZE);
+	SHA512_Update(&ctx, m, mlen);
+	SHA512_Final(hram, &ctx);
+	sc_reduce(hram, hram);
+	sc_muladd(sig + 32, hram, az, nonce);
+
+	bzero(az, sizeof(az));
+	bzero(nonce, sizeof(nonce));
+	bzero(&R, sizeof(R));
+	bzero(&ctx, sizeof(ctx));
+	return 0;
+}
+
+int
+crypto_sign_ed25519_verify(const u_char sig[ED25519_SIG_SIZE],
+    const u_char *m, size_t mlen, const u_char pk[ED25519_PK_SIZE])
+{
+	SHA512_CTX ctx;
+	u_char hram[64], check[32];
+	ge25519 A, R;
+
+	if (!sc_is_canonical(sig + 32) || ge25519_frombytes(&A, pk) != 0)
+		return -1;
+	fe25519_neg(A.X, A.X);
+	fe25519_neg(A.T, A.T);
+
+	SHA512_Init(&ctx);
+	SHA512_Update(&ctx, sig, 32);
+	SHA512_Update(&ctx, pk, ED25519_PK_SIZE);
+	SHA512_Update(&ctx, m, mlen);
+	SHA512_Final(hram, &ctx);
+	sc_reduce(hram, hram);
+
+	/* R' = S B - k A must encode to R */
+	ge25519_double_scalarmult_vartime(&R, hram, &A, sig + 32);
+	ge25519_tobytes(check, &R);
+	return memcmp(check, sig, sizeof(check)) == 0 ? 0 : -1;
+}
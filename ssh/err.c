@@ -115,6 +115,20 @@ ssh_err(int n)
 		return "certificate does not match key";
 	case SSH_ERR_KEY_NOT_FOUND:
 		return "key not found";
+	case SSH_ERR_KEX_IN_PROGRESS:
+		return "key exchange in progress";
+	case SSH_ERR_CONN_CLOSED:
+		return "connection closed";
+	case SSH_ERR_KEX_PENDING:
+		return "key exchange waiting for the application";
+	case SSH_ERR_QUEUE_FULL:
+		return "request queue full";
+	case SSH_ERR_KEY_REVOKED:
+		return "Key is revoked";
+	case SSH_ERR_KRL_BAD_MAGIC:
+		return "KRL file has invalid magic number";
+	case SSH_ERR_BUFFER_READ_ONLY:
+		return "buffer is read-only";
 	default:
 		return "unknown error";
 	}
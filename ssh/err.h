@@ -67,6 +67,13 @@
 #define SSH_ERR_KEY_BAD_PERMISSIONS		-43
 #define SSH_ERR_KEY_CERT_MISMATCH		-44
 #define SSH_ERR_KEY_NOT_FOUND			-45
+#define SSH_ERR_KEX_IN_PROGRESS			-46
+#define SSH_ERR_CONN_CLOSED			-47
+#define SSH_ERR_KEX_PENDING			-48
+#define SSH_ERR_QUEUE_FULL			-49
+#define SSH_ERR_KEY_REVOKED			-50
+#define SSH_ERR_KRL_BAD_MAGIC			-51
+#define SSH_ERR_BUFFER_READ_ONLY		-52
 
 
 /* Translate a numeric error code to a human-readable error string */
@@ -0,0 +1,362 @@
+/* $OpenBSD$ */
+/*
+ * Arithmetic modulo 2^255 - 19 for curve25519.
+ *
+ * The representation follows the "ref10" code by Bernstein, Duif, Lange,
+ * Schwabe and Yang: ten limbs of 25.5 bits, so that the products of two
+ * limbs and their sums fit comfortably into 64 bits and no carries are
+ * needed between additions and multiplications.  Limb i starts at bit
+ * ceil(25.5 i), so the product of two odd limbs lands one bit above the
+ * start of its target limb and is doubled, and a product at or beyond
+ * limb 10 wraps around multiplied by 19, since 2^255 = 19 mod p.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include "fe25519.h"
+
+#define LIMB_BITS(i)	(((i) & 1) ? 25 : 26)
+
+/* bit offset of limb i */
+static const u_int fe25519_off[10] = {
+	0, 26, 51, 77, 102, 128, 153, 179, 204, 230
+};
+
+void
+fe25519_0(fe25519 h)
+{
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		h[i] = 0;
+}
+
+void
+fe25519_1(fe25519 h)
+{
+	fe25519_0(h);
+	h[0] = 1;
+}
+
+void
+fe25519_copy(fe25519 h, const fe25519 f)
+{
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		h[i] = f[i];
+}
+
+void
+fe25519_add(fe25519 h, const fe25519 f, const fe25519 g)
+{
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		h[i] = f[i] + g[i];
+}
+
+void
+fe25519_sub(fe25519 h, const fe25519 f, const fe25519 g)
+{
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		h[i] = f[i] - g[i];
+}
+
+void
+fe25519_cswap(fe25519 f, fe25519 g, u_int b)
+{
+	int32_t mask = -(int32_t)b, x;
+	u_int i;
+
+	for (i = 0; i < 10; i++) {
+		x = (f[i] ^ g[i]) & mask;
+		f[i] ^= x;
+		g[i] ^= x;
+	}
+}
+
+#define CARRY(h, i) do {						\
+	int64_t c_ = ((h)[i] + ((int64_t)1 << (LIMB_BITS(i) - 1))) >>	\
+	    LIMB_BITS(i);						\
+	(h)[i] -= c_ * ((int64_t)1 << LIMB_BITS(i));			\
+	(h)[((i) + 1) % 10] += (i) == 9 ? c_ * 19 : c_;			\
+} while (0)
+
+/*
+ * reduce 64 bit limbs to |h[i]| <= 2^(bits - 1) (plus a little for h[1]),
+ * in the order used by ref10 which keeps every intermediate in range
+ */
+static void
+fe25519_carry(fe25519 out, int64_t h[10])
+{
+	u_int i;
+
+	CARRY(h, 0); CARRY(h, 4);
+	CARRY(h, 1); CARRY(h, 5);
+	CARRY(h, 2); CARRY(h, 6);
+	CARRY(h, 3); CARRY(h, 7);
+	CARRY(h, 4); CARRY(h, 8);
+	CARRY(h, 9);
+	CARRY(h, 0);
+	for (i = 0; i < 10; i++)
+		out[i] = (int32_t)h[i];
+}
+
+/*
+ * limbs of the inputs may be up to 1.65 times the reduced bound.  the
+ * factors 2 and 19 are applied to one operand up front.
+ */
+void
+fe25519_mul(fe25519 h, const fe25519 f, const fe25519 g)
+{
+	int64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	int64_t f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+	int64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+	int64_t g5 = g[5], g6 = g[6], g7 = g[7], g8 = g[8], g9 = g[9];
+	int64_t f1_2 = 2 * f1, f3_2 = 2 * f3, f5_2 = 2 * f5;
+	int64_t f7_2 = 2 * f7, f9_2 = 2 * f9;
+	int64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3;
+	int64_t g4_19 = 19 * g4, g5_19 = 19 * g5, g6_19 = 19 * g6;
+	int64_t g7_19 = 19 * g7, g8_19 = 19 * g8, g9_19 = 19 * g9;
+	int64_t t[10];
+
+	t[0] = f0 * g0 + f1_2 * g9_19 + f2 * g8_19 + f3_2 * g7_19 +
+	    f4 * g6_19 + f5_2 * g5_19 + f6 * g4_19 + f7_2 * g3_19 +
+	    f8 * g2_19 + f9_2 * g1_19;
+	t[1] = f0 * g1 + f1 * g0 + f2 * g9_19 + f3 * g8_19 + f4 * g7_19 +
+	    f5 * g6_19 + f6 * g5_19 + f7 * g4_19 + f8 * g3_19 + f9 * g2_19;
+	t[2] = f0 * g2 + f1_2 * g1 + f2 * g0 + f3_2 * g9_19 + f4 * g8_19 +
+	    f5_2 * g7_19 + f6 * g6_19 + f7_2 * g5_19 + f8 * g4_19 +
+	    f9_2 * g3_19;
+	t[3] = f0 * g3 + f1 * g2 + f2 * g1 + f3 * g0 + f4 * g9_19 +
+	    f5 * g8_19 + f6 * g7_19 + f7 * g6_19 + f8 * g5_19 + f9 * g4_19;
+	t[4] = f0 * g4 + f1_2 * g3 + f2 * g2 + f3_2 * g1 + f4 * g0 +
+	    f5_2 * g9_19 + f6 * g8_19 + f7_2 * g7_19 + f8 * g6_19 +
+	    f9_2 * g5_19;
+	t[5] = f0 * g5 + f1 * g4 + f2 * g3 + f3 * g2 + f4 * g1 + f5 * g0 +
+	    f6 * g9_19 + f7 * g8_19 + f8 * g7_19 + f9 * g6_19;
+	t[6] = f0 * g6 + f1_2 * g5 + f2 * g4 + f3_2 * g3 + f4 * g2 +
+	    f5_2 * g1 + f6 * g0 + f7_2 * g9_19 + f8 * g8_19 + f9_2 * g7_19;
+	t[7] = f0 * g7 + f1 * g6 + f2 * g5 + f3 * g4 + f4 * g3 + f5 * g2 +
+	    f6 * g1 + f7 * g0 + f8 * g9_19 + f9 * g8_19;
+	t[8] = f0 * g8 + f1_2 * g7 + f2 * g6 + f3_2 * g5 + f4 * g4 +
+	    f5_2 * g3 + f6 * g2 + f7_2 * g1 + f8 * g0 + f9_2 * g9_19;
+	t[9] = f0 * g9 + f1 * g8 + f2 * g7 + f3 * g6 + f4 * g5 + f5 * g4 +
+	    f6 * g3 + f7 * g2 + f8 * g1 + f9 * g0;
+
+	fe25519_carry(h, t);
+}
+
+/* as fe25519_mul(), but the products f[i] f[j] and f[j] f[i] are merged */
+void
+fe25519_sq(fe25519 h, const fe25519 f)
+{
+	int64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	int64_t f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+	int64_t f0_2 = 2 * f0, f1_2 = 2 * f1, f2_2 = 2 * f2, f3_2 = 2 * f3;
+	int64_t f4_2 = 2 * f4, f5_2 = 2 * f5, f7_2 = 2 * f7;
+	int64_t f6_19 = 19 * f6, f8_19 = 19 * f8;
+	int64_t f5_38 = 38 * f5, f6_38 = 38 * f6, f7_38 = 38 * f7;
+	int64_t f8_38 = 38 * f8, f9_38 = 38 * f9;
+	int64_t t[10];
+
+	t[0] = f0 * f0 + f1_2 * f9_38 + f2 * f8_38 + f3_2 * f7_38 +
+	    f4 * f6_38 + f5 * f5_38;
+	t[1] = f0_2 * f1 + f2 * f9_38 + f3 * f8_38 + f4 * f7_38 + f5 * f6_38;
+	t[2] = f0_2 * f2 + f1_2 * f1 + f3_2 * f9_38 + f4 * f8_38 +
+	    f5_2 * f7_38 + f6 * f6_19;
+	t[3] = f0_2 * f3 + f1_2 * f2 + f4 * f9_38 + f5 * f8_38 + f6 * f7_38;
+	t[4] = f0_2 * f4 + f1_2 * f3_2 + f2 * f2 + f5_2 * f9_38 + f6 * f8_38 +
+	    f7 * f7_38;
+	t[5] = f0_2 * f5 + f1_2 * f4 + f2_2 * f3 + f6 * f9_38 + f7 * f8_38;
+	t[6] = f0_2 * f6 + f1_2 * f5_2 + f2_2 * f4 + f3_2 * f3 + f7_2 * f9_38 +
+	    f8 * f8_19;
+	t[7] = f0_2 * f7 + f1_2 * f6 + f2_2 * f5 + f3_2 * f4 + f8 * f9_38;
+	t[8] = f0_2 * f8 + f1_2 * f7_2 + f2_2 * f6 + f3_2 * f5_2 + f4 * f4 +
+	    f9 * f9_38;
+	t[9] = f0_2 * f9 + f1_2 * f8 + f2_2 * f7 + f3_2 * f6 + f4_2 * f5;
+
+	fe25519_carry(h, t);
+}
+
+/* multiply by a constant below 2^17 */
+void
+fe25519_mul_small(fe25519 h, const fe25519 f, int32_t n)
+{
+	int64_t t[10];
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		t[i] = (int64_t)f[i] * n;
+	fe25519_carry(h, t);
+}
+
+/* square n times */
+static void
+fe25519_sqn(fe25519 h, const fe25519 f, u_int n)
+{
+	u_int i;
+
+	fe25519_sq(h, f);
+	for (i = 1; i < n; i++)
+		fe25519_sq(h, h);
+}
+
+void
+fe25519_neg(fe25519 h, const fe25519 f)
+{
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		h[i] = -f[i];
+}
+
+void
+fe25519_cmov(fe25519 f, const fe25519 g, u_int b)
+{
+	int32_t mask = -(int32_t)b;
+	u_int i;
+
+	for (i = 0; i < 10; i++)
+		f[i] ^= (f[i] ^ g[i]) & mask;
+}
+
+int
+fe25519_isnegative(const fe25519 f)
+{
+	u_char s[32];
+
+	fe25519_tobytes(s, f);
+	return s[0] & 1;
+}
+
+int
+fe25519_isnonzero(const fe25519 f)
+{
+	u_char s[32], x = 0;
+	u_int i;
+
+	fe25519_tobytes(s, f);
+	for (i = 0; i < sizeof(s); i++)
+		x |= s[i];
+	return x != 0;
+}
+
+/* h = z^(p - 2) = 1/z, the addition chain of ref10 */
+void
+fe25519_invert(fe25519 h, const fe25519 z)
+{
+	fe25519 t0, t1, t2, t3;
+
+	fe25519_sq(t0, z);			/* 2 */
+	fe25519_sqn(t1, t0, 2);			/* 8 */
+	fe25519_mul(t1, z, t1);			/* 9 */
+	fe25519_mul(t0, t0, t1);		/* 11 */
+	fe25519_sq(t2, t0);			/* 22 */
+	fe25519_mul(t1, t1, t2);		/* 2^5 - 1 */
+	fe25519_sqn(t2, t1, 5);
+	fe25519_mul(t1, t2, t1);		/* 2^10 - 1 */
+	fe25519_sqn(t2, t1, 10);
+	fe25519_mul(t2, t2, t1);		/* 2^20 - 1 */
+	fe25519_sqn(t3, t2, 20);
+	fe25519_mul(t2, t3, t2);		/* 2^40 - 1 */
+	fe25519_sqn(t2, t2, 10);
+	fe25519_mul(t1, t2, t1);		/* 2^50 - 1 */
+	fe25519_sqn(t2, t1, 50);
+	fe25519_mul(t2, t2, t1);		/* 2^100 - 1 */
+	fe25519_sqn(t3, t2, 100);
+	fe25519_mul(t2, t3, t2);		/* 2^200 - 1 */
+	fe25519_sqn(t2, t2, 50);
+	fe25519_mul(t1, t2, t1);		/* 2^250 - 1 */
+	fe25519_sqn(t1, t1, 5);			/* 2^255 - 2^5 */
+	fe25519_mul(h, t1, t0);			/* 2^255 - 21 */
+}
+
+/* h = z^((p - 5) / 8) = z^(2^252 - 3), for square roots */
+void
+fe25519_pow22523(fe25519 h, const fe25519 z)
+{
+	fe25519 t0, t1, t2;
+
+	fe25519_sq(t0, z);			/* 2 */
+	fe25519_sqn(t1, t0, 2);			/* 8 */
+	fe25519_mul(t1, z, t1);			/* 9 */
+	fe25519_mul(t0, t0, t1);		/* 11 */
+	fe25519_sq(t0, t0);			/* 22 */
+	fe25519_mul(t0, t1, t0);		/* 2^5 - 1 */
+	fe25519_sqn(t1, t0, 5);
+	fe25519_mul(t0, t1, t0);		/* 2^10 - 1 */
+	fe25519_sqn(t1, t0, 10);
+	fe25519_mul(t1, t1, t0);		/* 2^20 - 1 */
+	fe25519_sqn(t2, t1, 20);
+	fe25519_mul(t1, t2, t1);		/* 2^40 - 1 */
+	fe25519_sqn(t1, t1, 10);
+	fe25519_mul(t0, t1, t0);		/* 2^50 - 1 */
+	fe25519_sqn(t1, t0, 50);
+	fe25519_mul(t1, t1, t0);		/* 2^100 - 1 */
+	fe25519_sqn(t2, t1, 100);
+	fe25519_mul(t1, t2, t1);		/* 2^200 - 1 */
+	fe25519_sqn(t1, t1, 50);
+	fe25519_mul(t0, t1, t0);		/* 2^250 - 1 */
+	fe25519_sqn(t0, t0, 2);			/* 2^252 - 4 */
+	fe25519_mul(h, t0, z);			/* 2^252 - 3 */
+}
+
+void
+fe25519_frombytes(fe25519 h, const u_char s[32])
+{
+	u_int32_t w;
+	u_int i, off;
+
+	/* every limb lies within the 32 bits starting at its first byte */
+	for (i = 0; i < 10; i++) {
+		off = fe25519_off[i];
+		w = (u_int32_t)s[off / 8] |
+		    (u_int32_t)s[off / 8 + 1] << 8 |
+		    (u_int32_t)s[off / 8 + 2] << 16 |
+		    (u_int32_t)s[off / 8 + 3] << 24;
+		h[i] = (w >> (off % 8)) & ((1U << LIMB_BITS(i)) - 1);
+	}
+}
+
+void
+fe25519_tobytes(u_char s[32], const fe25519 f)
+{
+	fe25519 h;
+	u_int64_t acc = 0;
+	int32_t q, c;
+	u_int i, n = 0, nbits = 0;
+
+	fe25519_copy(h, f);
+	/*
+	 * q = floor(h / p) is 0 or 1 for the limb bounds above: it is the
+	 * carry out of the top limb of h + 19.  subtracting q p adds 19 q
+	 * and drops bit 255.
+	 */
+	q = (19 * h[9] + ((int32_t)1 << 24)) >> 25;
+	for (i = 0; i < 10; i++)
+		q = (h[i] + q) >> LIMB_BITS(i);
+	h[0] += 19 * q;
+	for (i = 0; i < 9; i++) {
+		c = h[i] >> LIMB_BITS(i);
+		h[i + 1] += c;
+		h[i] -= c * ((int32_t)1 << LIMB_BITS(i));
+	}
+	c = h[9] >> 25;
+	h[9] -= c * ((int32_t)1 << 25);
+
+	for (i = 0; i < 10; i++) {
+		acc |= (u_int64_t)h[i] << nbits;
+		nbits += LIMB_BITS(i);
+		for (; nbits >= 8; nbits -= 8) {
+			s[n++] = acc & 0xff;
+			acc >>= 8;
+		}
+	}
+	s[n] = acc & 0xff;
+}
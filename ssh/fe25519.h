@@ -0,0 +1,50 @@
+/* $OpenBSD$ */
+/*
+ * Arithmetic modulo 2^255 - 19 for curve25519 and ed25519.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef FE25519_H
+#define FE25519_H
+
+#include <sys/types.h>
+
+/*
+ * an element is kept in ten signed limbs of alternately 26 and 25 bits:
+ * h = h[0] + 2^26 h[1] + 2^51 h[2] + 2^77 h[3] + ... + 2^230 h[9].
+ * limbs are not kept reduced; fe25519_add() and fe25519_sub() results
+ * may only be passed on to the multiplications.  no function branches on
+ * or indexes memory by the value of an element.
+ */
+typedef int32_t fe25519[10];
+
+void	fe25519_0(fe25519);
+void	fe25519_1(fe25519);
+void	fe25519_copy(fe25519, const fe25519);
+void	fe25519_add(fe25519, const fe25519, const fe25519);
+void	fe25519_sub(fe25519, const fe25519, const fe25519);
+void	fe25519_mul(fe25519, const fe25519, const fe25519);
+void	fe25519_sq(fe25519, const fe25519);
+void	fe25519_mul_small(fe25519, const fe25519, int32_t);
+void	fe25519_neg(fe25519, const fe25519);
+void	fe25519_invert(fe25519, const fe25519);
+/* z^((p - 5) / 8), used to take square roots */
+void	fe25519_pow22523(fe25519, const fe25519);
+
+/* whether the reduced value is odd, or not zero */
+int	fe25519_isnegative(const fe25519);
+int	fe25519_isnonzero(const fe25519);
+
+/* f = g if b is 1, leave f alone if b is 0 */
+void	fe25519_cmov(fe25519 f, const fe25519 g, u_int b);
+
+/* swap f and g if b is 1, leave them alone if b is 0 */
+void	fe25519_cswap(fe25519 f, fe25519 g, u_int b);
+
+/* the top bit of s is ignored; the encoding need not be reduced */
+void	fe25519_frombytes(fe25519, const u_char s[32]);
+/* writes the reduced little endian encoding */
+void	fe25519_tobytes(u_char s[32], const fe25519);
+
+#endif
@@ -52,6 +52,7 @@
 #include "match.h"
 #include "key.h"
 #include "hostfile.h"
+#include "hostindex.h"
 #include "log.h"
 #include "misc.h"
 #include "err.h"
@@ -59,6 +60,7 @@
 struct hostkeys {
 	struct hostkey_entry *entries;
 	u_int num_entries;
+	int use_index;
 };
 
 static int
@@ -110,11 +112,21 @@ extract_salt(const char *s, u_int l, char *salt, size_t salt_len)
 
 char *
 host_hash(const char *host, const char *name_from_hostfile, u_int src_len)
+{
+	static char encoded[1024];
+
+	return host_hash_r(host, name_from_hostfile, src_len,
+	    encoded, sizeof(encoded));
+}
+
+/* As host_hash(), but into the caller's buffer, so that threads may use it */
+char *
+host_hash_r(const char *host, const char *name_from_hostfile, u_int src_len,
+    char *encoded, size_t encodedlen)
 {
 	const EVP_MD *md = EVP_sha1();
 	HMAC_CTX mac_ctx;
 	char salt[256], result[256], uu_salt[512], uu_result[512];
-	static char encoded[1024];
 	u_int i, len;
 
 	len = EVP_MD_size(md);
@@ -139,8 +151,9 @@ host_hash(const char *host, const char *name_from_hostfile, u_int src_len)
 	    __b64_ntop(result, len, uu_result, sizeof(uu_result)) == -1)
 		fatal("host_hash: __b64_ntop failed");
 
-	snprintf(encoded, sizeof(encoded), "%s%s%c%s", HASH_MAGIC, uu_salt,
-	    HASH_DELIM, uu_result);
+	if (snprintf(encoded, encodedlen, "%s%s%c%s", HASH_MAGIC, uu_salt,
+	    HASH_DELIM, uu_result) >= (int)encodedlen)
+		return (NULL);
 
 	return (encoded);
 }
@@ -234,93 +247,148 @@ init_hostkeys(void)
 	return ret;
 }
 
+/*
+ * Enables the sidecar index (see hostindex.c) for files subsequently
+ * loaded into 'hostkeys'; the index is created if it does not exist.
+ */
 void
-load_hostkeys(struct hostkeys *hostkeys, const char *host, const char *path)
+hostkeys_use_index(struct hostkeys *hostkeys, int use_index)
+{
+	hostkeys->use_index = use_index;
+}
+
+/*
+ * Adds the key on known_hosts line 'line' to 'hostkeys' if the line
+ * matches 'host'.  Returns 1 if a key was added, 0 if not and -1 on
+ * allocation failure.
+ */
+static int
+load_hostkeys_line(struct hostkeys *hostkeys, const char *host,
+    const char *path, char *line, u_long linenum)
 {
-	FILE *f;
-	char line[8192];
-	u_long linenum = 0, num_loaded = 0;
 	char *cp, *cp2, *hashed_host;
 	HostkeyMarker marker;
 	struct sshkey *key;
 	int kbits;
 
-	if ((f = fopen(path, "r")) == NULL)
-		return;
-	debug3("%s: loading entries for host \"%.100s\" from file \"%s\"",
-	    __func__, host, path);
-	while (read_keyfile_line(f, path, line, sizeof(line), &linenum) == 0) {
-		cp = line;
+	cp = line;
 
-		/* Skip any leading whitespace, comments and empty lines. */
-		for (; *cp == ' ' || *cp == '\t'; cp++)
-			;
-		if (!*cp || *cp == '#' || *cp == '\n')
-			continue;
+	/* Skip any leading whitespace, comments and empty lines. */
+	for (; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	if (!*cp || *cp == '#' || *cp == '\n')
+		return 0;
 
-		if ((marker = check_markers(&cp)) == MRK_ERROR) {
-			verbose("%s: invalid marker at %s:%lu",
-			    __func__, path, linenum);
-			continue;
-		}
+	if ((marker = check_markers(&cp)) == MRK_ERROR) {
+		verbose("%s: invalid marker at %s:%lu",
+		    __func__, path, linenum);
+		return 0;
+	}
 
-		/* Find the end of the host name portion. */
-		for (cp2 = cp; *cp2 && *cp2 != ' ' && *cp2 != '\t'; cp2++)
-			;
+	/* Find the end of the host name portion. */
+	for (cp2 = cp; *cp2 && *cp2 != ' ' && *cp2 != '\t'; cp2++)
+		;
 
-		/* Check if the host name matches. */
-		if (match_hostname(host, cp, (u_int) (cp2 - cp)) != 1) {
-			if (*cp != HASH_DELIM)
-				continue;
-			hashed_host = host_hash(host, cp, (u_int) (cp2 - cp));
-			if (hashed_host == NULL) {
-				debug("Invalid hashed host line %lu of %s",
-				    linenum, path);
-				continue;
-			}
-			if (strncmp(hashed_host, cp, (u_int) (cp2 - cp)) != 0)
-				continue;
+	/* Check if the host name matches. */
+	if (match_hostname(host, cp, (u_int) (cp2 - cp)) != 1) {
+		if (*cp != HASH_DELIM)
+			return 0;
+		hashed_host = host_hash(host, cp, (u_int) (cp2 - cp));
+		if (hashed_host == NULL) {
+			debug("Invalid hashed host line %lu of %s",
+			    linenum, path);
+			return 0;
 		}
+		if (strncmp(hashed_host, cp, (u_int) (cp2 - cp)) != 0)
+			return 0;
+	}
 
-		/* Got a match.  Skip host name. */
-		cp = cp2;
+	/* Got a match.  Skip host name. */
+	cp = cp2;
 
-		/*
-		 * Extract the key from the line.  This will skip any leading
-		 * whitespace.  Ignore badly formatted lines.
-		 */
-		if ((key = sshkey_new(KEY_UNSPEC)) == NULL) {
+	/*
+	 * Extract the key from the line.  This will skip any leading
+	 * whitespace.  Ignore badly formatted lines.
+	 */
+	if ((key = sshkey_new(KEY_UNSPEC)) == NULL) {
+		error("%s: sshkey_new failed", __func__);
+		return -1;
+	}
+	if (!hostfile_read_key(&cp, &kbits, key)) {
+		sshkey_free(key);
+		if ((key = sshkey_new(KEY_RSA1)) == NULL) {
 			error("%s: sshkey_new failed", __func__);
-			break;
+			return -1;
 		}
 		if (!hostfile_read_key(&cp, &kbits, key)) {
 			sshkey_free(key);
-			if ((key = sshkey_new(KEY_RSA1)) == NULL) {
-				error("%s: sshkey_new failed", __func__);
-				break;
-			}
-			if (!hostfile_read_key(&cp, &kbits, key)) {
-				sshkey_free(key);
-				continue;
-			}
+			return 0;
 		}
-		if (!hostfile_check_key(kbits, key, host, path, linenum))
-			continue;
+	}
+	if (!hostfile_check_key(kbits, key, host, path, linenum))
+		return 0;
 
-		debug3("%s: found %skey type %s in file %s:%lu", __func__,
-		    marker == MRK_NONE ? "" :
-		    (marker == MRK_CA ? "ca " : "revoked "),
-		    sshkey_type(key), path, linenum);
-		hostkeys->entries = xrealloc(hostkeys->entries,
-		    hostkeys->num_entries + 1, sizeof(*hostkeys->entries));
-		hostkeys->entries[hostkeys->num_entries].host = xstrdup(host);
-		hostkeys->entries[hostkeys->num_entries].file = xstrdup(path);
-		hostkeys->entries[hostkeys->num_entries].line = linenum;
-		hostkeys->entries[hostkeys->num_entries].key = key;
-		hostkeys->entries[hostkeys->num_entries].marker = marker;
-		hostkeys->num_entries++;
-		num_loaded++;
+	debug3("%s: found %skey type %s in file %s:%lu", __func__,
+	    marker == MRK_NONE ? "" :
+	    (marker == MRK_CA ? "ca " : "revoked "),
+	    sshkey_type(key), path, linenum);
+	hostkeys->entries = xrealloc(hostkeys->entries,
+	    hostkeys->num_entries + 1, sizeof(*hostkeys->entries));
+	hostkeys->entries[hostkeys->num_entries].host = xstrdup(host);
+	hostkeys->entries[hostkeys->num_entries].file = xstrdup(path);
+	hostkeys->entries[hostkeys->num_entries].line = linenum;
+	hostkeys->entries[hostkeys->num_entries].key = key;
+	hostkeys->entries[hostkeys->num_entries].marker = marker;
+	hostkeys->num_entries++;
+	return 1;
+}
+
+void
+load_hostkeys(struct hostkeys *hostkeys, const char *host, const char *path)
+{
+	FILE *f;
+	char line[8192];
+	u_long linenum = 0, num_loaded = 0;
+	struct hostindex_match *matches = NULL;
+	size_t i, nmatches = 0;
+	int r;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return;
+	debug3("%s: loading entries for host \"%.100s\" from file \"%s\"",
+	    __func__, host, path);
+	if (hostkeys->use_index) {
+		if ((r = hostindex_lookup(f, path, host, 1,
+		    &matches, &nmatches)) == 0) {
+			debug3("%s: %zu candidate lines", __func__, nmatches);
+			for (i = 0; i < nmatches; i++) {
+				/* Re-read the line and match it as usual */
+				if (fseeko(f, matches[i].offset, SEEK_SET) == -1)
+					break;
+				linenum = matches[i].line - 1;
+				if (read_keyfile_line(f, path, line,
+				    sizeof(line), &linenum) != 0 ||
+				    linenum != matches[i].line)
+					continue;
+				if ((r = load_hostkeys_line(hostkeys, host,
+				    path, line, linenum)) == -1)
+					break;
+				num_loaded += r;
+			}
+			free(matches);
+			goto done;
+		}
+		debug2("%s: index for %s unusable: %s", __func__, path,
+		    ssh_err(r));
+		rewind(f);
+	}
+	while (read_keyfile_line(f, path, line, sizeof(line), &linenum) == 0) {
+		if ((r = load_hostkeys_line(hostkeys, host, path,
+		    line, linenum)) == -1)
+			break;
+		num_loaded += r;
 	}
+ done:
 	debug3("%s: loaded %lu keys", __func__, num_loaded);
 	fclose(f);
 	return;
@@ -32,6 +32,7 @@ struct hostkey_entry {
 struct hostkeys;
 
 struct hostkeys *init_hostkeys(void);
+void	 hostkeys_use_index(struct hostkeys *, int);
 void	 load_hostkeys(struct hostkeys *, const char *, const char *);
 void	 free_hostkeys(struct hostkeys *);
 
@@ -51,5 +52,6 @@ int	 add_host_to_hostfile(const char *, const char *,
 #define REVOKE_MARKER	"@revoked"
 
 char	*host_hash(const char *, const char *, u_int);
+char	*host_hash_r(const char *, const char *, u_int, char *, size_t);
 
 #endif
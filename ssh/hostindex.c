@@ -0,0 +1,718 @@
+/* $OpenBSD$ */
+/*
+ * Sidecar index for large known_hosts files.
+ *
+ * Looking a host up in known_hosts means matching the host patterns of
+ * every line and computing an HMAC for every hashed entry.  The index,
+ * kept next to the file as "<file>.idx", turns this into a hash table
+ * lookup for plain host names and one HMAC per distinct salt for hashed
+ * entries.  Lines with wildcards or negations, and anything else the
+ * index does not understand, are always returned as candidates, so the
+ * callers' own matching has the final word on every line.
+ *
+ * The index is a flat big-endian file that is mapped read-only:
+ *
+ *	byte[8]	"KHIDX01\0"
+ *	uint64	size of the known_hosts file
+ *	uint64	modification time of the known_hosts file (seconds)
+ *	uint32	modification time of the known_hosts file (nanoseconds)
+ *	uint64	inode of the known_hosts file
+ *	uint32	number of buckets (a power of two)
+ *	uint32	number of host names
+ *	uint32	number of hashed entries
+ *	uint32	number of other lines
+ *	uint32	length of the string table
+ *	uint32	first host name of each bucket, plus the total count
+ *	names	hash, line, offset and string table offset and length of
+ *		every lowercased host name, ordered by bucket
+ *	hashed	salt, hash, line and offset of every hashed entry, ordered
+ *		by salt
+ *	other	line and offset of every line that must always be checked
+ *	byte[]	string table
+ *
+ * The index is rebuilt whenever the size, modification time or inode of
+ * the known_hosts file no longer match the header.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <netinet/in.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <resolv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+#include "sshbuf.h"
+#include "hostfile.h"
+#include "hostindex.h"
+#include "atomicio.h"
+#include "log.h"
+#include "err.h"
+
+#define HOSTINDEX_MAGIC		"KHIDX01"
+#define HOSTINDEX_MAGIC_LEN	8
+#define HOSTINDEX_HDR_LEN	(HOSTINDEX_MAGIC_LEN + 8 + 8 + 4 + 8 + 5 * 4)
+#define HOSTINDEX_NAME_LEN	(4 + 4 + 8 + 4 + 4)
+#define HOSTINDEX_HASHED_LEN	(2 * SHA_DIGEST_LENGTH + 4 + 8)
+#define HOSTINDEX_OTHER_LEN	(4 + 8)
+#define HOSTINDEX_MAX_ENTRIES	(1 << 24)
+#define HOSTINDEX_MAX_SIZE	(1024 * 1024 * 1024)
+#define HOSTINDEX_LINELEN	8192	/* as load_hostkeys() */
+
+struct hostindex {
+	const u_char *buckets, *names, *hashed, *other, *strings;
+	u_int32_t nbuckets, nnames, nhashed, nother, strings_len;
+};
+
+struct hostindex_name {
+	u_int32_t hash;
+	u_int32_t line;
+	u_int64_t offset;
+	u_int32_t stroff;
+	u_int32_t len;
+};
+
+struct hostindex_hashed {
+	u_char salt[SHA_DIGEST_LENGTH];
+	u_char hash[SHA_DIGEST_LENGTH];
+	u_int32_t line;
+	u_int64_t offset;
+};
+
+struct hostindex_build {
+	struct hostindex_name *names;
+	size_t nnames, names_alloc;
+	struct hostindex_hashed *hashed;
+	size_t nhashed, hashed_alloc;
+	struct hostindex_match *other;
+	size_t nother, other_alloc;
+	struct sshbuf *strings;
+};
+
+/* FNV-1a */
+static u_int32_t
+hostindex_hash(const char *s, size_t len)
+{
+	u_int32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (u_char)s[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static int
+hostindex_grow(void **p, size_t *alloc, size_t n, size_t size)
+{
+	size_t nalloc;
+	void *tmp;
+
+	if (n < *alloc)
+		return 0;
+	if (n >= HOSTINDEX_MAX_ENTRIES)
+		return SSH_ERR_NO_BUFFER_SPACE;
+	nalloc = *alloc == 0 ? 256 : *alloc * 2;
+	if ((tmp = realloc(*p, nalloc * size)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	*p = tmp;
+	*alloc = nalloc;
+	return 0;
+}
+
+static int
+hostindex_add_other(struct hostindex_build *b, u_long line, off_t offset)
+{
+	int r;
+
+	if ((r = hostindex_grow((void **)&b->other, &b->other_alloc,
+	    b->nother, sizeof(*b->other))) != 0)
+		return r;
+	b->other[b->nother].line = line;
+	b->other[b->nother].offset = offset;
+	b->nother++;
+	return 0;
+}
+
+static int
+hostindex_add_name(struct hostindex_build *b, const char *s, size_t len,
+    u_long line, off_t offset)
+{
+	struct hostindex_name *n;
+	u_char *p;
+	size_t i;
+	int r;
+
+	if ((r = hostindex_grow((void **)&b->names, &b->names_alloc,
+	    b->nnames, sizeof(*b->names))) != 0)
+		return r;
+	n = &b->names[b->nnames];
+	n->stroff = sshbuf_len(b->strings);
+	n->len = len;
+	/* match_hostname() lowercases the patterns, but not the host */
+	if ((r = sshbuf_reserve(b->strings, len, &p)) != 0)
+		return r;
+	for (i = 0; i < len; i++)
+		p[i] = tolower((u_char)s[i]);
+	n->hash = hostindex_hash((const char *)p, len);
+	n->line = line;
+	n->offset = offset;
+	b->nnames++;
+	return 0;
+}
+
+/* Decodes a "|1|salt|hash" field; returns 0 if it is not one. */
+static int
+hostindex_decode_hashed(const char *s, size_t len, u_char *salt, u_char *hash)
+{
+	char tmp[256], *cp;
+	u_char dec[256];
+
+	if (len >= sizeof(tmp) || len < sizeof(HASH_MAGIC) - 1 ||
+	    strncmp(s, HASH_MAGIC, sizeof(HASH_MAGIC) - 1) != 0)
+		return 0;
+	memcpy(tmp, s + sizeof(HASH_MAGIC) - 1, len - sizeof(HASH_MAGIC) + 1);
+	tmp[len - sizeof(HASH_MAGIC) + 1] = '\0';
+	if ((cp = strchr(tmp, HASH_DELIM)) == NULL)
+		return 0;
+	*cp++ = '\0';
+	if (__b64_pton(tmp, dec, sizeof(dec)) != SHA_DIGEST_LENGTH)
+		return 0;
+	memcpy(salt, dec, SHA_DIGEST_LENGTH);
+	if (__b64_pton(cp, dec, sizeof(dec)) != SHA_DIGEST_LENGTH)
+		return 0;
+	memcpy(hash, dec, SHA_DIGEST_LENGTH);
+	return 1;
+}
+
+static int
+hostindex_add_line(struct hostindex_build *b, char *cp, u_long line,
+    off_t offset)
+{
+	struct hostindex_hashed *h;
+	size_t len, toklen;
+	char *tok;
+	int r;
+
+	/* Skip leading whitespace, comments and empty lines. */
+	for (; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	if (!*cp || *cp == '#' || *cp == '\n')
+		return 0;
+
+	/* Markers are checked by the callers; skip them here. */
+	while (*cp == '@') {
+		cp += strcspn(cp, " \t");
+		cp += strspn(cp, " \t");
+	}
+	len = strcspn(cp, " \t");
+
+	if (*cp == HASH_DELIM) {
+		if ((r = hostindex_grow((void **)&b->hashed, &b->hashed_alloc,
+		    b->nhashed, sizeof(*b->hashed))) != 0)
+			return r;
+		h = &b->hashed[b->nhashed];
+		if (!hostindex_decode_hashed(cp, len, h->salt, h->hash))
+			return hostindex_add_other(b, line, offset);
+		h->line = line;
+		h->offset = offset;
+		b->nhashed++;
+		return 0;
+	}
+
+	for (tok = cp; tok < cp + len; tok += toklen + 1) {
+		toklen = strcspn(tok, ", \t");
+		if (toklen == 0)
+			continue;
+		/* Wildcards and negations need the whole pattern list. */
+		if (strcspn(tok, "*?!, \t") < toklen)
+			return hostindex_add_other(b, line, offset);
+		if ((r = hostindex_add_name(b, tok, toklen, line, offset)) != 0)
+			return r;
+	}
+	return 0;
+}
+
+static int
+hostindex_cmp_hashed(const void *a, const void *b)
+{
+	const struct hostindex_hashed *ha = a, *hb = b;
+	int r;
+
+	if ((r = memcmp(ha->salt, hb->salt, sizeof(ha->salt))) != 0)
+		return r;
+	return memcmp(ha->hash, hb->hash, sizeof(ha->hash));
+}
+
+static int
+hostindex_serialise(struct hostindex_build *b, const struct stat *st,
+    struct sshbuf *out)
+{
+	u_int32_t nbuckets, *counts = NULL, bucket;
+	struct hostindex_name *sorted = NULL;
+	u_char *p;
+	size_t i;
+	int r = SSH_ERR_INTERNAL_ERROR;
+
+	for (nbuckets = 16; nbuckets < b->nnames; nbuckets <<= 1)
+		;
+	if ((counts = calloc(nbuckets + 1, sizeof(*counts))) == NULL ||
+	    (b->nnames > 0 &&
+	    (sorted = calloc(b->nnames, sizeof(*sorted))) == NULL)) {
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+
+	/* Order the names by bucket, keeping them in line order. */
+	for (i = 0; i < b->nnames; i++)
+		counts[(b->names[i].hash & (nbuckets - 1)) + 1]++;
+	for (i = 0; i < nbuckets; i++)
+		counts[i + 1] += counts[i];
+	for (i = 0; i < b->nnames; i++) {
+		bucket = b->names[i].hash & (nbuckets - 1);
+		sorted[counts[bucket]++] = b->names[i];
+	}
+	/* counts[i] now holds the end of bucket i, i.e. the start of i+1 */
+	memmove(counts + 1, counts, nbuckets * sizeof(*counts));
+	counts[0] = 0;
+
+	if (b->nhashed > 0)
+		qsort(b->hashed, b->nhashed, sizeof(*b->hashed),
+		    hostindex_cmp_hashed);
+
+	if ((r = sshbuf_put(out, HOSTINDEX_MAGIC, HOSTINDEX_MAGIC_LEN)) != 0 ||
+	    (r = sshbuf_put_u64(out, st->st_size)) != 0 ||
+	    (r = sshbuf_put_u64(out, st->st_mtim.tv_sec)) != 0 ||
+	    (r = sshbuf_put_u32(out, st->st_mtim.tv_nsec)) != 0 ||
+	    (r = sshbuf_put_u64(out, st->st_ino)) != 0 ||
+	    (r = sshbuf_put_u32(out, nbuckets)) != 0 ||
+	    (r = sshbuf_put_u32(out, b->nnames)) != 0 ||
+	    (r = sshbuf_put_u32(out, b->nhashed)) != 0 ||
+	    (r = sshbuf_put_u32(out, b->nother)) != 0 ||
+	    (r = sshbuf_put_u32(out, sshbuf_len(b->strings))) != 0)
+		goto out;
+	if ((r = sshbuf_reserve(out, (nbuckets + 1) * 4, &p)) != 0)
+		goto out;
+	for (i = 0; i <= nbuckets; i++, p += 4)
+		POKE_U32(p, counts[i]);
+	if ((r = sshbuf_reserve(out, b->nnames * HOSTINDEX_NAME_LEN, &p)) != 0)
+		goto out;
+	for (i = 0; i < b->nnames; i++, p += HOSTINDEX_NAME_LEN) {
+		POKE_U32(p, sorted[i].hash);
+		POKE_U32(p + 4, sorted[i].line);
+		POKE_U64(p + 8, sorted[i].offset);
+		POKE_U32(p + 16, sorted[i].stroff);
+		POKE_U32(p + 20, sorted[i].len);
+	}
+	if ((r = sshbuf_reserve(out, b->nhashed * HOSTINDEX_HASHED_LEN,
+	    &p)) != 0)
+		goto out;
+	for (i = 0; i < b->nhashed; i++, p += HOSTINDEX_HASHED_LEN) {
+		memcpy(p, b->hashed[i].salt, SHA_DIGEST_LENGTH);
+		memcpy(p + SHA_DIGEST_LENGTH, b->hashed[i].hash,
+		    SHA_DIGEST_LENGTH);
+		POKE_U32(p + 2 * SHA_DIGEST_LENGTH, b->hashed[i].line);
+		POKE_U64(p + 2 * SHA_DIGEST_LENGTH + 4, b->hashed[i].offset);
+	}
+	if ((r = sshbuf_reserve(out, b->nother * HOSTINDEX_OTHER_LEN,
+	    &p)) != 0)
+		goto out;
+	for (i = 0; i < b->nother; i++, p += HOSTINDEX_OTHER_LEN) {
+		POKE_U32(p, b->other[i].line);
+		POKE_U64(p + 4, b->other[i].offset);
+	}
+	if ((r = sshbuf_putb(out, b->strings)) != 0)
+		goto out;
+	r = 0;
+ out:
+	free(counts);
+	free(sorted);
+	return r;
+}
+
+/* Builds the index for the known_hosts file 'f' into 'out'. */
+static int
+hostindex_build(FILE *f, const char *path, const struct stat *st,
+    struct sshbuf *out)
+{
+	struct hostindex_build b;
+	char line[HOSTINDEX_LINELEN];
+	u_long linenum = 0;
+	off_t offset;
+	int r = SSH_ERR_INTERNAL_ERROR;
+
+	bzero(&b, sizeof(b));
+	if ((b.strings = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if (fseeko(f, 0, SEEK_SET) == -1) {
+		r = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	}
+	/* Count lines exactly like read_keyfile_line() */
+	for (;;) {
+		if ((offset = ftello(f)) == -1) {
+			r = SSH_ERR_SYSTEM_ERROR;
+			goto out;
+		}
+		if (fgets(line, sizeof(line), f) == NULL)
+			break;
+		if (line[0] == '\0')
+			continue;
+		if (++linenum >= HOSTINDEX_MAX_ENTRIES) {
+			r = SSH_ERR_NO_BUFFER_SPACE;
+			goto out;
+		}
+		if (line[strlen(line) - 1] != '\n' && !feof(f)) {
+			/*
+			 * load_hostkeys() skips over-long lines, but
+			 * ssh-keygen reads longer ones.
+			 */
+			if ((r = hostindex_add_other(&b, linenum, offset)) != 0)
+				goto out;
+			while (fgetc(f) != '\n' && !feof(f))
+				;
+			continue;
+		}
+		if ((r = hostindex_add_line(&b, line, linenum, offset)) != 0)
+			goto out;
+	}
+	if (ferror(f)) {
+		r = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	}
+	debug3("%s: %s: %lu lines, %zu names, %zu hashed, %zu other",
+	    __func__, path, linenum, b.nnames, b.nhashed, b.nother);
+	r = hostindex_serialise(&b, st, out);
+ out:
+	free(b.names);
+	free(b.hashed);
+	free(b.other);
+	sshbuf_free(b.strings);
+	return r;
+}
+
+/*
+ * Index paths that could not be written, e.g. next to a system-wide
+ * known_hosts file.  Without this, every lookup would rebuild the index
+ * in memory only to throw it away again; scanning the file is cheaper.
+ */
+static char **unwritable;
+static size_t nunwritable;
+
+static int
+hostindex_is_unwritable(const char *idxpath)
+{
+	size_t i;
+
+	for (i = 0; i < nunwritable; i++) {
+		if (strcmp(unwritable[i], idxpath) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+hostindex_set_unwritable(const char *idxpath)
+{
+	char **tmp, *cp;
+
+	if ((cp = strdup(idxpath)) == NULL)
+		return;
+	if ((tmp = realloc(unwritable,
+	    (nunwritable + 1) * sizeof(*unwritable))) == NULL) {
+		free(cp);
+		return;
+	}
+	unwritable = tmp;
+	unwritable[nunwritable++] = cp;
+}
+
+/* Writes the index atomically. */
+static int
+hostindex_write(const char *idxpath, const struct sshbuf *b)
+{
+	char *tmp = NULL;
+	int fd = -1, r = SSH_ERR_SYSTEM_ERROR;
+
+	if (asprintf(&tmp, "%s.XXXXXXXXXX", idxpath) == -1) {
+		tmp = NULL;
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+	if ((fd = mkstemp(tmp)) == -1) {
+		debug2("%s: mkstemp %s: %s", __func__, tmp, strerror(errno));
+		goto out;
+	}
+	if (atomicio(vwrite, fd, sshbuf_ptr(b), sshbuf_len(b)) !=
+	    sshbuf_len(b) || close(fd) == -1) {
+		debug2("%s: write %s: %s", __func__, tmp, strerror(errno));
+		unlink(tmp);
+		fd = -1;
+		goto out;
+	}
+	fd = -1;
+	if (rename(tmp, idxpath) == -1) {
+		debug2("%s: rename %s: %s", __func__, idxpath, strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	debug2("%s: wrote %s", __func__, idxpath);
+	r = 0;
+ out:
+	if (fd != -1) {
+		close(fd);
+		unlink(tmp);
+	}
+	free(tmp);
+	return r;
+}
+
+/* Checks the index 'p' against the known_hosts file and sets up 'idx'. */
+static int
+hostindex_parse(const u_char *p, size_t len, const struct stat *st,
+    struct hostindex *idx)
+{
+	u_int64_t need;
+
+	if (len < HOSTINDEX_HDR_LEN ||
+	    memcmp(p, HOSTINDEX_MAGIC, sizeof(HOSTINDEX_MAGIC)) != 0)
+		return SSH_ERR_INVALID_FORMAT;
+	p += HOSTINDEX_MAGIC_LEN;
+	if (PEEK_U64(p) != (u_int64_t)st->st_size ||
+	    PEEK_U64(p + 8) != (u_int64_t)st->st_mtim.tv_sec ||
+	    PEEK_U32(p + 16) != (u_int32_t)st->st_mtim.tv_nsec ||
+	    PEEK_U64(p + 20) != (u_int64_t)st->st_ino)
+		return SSH_ERR_INVALID_FORMAT;	/* stale */
+	p += 28;
+	idx->nbuckets = PEEK_U32(p);
+	idx->nnames = PEEK_U32(p + 4);
+	idx->nhashed = PEEK_U32(p + 8);
+	idx->nother = PEEK_U32(p + 12);
+	idx->strings_len = PEEK_U32(p + 16);
+	p += 20;
+	if (idx->nbuckets == 0 || (idx->nbuckets & (idx->nbuckets - 1)) != 0 ||
+	    idx->nbuckets > HOSTINDEX_MAX_ENTRIES * 2 ||
+	    idx->nnames > HOSTINDEX_MAX_ENTRIES ||
+	    idx->nhashed > HOSTINDEX_MAX_ENTRIES ||
+	    idx->nother > HOSTINDEX_MAX_ENTRIES)
+		return SSH_ERR_INVALID_FORMAT;
+	need = HOSTINDEX_HDR_LEN + ((u_int64_t)idx->nbuckets + 1) * 4 +
+	    (u_int64_t)idx->nnames * HOSTINDEX_NAME_LEN +
+	    (u_int64_t)idx->nhashed * HOSTINDEX_HASHED_LEN +
+	    (u_int64_t)idx->nother * HOSTINDEX_OTHER_LEN + idx->strings_len;
+	if (need != len)
+		return SSH_ERR_INVALID_FORMAT;
+	idx->buckets = p;
+	idx->names = idx->buckets + (idx->nbuckets + 1) * 4;
+	idx->hashed = idx->names + idx->nnames * HOSTINDEX_NAME_LEN;
+	idx->other = idx->hashed + idx->nhashed * HOSTINDEX_HASHED_LEN;
+	idx->strings = idx->other + idx->nother * HOSTINDEX_OTHER_LEN;
+	return 0;
+}
+
+static int
+hostindex_add_match(struct hostindex_match **m, size_t *n, size_t *alloc,
+    u_long line, off_t offset)
+{
+	int r;
+
+	if ((r = hostindex_grow((void **)m, alloc, *n, sizeof(**m))) != 0)
+		return r;
+	(*m)[*n].line = line;
+	(*m)[*n].offset = offset;
+	(*n)++;
+	return 0;
+}
+
+static int
+hostindex_cmp_match(const void *a, const void *b)
+{
+	const struct hostindex_match *ma = a, *mb = b;
+
+	if (ma->line != mb->line)
+		return ma->line < mb->line ? -1 : 1;
+	return 0;
+}
+
+static int
+hostindex_search(const struct hostindex *idx, const char *host,
+    struct hostindex_match **matchesp, size_t *nmatchesp)
+{
+	struct hostindex_match *m = NULL;
+	size_t n = 0, alloc = 0, hostlen = strlen(host), i, j;
+	u_int32_t h, bucket, start, end, stroff, len;
+	u_char mac[SHA_DIGEST_LENGTH];
+	u_int maclen;
+	const u_char *p, *salt = NULL;
+	int r;
+
+	/* Plain host names */
+	h = hostindex_hash(host, hostlen);
+	bucket = h & (idx->nbuckets - 1);
+	start = PEEK_U32(idx->buckets + bucket * 4);
+	end = PEEK_U32(idx->buckets + (bucket + 1) * 4);
+	if (start > end || end > idx->nnames) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	for (i = start; i < end; i++) {
+		p = idx->names + i * HOSTINDEX_NAME_LEN;
+		stroff = PEEK_U32(p + 16);
+		len = PEEK_U32(p + 20);
+		if (PEEK_U32(p) != h || len != hostlen)
+			continue;
+		if (stroff > idx->strings_len ||
+		    len > idx->strings_len - stroff) {
+			r = SSH_ERR_INVALID_FORMAT;
+			goto out;
+		}
+		if (memcmp(idx->strings + stroff, host, len) != 0)
+			continue;
+		if ((r = hostindex_add_match(&m, &n, &alloc, PEEK_U32(p + 4),
+		    PEEK_U64(p + 8))) != 0)
+			goto out;
+	}
+
+	/* Hashed entries: one HMAC per distinct salt */
+	for (i = 0; i < idx->nhashed; i++) {
+		p = idx->hashed + i * HOSTINDEX_HASHED_LEN;
+		if (salt == NULL || memcmp(salt, p, SHA_DIGEST_LENGTH) != 0) {
+			salt = p;
+			if (HMAC(EVP_sha1(), salt, SHA_DIGEST_LENGTH,
+			    (const u_char *)host, hostlen, mac, &maclen) == NULL ||
+			    maclen != sizeof(mac)) {
+				r = SSH_ERR_LIBCRYPTO_ERROR;
+				goto out;
+			}
+		}
+		if (memcmp(mac, p + SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH) != 0)
+			continue;
+		if ((r = hostindex_add_match(&m, &n, &alloc,
+		    PEEK_U32(p + 2 * SHA_DIGEST_LENGTH),
+		    PEEK_U64(p + 2 * SHA_DIGEST_LENGTH + 4))) != 0)
+			goto out;
+	}
+
+	/* Lines that always need checking */
+	for (i = 0; i < idx->nother; i++) {
+		p = idx->other + i * HOSTINDEX_OTHER_LEN;
+		if ((r = hostindex_add_match(&m, &n, &alloc, PEEK_U32(p),
+		    PEEK_U64(p + 4))) != 0)
+			goto out;
+	}
+
+	/* Sort by line and drop lines that matched more than once */
+	if (n > 1) {
+		qsort(m, n, sizeof(*m), hostindex_cmp_match);
+		for (i = j = 1; i < n; i++) {
+			if (m[i].line != m[j - 1].line)
+				m[j++] = m[i];
+		}
+		n = j;
+	}
+	*matchesp = m;
+	*nmatchesp = n;
+	m = NULL;
+	r = 0;
+ out:
+	free(m);
+	bzero(mac, sizeof(mac));
+	return r;
+}
+
+int
+hostindex_lookup(FILE *f, const char *path, const char *host, int create,
+    struct hostindex_match **matchesp, size_t *nmatchesp)
+{
+	struct hostindex idx;
+	struct stat st, ist;
+	struct sshbuf *b = NULL;
+	char *idxpath = NULL;
+	void *map = MAP_FAILED;
+	size_t maplen = 0;
+	int fd = -1, r = SSH_ERR_INTERNAL_ERROR;
+
+	*matchesp = NULL;
+	*nmatchesp = 0;
+	if (fstat(fileno(f), &st) == -1)
+		return SSH_ERR_SYSTEM_ERROR;
+	if (asprintf(&idxpath, "%s%s", path, HOSTINDEX_SUFFIX) == -1)
+		return SSH_ERR_ALLOC_FAIL;
+
+	if ((fd = open(idxpath, O_RDONLY)) == -1) {
+		if (errno != ENOENT || !create) {
+			r = SSH_ERR_SYSTEM_ERROR;
+			goto out;
+		}
+	} else if (fstat(fd, &ist) == -1) {
+		r = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	} else if ((ist.st_mode & (S_IWGRP|S_IWOTH)) != 0) {
+		/* others could hide @revoked or @cert-authority lines */
+		debug("%s: %s is group or world writable, ignoring it",
+		    __func__, idxpath);
+		errno = EPERM;
+		r = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	} else if (ist.st_uid == st.st_uid && S_ISREG(ist.st_mode) &&
+	    ist.st_size >= HOSTINDEX_HDR_LEN &&
+	    ist.st_size <= HOSTINDEX_MAX_SIZE) {
+		maplen = ist.st_size;
+		if ((map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE,
+		    fd, 0)) == MAP_FAILED) {
+			r = SSH_ERR_SYSTEM_ERROR;
+			goto out;
+		}
+		if (hostindex_parse(map, maplen, &st, &idx) != 0)
+			debug2("%s: %s is stale", __func__, idxpath);
+		else if ((r = hostindex_search(&idx, host, matchesp,
+		    nmatchesp)) != SSH_ERR_INVALID_FORMAT)
+			goto out;
+		else
+			debug2("%s: %s is corrupt", __func__, idxpath);
+	}
+
+	/*
+	 * Missing, stale or unusable: rebuild it from the file, unless an
+	 * earlier rebuild could not be written back.
+	 */
+	if (hostindex_is_unwritable(idxpath)) {
+		r = SSH_ERR_SYSTEM_ERROR;
+		errno = EACCES;
+		goto out;
+	}
+	if ((b = sshbuf_new()) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+	if ((r = hostindex_build(f, path, &st, b)) != 0)
+		goto out;
+	if (hostindex_write(idxpath, b) == SSH_ERR_SYSTEM_ERROR)
+		hostindex_set_unwritable(idxpath);
+	if ((r = hostindex_parse(sshbuf_ptr(b), sshbuf_len(b), &st, &idx)) != 0)
+		goto out;
+	r = hostindex_search(&idx, host, matchesp, nmatchesp);
+ out:
+	if (map != MAP_FAILED)
+		munmap(map, maplen);
+	if (fd != -1)
+		close(fd);
+	if (b != NULL)
+		sshbuf_free(b);
+	free(idxpath);
+	return r;
+}
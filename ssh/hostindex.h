@@ -0,0 +1,44 @@
+/* $OpenBSD$ */
+/*
+ * Sidecar index for large known_hosts files.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef HOSTINDEX_H
+#define HOSTINDEX_H
+
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#define HOSTINDEX_SUFFIX	".idx"
+
+/* A known_hosts line that may match the host that was looked up. */
+struct hostindex_match {
+	u_long	line;		/* line number, as read_keyfile_line() counts */
+	off_t	offset;		/* offset of the start of the line */
+};
+
+/*
+ * hostindex_lookup() returns the lines of the known_hosts file 'f' (opened
+ * from 'path') that may match 'host', sorted by line number.  The result
+ * is a superset of the matching lines: lines with wildcards or negations
+ * and lines the index cannot classify are always returned, so callers
+ * must still match every returned line themselves.
+ *
+ * The index is read from 'path' with HOSTINDEX_SUFFIX appended.  If it
+ * is missing and 'create' is not set, SSH_ERR_SYSTEM_ERROR is returned
+ * with errno set to ENOENT.  A stale index (the file's size, modification
+ * time or inode changed) or a missing one with 'create' set is rebuilt
+ * from 'f' and written back if possible.  If it cannot be written back,
+ * later lookups in the same process return SSH_ERR_SYSTEM_ERROR instead
+ * of rebuilding it again.  An index that is group or world writable is
+ * never used or replaced; SSH_ERR_SYSTEM_ERROR is returned with errno set
+ * to EPERM.  On any error the caller should fall back to scanning the
+ * whole file.  The position of 'f' is undefined afterwards.
+ */
+int	hostindex_lookup(FILE *f, const char *path, const char *host,
+    int create, struct hostindex_match **matchesp, size_t *nmatchesp);
+
+#endif
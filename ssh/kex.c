@@ -44,12 +44,38 @@
 #include "match.h"
 #include "dispatch.h"
 #include "monitor.h"
+#include "monitor_wrap.h"
 #include "roaming.h"
 #include "err.h"
+#include "probe.h"
+
+/*
+ * the state a key exchange method leaves behind when the application
+ * completes the host key verification (client) or signature (server)
+ * later, see kex_resume().
+ */
+#define KEX_PENDING_VERIFY	1
+#define KEX_PENDING_SIGN	2
+
+struct kex_pending {
+	int	 what;
+	u_char	 hash[EVP_MAX_MD_SIZE];
+	size_t	 hashlen;
+	BIGNUM	*shared_secret;
+	/* KEX_PENDING_SIGN: the reply to send with the signature */
+	u_char	 reply_type;
+	struct sshkey *key;		/* private host key, not owned */
+	u_char	*blob;			/* server host key */
+	size_t	 bloblen;
+	struct sshbuf *reply;		/* method specific, e.g. Q_S or f */
+};
 
 /* prototype */
 static int kex_choose_conf(struct ssh *);
+static int choose_kex(Kex *, char *, char *);
+static int choose_hostkeyalg(Kex *, char *, char *);
 static int kex_input_newkeys(int, u_int32_t, struct ssh *);
+static void kex_pending_free(struct kex_pending *);
 
 /* Validate KEX method name list */
 int
@@ -67,6 +93,7 @@ kex_names_valid(const char *names)
 		    strcmp(p, KEX_DHGEX_SHA1) != 0 &&
 		    strcmp(p, KEX_DH14) != 0 &&
 		    strcmp(p, KEX_DH1) != 0 &&
+		    strcmp(p, KEX_CURVE25519_SHA256) != 0 &&
 		    (strncmp(p, KEX_ECDH_SHA2_STEM,
 		    sizeof(KEX_ECDH_SHA2_STEM) - 1) != 0 ||
 		    kex_ecdh_name_to_nid(p) == -1)) {
@@ -137,7 +164,7 @@ kex_buf2prop(struct sshbuf *raw, int *first_kex_follows, char ***propp)
 	    (r = sshbuf_get_u32(b, &i)) != 0)
 		goto out;
 	if (first_kex_follows != NULL)
-		*first_kex_follows = i;
+		*first_kex_follows = v;
 	debug2("kex_parse_kexinit: first_kex_follows %d ", v);
 	debug2("kex_parse_kexinit: reserved %u ", i);
 	r = 0;
@@ -167,7 +194,7 @@ kex_protocol_error(int type, u_int32_t seq, struct ssh *ssh)
 	return 0;
 }
 
-static void
+void
 kex_reset_dispatch(struct ssh *ssh)
 {
 	ssh_dispatch_range(ssh, SSH2_MSG_TRANSPORT_MIN,
@@ -201,6 +228,7 @@ kex_input_newkeys(int type, u_int32_t seq, struct ssh *ssh)
 	if ((r = sshpkt_get_end(ssh)) != 0)
 		return r;
 	kex->done = 1;
+	SSH_PROBE2(kex__done, ssh, kex->kex_type);
 	sshbuf_reset(kex->peer);
 	/* sshbuf_reset(kex->my); */
 	kex->flags &= ~KEX_INIT_SENT;
@@ -209,6 +237,19 @@ kex_input_newkeys(int type, u_int32_t seq, struct ssh *ssh)
 	return 0;
 }
 
+/*
+ * Serialise the server host key for the exchange hash and KEX reply,
+ * using the copy cached by the application if it provides one.
+ */
+int
+kex_host_key_blob(struct ssh *ssh, struct sshkey *key, u_char **blobp,
+    u_int *lenp)
+{
+	if (ssh->kex->host_key_blob != NULL)
+		return ssh->kex->host_key_blob(key, blobp, lenp, ssh);
+	return sshkey_to_blob(key, blobp, lenp);
+}
+
 int
 kex_send_kexinit(struct ssh *ssh)
 {
@@ -221,13 +262,16 @@ kex_send_kexinit(struct ssh *ssh)
 	if (kex->flags & KEX_INIT_SENT)
 		return 0;
 	kex->done = 0;
+	SSH_PROBE1(kex__start, ssh);
 
 	/* generate a random cookie */
-	if (sshbuf_len(kex->my) < KEX_COOKIE_LEN)
+	if (sshbuf_len(kex->my) < KEX_COOKIE_LEN + 5)
 		return SSH_ERR_INVALID_FORMAT;
 	if ((cookie = sshbuf_ptr(kex->my)) == NULL)
 		return SSH_ERR_INTERNAL_ERROR;
 	arc4random_buf(cookie, KEX_COOKIE_LEN);
+	/* first_kex_packet_follows, before the reserved uint32 */
+	cookie[sshbuf_len(kex->my) - 5] = (kex->flags & KEX_GUESS_SENT) != 0;
 
 	if ((r = sshpkt_start(ssh, SSH2_MSG_KEXINIT)) != 0)
 		return r;
@@ -241,6 +285,71 @@ kex_send_kexinit(struct ssh *ssh)
 	return 0;
 }
 
+/*
+ * Like kex_send_kexinit(), but follow the KEXINIT with the first packet
+ * of our preferred key exchange method (RFC 4253, section 7).  If the
+ * peer prefers the same kex and host key algorithms this saves a round
+ * trip; otherwise it discards the packet and kex_choose_conf() starts
+ * over with the negotiated method.  Only the client guesses, and only
+ * the ECDH methods, since the others depend on the negotiated ciphers.
+ */
+int
+kex_send_kexinit_guess(struct ssh *ssh)
+{
+	Kex *kex = ssh->kex;
+	char **my = NULL, *p;
+	int r;
+
+	if (kex == NULL)
+		return SSH_ERR_INTERNAL_ERROR;
+	if (kex->server || (kex->flags & KEX_INIT_SENT))
+		return kex_send_kexinit(ssh);
+	if ((r = kex_buf2prop(kex->my, NULL, &my)) != 0)
+		return r;
+	if ((p = strchr(my[PROPOSAL_KEX_ALGS], ',')) != NULL)
+		*p = '\0';
+	if ((p = strchr(my[PROPOSAL_SERVER_HOST_KEY_ALGS], ',')) != NULL)
+		*p = '\0';
+	if (choose_kex(kex, my[PROPOSAL_KEX_ALGS],
+	    my[PROPOSAL_KEX_ALGS]) != 0 ||
+	    (kex->kex_type != KEX_ECDH_SHA2 &&
+	    kex->kex_type != KEX_C25519_SHA256) ||
+	    kex->kex[kex->kex_type] == NULL ||
+	    choose_hostkeyalg(kex, my[PROPOSAL_SERVER_HOST_KEY_ALGS],
+	    my[PROPOSAL_SERVER_HOST_KEY_ALGS]) != 0) {
+		/* nothing worth guessing */
+		free(kex->name);
+		kex->name = NULL;
+		r = kex_send_kexinit(ssh);
+		goto out;
+	}
+	debug("kex: guessing %s", kex->name);
+	kex->flags |= KEX_GUESS_SENT;
+	if ((r = kex_send_kexinit(ssh)) != 0 ||
+	    (r = (kex->kex[kex->kex_type])(ssh)) != 0)
+		goto out;
+	r = 0;
+ out:
+	kex_prop_free(my);
+	return r;
+}
+
+/* throw away the state of a guessed key exchange that was wrong */
+static void
+kex_discard_guess(struct ssh *ssh)
+{
+	Kex *kex = ssh->kex;
+
+	debug("kex: our guess was wrong");
+	kex->flags &= ~KEX_GUESS_SENT;
+	if (kex->ec_client_key != NULL) {
+		EC_KEY_free(kex->ec_client_key);
+		kex->ec_client_key = NULL;
+	}
+	bzero(kex->c25519_client_key, sizeof(kex->c25519_client_key));
+	ssh_dispatch_set(ssh, SSH2_MSG_KEX_ECDH_REPLY, &kex_protocol_error);
+}
+
 /* ARGSUSED */
 int
 kex_input_kexinit(int type, u_int32_t seq, struct ssh *ssh)
@@ -276,7 +385,13 @@ kex_input_kexinit(int type, u_int32_t seq, struct ssh *ssh)
 			return r;
 	if ((r = kex_choose_conf(ssh)) != 0)
 		return r;
+	SSH_PROBE3(kex__negotiated, ssh, kex->kex_type, kex->name);
 
+	/* our guess was right, the method is running already */
+	if (kex->flags & KEX_GUESS_SENT) {
+		kex->flags &= ~KEX_GUESS_SENT;
+		return 0;
+	}
 	if (kex->kex_type >= 0 && kex->kex_type < KEX_MAX &&
 	    kex->kex[kex->kex_type] != NULL)
 		return (kex->kex[kex->kex_type])(ssh);
@@ -286,6 +401,22 @@ kex_input_kexinit(int type, u_int32_t seq, struct ssh *ssh)
 
 int
 kex_new(struct ssh *ssh, char *proposal[PROPOSAL_MAX], Kex **kexp)
+{
+	struct sshbuf *my;
+	int r;
+
+	*kexp = NULL;
+	if ((my = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = kex_prop2buf(my, proposal)) == 0)
+		r = kex_new_from_buf(ssh, my, kexp);
+	sshbuf_free(my);
+	return r;
+}
+
+/* like kex_new(), for a proposal serialised by kex_prop2buf() */
+int
+kex_new_from_buf(struct ssh *ssh, const struct sshbuf *my, Kex **kexp)
 {
 	Kex *kex;
 	int r;
@@ -298,7 +429,7 @@ kex_new(struct ssh *ssh, char *proposal[PROPOSAL_MAX], Kex **kexp)
 		r = SSH_ERR_ALLOC_FAIL;
 		goto out;
 	}
-	if ((r = kex_prop2buf(kex->my, proposal)) != 0)
+	if ((r = sshbuf_putb(kex->my, my)) != 0)
 		goto out;
 	kex->done = 0;
 	kex_reset_dispatch(ssh);
@@ -354,6 +485,8 @@ kex_free(Kex *kex)
 		DH_free(kex->dh);
 	if (kex->ec_client_key)
 		EC_KEY_free(kex->ec_client_key);
+	bzero(kex->c25519_client_key, sizeof(kex->c25519_client_key));
+	kex_pending_free(kex->pending);
 	for (mode = 0; mode < MODE_MAX; mode++) {
 		kex_free_newkeys(kex->newkeys[mode]);
 		kex->newkeys[mode] = NULL;
@@ -441,6 +574,7 @@ choose_comp(Comp *comp, char *client, char *server)
 static int
 choose_kex(Kex *k, char *client, char *server)
 {
+	free(k->name);		/* a guess */
 	k->name = match_list(client, server, NULL);
 
 	if (k->name == NULL)
@@ -463,6 +597,9 @@ choose_kex(Kex *k, char *client, char *server)
 		k->evp_md = kex_ecdh_name_to_evpmd(k->name);
 		if (k->evp_md == NULL)
 			return SSH_ERR_INTERNAL_ERROR;
+	} else if (strcmp(k->name, KEX_CURVE25519_SHA256) == 0) {
+		k->kex_type = KEX_C25519_SHA256;
+		k->evp_md = EVP_sha256();
 	} else
 		return SSH_ERR_INTERNAL_ERROR;
 	return 0;
@@ -514,7 +651,7 @@ kex_choose_conf(struct ssh *ssh)
 	char **cprop, **sprop;
 	int nenc, nmac, ncomp;
 	u_int mode, ctos, need;
-	int r, first_kex_follows;
+	int r, first_kex_follows, match;
 	Kex *kex = ssh->kex;
 
 	if ((r = kex_buf2prop(kex->my, NULL, &my)) != 0 ||
@@ -583,10 +720,14 @@ kex_choose_conf(struct ssh *ssh)
 	/* XXX need runden? */
 	kex->we_need = need;
 
+	match = proposals_match(my, peer);
 	/* ignore the next message if the proposals do not match */
-	if (first_kex_follows && !proposals_match(my, peer) &&
+	if (first_kex_follows && !match &&
 	    !(ssh->compat & SSH_BUG_FIRSTKEX))
 		ssh->skip_packets = 1;
+	/* and the peer ignores ours */
+	if ((kex->flags & KEX_GUESS_SENT) && !match)
+		kex_discard_guess(ssh);
 	r = 0;
  out:
 	kex_prop_free(my);
@@ -690,6 +831,196 @@ kex_derive_keys(struct ssh *ssh, u_char *hash, u_int hashlen,
 	return 0;
 }
 
+static void
+kex_pending_free(struct kex_pending *p)
+{
+	if (p == NULL)
+		return;
+	if (p->shared_secret != NULL)
+		BN_clear_free(p->shared_secret);
+	if (p->reply != NULL)
+		sshbuf_free(p->reply);
+	free(p->blob);
+	bzero(p, sizeof(*p));
+	free(p);
+}
+
+static int
+kex_pending_new(int what, u_char *hash, size_t hashlen, BIGNUM *shared_secret,
+    struct kex_pending **pp)
+{
+	struct kex_pending *p;
+
+	*pp = NULL;
+	if (hashlen > sizeof(p->hash))
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	p->what = what;
+	memcpy(p->hash, hash, hashlen);
+	p->hashlen = hashlen;
+	if ((p->shared_secret = BN_dup(shared_secret)) == NULL) {
+		kex_pending_free(p);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	*pp = p;
+	return 0;
+}
+
+static int
+kex_finish(struct ssh *ssh, u_char *hash, size_t hashlen,
+    BIGNUM *shared_secret)
+{
+	int r;
+
+	if ((r = kex_derive_keys(ssh, hash, hashlen, shared_secret)) != 0)
+		return r;
+	return kex_send_newkeys(ssh);
+}
+
+static int
+kex_send_reply(struct ssh *ssh, u_char type, u_char *blob, size_t bloblen,
+    struct sshbuf *reply, const u_char *signature, size_t slen)
+{
+	int r;
+
+	/* server hostkey, method specific part and signed H */
+	if ((r = sshpkt_start(ssh, type)) != 0 ||
+	    (r = sshpkt_put_string(ssh, blob, bloblen)) != 0 ||
+	    (r = sshpkt_put(ssh, sshbuf_ptr(reply), sshbuf_len(reply))) != 0 ||
+	    (r = sshpkt_put_string(ssh, signature, slen)) != 0 ||
+	    (r = sshpkt_send(ssh)) != 0)
+		return r;
+	return 0;
+}
+
+/*
+ * common end of the server side methods: sign H, send the reply and the
+ * new keys.  if the sign_host_key callback returns SSH_ERR_KEX_PENDING
+ * the reply is kept until the signature is passed to kex_resume().
+ */
+int
+kex_server_finish(struct ssh *ssh, u_char type, struct sshkey *private,
+    u_char *blob, size_t bloblen, struct sshbuf *reply,
+    u_char *hash, size_t hashlen, BIGNUM *shared_secret)
+{
+	Kex *kex = ssh->kex;
+	struct kex_pending *p;
+	u_char *signature = NULL;
+	u_int slen;
+	int r;
+
+	if (kex->sign_host_key != NULL)
+		r = kex->sign_host_key(private, &signature, &slen,
+		    hash, hashlen, ssh);
+	else
+		r = PRIVSEP(sshkey_sign(private, &signature, &slen,
+		    hash, hashlen, ssh->compat));
+	if (r == SSH_ERR_KEX_PENDING) {
+		if ((r = kex_pending_new(KEX_PENDING_SIGN, hash, hashlen,
+		    shared_secret, &p)) != 0)
+			return r;
+		p->reply_type = type;
+		p->key = private;
+		if ((p->blob = malloc(bloblen)) == NULL ||
+		    (p->reply = sshbuf_new()) == NULL ||
+		    (r = sshbuf_putb(p->reply, reply)) != 0) {
+			kex_pending_free(p);
+			return r != 0 ? r : SSH_ERR_ALLOC_FAIL;
+		}
+		memcpy(p->blob, blob, bloblen);
+		p->bloblen = bloblen;
+		kex->pending = p;
+		debug("%s: waiting for the host key signature", __func__);
+		return 0;
+	}
+	if (r < 0)
+		return r;
+
+	if ((r = kex_send_reply(ssh, type, blob, bloblen, reply,
+	    signature, slen)) == 0)
+		r = kex_finish(ssh, hash, hashlen, shared_secret);
+	free(signature);
+	return r;
+}
+
+/*
+ * common end of the client side methods, once H has been verified.
+ * 'pending' is set if the verify_host_key callback returned
+ * SSH_ERR_KEX_PENDING: the keys are derived after kex_resume().
+ */
+int
+kex_client_finish(struct ssh *ssh, int pending, u_char *hash, size_t hashlen,
+    BIGNUM *shared_secret)
+{
+	struct kex_pending *p;
+	int r;
+
+	if (!pending)
+		return kex_finish(ssh, hash, hashlen, shared_secret);
+	if ((r = kex_pending_new(KEX_PENDING_VERIFY, hash, hashlen,
+	    shared_secret, &p)) != 0)
+		return r;
+	ssh->kex->pending = p;
+	debug("%s: waiting for the host key verification", __func__);
+	return 0;
+}
+
+/* the host key and exchange hash of a pending signature */
+int
+kex_pending_sign(struct ssh *ssh, struct sshkey **keyp, const u_char **hashp,
+    size_t *hashlenp)
+{
+	struct kex_pending *p = ssh->kex->pending;
+
+	if (p == NULL || p->what != KEX_PENDING_SIGN)
+		return SSH_ERR_INVALID_ARGUMENT;
+	*keyp = p->key;
+	*hashp = p->hash;
+	*hashlenp = p->hashlen;
+	return 0;
+}
+
+/*
+ * complete a pending host key operation: 'result' is 0 if the host key
+ * was accepted or the signature in 'sig' was made, an error otherwise.
+ */
+int
+kex_resume(struct ssh *ssh, int result, const u_char *sig, size_t siglen)
+{
+	Kex *kex = ssh->kex;
+	struct kex_pending *p;
+	int r;
+
+	if (kex == NULL || (p = kex->pending) == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	kex->pending = NULL;
+	switch (p->what) {
+	case KEX_PENDING_VERIFY:
+		if (result != 0)
+			r = SSH_ERR_SIGNATURE_INVALID;
+		else
+			r = kex_finish(ssh, p->hash, p->hashlen,
+			    p->shared_secret);
+		break;
+	case KEX_PENDING_SIGN:
+		if (result != 0)
+			r = result < 0 ? result : SSH_ERR_INTERNAL_ERROR;
+		else if (sig == NULL || siglen == 0)
+			r = SSH_ERR_INVALID_ARGUMENT;
+		else if ((r = kex_send_reply(ssh, p->reply_type, p->blob,
+		    p->bloblen, p->reply, sig, siglen)) == 0)
+			r = kex_finish(ssh, p->hash, p->hashlen,
+			    p->shared_secret);
+		break;
+	default:
+		r = SSH_ERR_INTERNAL_ERROR;
+		break;
+	}
+	kex_pending_free(p);
+	return r;
+}
+
 Newkeys *
 kex_get_newkeys(struct ssh *ssh, int mode)
 {
@@ -30,6 +30,7 @@
 #include <openssl/ec.h>
 
 #include "mac.h"
+#include "crypto_api.h"
 
 #define KEX_COOKIE_LEN	16
 
@@ -40,6 +41,7 @@
 #define	KEX_RESUME		"resume@appgate.com"
 /* The following represents the family of ECDH methods */
 #define	KEX_ECDH_SHA2_STEM	"ecdh-sha2-"
+#define	KEX_CURVE25519_SHA256	"curve25519-sha256@libssh.org"
 
 #define COMP_NONE	0
 #define COMP_ZLIB	1
@@ -71,10 +73,12 @@ enum kex_exchange {
 	KEX_DH_GEX_SHA1,
 	KEX_DH_GEX_SHA256,
 	KEX_ECDH_SHA2,
+	KEX_C25519_SHA256,
 	KEX_MAX
 };
 
 #define KEX_INIT_SENT	0x0001
+#define KEX_GUESS_SENT	0x0002	/* first_kex_packet_follows */
 
 typedef struct Kex Kex;
 typedef struct sshmac Mac;
@@ -103,6 +107,8 @@ struct Newkeys {
 };
 
 struct ssh;
+struct kex_keypool;
+struct kex_pending;
 
 struct Kex {
 	u_char	*session_id;
@@ -124,30 +130,48 @@ struct Kex {
 	int	(*verify_host_key)(struct sshkey *, struct ssh *);
 	struct sshkey *(*load_host_public_key)(int, struct ssh *);
 	struct sshkey *(*load_host_private_key)(int, struct ssh *);
+	int	(*host_key_blob)(struct sshkey *, u_char **, u_int *,
+	    struct ssh *);
 	int	(*host_key_index)(struct sshkey *);
+	int	(*sign_host_key)(struct sshkey *, u_char **, u_int *,
+	    const u_char *, u_int, struct ssh *);
+	struct kex_pending *pending;	/* host key operation in progress */
 	int	(*kex[KEX_MAX])(struct ssh *);
 	/* kex specific state */
 	DH	*dh;			/* DH */
 	int	min, max, nbits;	/* GEX */
+	struct kex_keypool *keypool;	/* DH/ECDH server, not owned */
 	EC_KEY	*ec_client_key;		/* ECH */
 	const EC_GROUP *ec_group;	/* ECH */
+	u_char	c25519_client_key[CURVE25519_SIZE]; /* 25519 */
+	u_char	c25519_client_pubkey[CURVE25519_SIZE]; /* 25519 */
 };
 
 int	 kex_names_valid(const char *);
 
 int	 kex_new(struct ssh *, char *[PROPOSAL_MAX], Kex **);
+int	 kex_new_from_buf(struct ssh *, const struct sshbuf *, Kex **);
 int	 kex_setup(struct ssh *, char *[PROPOSAL_MAX]);
 void	 kex_free_newkeys(Newkeys *);
 void	 kex_free(Kex *);
+void	 kex_reset_dispatch(struct ssh *);
 
 int	 kex_buf2prop(struct sshbuf *, int *, char ***);
 int	 kex_prop2buf(struct sshbuf *, char *proposal[PROPOSAL_MAX]);
 void	 kex_prop_free(char **);
 
 int	 kex_send_kexinit(struct ssh *);
+int	 kex_send_kexinit_guess(struct ssh *);
+int	 kex_host_key_blob(struct ssh *, struct sshkey *, u_char **, u_int *);
 int	 kex_input_kexinit(int, u_int32_t, struct ssh *);
 int	 kex_derive_keys(struct ssh *, u_char *, u_int, BIGNUM *);
 int	 kex_send_newkeys(struct ssh *);
+int	 kex_server_finish(struct ssh *, u_char, struct sshkey *,
+    u_char *, size_t, struct sshbuf *, u_char *, size_t, BIGNUM *);
+int	 kex_client_finish(struct ssh *, int, u_char *, size_t, BIGNUM *);
+int	 kex_resume(struct ssh *, int, const u_char *, size_t);
+int	 kex_pending_sign(struct ssh *, struct sshkey **, const u_char **,
+    size_t *);
 
 Newkeys *kex_get_newkeys(struct ssh *, int);
 
@@ -157,18 +181,29 @@ int	 kexgex_client(struct ssh *);
 int	 kexgex_server(struct ssh *);
 int	 kexecdh_client(struct ssh *);
 int	 kexecdh_server(struct ssh *);
+int	 kexc25519_client(struct ssh *);
+int	 kexc25519_server(struct ssh *);
 
 int
 kex_dh_hash(char *, char *, char *, size_t, char *, size_t, u_char *, size_t,
-    BIGNUM *, BIGNUM *, BIGNUM *, u_char **, size_t *);
+    BIGNUM *, BIGNUM *, BIGNUM *, u_char *, size_t *);
 int
 kexgex_hash(const EVP_MD *, char *, char *, char *, size_t, char *,
     size_t, u_char *, size_t, int, int, int, BIGNUM *, BIGNUM *, BIGNUM *,
-    BIGNUM *, BIGNUM *, u_char **, size_t *);
+    BIGNUM *, BIGNUM *, u_char *, size_t *);
 int
-kex_ecdh_hash(const EVP_MD *, const EC_GROUP *, char *, char *, char *, size_t,
-    char *, size_t, u_char *, size_t, const EC_POINT *, const EC_POINT *,
-    const BIGNUM *, u_char **, size_t *);
+kex_ecdh_hash(const EVP_MD *, const EC_GROUP *, BN_CTX *, char *, char *,
+    char *, size_t, char *, size_t, u_char *, size_t, const EC_POINT *,
+    const EC_POINT *, const BIGNUM *, u_char *, size_t *);
+
+int
+kex_c25519_hash(const EVP_MD *, char *, char *, char *, size_t, char *,
+    size_t, u_char *, size_t, const u_char[CURVE25519_SIZE],
+    const u_char[CURVE25519_SIZE], const BIGNUM *, u_char *, size_t *);
+
+void	kexc25519_keygen(u_char[CURVE25519_SIZE], u_char[CURVE25519_SIZE]);
+int	kexc25519_shared_key(const u_char[CURVE25519_SIZE],
+    const u_char[CURVE25519_SIZE], BIGNUM **);
 
 int	kex_ecdh_name_to_nid(const char *);
 const EVP_MD *kex_ecdh_name_to_evpmd(const char *);
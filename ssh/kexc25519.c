@@ -0,0 +1,114 @@
+/* $OpenBSD$ */
+/*
+ * curve25519-sha256@libssh.org key exchange: X25519 (RFC 7748) with the
+ * exchange hash of the ECDH methods, public keys sent as strings.
+ *
+ * Unlike the NIST curves every 32 byte string is a valid public key, so
+ * there is no point validation; a peer can only force the all zero
+ * shared secret, which is refused.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include <signal.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+
+#include "buffer.h"
+#include "ssh2.h"
+#include "key.h"
+#include "cipher.h"
+#include "kex.h"
+#include "log.h"
+#include "err.h"
+
+void
+kexc25519_keygen(u_char key[CURVE25519_SIZE], u_char pub[CURVE25519_SIZE])
+{
+	arc4random_buf(key, CURVE25519_SIZE);
+	crypto_scalarmult_curve25519_base(pub, key);
+}
+
+int
+kexc25519_shared_key(const u_char key[CURVE25519_SIZE],
+    const u_char pub[CURVE25519_SIZE], BIGNUM **sharedp)
+{
+	u_char shared[CURVE25519_SIZE], acc = 0;
+	u_int i;
+	int r = 0;
+
+	*sharedp = NULL;
+	crypto_scalarmult_curve25519(shared, key, pub);
+	/* a low order point from the peer; not a secret, but no branches */
+	for (i = 0; i < sizeof(shared); i++)
+		acc |= shared[i];
+	if (acc == 0) {
+		r = SSH_ERR_KEY_INVALID_EC_VALUE;
+		goto out;
+	}
+#ifdef DEBUG_KEXECDH
+	dump_digest("shared secret", shared, sizeof(shared));
+#endif
+	/* the X25519 output is encoded as an mpint as is */
+	if ((*sharedp = BN_bin2bn(shared, sizeof(shared), NULL)) == NULL)
+		r = SSH_ERR_ALLOC_FAIL;
+ out:
+	bzero(shared, sizeof(shared));
+	return r;
+}
+
+int
+kex_c25519_hash(
+    const EVP_MD *evp_md,
+    char *client_version_string,
+    char *server_version_string,
+    char *ckexinit, size_t ckexinitlen,
+    char *skexinit, size_t skexinitlen,
+    u_char *serverhostkeyblob, size_t sbloblen,
+    const u_char client_dh_pub[CURVE25519_SIZE],
+    const u_char server_dh_pub[CURVE25519_SIZE],
+    const BIGNUM *shared_secret,
+    u_char *hash, size_t *hashlen)
+{
+	struct sshbuf *b;
+	EVP_MD_CTX md;
+	int r;
+
+	if ((b = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = sshbuf_put_cstring(b, client_version_string)) != 0 ||
+	    (r = sshbuf_put_cstring(b, server_version_string)) != 0 ||
+	    /* kexinit messages: fake header: len+SSH2_MSG_KEXINIT */
+	    (r = sshbuf_put_u32(b, ckexinitlen+1)) != 0 ||
+	    (r = sshbuf_put_u8(b, SSH2_MSG_KEXINIT)) != 0 ||
+	    (r = sshbuf_put(b, ckexinit, ckexinitlen)) != 0 ||
+	    (r = sshbuf_put_u32(b, skexinitlen+1)) != 0 ||
+	    (r = sshbuf_put_u8(b, SSH2_MSG_KEXINIT)) != 0 ||
+	    (r = sshbuf_put(b, skexinit, skexinitlen)) != 0 ||
+	    (r = sshbuf_put_string(b, serverhostkeyblob, sbloblen)) != 0 ||
+	    (r = sshbuf_put_string(b, client_dh_pub, CURVE25519_SIZE)) != 0 ||
+	    (r = sshbuf_put_string(b, server_dh_pub, CURVE25519_SIZE)) != 0 ||
+	    (r = sshbuf_put_bignum2(b, shared_secret)) != 0) {
+		sshbuf_free(b);
+		return r;
+	}
+#ifdef DEBUG_KEX
+	sshbuf_dump(b, stderr);
+#endif
+	if (EVP_DigestInit(&md, evp_md) != 1 ||
+	    EVP_DigestUpdate(&md, sshbuf_ptr(b), sshbuf_len(b)) != 1 ||
+	    EVP_DigestFinal(&md, hash, NULL) != 1) {
+		sshbuf_free(b);
+		return SSH_ERR_LIBCRYPTO_ERROR;
+	}
+	sshbuf_free(b);
+#ifdef DEBUG_KEX
+	dump_digest("hash", hash, EVP_MD_size(evp_md));
+#endif
+	*hashlen = EVP_MD_size(evp_md);
+	return 0;
+}
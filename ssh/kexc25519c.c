@@ -0,0 +1,145 @@
+/* $OpenBSD$ */
+/*
+ * Client side of the curve25519-sha256@libssh.org key exchange.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include "buffer.h"
+#include "key.h"
+#include "cipher.h"
+#include "kex.h"
+#include "log.h"
+#include "packet.h"
+#include "ssh2.h"
+#include "dispatch.h"
+#include "compat.h"
+#include "err.h"
+
+static int input_kex_c25519_reply(int, u_int32_t, struct ssh *);
+
+int
+kexc25519_client(struct ssh *ssh)
+{
+	Kex *kex = ssh->kex;
+	int r;
+
+	kexc25519_keygen(kex->c25519_client_key, kex->c25519_client_pubkey);
+#ifdef DEBUG_KEXECDH
+	dump_digest("client private key:", kex->c25519_client_key,
+	    CURVE25519_SIZE);
+#endif
+	if ((r = sshpkt_start(ssh, SSH2_MSG_KEX_ECDH_INIT)) != 0 ||
+	    (r = sshpkt_put_string(ssh, kex->c25519_client_pubkey,
+	    CURVE25519_SIZE)) != 0 ||
+	    (r = sshpkt_send(ssh)) != 0)
+		return r;
+	debug("sending SSH2_MSG_KEX_ECDH_INIT");
+
+	debug("expecting SSH2_MSG_KEX_ECDH_REPLY");
+	ssh_dispatch_set(ssh, SSH2_MSG_KEX_ECDH_REPLY, &input_kex_c25519_reply);
+	return 0;
+}
+
+static int
+input_kex_c25519_reply(int type, u_int32_t seq, struct ssh *ssh)
+{
+	Kex *kex = ssh->kex;
+	BIGNUM *shared_secret = NULL;
+	struct sshkey *server_host_key = NULL;
+	u_char *server_host_key_blob = NULL, *signature = NULL;
+	u_char *server_pubkey = NULL, hash[EVP_MAX_MD_SIZE];
+	size_t slen, sbloblen, pklen, hashlen;
+	int verified, r;
+
+	if (kex->verify_host_key == NULL) {
+		r = SSH_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	/* hostkey */
+	if ((r = sshpkt_get_string(ssh, &server_host_key_blob,
+	    &sbloblen)) != 0 ||
+	    (r = sshkey_from_blob_shared(server_host_key_blob, sbloblen,
+	    &server_host_key)) != 0)
+		goto out;
+	if (server_host_key->type != kex->hostkey_type) {
+		r = SSH_ERR_KEY_TYPE_MISMATCH;
+		goto out;
+	}
+	verified = kex->verify_host_key(server_host_key, ssh);
+	if (verified != 0 && verified != SSH_ERR_KEX_PENDING) {
+		r = SSH_ERR_SIGNATURE_INVALID;
+		goto out;
+	}
+
+	/* Q_S, server public key */
+	/* signed H */
+	if ((r = sshpkt_get_string(ssh, &server_pubkey, &pklen)) != 0 ||
+	    (r = sshpkt_get_string(ssh, &signature, &slen)) != 0 ||
+	    (r = sshpkt_get_end(ssh)) != 0)
+		goto out;
+	if (pklen != CURVE25519_SIZE) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+
+#ifdef DEBUG_KEXECDH
+	dump_digest("server public key:", server_pubkey, CURVE25519_SIZE);
+#endif
+	if ((r = kexc25519_shared_key(kex->c25519_client_key, server_pubkey,
+	    &shared_secret)) != 0)
+		goto out;
+
+	/* calc and verify H */
+	if ((r = kex_c25519_hash(
+	    kex->evp_md,
+	    kex->client_version_string,
+	    kex->server_version_string,
+	    sshbuf_ptr(kex->my), sshbuf_len(kex->my),
+	    sshbuf_ptr(kex->peer), sshbuf_len(kex->peer),
+	    server_host_key_blob, sbloblen,
+	    kex->c25519_client_pubkey,
+	    server_pubkey,
+	    shared_secret,
+	    hash, &hashlen)) != 0)
+		goto out;
+
+	if ((r = sshkey_verify(server_host_key, signature, slen, hash,
+	    hashlen, ssh->compat)) != 0)
+		goto out;
+
+	/* save session id */
+	if (kex->session_id == NULL) {
+		kex->session_id_len = hashlen;
+		kex->session_id = malloc(kex->session_id_len);
+		if (kex->session_id == NULL) {
+			r = SSH_ERR_ALLOC_FAIL;
+			goto out;
+		}
+		memcpy(kex->session_id, hash, kex->session_id_len);
+	}
+
+	/* now, or once the application has verified the host key */
+	r = kex_client_finish(ssh, verified == SSH_ERR_KEX_PENDING,
+	    hash, hashlen, shared_secret);
+ out:
+	bzero(kex->c25519_client_key, sizeof(kex->c25519_client_key));
+	if (server_host_key_blob)
+		free(server_host_key_blob);
+	if (server_host_key)
+		sshkey_free(server_host_key);
+	if (server_pubkey)
+		free(server_pubkey);
+	if (shared_secret)
+		BN_clear_free(shared_secret);
+	if (signature)
+		free(signature);
+	return r;
+}
@@ -0,0 +1,132 @@
+/* $OpenBSD$ */
+/*
+ * Server side of the curve25519-sha256@libssh.org key exchange.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <string.h>
+#include <signal.h>
+
+#include "buffer.h"
+#include "key.h"
+#include "cipher.h"
+#include "kex.h"
+#include "log.h"
+#include "packet.h"
+#include "ssh2.h"
+#include "dispatch.h"
+#include "compat.h"
+#include "err.h"
+
+static int input_kex_c25519_init(int, u_int32_t, struct ssh *);
+
+int
+kexc25519_server(struct ssh *ssh)
+{
+	debug("expecting SSH2_MSG_KEX_ECDH_INIT");
+	ssh_dispatch_set(ssh, SSH2_MSG_KEX_ECDH_INIT, &input_kex_c25519_init);
+	return 0;
+}
+
+static int
+input_kex_c25519_init(int type, u_int32_t seq, struct ssh *ssh)
+{
+	Kex *kex = ssh->kex;
+	BIGNUM *shared_secret = NULL;
+	struct sshkey *server_host_private, *server_host_public;
+	u_char *server_host_key_blob = NULL, *client_pubkey = NULL;
+	u_char server_key[CURVE25519_SIZE];
+	u_char server_pubkey[CURVE25519_SIZE];
+	u_char hash[EVP_MAX_MD_SIZE];
+	struct sshbuf *reply = NULL;
+	u_int sbloblen;
+	size_t pklen, hashlen;
+	int r;
+
+	kexc25519_keygen(server_key, server_pubkey);
+#ifdef DEBUG_KEXECDH
+	dump_digest("server private key:", server_key, sizeof(server_key));
+#endif
+
+	if (kex->load_host_public_key == NULL ||
+	    kex->load_host_private_key == NULL) {
+		r = SSH_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+	if ((server_host_public = kex->load_host_public_key(kex->hostkey_type,
+	    ssh)) == NULL ||
+	    (server_host_private = kex->load_host_private_key(kex->hostkey_type,
+	    ssh)) == NULL) {
+		r = SSH_ERR_NO_HOSTKEY_LOADED;
+		goto out;
+	}
+
+	if ((r = sshpkt_get_string(ssh, &client_pubkey, &pklen)) != 0 ||
+	    (r = sshpkt_get_end(ssh)) != 0)
+		goto out;
+	if (pklen != CURVE25519_SIZE) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+#ifdef DEBUG_KEXECDH
+	dump_digest("client public key:", client_pubkey, CURVE25519_SIZE);
+#endif
+
+	/* Calculate shared_secret */
+	if ((r = kexc25519_shared_key(server_key, client_pubkey,
+	    &shared_secret)) != 0)
+		goto out;
+
+	/* calc H */
+	if ((r = kex_host_key_blob(ssh, server_host_public,
+	    &server_host_key_blob, &sbloblen)) != 0)
+		goto out;
+	if ((r = kex_c25519_hash(
+	    kex->evp_md,
+	    kex->client_version_string,
+	    kex->server_version_string,
+	    sshbuf_ptr(kex->peer), sshbuf_len(kex->peer),
+	    sshbuf_ptr(kex->my), sshbuf_len(kex->my),
+	    server_host_key_blob, sbloblen,
+	    client_pubkey,
+	    server_pubkey,
+	    shared_secret,
+	    hash, &hashlen)) != 0)
+		goto out;
+
+	/* save session id := H */
+	if (kex->session_id == NULL) {
+		kex->session_id_len = hashlen;
+		kex->session_id = malloc(kex->session_id_len);
+		if (kex->session_id == NULL) {
+			r = SSH_ERR_ALLOC_FAIL;
+			goto out;
+		}
+		memcpy(kex->session_id, hash, kex->session_id_len);
+	}
+
+	/* sign H, send server hostkey, public key 'Q_S' and signed H */
+	if ((reply = sshbuf_new()) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+	if ((r = sshbuf_put_string(reply, server_pubkey,
+	    sizeof(server_pubkey))) != 0)
+		goto out;
+	r = kex_server_finish(ssh, SSH2_MSG_KEX_ECDH_REPLY, server_host_private,
+	    server_host_key_blob, sbloblen, reply, hash, hashlen,
+	    shared_secret);
+ out:
+	bzero(server_key, sizeof(server_key));
+	if (server_host_key_blob)
+		free(server_host_key_blob);
+	if (client_pubkey)
+		free(client_pubkey);
+	if (shared_secret)
+		BN_clear_free(shared_secret);
+	if (reply)
+		sshbuf_free(reply);
+	return r;
+}
@@ -65,6 +65,7 @@ int
 kex_ecdh_hash(
     const EVP_MD *evp_md,
     const EC_GROUP *ec_group,
+    BN_CTX *bn_ctx,
     char *client_version_string,
     char *server_version_string,
     char *ckexinit, size_t ckexinitlen,
@@ -73,11 +74,10 @@ kex_ecdh_hash(
     const EC_POINT *client_dh_pub,
     const EC_POINT *server_dh_pub,
     const BIGNUM *shared_secret,
-    u_char **hash, size_t *hashlen)
+    u_char *hash, size_t *hashlen)
 {
 	struct sshbuf *b;
 	EVP_MD_CTX md;
-	static u_char digest[EVP_MAX_MD_SIZE];
 	int r;
 
 	if ((b = sshbuf_new()) == NULL)
@@ -92,8 +92,8 @@ kex_ecdh_hash(
 	    (r = sshbuf_put_u8(b, SSH2_MSG_KEXINIT)) != 0 ||
 	    (r = sshbuf_put(b, skexinit, skexinitlen)) != 0 ||
 	    (r = sshbuf_put_string(b, serverhostkeyblob, sbloblen)) != 0 ||
-	    (r = sshbuf_put_ec(b, client_dh_pub, ec_group)) != 0 ||
-	    (r = sshbuf_put_ec(b, server_dh_pub, ec_group)) != 0 ||
+	    (r = sshbuf_put_ec_ctx(b, client_dh_pub, ec_group, bn_ctx)) != 0 ||
+	    (r = sshbuf_put_ec_ctx(b, server_dh_pub, ec_group, bn_ctx)) != 0 ||
 	    (r = sshbuf_put_bignum2(b, shared_secret)) != 0) {
 		sshbuf_free(b);
 		return r;
@@ -103,15 +103,14 @@ kex_ecdh_hash(
 #endif
 	if (EVP_DigestInit(&md, evp_md) != 1 ||
 	    EVP_DigestUpdate(&md, sshbuf_ptr(b), sshbuf_len(b)) != 1 ||
-	    EVP_DigestFinal(&md, digest, NULL) != 1) {
+	    EVP_DigestFinal(&md, hash, NULL) != 1) {
 		sshbuf_free(b);
 		return SSH_ERR_LIBCRYPTO_ERROR;
 	}
 	sshbuf_free(b);
 #ifdef DEBUG_KEX
-	dump_digest("hash", digest, EVP_MD_size(evp_md));
+	dump_digest("hash", hash, EVP_MD_size(evp_md));
 #endif
-	*hash = digest;
 	*hashlen = EVP_MD_size(evp_md);
 	return 0;
 }
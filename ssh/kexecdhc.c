@@ -103,10 +103,10 @@ input_kex_ecdh_reply(int type, u_int32_t seq, struct ssh *ssh)
 	BIGNUM *shared_secret = NULL;
 	struct sshkey *server_host_key = NULL;
 	u_char *server_host_key_blob = NULL, *signature = NULL;
-	u_char *kbuf = NULL, *hash;
+	u_char *kbuf = NULL, hash[EVP_MAX_MD_SIZE];
 	size_t slen, sbloblen;
 	size_t klen = 0, hashlen;
-	int r;
+	int verified, r;
 
 	if (kex->verify_host_key == NULL) {
 		r = SSH_ERR_INVALID_ARGUMENT;
@@ -118,14 +118,15 @@ input_kex_ecdh_reply(int type, u_int32_t seq, struct ssh *ssh)
 	/* hostkey */
 	if ((r = sshpkt_get_string(ssh, &server_host_key_blob,
 	    &sbloblen)) != 0 ||
-	    (r = sshkey_from_blob(server_host_key_blob, sbloblen,
+	    (r = sshkey_from_blob_shared(server_host_key_blob, sbloblen,
 	    &server_host_key)) != 0)
 		goto out;
 	if (server_host_key->type != kex->hostkey_type) {
 		r = SSH_ERR_KEY_TYPE_MISMATCH;
 		goto out;
 	}
-	if (kex->verify_host_key(server_host_key, ssh) == -1) {
+	verified = kex->verify_host_key(server_host_key, ssh);
+	if (verified != 0 && verified != SSH_ERR_KEX_PENDING) {
 		r = SSH_ERR_SIGNATURE_INVALID;
 		goto out;
 	}
@@ -171,6 +172,7 @@ input_kex_ecdh_reply(int type, u_int32_t seq, struct ssh *ssh)
 	if ((r = kex_ecdh_hash(
 	    kex->evp_md,
 	    group,
+	    ssh_packet_bn_ctx(ssh),
 	    kex->client_version_string,
 	    kex->server_version_string,
 	    sshbuf_ptr(kex->my), sshbuf_len(kex->my),
@@ -179,7 +181,7 @@ input_kex_ecdh_reply(int type, u_int32_t seq, struct ssh *ssh)
 	    EC_KEY_get0_public_key(client_key),
 	    server_public,
 	    shared_secret,
-	    &hash, &hashlen)) != 0)
+	    hash, &hashlen)) != 0)
 		goto out;
 
 	if ((r = sshkey_verify(server_host_key, signature, slen, hash,
@@ -197,8 +199,9 @@ input_kex_ecdh_reply(int type, u_int32_t seq, struct ssh *ssh)
 		memcpy(kex->session_id, hash, kex->session_id_len);
 	}
 
-	if ((r = kex_derive_keys(ssh, hash, hashlen, shared_secret)) == 0)
-		r = kex_send_newkeys(ssh);
+	/* now, or once the application has verified the host key */
+	r = kex_client_finish(ssh, verified == SSH_ERR_KEX_PENDING,
+	    hash, hashlen, shared_secret);
  out:
 	if (kex->ec_client_key) {
 		EC_KEY_free(kex->ec_client_key);
@@ -34,6 +34,7 @@
 #include "key.h"
 #include "cipher.h"
 #include "kex.h"
+#include "kexpool.h"
 #include "log.h"
 #include "packet.h"
 #include "dh.h"
@@ -66,9 +67,10 @@ input_kex_ecdh_init(int type, u_int32_t seq, struct ssh *ssh)
 	const EC_POINT *public_key;
 	BIGNUM *shared_secret = NULL;
 	struct sshkey *server_host_private, *server_host_public;
-	u_char *server_host_key_blob = NULL, *signature = NULL;
-	u_char *kbuf = NULL, *hash;
-	u_int slen, sbloblen;
+	u_char *server_host_key_blob = NULL;
+	u_char *kbuf = NULL, hash[EVP_MAX_MD_SIZE];
+	struct sshbuf *reply = NULL;
+	u_int sbloblen;
 	size_t klen = 0, hashlen;
 	int curve_nid, r;
 
@@ -76,14 +78,8 @@ input_kex_ecdh_init(int type, u_int32_t seq, struct ssh *ssh)
 		r = SSH_ERR_INVALID_ARGUMENT;
 		goto out;
 	}
-	if ((server_key = EC_KEY_new_by_curve_name(curve_nid)) == NULL) {
-		r = SSH_ERR_ALLOC_FAIL;
-		goto out;
-	}
-	if (EC_KEY_generate_key(server_key) != 1) {
-		r = SSH_ERR_LIBCRYPTO_ERROR;
+	if ((r = kex_keypool_ec_key(ssh, curve_nid, &server_key)) != 0)
 		goto out;
-	}
 	group = EC_KEY_get0_group(server_key);
 
 #ifdef DEBUG_KEXECDH
@@ -139,12 +135,13 @@ input_kex_ecdh_init(int type, u_int32_t seq, struct ssh *ssh)
 	dump_digest("shared secret", kbuf, klen);
 #endif
 	/* calc H */
-	if ((r = sshkey_to_blob(server_host_public, &server_host_key_blob,
-	    &sbloblen)) != 0)
+	if ((r = kex_host_key_blob(ssh, server_host_public,
+	    &server_host_key_blob, &sbloblen)) != 0)
 		goto out;
 	if ((r = kex_ecdh_hash(
 	    kex->evp_md,
 	    group,
+	    ssh_packet_bn_ctx(ssh),
 	    kex->client_version_string,
 	    kex->server_version_string,
 	    sshbuf_ptr(kex->peer), sshbuf_len(kex->peer),
@@ -153,7 +150,7 @@ input_kex_ecdh_init(int type, u_int32_t seq, struct ssh *ssh)
 	    client_public,
 	    EC_KEY_get0_public_key(server_key),
 	    shared_secret,
-	    &hash, &hashlen)) != 0)
+	    hash, &hashlen)) != 0)
 		goto out;
 
 	/* save session id := H */
@@ -167,24 +164,18 @@ input_kex_ecdh_init(int type, u_int32_t seq, struct ssh *ssh)
 		memcpy(kex->session_id, hash, kex->session_id_len);
 	}
 
-	/* sign H */
-	if ((r = PRIVSEP(sshkey_sign(server_host_private, &signature, &slen,
-	    hash, hashlen, ssh->compat))) < 0)
-		goto out;
-
-	/* destroy_sensitive_data(); */
-
+	/* sign H, send server hostkey, ECDH pubkey 'Q_S' and signed H */
 	public_key = EC_KEY_get0_public_key(server_key);
-	/* send server hostkey, ECDH pubkey 'Q_S' and signed H */
-	if ((r = sshpkt_start(ssh, SSH2_MSG_KEX_ECDH_REPLY)) != 0 ||
-	    (r = sshpkt_put_string(ssh, server_host_key_blob, sbloblen)) != 0 ||
-	    (r = sshpkt_put_ec(ssh, public_key, group)) != 0 ||
-	    (r = sshpkt_put_string(ssh, signature, slen)) != 0 ||
-	    (r = sshpkt_send(ssh)) != 0)
+	if ((reply = sshbuf_new()) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
 		goto out;
-
-	if ((r = kex_derive_keys(ssh, hash, hashlen, shared_secret)) == 0)
-		r = kex_send_newkeys(ssh);
+	}
+	if ((r = sshbuf_put_ec_ctx(reply, public_key, group,
+	    ssh_packet_bn_ctx(ssh))) != 0)
+		goto out;
+	r = kex_server_finish(ssh, SSH2_MSG_KEX_ECDH_REPLY, server_host_private,
+	    server_host_key_blob, sbloblen, reply, hash, hashlen,
+	    shared_secret);
  out:
 	if (kex->ec_client_key) {
 		EC_KEY_free(kex->ec_client_key);
@@ -200,7 +191,7 @@ input_kex_ecdh_init(int type, u_int32_t seq, struct ssh *ssh)
 	}
 	if (shared_secret)
 		BN_clear_free(shared_secret);
-	if (signature)
-		free(signature);
+	if (reply)
+		sshbuf_free(reply);
 	return r;
 }
@@ -48,10 +48,9 @@ kexgex_hash(
     BIGNUM *client_dh_pub,
     BIGNUM *server_dh_pub,
     BIGNUM *shared_secret,
-    u_char **hash, size_t *hashlen)
+    u_char *hash, size_t *hashlen)
 {
 	struct sshbuf *b;
-	static u_char digest[EVP_MAX_MD_SIZE];
 	EVP_MD_CTX md;
 	int r;
 
@@ -83,15 +82,14 @@ kexgex_hash(
 #endif
 	if (EVP_DigestInit(&md, evp_md) != 1 ||
 	    EVP_DigestUpdate(&md, sshbuf_ptr(b), sshbuf_len(b)) != 1 ||
-	    EVP_DigestFinal(&md, digest, NULL) != 1) {
+	    EVP_DigestFinal(&md, hash, NULL) != 1) {
 		sshbuf_free(b);
 		return SSH_ERR_LIBCRYPTO_ERROR;
 	}
 	sshbuf_free(b);
-	*hash = digest;
 	*hashlen = EVP_MD_size(evp_md);
 #ifdef DEBUG_KEXDH
-	dump_digest("hash", digest, *hashlen);
+	dump_digest("hash", hash, *hashlen);
 #endif
 	return 0;
 }
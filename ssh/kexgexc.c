@@ -146,9 +146,10 @@ input_kex_dh_gex_reply(int type, u_int32_t seq, struct ssh *ssh)
 	Kex *kex = ssh->kex;
 	BIGNUM *dh_server_pub = NULL, *shared_secret = NULL;
 	struct sshkey *server_host_key;
-	u_char *kbuf = NULL, *hash, *signature = NULL, *server_host_key_blob = NULL;
+	u_char *kbuf = NULL, *signature = NULL, *server_host_key_blob = NULL;
+	u_char hash[EVP_MAX_MD_SIZE];
 	size_t klen = 0, slen, sbloblen, hashlen;
-	int kout, r;
+	int kout, verified, r;
 
 	debug("got SSH2_MSG_KEX_DH_GEX_REPLY");
 	if (kex->verify_host_key == NULL) {
@@ -158,14 +159,15 @@ input_kex_dh_gex_reply(int type, u_int32_t seq, struct ssh *ssh)
 	/* key, cert */
 	if ((r = sshpkt_get_string(ssh, &server_host_key_blob,
 	    &sbloblen)) != 0 ||
-	    (r = sshkey_from_blob(server_host_key_blob, sbloblen,
+	    (r = sshkey_from_blob_shared(server_host_key_blob, sbloblen,
 	    &server_host_key)) != 0)
 		goto out;
 	if (server_host_key->type != kex->hostkey_type) {
 		r = SSH_ERR_KEY_TYPE_MISMATCH;
 		goto out;
 	}
-	if (kex->verify_host_key(server_host_key, ssh) == -1) {
+	verified = kex->verify_host_key(server_host_key, ssh);
+	if (verified != 0 && verified != SSH_ERR_KEX_PENDING) {
 		r = SSH_ERR_SIGNATURE_INVALID;
 		goto out;
 	}
@@ -221,7 +223,7 @@ input_kex_dh_gex_reply(int type, u_int32_t seq, struct ssh *ssh)
 	    kex->dh->pub_key,
 	    dh_server_pub,
 	    shared_secret,
-	    &hash, &hashlen)) != 0)
+	    hash, &hashlen)) != 0)
 		goto out;
 
 	if ((r = sshkey_verify(server_host_key, signature, slen, hash,
@@ -239,8 +241,9 @@ input_kex_dh_gex_reply(int type, u_int32_t seq, struct ssh *ssh)
 		memcpy(kex->session_id, hash, kex->session_id_len);
 	}
 
-	if ((r = kex_derive_keys(ssh, hash, hashlen, shared_secret)) == 0)
-		r = kex_send_newkeys(ssh);
+	/* now, or once the application has verified the host key */
+	r = kex_client_finish(ssh, verified == SSH_ERR_KEX_PENDING,
+	    hash, hashlen, shared_secret);
  out:
 	DH_free(kex->dh);
 	kex->dh = NULL;
@@ -140,9 +140,10 @@ input_kex_dh_gex_init(int type, u_int32_t seq, struct ssh *ssh)
 	Kex *kex = ssh->kex;
 	BIGNUM *shared_secret = NULL, *dh_client_pub = NULL;
 	struct sshkey *server_host_public, *server_host_private;
-	u_char *kbuf = NULL, *signature = NULL, *server_host_key_blob = NULL;
-	u_char *hash;
-	u_int sbloblen, slen;
+	u_char *kbuf = NULL, *server_host_key_blob = NULL;
+	u_char hash[EVP_MAX_MD_SIZE];
+	struct sshbuf *reply = NULL;
+	u_int sbloblen;
 	size_t klen = 0, hashlen;
 	int kout, r;
 
@@ -201,8 +202,8 @@ input_kex_dh_gex_init(int type, u_int32_t seq, struct ssh *ssh)
 #ifdef DEBUG_KEXDH
 	dump_digest("shared secret", kbuf, kout);
 #endif
-	if ((r = sshkey_to_blob(server_host_public, &server_host_key_blob,
-	    &sbloblen)) != 0)
+	if ((r = kex_host_key_blob(ssh, server_host_public,
+	    &server_host_key_blob, &sbloblen)) != 0)
 		goto out;
 	/* calc H */
 	if ((r = kexgex_hash(
@@ -217,7 +218,7 @@ input_kex_dh_gex_init(int type, u_int32_t seq, struct ssh *ssh)
 	    dh_client_pub,
 	    kex->dh->pub_key,
 	    shared_secret,
-	    &hash, &hashlen)) != 0)
+	    hash, &hashlen)) != 0)
 		goto out;
 
 	/* save session id := H */
@@ -231,23 +232,16 @@ input_kex_dh_gex_init(int type, u_int32_t seq, struct ssh *ssh)
 		memcpy(kex->session_id, hash, kex->session_id_len);
 	}
 
-	/* sign H */
-	if ((r = PRIVSEP(sshkey_sign(server_host_private, &signature, &slen,
-	    hash, hashlen, ssh->compat))) < 0)
+	/* sign H, send server hostkey, DH pubkey 'f' and signed H */
+	if ((reply = sshbuf_new()) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
 		goto out;
-
-	/* destroy_sensitive_data(); */
-
-	/* send server hostkey, DH pubkey 'f' and singed H */
-	if ((r = sshpkt_start(ssh, SSH2_MSG_KEX_DH_GEX_REPLY)) != 0 ||
-	    (r = sshpkt_put_string(ssh, server_host_key_blob, sbloblen)) != 0 ||
-	    (r = sshpkt_put_bignum2(ssh, kex->dh->pub_key)) != 0 ||     /* f */
-	    (r = sshpkt_put_string(ssh, signature, slen)) != 0 ||
-	    (r = sshpkt_send(ssh)) != 0)
+	}
+	if ((r = sshbuf_put_bignum2(reply, kex->dh->pub_key)) != 0)	/* f */
 		goto out;
-
-	if ((r = kex_derive_keys(ssh, hash, hashlen, shared_secret)) == 0)
-		r = kex_send_newkeys(ssh);
+	r = kex_server_finish(ssh, SSH2_MSG_KEX_DH_GEX_REPLY,
+	    server_host_private, server_host_key_blob, sbloblen, reply,
+	    hash, hashlen, shared_secret);
  out:
 	DH_free(kex->dh);
 	kex->dh = NULL;
@@ -261,7 +255,7 @@ input_kex_dh_gex_init(int type, u_int32_t seq, struct ssh *ssh)
 		BN_clear_free(shared_secret);
 	if (server_host_key_blob)
 		free(server_host_key_blob);
-	if (signature)
-		free(signature);
+	if (reply)
+		sshbuf_free(reply);
 	return r;
 }
@@ -0,0 +1,516 @@
+/* $OpenBSD$ */
+/*
+ * Pool of precomputed ephemeral ECDH and DH keys for the server side
+ * of the key exchange.
+ *
+ * Generating the server's ephemeral key sits between the client's
+ * KEXDH_INIT/KEX_ECDH_INIT and our reply, so under load it adds directly
+ * to the handshake latency.  A pool lets an idle server generate these
+ * keys ahead of time.  Every key is handed out exactly once; the kex
+ * code frees it with the rest of its state, which clears the private
+ * part, and keys still in the pool are cleared when it is freed.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/dh.h>
+#include <openssl/ec.h>
+#include <openssl/objects.h>
+
+#include "buffer.h"
+#include "key.h"
+#include "cipher.h"
+#include "kex.h"
+#include "kexpool.h"
+#include "dh.h"
+#include "packet.h"
+#include "log.h"
+#include "err.h"
+
+#define KEYPOOL_DH_NEED		512	/* bits, capped by the group size */
+
+static const struct {
+	const char *name;
+	int type;
+	int nid;
+} keypool_methods[] = {
+	{ KEX_DH1,			KEX_DH_GRP1_SHA1,	-1 },
+	{ KEX_DH14,			KEX_DH_GRP14_SHA1,	-1 },
+	{ "ecdh-sha2-nistp256",		KEX_ECDH_SHA2,	NID_X9_62_prime256v1 },
+	{ "ecdh-sha2-nistp384",		KEX_ECDH_SHA2,	NID_secp384r1 },
+	{ "ecdh-sha2-nistp521",		KEX_ECDH_SHA2,	NID_secp521r1 },
+};
+#define KEYPOOL_NSLOTS	(sizeof(keypool_methods) / sizeof(keypool_methods[0]))
+
+struct keypool_slot {
+	int	wanted;
+	int	need;		/* DH: bits of key material covered */
+	u_int	nkeys;
+	EC_KEY	**ec;
+	DH	**dh;
+};
+
+struct kex_keypool {
+	u_int	size;
+	struct keypool_slot slots[KEYPOOL_NSLOTS];
+	u_int64_t hits, misses, generated;
+};
+
+static DH *
+keypool_dh_group(int type)
+{
+	switch (type) {
+	case KEX_DH_GRP1_SHA1:
+		return dh_new_group1();
+	case KEX_DH_GRP14_SHA1:
+		return dh_new_group14();
+	}
+	return NULL;
+}
+
+static int
+keypool_slot_by_type(int type, int nid)
+{
+	u_int i;
+
+	for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+		if (keypool_methods[i].type == type &&
+		    (type != KEX_ECDH_SHA2 || keypool_methods[i].nid == nid))
+			return i;
+	}
+	return -1;
+}
+
+static int
+keypool_slot_by_name(const char *name)
+{
+	u_int i;
+
+	for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+		if (strcmp(keypool_methods[i].name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static int
+keypool_slot_init(struct kex_keypool *p, u_int i)
+{
+	struct keypool_slot *s = &p->slots[i];
+	DH *dh;
+
+	if (s->wanted)
+		return 0;
+	if (keypool_methods[i].type == KEX_ECDH_SHA2) {
+		if ((s->ec = calloc(p->size, sizeof(*s->ec))) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+	} else {
+		if ((dh = keypool_dh_group(keypool_methods[i].type)) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		s->need = MIN(KEYPOOL_DH_NEED, BN_num_bits(dh->p) / 2 - 1);
+		DH_free(dh);
+		if ((s->dh = calloc(p->size, sizeof(*s->dh))) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+	}
+	s->wanted = 1;
+	return 0;
+}
+
+/* generate one key for slot i */
+static int
+keypool_gen(struct kex_keypool *p, u_int i)
+{
+	struct keypool_slot *s = &p->slots[i];
+	EC_KEY *ec;
+	DH *dh;
+	int r;
+
+	if (keypool_methods[i].type == KEX_ECDH_SHA2) {
+		if ((ec = EC_KEY_new_by_curve_name(
+		    keypool_methods[i].nid)) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		if (EC_KEY_generate_key(ec) != 1) {
+			EC_KEY_free(ec);
+			return SSH_ERR_LIBCRYPTO_ERROR;
+		}
+		s->ec[s->nkeys++] = ec;
+	} else {
+		if ((dh = keypool_dh_group(keypool_methods[i].type)) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		if ((r = dh_gen_key(dh, s->need)) != 0) {
+			DH_free(dh);
+			return r;
+		}
+		s->dh[s->nkeys++] = dh;
+	}
+	p->generated++;
+	return 0;
+}
+
+u_int
+kex_keypool_missing(struct kex_keypool *p)
+{
+	u_int i, n = 0;
+
+	for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+		if (p->slots[i].wanted)
+			n += p->size - p->slots[i].nkeys;
+	}
+	return n;
+}
+
+int
+kex_keypool_new(struct kex_keypool **pp, u_int size)
+{
+	struct kex_keypool *p;
+
+	*pp = NULL;
+	if (size == 0 || size > 1024 * 1024)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	p->size = size;
+	*pp = p;
+	return 0;
+}
+
+void
+kex_keypool_free(struct kex_keypool *p)
+{
+	struct keypool_slot *s;
+	u_int i, j;
+
+	if (p == NULL)
+		return;
+	for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+		s = &p->slots[i];
+		for (j = 0; j < s->nkeys; j++) {
+			if (s->ec != NULL)
+				EC_KEY_free(s->ec[j]);
+			if (s->dh != NULL)
+				DH_free(s->dh[j]);
+		}
+		free(s->ec);
+		free(s->dh);
+	}
+	bzero(p, sizeof(*p));
+	free(p);
+}
+
+int
+kex_keypool_want(struct kex_keypool *p, const char *kexalgs)
+{
+	char *s, *cp, *name;
+	int i, r = 0;
+
+	if ((s = cp = strdup(kexalgs)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	while ((name = strsep(&cp, ",")) != NULL) {
+		if ((i = keypool_slot_by_name(name)) == -1)
+			continue;
+		if ((r = keypool_slot_init(p, i)) != 0)
+			break;
+	}
+	free(s);
+	return r;
+}
+
+int
+kex_keypool_fill(struct kex_keypool *p, u_int max)
+{
+	struct keypool_slot *s;
+	u_int i, n;
+	int best, r;
+
+	for (n = 0; n < max; n++) {
+		/* keep the slots level: fill the emptiest one first */
+		best = -1;
+		for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+			s = &p->slots[i];
+			if (!s->wanted || s->nkeys >= p->size)
+				continue;
+			if (best == -1 || s->nkeys < p->slots[best].nkeys)
+				best = i;
+		}
+		if (best == -1)
+			break;
+		if ((r = keypool_gen(p, best)) != 0)
+			return r;
+	}
+	return kex_keypool_missing(p);
+}
+
+int
+kex_keypool_split(struct kex_keypool *p, u_int n, struct kex_keypool **cp)
+{
+	struct kex_keypool *c;
+	struct keypool_slot *s, *cs;
+	u_int i;
+	int r;
+
+	*cp = NULL;
+	if ((r = kex_keypool_new(&c, MAX(n, 1))) != 0)
+		return r;
+	for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+		s = &p->slots[i];
+		if (!s->wanted)
+			continue;
+		if ((r = keypool_slot_init(c, i)) != 0) {
+			kex_keypool_free(c);
+			return r;
+		}
+		cs = &c->slots[i];
+		while (cs->nkeys < n && s->nkeys > 0) {
+			s->nkeys--;
+			if (s->ec != NULL) {
+				cs->ec[cs->nkeys++] = s->ec[s->nkeys];
+				s->ec[s->nkeys] = NULL;
+			} else {
+				cs->dh[cs->nkeys++] = s->dh[s->nkeys];
+				s->dh[s->nkeys] = NULL;
+			}
+		}
+	}
+	*cp = c;
+	return 0;
+}
+
+/*
+ * blob format:
+ *	u32	number of keys
+ *	for each key:
+ *		cstring	kex method
+ *		bignum2	private key
+ *		bignum2	public key	(DH only, EC public keys are derived)
+ */
+int
+kex_keypool_to_blob(struct kex_keypool *p, struct sshbuf *b)
+{
+	struct keypool_slot *s;
+	u_int i, n = 0;
+	int r;
+
+	for (i = 0; i < KEYPOOL_NSLOTS; i++)
+		n += p->slots[i].nkeys;
+	if ((r = sshbuf_put_u32(b, n)) != 0)
+		return r;
+	for (i = 0; i < KEYPOOL_NSLOTS; i++) {
+		s = &p->slots[i];
+		for (; s->nkeys > 0; s->nkeys--) {
+			if ((r = sshbuf_put_cstring(b,
+			    keypool_methods[i].name)) != 0)
+				return r;
+			if (s->ec != NULL) {
+				if ((r = sshbuf_put_bignum2(b,
+				    EC_KEY_get0_private_key(
+				    s->ec[s->nkeys - 1]))) != 0)
+					return r;
+				EC_KEY_free(s->ec[s->nkeys - 1]);
+				s->ec[s->nkeys - 1] = NULL;
+			} else {
+				if ((r = sshbuf_put_bignum2(b,
+				    s->dh[s->nkeys - 1]->priv_key)) != 0 ||
+				    (r = sshbuf_put_bignum2(b,
+				    s->dh[s->nkeys - 1]->pub_key)) != 0)
+					return r;
+				DH_free(s->dh[s->nkeys - 1]);
+				s->dh[s->nkeys - 1] = NULL;
+			}
+		}
+	}
+	return 0;
+}
+
+static int
+keypool_ec_from_blob(struct sshbuf *b, int nid, EC_KEY **ecp)
+{
+	EC_KEY *ec = NULL;
+	EC_POINT *pub = NULL;
+	BIGNUM *priv = NULL;
+	int r;
+
+	*ecp = NULL;
+	if ((ec = EC_KEY_new_by_curve_name(nid)) == NULL ||
+	    (priv = BN_new()) == NULL ||
+	    (pub = EC_POINT_new(EC_KEY_get0_group(ec))) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+	if ((r = sshbuf_get_bignum2(b, priv)) != 0)
+		goto out;
+	if (EC_POINT_mul(EC_KEY_get0_group(ec), pub, priv,
+	    NULL, NULL, NULL) != 1 ||
+	    EC_KEY_set_private_key(ec, priv) != 1 ||
+	    EC_KEY_set_public_key(ec, pub) != 1) {
+		r = SSH_ERR_LIBCRYPTO_ERROR;
+		goto out;
+	}
+	*ecp = ec;
+	ec = NULL;
+	r = 0;
+ out:
+	if (ec != NULL)
+		EC_KEY_free(ec);
+	if (pub != NULL)
+		EC_POINT_free(pub);
+	if (priv != NULL)
+		BN_clear_free(priv);
+	return r;
+}
+
+static int
+keypool_dh_from_blob(struct sshbuf *b, int type, DH **dhp)
+{
+	DH *dh;
+	int r;
+
+	*dhp = NULL;
+	if ((dh = keypool_dh_group(type)) == NULL ||
+	    (dh->priv_key = BN_new()) == NULL ||
+	    (dh->pub_key = BN_new()) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+	if ((r = sshbuf_get_bignum2(b, dh->priv_key)) != 0 ||
+	    (r = sshbuf_get_bignum2(b, dh->pub_key)) != 0)
+		goto out;
+	if (!dh_pub_is_valid(dh, dh->pub_key)) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	*dhp = dh;
+	dh = NULL;
+	r = 0;
+ out:
+	if (dh != NULL)
+		DH_free(dh);
+	return r;
+}
+
+int
+kex_keypool_from_blob(struct sshbuf *b, struct kex_keypool **pp)
+{
+	struct kex_keypool *p = NULL;
+	struct keypool_slot *s;
+	char *name = NULL;
+	u_int32_t n, i;
+	int slot, r;
+
+	*pp = NULL;
+	if ((r = sshbuf_get_u32(b, &n)) != 0)
+		return r;
+	if (n == 0)
+		return 0;
+	if ((r = kex_keypool_new(&p, n)) != 0)
+		return r;
+	for (i = 0; i < n; i++) {
+		if ((r = sshbuf_get_cstring(b, &name, NULL)) != 0)
+			goto out;
+		if ((slot = keypool_slot_by_name(name)) == -1) {
+			r = SSH_ERR_INVALID_FORMAT;
+			goto out;
+		}
+		free(name);
+		name = NULL;
+		if ((r = keypool_slot_init(p, slot)) != 0)
+			goto out;
+		s = &p->slots[slot];
+		if (keypool_methods[slot].type == KEX_ECDH_SHA2)
+			r = keypool_ec_from_blob(b, keypool_methods[slot].nid,
+			    &s->ec[s->nkeys]);
+		else
+			r = keypool_dh_from_blob(b, keypool_methods[slot].type,
+			    &s->dh[s->nkeys]);
+		if (r != 0)
+			goto out;
+		s->nkeys++;
+	}
+	*pp = p;
+	p = NULL;
+	r = 0;
+ out:
+	free(name);
+	kex_keypool_free(p);
+	return r;
+}
+
+void
+kex_keypool_get_stats(struct kex_keypool *p, struct kex_keypool_stats *st)
+{
+	u_int i;
+
+	bzero(st, sizeof(*st));
+	st->hits = p->hits;
+	st->misses = p->misses;
+	st->generated = p->generated;
+	for (i = 0; i < KEYPOOL_NSLOTS; i++)
+		st->available += p->slots[i].nkeys;
+	st->missing = kex_keypool_missing(p);
+}
+
+int
+kex_keypool_ec_key(struct ssh *ssh, int nid, EC_KEY **ecp)
+{
+	struct kex_keypool *p = ssh->kex->keypool;
+	struct keypool_slot *s;
+	EC_KEY *ec;
+	int i;
+
+	*ecp = NULL;
+	if (p != NULL && (i = keypool_slot_by_type(KEX_ECDH_SHA2, nid)) != -1 &&
+	    (s = &p->slots[i])->nkeys > 0) {
+		*ecp = s->ec[--s->nkeys];
+		s->ec[s->nkeys] = NULL;
+		p->hits++;
+		return 0;
+	}
+	if (p != NULL)
+		p->misses++;
+	if ((ec = EC_KEY_new_by_curve_name(nid)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if (EC_KEY_generate_key(ec) != 1) {
+		EC_KEY_free(ec);
+		return SSH_ERR_LIBCRYPTO_ERROR;
+	}
+	*ecp = ec;
+	return 0;
+}
+
+int
+kex_keypool_dh_key(struct ssh *ssh, DH **dhp)
+{
+	Kex *kex = ssh->kex;
+	struct kex_keypool *p = kex->keypool;
+	struct keypool_slot *s;
+	DH *dh;
+	int i, r;
+
+	*dhp = NULL;
+	if ((i = keypool_slot_by_type(kex->kex_type, -1)) == -1)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if (p != NULL && (s = &p->slots[i])->nkeys > 0 &&
+	    (u_int)s->need >= kex->we_need * 8) {
+		*dhp = s->dh[--s->nkeys];
+		s->dh[s->nkeys] = NULL;
+		p->hits++;
+		return 0;
+	}
+	if (p != NULL)
+		p->misses++;
+	if ((dh = keypool_dh_group(kex->kex_type)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = dh_gen_key(dh, kex->we_need * 8)) != 0) {
+		DH_free(dh);
+		return r;
+	}
+	*dhp = dh;
+	return 0;
+}
@@ -0,0 +1,81 @@
+/* $OpenBSD$ */
+/*
+ * Pool of precomputed ephemeral ECDH and DH keys for the server side
+ * of the key exchange.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef KEXPOOL_H
+#define KEXPOOL_H
+
+#include <sys/types.h>
+
+#include <openssl/dh.h>
+#include <openssl/ec.h>
+
+struct ssh;
+struct sshbuf;
+struct kex_keypool;
+
+struct kex_keypool_stats {
+	u_int64_t	hits;		/* keys handed out by the pool */
+	u_int64_t	misses;		/* keys generated on the kex path */
+	u_int64_t	generated;	/* keys generated by kex_keypool_fill */
+	u_int		available;	/* keys currently in the pool */
+	u_int		missing;	/* keys still to be generated */
+};
+
+/*
+ * kex_keypool_new() creates an empty pool holding up to 'size' keys for
+ * every method enabled with kex_keypool_want().  a pool is not locked;
+ * it must only be used by one thread at a time.
+ */
+int	kex_keypool_new(struct kex_keypool **, u_int size);
+
+/* kex_keypool_free() releases the pool, clearing all unused keys */
+void	kex_keypool_free(struct kex_keypool *);
+
+/*
+ * kex_keypool_want() enables pooling for the methods in the comma
+ * separated list of kex algorithms.  group exchange is not pooled since
+ * its group is only known once the client has sent its request.
+ */
+int	kex_keypool_want(struct kex_keypool *, const char *kexalgs);
+
+/*
+ * kex_keypool_fill() generates up to 'max' missing keys, starting with
+ * the emptiest slot.  it is meant to be called when the caller is idle
+ * and returns the number of keys still missing or an error.
+ */
+int	kex_keypool_fill(struct kex_keypool *, u_int max);
+
+/* kex_keypool_missing() returns the number of keys the pool lacks */
+u_int	kex_keypool_missing(struct kex_keypool *);
+
+/*
+ * kex_keypool_split() moves up to 'n' keys per method into a new pool,
+ * e.g. for handing them to a child process.  a key is never left in
+ * both pools.
+ */
+int	kex_keypool_split(struct kex_keypool *, u_int n,
+    struct kex_keypool **);
+
+/*
+ * kex_keypool_to_blob() moves all keys of the pool into a buffer that
+ * kex_keypool_from_blob() turns back into a pool, e.g. in a re-executed
+ * process.  the buffer holds private keys and should be cleared.
+ */
+int	kex_keypool_to_blob(struct kex_keypool *, struct sshbuf *);
+int	kex_keypool_from_blob(struct sshbuf *, struct kex_keypool **);
+
+void	kex_keypool_get_stats(struct kex_keypool *, struct kex_keypool_stats *);
+
+/*
+ * used by the server side kex methods: take the ephemeral key from
+ * ssh->kex->keypool if possible and generate one otherwise.
+ */
+int	kex_keypool_ec_key(struct ssh *, int nid, EC_KEY **);
+int	kex_keypool_dh_key(struct ssh *, DH **);
+
+#endif
@@ -27,8 +27,10 @@
 
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/queue.h>
 
 #include <openssl/evp.h>
+#include <openssl/sha.h>
 
 #include <errno.h>
 #include <stdio.h>
@@ -52,6 +54,7 @@ static const struct keytype key_types[] = {
 	{ KEY_RSA1, "RSA1", NULL, KEY_RSA, -1 },
 	{ KEY_RSA, "RSA", "ssh-rsa", KEY_RSA, -1 },
 	{ KEY_DSA, "DSA", "ssh-dss", KEY_DSA, -1 },
+	{ KEY_ED25519, "ED25519", "ssh-ed25519", KEY_ED25519, -1 },
 	{ KEY_RSA_CERT_V00, "RSA-CERT-V00", "ssh-rsa-cert-v00@openssh.com",
 	  KEY_RSA, -1 },
 	{ KEY_DSA_CERT_V00, "DSA-CERT-V00", "ssh-dss-cert-v00@openssh.com",
@@ -60,6 +63,8 @@ static const struct keytype key_types[] = {
 	  KEY_RSA, -1 },
 	{ KEY_DSA_CERT, "DSA-CERT", "ssh-dss-cert-v01@openssh.com",
 	  KEY_DSA, -1 },
+	{ KEY_ED25519_CERT, "ED25519-CERT", "ssh-ed25519-cert-v01@openssh.com",
+	  KEY_ED25519, -1 },
 	{ KEY_ECDSA, "ECDSA", "ecdsa-sha2-nistp256",
 	  KEY_ECDSA, NID_X9_62_prime256v1 },
 	{ KEY_ECDSA, "ECDSA", "ecdsa-sha2-nistp384", KEY_ECDSA, NID_secp384r1 },
@@ -307,6 +312,10 @@ sshkey_new(int type)
 	case KEY_ECDSA_CERT:
 		/* Cannot do anything until we know the group */
 		break;
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		/* no need to prealloc */
+		break;
 	case KEY_UNSPEC:
 		break;
 	default:
@@ -351,6 +360,10 @@ sshkey_add_private(struct sshkey *k)
 	case KEY_ECDSA_CERT:
 		/* Cannot do anything until we know the group */
 		break;
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		/* no need to prealloc */
+		break;
 	case KEY_UNSPEC:
 		break;
 	default:
@@ -373,6 +386,50 @@ sshkey_new_private(int type)
 	return k;
 }
 
+/*
+ * The public blob of the plain key and its fingerprint digests are kept
+ * with the key, since host and agent keys are serialised over and over.
+ * sshkey_memoise() fills the whole memo, and sshkey_fingerprint_raw()
+ * fills it as it goes; functions that take a const key only ever read it.
+ * A completely filled memo is therefore only read, and a key that is used
+ * from several threads at once must be memoised before it is shared.
+ * A memo belongs to the plain key type it was made for and is dropped
+ * when the type changes; code that changes the public parts of a key in
+ * place must call sshkey_memo_clear().
+ */
+struct sshkey_memo {
+	int	 type;		/* plain key type */
+	u_char	*blob;		/* public blob of the plain key */
+	u_int	 bloblen;
+	u_char	 md5[EVP_MAX_MD_SIZE], sha1[EVP_MAX_MD_SIZE];
+	u_int	 md5len, sha1len;	/* 0 until computed */
+};
+
+void
+sshkey_memo_clear(struct sshkey *k)
+{
+	if (k == NULL || k->memo == NULL)
+		return;
+	free(k->memo->blob);
+	bzero(k->memo, sizeof(*k->memo));
+	free(k->memo);
+	k->memo = NULL;
+}
+
+/* Returns the memo of 'k', creating it if needed; NULL for RSA1 keys */
+static struct sshkey_memo *
+memo_get(struct sshkey *k)
+{
+	int type = sshkey_type_plain(k->type);
+
+	if (k->memo != NULL && k->memo->type != type)
+		sshkey_memo_clear(k);
+	if (k->memo == NULL && type != KEY_RSA1 && type != KEY_UNSPEC &&
+	    (k->memo = calloc(1, sizeof(*k->memo))) != NULL)
+		k->memo->type = type;
+	return k->memo;
+}
+
 static void
 cert_free(struct sshkey_cert *cert)
 {
@@ -402,6 +459,11 @@ sshkey_free(struct sshkey *k)
 {
 	if (k == NULL)
 		return;
+	if (k->refs > 1) {
+		/* An interned key that is still in use */
+		k->refs--;
+		return;
+	}
 	switch (k->type) {
 	case KEY_RSA1:
 	case KEY_RSA:
@@ -424,6 +486,19 @@ sshkey_free(struct sshkey *k)
 			EC_KEY_free(k->ecdsa);
 		k->ecdsa = NULL;
 		break;
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		if (k->ed25519_pk != NULL) {
+			bzero(k->ed25519_pk, ED25519_PK_SIZE);
+			free(k->ed25519_pk);
+			k->ed25519_pk = NULL;
+		}
+		if (k->ed25519_sk != NULL) {
+			bzero(k->ed25519_sk, ED25519_SK_SIZE);
+			free(k->ed25519_sk);
+			k->ed25519_sk = NULL;
+		}
+		break;
 	case KEY_UNSPEC:
 		break;
 	default:
@@ -431,6 +506,7 @@ sshkey_free(struct sshkey *k)
 	}
 	if (sshkey_is_cert(k))
 		cert_free(k->cert);
+	sshkey_memo_clear(k);
 	bzero(k, sizeof(*k));
 	free(k);
 }
@@ -450,6 +526,16 @@ cert_compare(struct sshkey_cert *a, struct sshkey_cert *b)
 	return 1;
 }
 
+/* Returns the memoised plain public blob of 'k', or NULL */
+static const struct sshkey_memo *
+memo_blob(const struct sshkey *k)
+{
+	if (k->memo == NULL || k->memo->blob == NULL ||
+	    k->memo->type != sshkey_type_plain(k->type))
+		return NULL;
+	return k->memo;
+}
+
 /*
  * Compare public portions of key only, allowing comparisons between
  * certificates and plain keys too.
@@ -457,12 +543,18 @@ cert_compare(struct sshkey_cert *a, struct sshkey_cert *b)
 int
 sshkey_equal_public(const struct sshkey *a, const struct sshkey *b)
 {
+	const struct sshkey_memo *ma, *mb;
 	BN_CTX *bnctx;
 
 	if (a == NULL || b == NULL ||
 	    sshkey_type_plain(a->type) != sshkey_type_plain(b->type))
 		return 0;
 
+	/* The plain blobs encode exactly the public parts */
+	if ((ma = memo_blob(a)) != NULL && (mb = memo_blob(b)) != NULL)
+		return ma->bloblen == mb->bloblen &&
+		    memcmp(ma->blob, mb->blob, ma->bloblen) == 0;
+
 	switch (a->type) {
 	case KEY_RSA1:
 	case KEY_RSA_CERT_V00:
@@ -497,6 +589,10 @@ sshkey_equal_public(const struct sshkey *a, const struct sshkey *b)
 		}
 		BN_CTX_free(bnctx);
 		return 1;
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		return a->ed25519_pk != NULL && b->ed25519_pk != NULL &&
+		    memcmp(a->ed25519_pk, b->ed25519_pk, ED25519_PK_SIZE) == 0;
 	default:
 		return 0;
 	}
@@ -521,13 +617,19 @@ sshkey_fingerprint_raw(struct sshkey *k, enum sshkey_fp_type dgst_type,
 {
 	const EVP_MD *md = NULL;
 	EVP_MD_CTX ctx;
-	u_char *blob;
+	struct sshkey_memo *memo;
+	u_char *blob, *memo_dgst = NULL;
 	u_char *retval = NULL;
-	u_int len = 0;
-	int nlen, elen, otype;
+	u_int len = 0, *memo_len = NULL;
+	int nlen, elen;
 
 	*dgst_raw_length = 0;
 
+	if ((memo = memo_get(k)) != NULL) {
+		memo_dgst = dgst_type == SSH_FP_MD5 ? memo->md5 : memo->sha1;
+		memo_len = dgst_type == SSH_FP_MD5 ?
+		    &memo->md5len : &memo->sha1len;
+	}
 	switch (dgst_type) {
 	case SSH_FP_MD5:
 		md = EVP_md5();
@@ -538,6 +640,13 @@ sshkey_fingerprint_raw(struct sshkey *k, enum sshkey_fp_type dgst_type,
 	default:
 		return NULL;
 	}
+	if (memo_len != NULL && *memo_len != 0) {
+		if ((retval = malloc(EVP_MAX_MD_SIZE)) == NULL)
+			return NULL;
+		memcpy(retval, memo_dgst, *memo_len);
+		*dgst_raw_length = *memo_len;
+		return retval;
+	}
 	switch (k->type) {
 	case KEY_RSA1:
 		nlen = BN_num_bytes(k->rsa->n);
@@ -551,7 +660,8 @@ sshkey_fingerprint_raw(struct sshkey *k, enum sshkey_fp_type dgst_type,
 	case KEY_DSA:
 	case KEY_ECDSA:
 	case KEY_RSA:
-		if (sshkey_to_blob(k, &blob, &len) == -1)
+	case KEY_ED25519:
+		if (sshkey_to_blob(k, &blob, &len) != 0)
 			return NULL;
 		break;
 	case KEY_DSA_CERT_V00:
@@ -559,14 +669,10 @@ sshkey_fingerprint_raw(struct sshkey *k, enum sshkey_fp_type dgst_type,
 	case KEY_DSA_CERT:
 	case KEY_ECDSA_CERT:
 	case KEY_RSA_CERT:
+	case KEY_ED25519_CERT:
 		/* We want a fingerprint of the _key_ not of the cert */
-		otype = k->type;
-		k->type = sshkey_type_plain(k->type);
-		if (sshkey_to_blob(k, &blob, &len) == -1) {
-			k->type = otype;
+		if (sshkey_plain_to_blob(k, &blob, &len) != 0)
 			return NULL;
-		}
-		k->type = otype;
 		break;
 	case KEY_UNSPEC:
 	default:
@@ -580,11 +686,43 @@ sshkey_fingerprint_raw(struct sshkey *k, enum sshkey_fp_type dgst_type,
 	EVP_DigestInit(&ctx, md);
 	EVP_DigestUpdate(&ctx, blob, len);
 	EVP_DigestFinal(&ctx, retval, dgst_raw_length);
-	bzero(blob, len);
-	free(blob);
+	if (memo_len != NULL) {
+		memcpy(memo_dgst, retval, *dgst_raw_length);
+		*memo_len = *dgst_raw_length;
+		/* What was hashed is the plain public blob */
+		if (memo->blob == NULL) {
+			memo->blob = blob;
+			memo->bloblen = len;
+			blob = NULL;
+		}
+	}
+	if (blob != NULL) {
+		bzero(blob, len);
+		free(blob);
+	}
 	return retval;
 }
 
+int
+sshkey_memoise(struct sshkey *k)
+{
+	u_char *dgst;
+	u_int len;
+
+	if (k == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if (k->type == KEY_RSA1)
+		return 0;
+	if ((dgst = sshkey_fingerprint_raw(k, SSH_FP_MD5, &len)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	free(dgst);
+	if ((dgst = sshkey_fingerprint_raw(k, SSH_FP_SHA1, &len)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	free(dgst);
+	return k->memo != NULL && k->memo->blob != NULL ?
+	    0 : SSH_ERR_ALLOC_FAIL;
+}
+
 static char *
 fingerprint_hex(u_char *dgst_raw, u_int dgst_raw_len)
 {
@@ -838,7 +976,10 @@ sshkey_read(struct sshkey *ret, char **cpp)
 	u_long bits;
 	struct sshbuf *blob;
 
+	if (ret->refs > 1)
+		return SSH_ERR_INVALID_ARGUMENT;
 	cp = *cpp;
+	sshkey_memo_clear(ret);
 
 	switch (ret->type) {
 	case KEY_RSA1:
@@ -862,11 +1003,13 @@ sshkey_read(struct sshkey *ret, char **cpp)
 	case KEY_RSA:
 	case KEY_DSA:
 	case KEY_ECDSA:
+	case KEY_ED25519:
 	case KEY_DSA_CERT_V00:
 	case KEY_RSA_CERT_V00:
 	case KEY_DSA_CERT:
 	case KEY_ECDSA_CERT:
 	case KEY_RSA_CERT:
+	case KEY_ED25519_CERT:
 		space = strchr(cp, ' ');
 		if (space == NULL)
 			return SSH_ERR_INVALID_FORMAT;
@@ -950,6 +1093,11 @@ sshkey_read(struct sshkey *ret, char **cpp)
 			sshkey_dump_ec_key(ret->ecdsa);
 #endif
 		}
+		if (sshkey_type_plain(ret->type) == KEY_ED25519) {
+			free(ret->ed25519_pk);
+			ret->ed25519_pk = k->ed25519_pk;
+			k->ed25519_pk = NULL;
+		}
 		retval = 0;
 /*XXXX*/
 		sshkey_free(k);
@@ -968,12 +1116,13 @@ sshkey_read(struct sshkey *ret, char **cpp)
 	return retval;
 }
 
+/* Appends the text form of 'key', as in a public key file, to 'b' */
 int
-sshkey_write(const struct sshkey *key, FILE *f)
+sshkey_format_text(const struct sshkey *key, struct sshbuf *b)
 {
 	int ret = SSH_ERR_INTERNAL_ERROR;
 	u_int bits = 0;
-	struct sshbuf *b = NULL, *bb = NULL;
+	struct sshbuf *bb = NULL;
 	char *uu = NULL, *dec_e = NULL, *dec_n = NULL;
 
 	if (sshkey_is_cert(key)) {
@@ -982,8 +1131,6 @@ sshkey_write(const struct sshkey *key, FILE *f)
 		if (sshbuf_len(key->cert->certblob) == 0)
 			return SSH_ERR_KEY_LACKS_CERTBLOB;
 	}
-	if ((b = sshbuf_new()) == NULL)
-		return SSH_ERR_ALLOC_FAIL;
 	switch (key->type) {
 	case KEY_RSA1:
 		if (key->rsa == NULL || key->rsa->e == NULL ||
@@ -1012,6 +1159,8 @@ sshkey_write(const struct sshkey *key, FILE *f)
 	case KEY_RSA:
 	case KEY_RSA_CERT_V00:
 	case KEY_RSA_CERT:
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
 		if ((bb = sshbuf_new()) == NULL) {
 			ret = SSH_ERR_ALLOC_FAIL;
 			goto out;
@@ -1031,16 +1180,8 @@ sshkey_write(const struct sshkey *key, FILE *f)
 		ret = SSH_ERR_KEY_TYPE_UNKNOWN;
 		goto out;
 	}
-	if (fwrite(sshbuf_ptr(b), sshbuf_len(b), 1, f) != 1) {
-		if (feof(f))
-			errno = EPIPE;
-		ret = SSH_ERR_SYSTEM_ERROR;
-		goto out;
-	}
 	ret = 0;
  out:
-	if (b != NULL)
-		sshbuf_free(b);
 	if (bb != NULL)
 		sshbuf_free(bb);
 	if (uu != NULL)
@@ -1052,6 +1193,28 @@ sshkey_write(const struct sshkey *key, FILE *f)
 	return ret;
 }
 
+int
+sshkey_write(const struct sshkey *key, FILE *f)
+{
+	struct sshbuf *b;
+	int ret;
+
+	if ((b = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((ret = sshkey_format_text(key, b)) != 0)
+		goto out;
+	if (fwrite(sshbuf_ptr(b), sshbuf_len(b), 1, f) != 1) {
+		if (feof(f))
+			errno = EPIPE;
+		ret = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	}
+	ret = 0;
+ out:
+	sshbuf_free(b);
+	return ret;
+}
+
 u_int
 sshkey_size(const struct sshkey *k)
 {
@@ -1068,6 +1231,9 @@ sshkey_size(const struct sshkey *k)
 	case KEY_ECDSA:
 	case KEY_ECDSA_CERT:
 		return sshkey_curve_nid_to_bits(k->ecdsa_nid);
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		return 256;
 	}
 	return 0;
 }
@@ -1204,6 +1370,22 @@ ecdsa_generate_private_key(u_int bits, int *nid, EC_KEY **ecdsap)
 	return ret;
 }
 
+static int
+ed25519_generate_private_key(u_char **pkp, u_char **skp)
+{
+	u_char *pk = NULL, *sk = NULL;
+
+	if ((pk = malloc(ED25519_PK_SIZE)) == NULL ||
+	    (sk = malloc(ED25519_SK_SIZE)) == NULL) {
+		free(pk);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	crypto_sign_ed25519_keypair(pk, sk);
+	*pkp = pk;
+	*skp = sk;
+	return 0;
+}
+
 int
 sshkey_generate(int type, u_int bits, struct sshkey **keyp)
 {
@@ -1223,6 +1405,10 @@ sshkey_generate(int type, u_int bits, struct sshkey **keyp)
 		ret = ecdsa_generate_private_key(bits, &k->ecdsa_nid,
 		    &k->ecdsa);
 		break;
+	case KEY_ED25519:
+		ret = ed25519_generate_private_key(&k->ed25519_pk,
+		    &k->ed25519_sk);
+		break;
 	case KEY_RSA:
 	case KEY_RSA1:
 		ret = rsa_generate_private_key(bits, &k->rsa);
@@ -1334,6 +1520,18 @@ sshkey_from_private(const struct sshkey *k, struct sshkey **pkp)
 			return SSH_ERR_LIBCRYPTO_ERROR;
 		}
 		break;
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		if ((n = sshkey_new(k->type)) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		if (k->ed25519_pk != NULL) {
+			if ((n->ed25519_pk = malloc(ED25519_PK_SIZE)) == NULL) {
+				sshkey_free(n);
+				return SSH_ERR_ALLOC_FAIL;
+			}
+			memcpy(n->ed25519_pk, k->ed25519_pk, ED25519_PK_SIZE);
+		}
+		break;
 	case KEY_RSA:
 	case KEY_RSA1:
 	case KEY_RSA_CERT_V00:
@@ -1381,48 +1579,141 @@ sshkey_names_valid2(const char *names)
 	return 1;
 }
 
+/*
+ * Bounded LRU of certificates whose CA signature verified, keyed by the
+ * SHA256 of the whole certificate blob, which includes the CA key and the
+ * signature.  Entries are kept most recently used first.  Only the
+ * signature check is skipped on a hit; validity and principals are
+ * checked by the callers on every use.
+ */
+static u_char (*cert_sigcache)[SHA256_DIGEST_LENGTH];
+static u_int cert_sigcache_len, cert_sigcache_max;
+static u_int64_t cert_sigcache_hits, cert_sigcache_misses;
+
+int
+sshkey_cert_cache_init(u_int max)
+{
+	free(cert_sigcache);
+	cert_sigcache = NULL;
+	cert_sigcache_len = cert_sigcache_max = 0;
+	cert_sigcache_hits = cert_sigcache_misses = 0;
+	if (max == 0)
+		return 0;
+	if ((cert_sigcache = calloc(max, sizeof(*cert_sigcache))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	cert_sigcache_max = max;
+	return 0;
+}
+
+void
+sshkey_cert_cache_stats(u_int64_t *hitsp, u_int64_t *missesp)
+{
+	if (hitsp != NULL)
+		*hitsp = cert_sigcache_hits;
+	if (missesp != NULL)
+		*missesp = cert_sigcache_misses;
+}
+
+static int
+cert_sigcache_lookup(const u_char *digest)
+{
+	u_char tmp[SHA256_DIGEST_LENGTH];
+	u_int i;
+
+	for (i = 0; i < cert_sigcache_len; i++) {
+		if (memcmp(cert_sigcache[i], digest, sizeof(tmp)) != 0)
+			continue;
+		if (i > 0) {
+			memcpy(tmp, cert_sigcache[i], sizeof(tmp));
+			memmove(cert_sigcache + 1, cert_sigcache,
+			    i * sizeof(*cert_sigcache));
+			memcpy(cert_sigcache[0], tmp, sizeof(tmp));
+		}
+		cert_sigcache_hits++;
+		return 1;
+	}
+	cert_sigcache_misses++;
+	return 0;
+}
+
+static void
+cert_sigcache_add(const u_char *digest)
+{
+	/* The least recently used entry falls off the end */
+	if (cert_sigcache_len < cert_sigcache_max)
+		cert_sigcache_len++;
+	memmove(cert_sigcache + 1, cert_sigcache,
+	    (cert_sigcache_len - 1) * sizeof(*cert_sigcache));
+	memcpy(cert_sigcache[0], digest, SHA256_DIGEST_LENGTH);
+}
+
+/* Checks that a certificate option list is a sequence of name/data pairs */
+static int
+cert_check_options(struct sshbuf *opts)
+{
+	struct sshbuf *v;
+	int ret = 0;
+
+	if ((v = sshbuf_fromb(opts)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	while (sshbuf_len(v) != 0) {
+		if (sshbuf_get_string_direct(v, NULL, NULL) != 0 ||
+		    sshbuf_get_string_direct(v, NULL, NULL) != 0) {
+			ret = SSH_ERR_INVALID_FORMAT;
+			break;
+		}
+	}
+	sshbuf_free(v);
+	return ret;
+}
+
+/*
+ * The certificate keeps one copy of the blob in certblob; the critical
+ * options and extensions are read-only views into it rather than copies.
+ */
 static int
 cert_parse(struct sshbuf *b, struct sshkey *key, const u_char *blob, u_int blen)
 {
-	u_char *principals = NULL, *critical = NULL, *exts = NULL;
-	u_char *sig_key = NULL, *sig = NULL;
-	size_t signed_len, plen, clen, sklen, slen, kidlen, elen;
-	struct sshbuf *tmp;
+	u_char digest[SHA256_DIGEST_LENGTH];
+	const u_char *sig_key, *sig;
+	size_t signed_len, sklen, slen, kidlen, plen;
+	struct sshbuf *cb = NULL, *principals = NULL;
+	struct sshbuf *critical = NULL, *exts = NULL;
 	char *principal;
 	int ret;
 	int v00 = key->type == KEY_DSA_CERT_V00 ||
 	    key->type == KEY_RSA_CERT_V00;
 	char **oprincipals;
 
-	if ((tmp = sshbuf_new()) == NULL)
-		return SSH_ERR_ALLOC_FAIL;
-
 	/* Copy the entire key blob for verification and later serialisation */
 	if ((ret = sshbuf_put(key->cert->certblob, blob, blen)) != 0)
 		return ret;
+	/* Parse the rest from the copy, at the same offset as 'b' */
+	if ((cb = sshbuf_fromb(key->cert->certblob)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((ret = sshbuf_consume(cb, blen - sshbuf_len(b))) != 0)
+		goto out;
 
-	elen = 0; /* Not touched for v00 certs */
-	principals = exts = critical = sig_key = sig = NULL;
-	if ((!v00 && (ret = sshbuf_get_u64(b, &key->cert->serial)) != 0) ||
-	    (ret = sshbuf_get_u32(b, &key->cert->type)) != 0 ||
-	    (ret = sshbuf_get_cstring(b, &key->cert->key_id, &kidlen)) != 0 ||
-	    (ret = sshbuf_get_string(b, &principals, &plen)) != 0 ||
-	    (ret = sshbuf_get_u64(b, &key->cert->valid_after)) != 0 ||
-	    (ret = sshbuf_get_u64(b, &key->cert->valid_before)) != 0 ||
-	    (ret = sshbuf_get_string(b, &critical, &clen)) != 0 ||
-	    (!v00 && (ret = sshbuf_get_string(b, &exts, &elen)) != 0) ||
-	    (v00 && (ret = sshbuf_get_string_direct(b, NULL, NULL)) != 0) ||
-	    (ret = sshbuf_get_string_direct(b, NULL, NULL)) != 0 ||
-	    (ret = sshbuf_get_string(b, &sig_key, &sklen)) != 0) {
+	if ((!v00 && (ret = sshbuf_get_u64(cb, &key->cert->serial)) != 0) ||
+	    (ret = sshbuf_get_u32(cb, &key->cert->type)) != 0 ||
+	    (ret = sshbuf_get_cstring(cb, &key->cert->key_id, &kidlen)) != 0 ||
+	    (ret = sshbuf_froms(cb, &principals)) != 0 ||
+	    (ret = sshbuf_get_u64(cb, &key->cert->valid_after)) != 0 ||
+	    (ret = sshbuf_get_u64(cb, &key->cert->valid_before)) != 0 ||
+	    (ret = sshbuf_froms(cb, &critical)) != 0 ||
+	    (!v00 && (ret = sshbuf_froms(cb, &exts)) != 0) ||
+	    (v00 && (ret = sshbuf_get_string_direct(cb, NULL, NULL)) != 0) ||
+	    (ret = sshbuf_get_string_direct(cb, NULL, NULL)) != 0 ||
+	    (ret = sshbuf_get_string_direct(cb, &sig_key, &sklen)) != 0) {
 		/* XXX debug print error for ret */
 		ret = SSH_ERR_INVALID_FORMAT;
 		goto out;
 	}
 
 	/* Signature is left in the buffer so we can calculate this length */
-	signed_len = sshbuf_len(key->cert->certblob) - sshbuf_len(b);
+	signed_len = blen - sshbuf_len(cb);
 
-	if ((ret = sshbuf_get_string(b, &sig, &slen)) != 0) {
+	if ((ret = sshbuf_get_string_direct(cb, &sig, &slen)) != 0) {
 		ret = SSH_ERR_INVALID_FORMAT;
 		goto out;
 	}
@@ -1433,14 +1724,13 @@ cert_parse(struct sshbuf *b, struct sshkey *key, const u_char *blob, u_int blen)
 		goto out;
 	}
 
-	if ((ret = sshbuf_put(tmp, principals, plen)) != 0)
-		goto out;
-	while (sshbuf_len(tmp) > 0) {
+	while (sshbuf_len(principals) > 0) {
 		if (key->cert->nprincipals >= SSHKEY_CERT_MAX_PRINCIPALS) {
 			ret = SSH_ERR_INVALID_FORMAT;
 			goto out;
 		}
-		if ((ret = sshbuf_get_cstring(tmp, &principal, &plen)) != 0) {
+		if ((ret = sshbuf_get_cstring(principals, &principal,
+		    &plen)) != 0) {
 			ret = SSH_ERR_INVALID_FORMAT;
 			goto out;
 		}
@@ -1457,35 +1747,18 @@ cert_parse(struct sshbuf *b, struct sshkey *key, const u_char *blob, u_int blen)
 		key->cert->principals[key->cert->nprincipals++] = principal;
 	}
 
-	sshbuf_reset(tmp);
-
-	if ((ret = sshbuf_put(key->cert->critical, critical, clen)) != 0 ||
-	    (ret = sshbuf_put(tmp, critical, clen)) != 0)
-		goto out;
-
 	/* validate structure */
-	while (sshbuf_len(tmp) != 0) {
-		if ((ret = sshbuf_get_string_direct(tmp, NULL, NULL)) != 0 ||
-		    (ret = sshbuf_get_string_direct(tmp, NULL, NULL)) != 0) {
-			ret = SSH_ERR_INVALID_FORMAT;
-			goto out;
-		}
-	}
-	sshbuf_reset(tmp);
-
-	if ((ret = sshbuf_put(key->cert->extensions, exts, elen)) != 0 ||
-	    (ret = sshbuf_put(tmp, exts, elen)) != 0)
+	if ((ret = cert_check_options(critical)) != 0 ||
+	    (exts != NULL && (ret = cert_check_options(exts)) != 0))
 		goto out;
-
-	/* validate structure */
-	while (sshbuf_len(tmp) != 0) {
-		if ((ret = sshbuf_get_string_direct(tmp, NULL, NULL)) != 0 ||
-		    (ret = sshbuf_get_string_direct(tmp, NULL, NULL)) != 0) {
-			ret = SSH_ERR_INVALID_FORMAT;
-			goto out;
-		}
+	sshbuf_free(key->cert->critical);
+	key->cert->critical = critical;
+	critical = NULL;
+	if (exts != NULL) {
+		sshbuf_free(key->cert->extensions);
+		key->cert->extensions = exts;
+		exts = NULL;
 	}
-	sshbuf_reset(tmp);
 
 	if (sshkey_from_blob(sig_key, sklen, &key->cert->signature_key) != 0) {
 		ret = SSH_ERR_KEY_CERT_INVALID_SIGN_KEY;
@@ -1493,23 +1766,35 @@ cert_parse(struct sshbuf *b, struct sshkey *key, const u_char *blob, u_int blen)
 	}
 	if (key->cert->signature_key->type != KEY_RSA &&
 	    key->cert->signature_key->type != KEY_DSA &&
-	    key->cert->signature_key->type != KEY_ECDSA) {
+	    key->cert->signature_key->type != KEY_ECDSA &&
+	    key->cert->signature_key->type != KEY_ED25519) {
 		ret = SSH_ERR_KEY_CERT_INVALID_SIGN_KEY;
 		goto out;
 	}
 
+	if (cert_sigcache_max > 0) {
+		SHA256(sshbuf_ptr(key->cert->certblob),
+		    sshbuf_len(key->cert->certblob), digest);
+		if (cert_sigcache_lookup(digest))
+			goto done;
+	}
 	if ((ret = sshkey_verify(key->cert->signature_key, sig, slen, 
 	    sshbuf_ptr(key->cert->certblob), signed_len, 0)) != 0)
 		goto out;
-	ret = 0;
+	if (cert_sigcache_max > 0)
+		cert_sigcache_add(digest);
+ done:
+	/* Leave 'b' where parsing the copy stopped */
+	ret = sshbuf_consume(b, sshbuf_len(b) - sshbuf_len(cb));
 
  out:
-	sshbuf_free(tmp);
-	free(principals);
-	free(critical);
-	free(exts);
-	free(sig_key);
-	free(sig);
+	if (principals != NULL)
+		sshbuf_free(principals);
+	if (critical != NULL)
+		sshbuf_free(critical);
+	if (exts != NULL)
+		sshbuf_free(exts);
+	sshbuf_free(cb);
 	return ret;
 }
 
@@ -1521,15 +1806,18 @@ sshkey_from_blob(const u_char *blob, u_int blen, struct sshkey **keyp)
 	char *ktype = NULL, *curve = NULL;
 	struct sshkey *key = NULL;
 	EC_POINT *q = NULL;
+	u_char *pk = NULL;
+	size_t pklen = 0;
 
 #ifdef DEBUG_PK /* XXX */
 	dump_base64(stderr, blob, blen);
 #endif
 	*keyp = NULL;
-	if ((b = sshbuf_new()) == NULL)
+	if (blob == NULL)
+		return SSH_ERR_INVALID_FORMAT;
+	/* Parse in place; certificates keep their own copy of the blob */
+	if ((b = sshbuf_from(blob, blen)) == NULL)
 		return SSH_ERR_ALLOC_FAIL;
-	if ((ret = sshbuf_put(b, blob, blen)) != 0)
-		goto out;
 	if (sshbuf_get_cstring(b, &ktype, NULL) != 0) {
 		ret = SSH_ERR_INVALID_FORMAT;
 		goto out;
@@ -1624,6 +1912,26 @@ sshkey_from_blob(const u_char *blob, u_int blen, struct sshkey **keyp)
 		sshkey_dump_ec_point(EC_KEY_get0_group(key->ecdsa), q);
 #endif
 		break;
+	case KEY_ED25519_CERT:
+		if (sshbuf_get_string_direct(b, NULL, NULL) != 0) {
+			ret = SSH_ERR_INVALID_FORMAT;
+			goto out;
+		}
+		/* FALLTHROUGH */
+	case KEY_ED25519:
+		if ((ret = sshbuf_get_string(b, &pk, &pklen)) != 0)
+			goto out;
+		if (pklen != ED25519_PK_SIZE) {
+			ret = SSH_ERR_INVALID_FORMAT;
+			goto out;
+		}
+		if ((key = sshkey_new(type)) == NULL) {
+			ret = SSH_ERR_ALLOC_FAIL;
+			goto out;
+		}
+		key->ed25519_pk = pk;
+		pk = NULL;
+		break;
 	case KEY_UNSPEC:
 		key = sshkey_new(type);
 		break;
@@ -1652,32 +1960,162 @@ sshkey_from_blob(const u_char *blob, u_int blen, struct sshkey **keyp)
 		free(curve);
 	if (q != NULL)
 		EC_POINT_free(q);
+	free(pk);
 	sshbuf_free(b);
 	return ret;
 }
 
+/*
+ * Process-wide table of interned public keys, keyed by the SHA256 of
+ * their blob.  A process that handles many connections otherwise keeps a
+ * separate copy of the same host and user keys for every one of them.
+ * An interned key is shared by all of its users and must not be changed:
+ * k->refs counts the table and every caller holding it, sshkey_free()
+ * only drops a reference while others remain, and the functions that
+ * modify a key in place refuse shared keys.  Sharing also keeps the
+ * memoised blob and fingerprints and the state OpenSSL caches inside a
+ * key, such as the RSA Montgomery contexts, warm from one use to the
+ * next.  When the table is full the least recently used key leaves it;
+ * callers still holding that key keep their references.  Like the
+ * certificate cache this is not thread-safe.
+ */
+struct intern_entry {
+	LIST_ENTRY(intern_entry) bucket;
+	TAILQ_ENTRY(intern_entry) lru;
+	u_char digest[SHA256_DIGEST_LENGTH];
+	u_char *blob;
+	u_int bloblen;
+	struct sshkey *key;
+};
+LIST_HEAD(intern_bucket, intern_entry);
+static TAILQ_HEAD(intern_lru, intern_entry) intern_lru =
+    TAILQ_HEAD_INITIALIZER(intern_lru);
+static struct intern_bucket *intern_buckets;
+static u_int intern_nbuckets, intern_len, intern_max;
+static u_int64_t intern_hits, intern_misses;
+
+static void
+intern_entry_free(struct intern_entry *e)
+{
+	LIST_REMOVE(e, bucket);
+	TAILQ_REMOVE(&intern_lru, e, lru);
+	intern_len--;
+	sshkey_free(e->key);
+	free(e->blob);
+	free(e);
+}
+
 int
-sshkey_to_blob_buf(const struct sshkey *key, struct sshbuf *b)
+sshkey_intern_init(u_int max)
+{
+	struct intern_entry *e;
+
+	/* Keys still held by callers stay valid and become theirs alone */
+	while ((e = TAILQ_FIRST(&intern_lru)) != NULL)
+		intern_entry_free(e);
+	free(intern_buckets);
+	intern_buckets = NULL;
+	intern_nbuckets = intern_len = intern_max = 0;
+	intern_hits = intern_misses = 0;
+	if (max == 0)
+		return 0;
+	for (intern_nbuckets = 16; intern_nbuckets < max;
+	    intern_nbuckets <<= 1)
+		;
+	if ((intern_buckets = calloc(intern_nbuckets,
+	    sizeof(*intern_buckets))) == NULL) {
+		intern_nbuckets = 0;
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	intern_max = max;
+	return 0;
+}
+
+void
+sshkey_intern_stats(u_int64_t *hitsp, u_int64_t *missesp)
+{
+	if (hitsp != NULL)
+		*hitsp = intern_hits;
+	if (missesp != NULL)
+		*missesp = intern_misses;
+}
+
+int
+sshkey_from_blob_shared(const u_char *blob, u_int blen, struct sshkey **keyp)
+{
+	struct intern_bucket *bucket;
+	struct intern_entry *e;
+	u_char digest[SHA256_DIGEST_LENGTH];
+	struct sshkey *key = NULL;
+	int ret;
+
+	*keyp = NULL;
+	if (intern_max == 0)
+		return sshkey_from_blob(blob, blen, keyp);
+	if (blob == NULL)
+		return SSH_ERR_INVALID_FORMAT;
+	SHA256(blob, blen, digest);
+	bucket = &intern_buckets[(digest[0] | digest[1] << 8 |
+	    digest[2] << 16) & (intern_nbuckets - 1)];
+	LIST_FOREACH(e, bucket, bucket) {
+		if (memcmp(e->digest, digest, sizeof(digest)) != 0 ||
+		    e->bloblen != blen || memcmp(e->blob, blob, blen) != 0)
+			continue;
+		TAILQ_REMOVE(&intern_lru, e, lru);
+		TAILQ_INSERT_HEAD(&intern_lru, e, lru);
+		e->key->refs++;
+		intern_hits++;
+		*keyp = e->key;
+		return 0;
+	}
+	intern_misses++;
+
+	if ((ret = sshkey_from_blob(blob, blen, &key)) != 0)
+		return ret;
+	if ((e = calloc(1, sizeof(*e))) == NULL ||
+	    (e->blob = malloc(blen)) == NULL) {
+		/* Not interned, but the key is still good */
+		free(e);
+		*keyp = key;
+		return 0;
+	}
+	memcpy(e->digest, digest, sizeof(digest));
+	memcpy(e->blob, blob, blen);
+	e->bloblen = blen;
+	e->key = key;
+	key->refs = 2;		/* the table and the caller */
+	if (intern_len >= intern_max)
+		intern_entry_free(TAILQ_LAST(&intern_lru, intern_lru));
+	LIST_INSERT_HEAD(bucket, e, bucket);
+	TAILQ_INSERT_HEAD(&intern_lru, e, lru);
+	intern_len++;
+	*keyp = key;
+	return 0;
+}
+
+static int
+to_blob_buf(const struct sshkey *key, struct sshbuf *b, int force_plain)
 {
+	const struct sshkey_memo *memo;
+	const char *name;
 	int ret = SSH_ERR_INTERNAL_ERROR;
 
 	if (key == NULL)
 		return SSH_ERR_INVALID_ARGUMENT;
-	switch (key->type) {
-	case KEY_DSA_CERT_V00:
-	case KEY_RSA_CERT_V00:
-	case KEY_DSA_CERT:
-	case KEY_ECDSA_CERT:
-	case KEY_RSA_CERT:
+	if (sshkey_is_cert(key) && !force_plain) {
 		/* Use the existing blob */
 		/* XXX modified flag? */
-		if ((ret = sshbuf_putb(b, key->cert->certblob)) != 0)
-			return ret;
-		break;
+		return sshbuf_putb(b, key->cert->certblob);
+	}
+	if ((memo = memo_blob(key)) != NULL)
+		return sshbuf_put(b, memo->blob, memo->bloblen);
+
+	name = sshkey_ssh_name_plain(key);
+	switch (sshkey_type_plain(key->type)) {
 	case KEY_DSA:
 		if (key->dsa == NULL)
 			return SSH_ERR_INVALID_ARGUMENT;
-		if ((ret = sshbuf_put_cstring(b, sshkey_ssh_name(key))) != 0 ||
+		if ((ret = sshbuf_put_cstring(b, name)) != 0 ||
 		    (ret = sshbuf_put_bignum2(b, key->dsa->p)) != 0 ||
 		    (ret = sshbuf_put_bignum2(b, key->dsa->q)) != 0 ||
 		    (ret = sshbuf_put_bignum2(b, key->dsa->g)) != 0 ||
@@ -1687,7 +2125,7 @@ sshkey_to_blob_buf(const struct sshkey *key, struct sshbuf *b)
 	case KEY_ECDSA:
 		if (key->ecdsa == NULL)
 			return SSH_ERR_INVALID_ARGUMENT;
-		if ((ret = sshbuf_put_cstring(b, sshkey_ssh_name(key))) != 0 ||
+		if ((ret = sshbuf_put_cstring(b, name)) != 0 ||
 		    (ret = sshbuf_put_cstring(b,
 		    sshkey_curve_nid_to_name(key->ecdsa_nid))) != 0 ||
 		    (ret = sshbuf_put_eckey(b, key->ecdsa)) != 0)
@@ -1696,11 +2134,19 @@ sshkey_to_blob_buf(const struct sshkey *key, struct sshbuf *b)
 	case KEY_RSA:
 		if (key->rsa == NULL)
 			return SSH_ERR_INVALID_ARGUMENT;
-		if ((ret = sshbuf_put_cstring(b, sshkey_ssh_name(key))) != 0 ||
+		if ((ret = sshbuf_put_cstring(b, name)) != 0 ||
 		    (ret = sshbuf_put_bignum2(b, key->rsa->e)) != 0 ||
 		    (ret = sshbuf_put_bignum2(b, key->rsa->n)) != 0)
 			return ret;
 		break;
+	case KEY_ED25519:
+		if (key->ed25519_pk == NULL)
+			return SSH_ERR_INVALID_ARGUMENT;
+		if ((ret = sshbuf_put_cstring(b, name)) != 0 ||
+		    (ret = sshbuf_put_string(b,
+		    key->ed25519_pk, ED25519_PK_SIZE)) != 0)
+			return ret;
+		break;
 	default:
 		return SSH_ERR_KEY_TYPE_UNKNOWN;
 	}
@@ -1708,15 +2154,36 @@ sshkey_to_blob_buf(const struct sshkey *key, struct sshbuf *b)
 }
 
 int
-sshkey_to_blob(const struct sshkey *key, u_char **blobp, u_int *lenp)
+sshkey_to_blob_buf(const struct sshkey *key, struct sshbuf *b)
+{
+	return to_blob_buf(key, b, 0);
+}
+
+static int
+to_blob(const struct sshkey *key, u_char **blobp, u_int *lenp,
+    int force_plain)
 {
+	const struct sshkey_memo *memo;
 	int ret = SSH_ERR_INTERNAL_ERROR;
 	size_t len;
 	struct sshbuf *b = NULL;
 
+	if (key == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((force_plain || !sshkey_is_cert(key)) &&
+	    (memo = memo_blob(key)) != NULL) {
+		if (lenp != NULL)
+			*lenp = memo->bloblen;
+		if (blobp != NULL) {
+			if ((*blobp = malloc(memo->bloblen)) == NULL)
+				return SSH_ERR_ALLOC_FAIL;
+			memcpy(*blobp, memo->blob, memo->bloblen);
+		}
+		return 0;
+	}
 	if ((b = sshbuf_new()) == NULL)
 		return SSH_ERR_ALLOC_FAIL;
-	if ((ret = sshkey_to_blob_buf(key, b)) != 0)
+	if ((ret = to_blob_buf(key, b, force_plain)) != 0)
 		goto out;
 	len = sshbuf_len(b);
 	if (lenp != NULL)
@@ -1734,6 +2201,130 @@ sshkey_to_blob(const struct sshkey *key, u_char **blobp, u_int *lenp)
 	return ret;
 }
 
+int
+sshkey_to_blob(const struct sshkey *key, u_char **blobp, u_int *lenp)
+{
+	return to_blob(key, blobp, lenp, 0);
+}
+
+/* Like sshkey_to_blob(), but serialises certificates as their plain key */
+int
+sshkey_plain_to_blob(const struct sshkey *key, u_char **blobp, u_int *lenp)
+{
+	return to_blob(key, blobp, lenp, 1);
+}
+
+/*
+ * Serialise a private key as the agent protocol and the "openssh-key-v1"
+ * private key format do.  only Ed25519 keys, which have no encoding in
+ * PEM, are supported so far.
+ */
+int
+sshkey_private_serialize(const struct sshkey *key, struct sshbuf *b)
+{
+	int r;
+
+	if (key == NULL || key->ed25519_pk == NULL || key->ed25519_sk == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	switch (key->type) {
+	case KEY_ED25519:
+		if ((r = sshbuf_put_cstring(b, sshkey_ssh_name(key))) != 0)
+			return r;
+		break;
+	case KEY_ED25519_CERT:
+		if (key->cert == NULL || sshbuf_len(key->cert->certblob) == 0)
+			return SSH_ERR_INVALID_ARGUMENT;
+		if ((r = sshbuf_put_cstring(b, sshkey_ssh_name(key))) != 0 ||
+		    (r = sshbuf_put_stringb(b, key->cert->certblob)) != 0)
+			return r;
+		break;
+	default:
+		return SSH_ERR_KEY_TYPE_UNKNOWN;
+	}
+	if ((r = sshbuf_put_string(b, key->ed25519_pk, ED25519_PK_SIZE)) != 0 ||
+	    (r = sshbuf_put_string(b, key->ed25519_sk, ED25519_SK_SIZE)) != 0)
+		return r;
+	return 0;
+}
+
+int
+sshkey_private_deserialize(struct sshbuf *b, struct sshkey **kp)
+{
+	struct sshkey *k = NULL;
+	char *tname = NULL;
+	const u_char *cert;
+	u_char *pk = NULL, *sk = NULL;
+	size_t certlen, pklen = 0, sklen = 0;
+	int type, r = SSH_ERR_INTERNAL_ERROR;
+
+	*kp = NULL;
+	if ((r = sshbuf_get_cstring(b, &tname, NULL)) != 0)
+		goto out;
+	type = sshkey_type_from_name(tname);
+	switch (type) {
+	case KEY_ED25519:
+		if ((k = sshkey_new(type)) == NULL) {
+			r = SSH_ERR_ALLOC_FAIL;
+			goto out;
+		}
+		break;
+	case KEY_ED25519_CERT:
+		if ((r = sshbuf_get_string_direct(b, &cert, &certlen)) != 0)
+			goto out;
+		if (certlen > UINT_MAX) {
+			r = SSH_ERR_INVALID_FORMAT;
+			goto out;
+		}
+		if ((r = sshkey_from_blob(cert, certlen, &k)) != 0)
+			goto out;
+		if (k->type != type) {
+			r = SSH_ERR_KEY_CERT_MISMATCH;
+			goto out;
+		}
+		break;
+	default:
+		r = SSH_ERR_KEY_TYPE_UNKNOWN;
+		goto out;
+	}
+	if ((r = sshbuf_get_string(b, &pk, &pklen)) != 0 ||
+	    (r = sshbuf_get_string(b, &sk, &sklen)) != 0)
+		goto out;
+	if (pklen != ED25519_PK_SIZE || sklen != ED25519_SK_SIZE) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	/* the public key is stored twice; a certificate has it once more */
+	if (memcmp(pk, sk + ED25519_SEED_SIZE, ED25519_PK_SIZE) != 0) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	if (k->ed25519_pk != NULL &&
+	    memcmp(pk, k->ed25519_pk, ED25519_PK_SIZE) != 0) {
+		r = SSH_ERR_KEY_CERT_MISMATCH;
+		goto out;
+	}
+	free(k->ed25519_pk);
+	k->ed25519_pk = pk;
+	k->ed25519_sk = sk;
+	pk = sk = NULL;
+	*kp = k;
+	k = NULL;
+	r = 0;
+ out:
+	free(tname);
+	if (pk != NULL) {
+		bzero(pk, pklen);
+		free(pk);
+	}
+	if (sk != NULL) {
+		bzero(sk, sklen);
+		free(sk);
+	}
+	if (k != NULL)
+		sshkey_free(k);
+	return r;
+}
+
 int
 sshkey_sign(const struct sshkey *key,
     u_char **sigp, u_int *lenp,
@@ -1751,6 +2342,9 @@ sshkey_sign(const struct sshkey *key,
 	case KEY_RSA_CERT:
 	case KEY_RSA:
 		return ssh_rsa_sign(key, sigp, lenp, data, datalen, compat);
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		return ssh_ed25519_sign(key, sigp, lenp, data, datalen, compat);
 	default:
 		return SSH_ERR_KEY_TYPE_UNKNOWN;
 	}
@@ -1779,6 +2373,9 @@ sshkey_verify(const struct sshkey *key,
 	case KEY_RSA_CERT:
 	case KEY_RSA:
 		return ssh_rsa_verify(key, sig, siglen, data, dlen, compat);
+	case KEY_ED25519:
+	case KEY_ED25519_CERT:
+		return ssh_ed25519_verify(key, sig, siglen, data, dlen, compat);
 	default:
 		return SSH_ERR_KEY_TYPE_UNKNOWN;
 	}
@@ -1846,6 +2443,19 @@ sshkey_demote(const struct sshkey *k, struct sshkey **dkp)
 			goto fail;
 		}
 		break;
+	case KEY_ED25519_CERT:
+		if ((ret = sshkey_cert_copy(k, pk)) != 0)
+			goto fail;
+		/* FALLTHROUGH */
+	case KEY_ED25519:
+		if (k->ed25519_pk != NULL) {
+			if ((pk->ed25519_pk = malloc(ED25519_PK_SIZE)) == NULL) {
+				ret = SSH_ERR_ALLOC_FAIL;
+				goto fail;
+			}
+			memcpy(pk->ed25519_pk, k->ed25519_pk, ED25519_PK_SIZE);
+		}
+		break;
 	default:
 		ret = SSH_ERR_KEY_TYPE_UNKNOWN;
  fail:
@@ -1867,6 +2477,7 @@ sshkey_is_cert(const struct sshkey *k)
 	case KEY_RSA_CERT:
 	case KEY_DSA_CERT:
 	case KEY_ECDSA_CERT:
+	case KEY_ED25519_CERT:
 		return 1;
 	default:
 		return 0;
@@ -1886,6 +2497,8 @@ sshkey_type_plain(int type)
 		return KEY_DSA;
 	case KEY_ECDSA_CERT:
 		return KEY_ECDSA;
+	case KEY_ED25519_CERT:
+		return KEY_ED25519;
 	default:
 		return type;
 	}
@@ -1895,6 +2508,9 @@ sshkey_type_plain(int type)
 int
 sshkey_to_certified(struct sshkey *k, int legacy)
 {
+	if (k->refs > 1)
+		return SSH_ERR_INVALID_ARGUMENT;
+	sshkey_memo_clear(k);
 	switch (k->type) {
 	case KEY_RSA:
 		if ((k->cert = cert_new()) == NULL)
@@ -1913,6 +2529,13 @@ sshkey_to_certified(struct sshkey *k, int legacy)
 			return SSH_ERR_ALLOC_FAIL;
 		k->type = KEY_ECDSA_CERT;
 		return 0;
+	case KEY_ED25519:
+		if (legacy)
+			return SSH_ERR_INVALID_ARGUMENT;
+		if ((k->cert = cert_new()) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		k->type = KEY_ED25519_CERT;
+		return 0;
 	default:
 		return SSH_ERR_KEY_TYPE_UNKNOWN;
 	}
@@ -1922,6 +2545,9 @@ sshkey_to_certified(struct sshkey *k, int legacy)
 int
 sshkey_drop_cert(struct sshkey *k)
 {
+	if (k->refs > 1)
+		return SSH_ERR_INVALID_ARGUMENT;
+	sshkey_memo_clear(k);
 	switch (k->type) {
 	case KEY_RSA_CERT_V00:
 	case KEY_RSA_CERT:
@@ -1937,14 +2563,18 @@ sshkey_drop_cert(struct sshkey *k)
 		cert_free(k->cert);
 		k->type = KEY_ECDSA;
 		return 0;
+	case KEY_ED25519_CERT:
+		cert_free(k->cert);
+		k->type = KEY_ED25519;
+		return 0;
 	default:
 		return SSH_ERR_KEY_TYPE_UNKNOWN;
 	}
 }
 
 /*
- * Sign a KEY_RSA_CERT, KEY_DSA_CERT or KEY_ECDSA_CERT, (re-)generating
- * the signed certblob
+ * Sign a KEY_RSA_CERT, KEY_DSA_CERT, KEY_ECDSA_CERT or KEY_ED25519_CERT,
+ * (re-)generating the signed certblob
  */
 int
 sshkey_certify(struct sshkey *k, struct sshkey *ca)
@@ -1955,17 +2585,19 @@ sshkey_certify(struct sshkey *k, struct sshkey *ca)
 	int ret;
 	struct sshbuf *cert;
 
-	if (k == NULL || k->cert == NULL || k->cert->certblob == NULL)
+	if (k == NULL || k->refs > 1 || k->cert == NULL ||
+	    k->cert->certblob == NULL)
 		return SSH_ERR_INVALID_ARGUMENT;
 	if (!sshkey_is_cert(k))
 		return SSH_ERR_KEY_TYPE_UNKNOWN;
 	if (ca->type != KEY_RSA && ca->type != KEY_DSA &&
-	    ca->type != KEY_ECDSA)
+	    ca->type != KEY_ECDSA && ca->type != KEY_ED25519)
 		return SSH_ERR_KEY_CERT_INVALID_SIGN_KEY;
 
 	if ((ret = sshkey_to_blob(ca, &ca_blob, &ca_len)) != 0)
 		return SSH_ERR_KEY_CERT_INVALID_SIGN_KEY;
 
+	sshkey_memo_clear(k);
 	cert = k->cert->certblob; /* for readability */
 	sshbuf_reset(cert);
 	if ((ret = sshbuf_put_cstring(cert, sshkey_ssh_name(k))) != 0)
@@ -2001,6 +2633,11 @@ sshkey_certify(struct sshkey *k, struct sshkey *ca)
 		    (sshbuf_put_bignum2(cert, k->rsa->n)) != 0)
 			goto out;
 		break;
+	case KEY_ED25519_CERT:
+		if ((ret = sshbuf_put_string(cert,
+		    k->ed25519_pk, ED25519_PK_SIZE)) != 0)
+			goto out;
+		break;
 	default:
 		ret = SSH_ERR_INVALID_ARGUMENT;
 	}
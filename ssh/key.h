@@ -32,6 +32,8 @@
 #include <openssl/dsa.h>
 #include <openssl/ec.h>
 
+#include "crypto_api.h"
+
 #define SSH_RSA_MINIMUM_MODULUS_SIZE	768
 
 /* XXX compat, remove when we can */
@@ -47,9 +49,11 @@ enum sshkey_types {
 	KEY_RSA,
 	KEY_DSA,
 	KEY_ECDSA,
+	KEY_ED25519,
 	KEY_RSA_CERT,
 	KEY_DSA_CERT,
 	KEY_ECDSA_CERT,
+	KEY_ED25519_CERT,
 	KEY_RSA_CERT_V00,
 	KEY_DSA_CERT_V00,
 	KEY_UNSPEC
@@ -87,6 +91,8 @@ struct sshkey_cert {
 	struct sshkey	*signature_key;
 };
 
+struct sshkey_memo;
+
 /* XXX opaquify? */
 struct sshkey {
 	int	 type;
@@ -95,7 +101,11 @@ struct sshkey {
 	DSA	*dsa;
 	int	 ecdsa_nid;	/* NID of curve */
 	EC_KEY	*ecdsa;
+	u_char	*ed25519_sk;	/* ED25519_SK_SIZE: seed and public key */
+	u_char	*ed25519_pk;	/* ED25519_PK_SIZE */
 	struct sshkey_cert *cert;
+	struct sshkey_memo *memo;	/* cached public blob and digests */
+	u_int	 refs;		/* references to an interned key, or 0 */
 };
 
 struct sshkey	*sshkey_new(int);
@@ -106,6 +116,11 @@ int		 sshkey_demote(const struct sshkey *, struct sshkey **);
 int		 sshkey_equal_public(const struct sshkey *,
     const struct sshkey *);
 int		 sshkey_equal(const struct sshkey *, const struct sshkey *);
+/*
+ * Fingerprinting memoises the digests and the public blob in the key, so
+ * two threads must not fingerprint one key unless it went through
+ * sshkey_memoise() before it was shared; after that it is only read.
+ */
 char		*sshkey_fingerprint(struct sshkey *,
     enum sshkey_fp_type, enum sshkey_fp_rep);
 u_char		*sshkey_fingerprint_raw(struct sshkey *,
@@ -113,6 +128,7 @@ u_char		*sshkey_fingerprint_raw(struct sshkey *,
 const char	*sshkey_type(const struct sshkey *);
 const char	*sshkey_cert_type(const struct sshkey *);
 int		 sshkey_write(const struct sshkey *, FILE *);
+int		 sshkey_format_text(const struct sshkey *, struct sshbuf *);
 int		 sshkey_read(struct sshkey *, char **);
 u_int		 sshkey_size(const struct sshkey *);
 
@@ -129,6 +145,8 @@ int	 sshkey_cert_check_authority(const struct sshkey *, int, int,
     const char *,
 	    const char **);
 int	 sshkey_cert_is_legacy(struct sshkey *);
+int	 sshkey_cert_cache_init(u_int);
+void	 sshkey_cert_cache_stats(u_int64_t *, u_int64_t *);
 
 int		 sshkey_ecdsa_nid_from_name(const char *);
 int		 sshkey_curve_name_to_nid(const char *);
@@ -141,12 +159,23 @@ int		 sshkey_ec_validate_public(const EC_GROUP *, const EC_POINT *);
 int		 sshkey_ec_validate_private(const EC_KEY *);
 
 int		 sshkey_from_blob(const u_char *, u_int, struct sshkey **);
+int		 sshkey_from_blob_shared(const u_char *, u_int,
+    struct sshkey **);
+int		 sshkey_intern_init(u_int);
+void		 sshkey_intern_stats(u_int64_t *, u_int64_t *);
+/* Serialising uses the memo if there is one but never fills it */
 int		 sshkey_to_blob_buf(const struct sshkey *, struct sshbuf *);
 int		 sshkey_to_blob(const struct sshkey *, u_char **, u_int *);
+int		 sshkey_plain_to_blob(const struct sshkey *, u_char **, u_int *);
+int		 sshkey_memoise(struct sshkey *);
+void		 sshkey_memo_clear(struct sshkey *);
 const char	*sshkey_ssh_name(const struct sshkey *);
 const char	*sshkey_ssh_name_plain(const struct sshkey *);
 int		 sshkey_names_valid2(const char *);
 
+int	 sshkey_private_serialize(const struct sshkey *, struct sshbuf *);
+int	 sshkey_private_deserialize(struct sshbuf *, struct sshkey **);
+
 int	 sshkey_sign(const struct sshkey *, u_char **, u_int *,
     const u_char *, u_int, u_int);
 int	 sshkey_verify(const struct sshkey *, const u_char *, u_int,
@@ -172,6 +201,11 @@ int ssh_ecdsa_sign(const struct sshkey *key, u_char **sigp, u_int *lenp,
 int ssh_ecdsa_verify(const struct sshkey *key,
     const u_char *signature, u_int signaturelen,
     const u_char *data, u_int datalen, u_int compat);
+int ssh_ed25519_sign(const struct sshkey *key, u_char **sigp, u_int *lenp,
+    const u_char *data, u_int datalen, u_int compat);
+int ssh_ed25519_verify(const struct sshkey *key,
+    const u_char *signature, u_int signaturelen,
+    const u_char *data, u_int datalen, u_int compat);
 #endif
 
 
@@ -0,0 +1,432 @@
+/* $OpenBSD$ */
+/*
+ * Compact binary key revocation lists.
+ *
+ * A revocation list holds the SHA256 hashes of revoked keys and, for each
+ * CA, the ranges of revoked certificate serials.  Both are kept sorted in
+ * a flat file (see PROTOCOL.krl) that is mapped read-only and searched
+ * with binary searches, so checking a key costs O(log n) no matter how
+ * many keys and serials are revoked.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "sshbuf.h"
+#include "key.h"
+#include "krl.h"
+#include "err.h"
+
+#define KRL_MAGIC		"SSHKRL\n"	/* 8 bytes with the \0 */
+#define KRL_MAGIC_LEN		8
+#define KRL_FORMAT_VERSION	1
+#define KRL_HASH_LEN		SHA256_DIGEST_LENGTH
+#define KRL_HDR_LEN		(KRL_MAGIC_LEN + 4 + 8 + 8 + 4 * 4)
+#define KRL_CA_LEN		(KRL_HASH_LEN + 4 + 4)
+#define KRL_RANGE_LEN		(8 + 8)
+#define KRL_MAX_ENTRIES		(1 << 26)
+#define KRL_MAX_SIZE		(1024 * 1024 * 1024)
+
+struct krl_range {
+	u_int64_t lo, hi;
+};
+
+struct krl_ca {
+	u_char hash[KRL_HASH_LEN];
+	struct krl_range *ranges;
+	size_t nranges, ranges_alloc;
+};
+
+struct sshkrl_build {
+	u_int64_t version;
+	struct krl_ca *cas;
+	size_t ncas, cas_alloc;
+	u_char (*keys)[KRL_HASH_LEN];
+	size_t nkeys, keys_alloc;
+};
+
+struct sshkrl {
+	u_int64_t version;
+	const u_char *cas, *ranges, *keys;
+	u_int32_t ncas, nranges, nkeys;
+	void *map;
+	size_t maplen;
+};
+
+/* SHA256 of the plain public key blob; certificates hash as their key */
+static int
+krl_key_hash(const struct sshkey *key, u_char *digest)
+{
+	u_char *blob;
+	u_int len;
+	int r;
+
+	if ((r = sshkey_plain_to_blob(key, &blob, &len)) != 0)
+		return r;
+	SHA256(blob, len, digest);
+	free(blob);
+	return 0;
+}
+
+static int
+krl_grow(void **p, size_t *alloc, size_t n, size_t size)
+{
+	size_t nalloc;
+	void *tmp;
+
+	if (n < *alloc)
+		return 0;
+	if (n >= KRL_MAX_ENTRIES)
+		return SSH_ERR_NO_BUFFER_SPACE;
+	nalloc = *alloc == 0 ? 64 : *alloc * 2;
+	if ((tmp = realloc(*p, nalloc * size)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	*p = tmp;
+	*alloc = nalloc;
+	return 0;
+}
+
+struct sshkrl_build *
+sshkrl_build_new(void)
+{
+	return calloc(1, sizeof(struct sshkrl_build));
+}
+
+void
+sshkrl_build_free(struct sshkrl_build *b)
+{
+	size_t i;
+
+	if (b == NULL)
+		return;
+	for (i = 0; i < b->ncas; i++)
+		free(b->cas[i].ranges);
+	free(b->cas);
+	free(b->keys);
+	free(b);
+}
+
+void
+sshkrl_build_set_version(struct sshkrl_build *b, u_int64_t version)
+{
+	b->version = version;
+}
+
+int
+sshkrl_build_revoke_key(struct sshkrl_build *b, const struct sshkey *key)
+{
+	int r;
+
+	if ((r = krl_grow((void **)&b->keys, &b->keys_alloc, b->nkeys,
+	    sizeof(*b->keys))) != 0)
+		return r;
+	if ((r = krl_key_hash(key, b->keys[b->nkeys])) != 0)
+		return r;
+	b->nkeys++;
+	return 0;
+}
+
+int
+sshkrl_build_revoke_serials(struct sshkrl_build *b, const struct sshkey *ca,
+    u_int64_t lo, u_int64_t hi)
+{
+	u_char hash[KRL_HASH_LEN];
+	struct krl_ca *c = NULL;
+	size_t i;
+	int r;
+
+	if (lo > hi)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((r = krl_key_hash(ca, hash)) != 0)
+		return r;
+	for (i = 0; i < b->ncas; i++) {
+		if (memcmp(b->cas[i].hash, hash, sizeof(hash)) == 0) {
+			c = &b->cas[i];
+			break;
+		}
+	}
+	if (c == NULL) {
+		if ((r = krl_grow((void **)&b->cas, &b->cas_alloc, b->ncas,
+		    sizeof(*b->cas))) != 0)
+			return r;
+		c = &b->cas[b->ncas++];
+		bzero(c, sizeof(*c));
+		memcpy(c->hash, hash, sizeof(hash));
+	}
+	if ((r = krl_grow((void **)&c->ranges, &c->ranges_alloc, c->nranges,
+	    sizeof(*c->ranges))) != 0)
+		return r;
+	c->ranges[c->nranges].lo = lo;
+	c->ranges[c->nranges].hi = hi;
+	c->nranges++;
+	return 0;
+}
+
+static int
+krl_cmp_hash(const void *a, const void *b)
+{
+	return memcmp(a, b, KRL_HASH_LEN);
+}
+
+static int
+krl_cmp_range(const void *a, const void *b)
+{
+	const struct krl_range *ra = a, *rb = b;
+
+	if (ra->lo != rb->lo)
+		return ra->lo < rb->lo ? -1 : 1;
+	return 0;
+}
+
+/* Sorts the ranges of a CA and merges overlapping or adjacent ones */
+static void
+krl_merge_ranges(struct krl_ca *c)
+{
+	size_t i, j;
+
+	if (c->nranges < 2)
+		return;
+	qsort(c->ranges, c->nranges, sizeof(*c->ranges), krl_cmp_range);
+	for (i = 0, j = 1; j < c->nranges; j++) {
+		if (c->ranges[i].hi == (u_int64_t)-1 ||
+		    c->ranges[j].lo <= c->ranges[i].hi + 1) {
+			if (c->ranges[j].hi > c->ranges[i].hi)
+				c->ranges[i].hi = c->ranges[j].hi;
+		} else
+			c->ranges[++i] = c->ranges[j];
+	}
+	c->nranges = i + 1;
+}
+
+int
+sshkrl_build_serialise(struct sshkrl_build *b, struct sshbuf *out)
+{
+	size_t i, j, nranges = 0, nkeys;
+	u_char *p;
+	int r;
+
+	/* struct krl_ca starts with the hash, so it sorts like one */
+	qsort(b->cas, b->ncas, sizeof(*b->cas), krl_cmp_hash);
+	for (i = 0; i < b->ncas; i++) {
+		krl_merge_ranges(&b->cas[i]);
+		nranges += b->cas[i].nranges;
+	}
+	qsort(b->keys, b->nkeys, sizeof(*b->keys), krl_cmp_hash);
+	for (i = 0, nkeys = 0; i < b->nkeys; i++) {
+		if (nkeys > 0 &&
+		    memcmp(b->keys[nkeys - 1], b->keys[i], KRL_HASH_LEN) == 0)
+			continue;
+		memmove(b->keys[nkeys++], b->keys[i], KRL_HASH_LEN);
+	}
+	b->nkeys = nkeys;
+	if (nranges >= KRL_MAX_ENTRIES)
+		return SSH_ERR_NO_BUFFER_SPACE;
+
+	if ((r = sshbuf_put(out, KRL_MAGIC, KRL_MAGIC_LEN)) != 0 ||
+	    (r = sshbuf_put_u32(out, KRL_FORMAT_VERSION)) != 0 ||
+	    (r = sshbuf_put_u64(out, b->version)) != 0 ||
+	    (r = sshbuf_put_u64(out, time(NULL))) != 0 ||
+	    (r = sshbuf_put_u32(out, b->ncas)) != 0 ||
+	    (r = sshbuf_put_u32(out, nranges)) != 0 ||
+	    (r = sshbuf_put_u32(out, b->nkeys)) != 0 ||
+	    (r = sshbuf_put_u32(out, 0)) != 0)	/* reserved */
+		return r;
+	if ((r = sshbuf_reserve(out, b->ncas * KRL_CA_LEN, &p)) != 0)
+		return r;
+	for (i = j = 0; i < b->ncas; i++, p += KRL_CA_LEN) {
+		memcpy(p, b->cas[i].hash, KRL_HASH_LEN);
+		POKE_U32(p + KRL_HASH_LEN, j);
+		POKE_U32(p + KRL_HASH_LEN + 4, b->cas[i].nranges);
+		j += b->cas[i].nranges;
+	}
+	if ((r = sshbuf_reserve(out, nranges * KRL_RANGE_LEN, &p)) != 0)
+		return r;
+	for (i = 0; i < b->ncas; i++) {
+		for (j = 0; j < b->cas[i].nranges; j++, p += KRL_RANGE_LEN) {
+			POKE_U64(p, b->cas[i].ranges[j].lo);
+			POKE_U64(p + 8, b->cas[i].ranges[j].hi);
+		}
+	}
+	if ((r = sshbuf_put(out, b->keys, b->nkeys * KRL_HASH_LEN)) != 0)
+		return r;
+	return 0;
+}
+
+int
+sshkrl_from_blob(const u_char *blob, size_t len, struct sshkrl **krlp)
+{
+	struct sshkrl *krl;
+	const u_char *p = blob;
+	u_int32_t ncas, nranges, nkeys;
+	u_int64_t need;
+
+	*krlp = NULL;
+	if (len < KRL_MAGIC_LEN || memcmp(p, KRL_MAGIC, KRL_MAGIC_LEN) != 0)
+		return SSH_ERR_KRL_BAD_MAGIC;
+	if (len < KRL_HDR_LEN ||
+	    PEEK_U32(p + KRL_MAGIC_LEN) != KRL_FORMAT_VERSION)
+		return SSH_ERR_INVALID_FORMAT;
+	p += KRL_MAGIC_LEN + 4 + 8 + 8;
+	ncas = PEEK_U32(p);
+	nranges = PEEK_U32(p + 4);
+	nkeys = PEEK_U32(p + 8);
+	if (ncas > KRL_MAX_ENTRIES || nranges > KRL_MAX_ENTRIES ||
+	    nkeys > KRL_MAX_ENTRIES)
+		return SSH_ERR_INVALID_FORMAT;
+	need = KRL_HDR_LEN + (u_int64_t)ncas * KRL_CA_LEN +
+	    (u_int64_t)nranges * KRL_RANGE_LEN + (u_int64_t)nkeys * KRL_HASH_LEN;
+	if (need != len)
+		return SSH_ERR_INVALID_FORMAT;
+	if ((krl = calloc(1, sizeof(*krl))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	krl->version = PEEK_U64(blob + KRL_MAGIC_LEN + 4);
+	krl->ncas = ncas;
+	krl->nranges = nranges;
+	krl->nkeys = nkeys;
+	krl->cas = blob + KRL_HDR_LEN;
+	krl->ranges = krl->cas + ncas * KRL_CA_LEN;
+	krl->keys = krl->ranges + nranges * KRL_RANGE_LEN;
+	*krlp = krl;
+	return 0;
+}
+
+int
+sshkrl_load(const char *path, struct sshkrl **krlp)
+{
+	struct stat st;
+	void *map;
+	size_t len;
+	int fd, r;
+
+	*krlp = NULL;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return SSH_ERR_SYSTEM_ERROR;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return SSH_ERR_SYSTEM_ERROR;
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size < KRL_MAGIC_LEN ||
+	    st.st_size > KRL_MAX_SIZE) {
+		close(fd);
+		return st.st_size < KRL_MAGIC_LEN ?
+		    SSH_ERR_KRL_BAD_MAGIC : SSH_ERR_INVALID_FORMAT;
+	}
+	len = st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return SSH_ERR_SYSTEM_ERROR;
+	if ((r = sshkrl_from_blob(map, len, krlp)) != 0) {
+		munmap(map, len);
+		return r;
+	}
+	(*krlp)->map = map;
+	(*krlp)->maplen = len;
+	return 0;
+}
+
+void
+sshkrl_free(struct sshkrl *krl)
+{
+	if (krl == NULL)
+		return;
+	if (krl->map != NULL)
+		munmap(krl->map, krl->maplen);
+	free(krl);
+}
+
+u_int64_t
+sshkrl_version(const struct sshkrl *krl)
+{
+	return krl->version;
+}
+
+/* Binary search for a hash in a sorted table with 'stride' byte entries */
+static const u_char *
+krl_bsearch(const u_char *table, u_int32_t n, size_t stride,
+    const u_char *hash)
+{
+	u_int32_t lo = 0, hi = n, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = memcmp(hash, table + mid * stride, KRL_HASH_LEN);
+		if (c == 0)
+			return table + mid * stride;
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+static int
+krl_serial_revoked(const struct sshkrl *krl, const u_char *cahash,
+    u_int64_t serial)
+{
+	const u_char *ca, *r;
+	u_int32_t first, n, lo, hi, mid;
+
+	if ((ca = krl_bsearch(krl->cas, krl->ncas, KRL_CA_LEN, cahash)) == NULL)
+		return 0;
+	first = PEEK_U32(ca + KRL_HASH_LEN);
+	n = PEEK_U32(ca + KRL_HASH_LEN + 4);
+	if (first > krl->nranges || n > krl->nranges - first)
+		return -1;
+	/* Find the last range starting at or before the serial */
+	for (lo = 0, hi = n; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		r = krl->ranges + (first + mid) * KRL_RANGE_LEN;
+		if (PEEK_U64(r) <= serial)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return 0;
+	r = krl->ranges + (first + lo - 1) * KRL_RANGE_LEN;
+	return serial <= PEEK_U64(r + 8);
+}
+
+int
+sshkrl_check_key(const struct sshkrl *krl, const struct sshkey *key)
+{
+	u_char hash[KRL_HASH_LEN];
+	int r;
+
+	if ((r = krl_key_hash(key, hash)) != 0)
+		return r;
+	if (krl_bsearch(krl->keys, krl->nkeys, KRL_HASH_LEN, hash) != NULL)
+		return SSH_ERR_KEY_REVOKED;
+	if (!sshkey_is_cert(key))
+		return 0;
+	if ((r = krl_key_hash(key->cert->signature_key, hash)) != 0)
+		return r;
+	if (krl_bsearch(krl->keys, krl->nkeys, KRL_HASH_LEN, hash) != NULL)
+		return SSH_ERR_KEY_REVOKED;
+	/* Legacy certificates have no serial */
+	if (key->type == KEY_RSA_CERT_V00 || key->type == KEY_DSA_CERT_V00)
+		return 0;
+	switch (krl_serial_revoked(krl, hash, key->cert->serial)) {
+	case 0:
+		return 0;
+	case 1:
+		return SSH_ERR_KEY_REVOKED;
+	default:
+		return SSH_ERR_INVALID_FORMAT;
+	}
+}
@@ -0,0 +1,52 @@
+/* $OpenBSD$ */
+/*
+ * Compact binary key revocation lists, see PROTOCOL.krl.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef KRL_H
+#define KRL_H
+
+#include <sys/types.h>
+
+struct sshbuf;
+struct sshkey;
+
+/* A revocation list under construction (ssh-keygen -k) */
+struct sshkrl_build;
+
+struct sshkrl_build *sshkrl_build_new(void);
+void	sshkrl_build_free(struct sshkrl_build *);
+void	sshkrl_build_set_version(struct sshkrl_build *, u_int64_t);
+/* Revokes a key, and with it every certificate for that key. */
+int	sshkrl_build_revoke_key(struct sshkrl_build *, const struct sshkey *);
+/* Revokes the certificates signed by 'ca' with serials 'lo' to 'hi'. */
+int	sshkrl_build_revoke_serials(struct sshkrl_build *,
+    const struct sshkey *ca, u_int64_t lo, u_int64_t hi);
+/* Appends the sorted, merged revocation list to 'out'. */
+int	sshkrl_build_serialise(struct sshkrl_build *, struct sshbuf *out);
+
+/* A read-only revocation list */
+struct sshkrl;
+
+/*
+ * sshkrl_from_blob() checks the revocation list in 'blob' and refers to
+ * it directly; the blob must outlive the returned list.  sshkrl_load()
+ * maps a revocation list file.  Both return SSH_ERR_KRL_BAD_MAGIC for
+ * data without the KRL magic, so that callers may fall back to plain
+ * key lists.
+ */
+int	sshkrl_from_blob(const u_char *blob, size_t len, struct sshkrl **);
+int	sshkrl_load(const char *path, struct sshkrl **);
+void	sshkrl_free(struct sshkrl *);
+u_int64_t sshkrl_version(const struct sshkrl *);
+
+/*
+ * sshkrl_check_key() returns SSH_ERR_KEY_REVOKED if 'key' is revoked,
+ * 0 if it is not, or another error.  For certificates the certified key,
+ * the CA key and the serial are checked.
+ */
+int	sshkrl_check_key(const struct sshkrl *, const struct sshkey *);
+
+#endif
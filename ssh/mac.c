@@ -37,6 +37,7 @@
 #include "mac.h"
 #include "misc.h"
 #include "err.h"
+#include "probe.h"
 
 #include "umac.h"
 
@@ -129,12 +130,14 @@ int
 mac_compute(Mac *mac, u_int32_t seqno, u_char *data, int datalen,
     u_char *digest, size_t dlen)
 {
-	static u_char m[MAC_DIGEST_LEN_MAX];
+	u_char m[MAC_DIGEST_LEN_MAX];
 	u_char b[4], nonce[8];
+	int r = 0;
 
 	if (mac->mac_len > sizeof(m))
 		return SSH_ERR_INTERNAL_ERROR;
 
+	SSH_PROBE3(mac__entry, mac, seqno, datalen);
 	switch (mac->type) {
 	case SSH_EVP:
 		POKE_U32(b, seqno);
@@ -143,7 +146,7 @@ mac_compute(Mac *mac, u_int32_t seqno, u_char *data, int datalen,
 		    HMAC_Update(&mac->evp_ctx, b, sizeof(b)) != 1 ||
 		    HMAC_Update(&mac->evp_ctx, data, datalen) != 1 ||
 		    HMAC_Final(&mac->evp_ctx, m, NULL) != 1)
-			return SSH_ERR_LIBCRYPTO_ERROR;
+			r = SSH_ERR_LIBCRYPTO_ERROR;
 		break;
 	case SSH_UMAC:
 		POKE_U64(nonce, seqno);
@@ -151,14 +154,17 @@ mac_compute(Mac *mac, u_int32_t seqno, u_char *data, int datalen,
 		umac_final(mac->umac_ctx, m, nonce);
 		break;
 	default:
-		return SSH_ERR_INVALID_ARGUMENT;
+		r = SSH_ERR_INVALID_ARGUMENT;
+		break;
 	}
-	if (digest != NULL) {
+	SSH_PROBE3(mac__return, mac, seqno, r);
+	if (r == 0 && digest != NULL) {
 		if (dlen > mac->mac_len)
 			dlen = mac->mac_len;
 		memcpy(digest, m, dlen);
 	}
-	return 0;
+	bzero(m, sizeof(m));
+	return r;
 }
 
 void
@@ -56,6 +56,7 @@
 #include <zlib.h>
 #include "packet.h"
 #include "auth-options.h"
+#include "authkeys.h"
 #include "sshpty.h"
 #include "channels.h"
 #include "session.h"
@@ -315,6 +316,9 @@ monitor_child_preauth(Authctxt *_authctxt, struct monitor *pmonitor)
 	debug("%s: %s has been authenticated by privileged process",
 	    __func__, authctxt->user);
 
+	/* The parsed authorized_keys files are not needed any more */
+	authkeys_flush();
+
 	mm_get_keystate(pmonitor);
 
 	close(pmonitor->m_sendfd);
@@ -842,7 +846,12 @@ mm_answer_keyallowed(int sock, Buffer *m)
 	chost = buffer_get_string(m, NULL);
 	blob = buffer_get_string(m, &bloblen);
 
-	if ((r = sshkey_from_blob(blob, bloblen, &key)) != 0)
+	/* RSA host keys are changed into RSA1 keys below, so not shared */
+	if (type == MM_RSAHOSTKEY)
+		r = sshkey_from_blob(blob, bloblen, &key);
+	else
+		r = sshkey_from_blob_shared(blob, bloblen, &key);
+	if (r != 0)
 		fatal("%s: cannot parse key: %s", __func__, ssh_err(r));
 
 	if ((compat20 && type == MM_RSAHOSTKEY) ||
@@ -1042,7 +1051,7 @@ mm_answer_keyverify(int sock, Buffer *m)
 	  !monitor_allowed_key(blob, bloblen))
 		fatal("%s: bad key, not previously allowed", __func__);
 
-	if ((r = sshkey_from_blob(blob, bloblen, &key)) != 0)
+	if ((r = sshkey_from_blob_shared(blob, bloblen, &key)) != 0)
 		fatal("%s: bad public key blob: %s", __func__, ssh_err(r));
 
 	switch (key_blobtype) {
@@ -1419,6 +1428,7 @@ monitor_apply_keystate(struct monitor *pmonitor)
 		kex->kex[KEX_DH_GEX_SHA1] = kexgex_server;
 		kex->kex[KEX_DH_GEX_SHA256] = kexgex_server;
 		kex->kex[KEX_ECDH_SHA2] = kexecdh_server;
+		kex->kex[KEX_C25519_SHA256] = kexc25519_server;
 		kex->load_host_public_key=&get_hostkey_public_by_type;
 		kex->load_host_private_key=&get_hostkey_private_by_type;
 		kex->host_key_index=&get_hostkey_index;
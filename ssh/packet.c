@@ -46,6 +46,7 @@
 #include <netinet/in_systm.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 #include <errno.h>
 #include <stdarg.h>
@@ -75,6 +76,7 @@
 #include "packet.h"
 #include "roaming.h"
 #include "err.h"
+#include "probe.h"
 
 #ifdef PACKET_DEBUG
 #define DBG(x) x
@@ -84,6 +86,37 @@
 
 #define PACKET_MAX_SIZE (256 * 1024)
 
+/*
+ * In large-packet mode ssh_packet_set_maxsize() raises the maximum SSH2
+ * payload up to PACKET_MAX_SIZE; incoming packets may then exceed
+ * PACKET_MAX_SIZE by the packet and channel headers and padding.
+ */
+#define PACKET_MAX_HEADROOM	1024
+#define PACKET_MAX_IN(state) \
+	MAX(PACKET_MAX_SIZE, (state)->max_packet_size + PACKET_MAX_HEADROOM)
+
+/*
+ * Outgoing SSH2 connection layer packets are kept in plaintext, sorted
+ * into priority classes, and only encrypted when the connection can take
+ * them.  At most PACKET_ENCRYPT_CHUNK bytes are encrypted ahead of the
+ * socket, so a packet of a higher class never waits behind more than one
+ * chunk of bulk data.  Channel packets with a payload of at most
+ * PACKET_INTERACTIVE_MAX bytes count as interactive.
+ */
+#define PACKET_PRIO_CONTROL	0	/* window adjust, channel open, ... */
+#define PACKET_PRIO_INTERACTIVE	1	/* small channel packets */
+#define PACKET_PRIO_BULK	2	/* everything else */
+#define PACKET_PRIO_MAX		3
+
+#define PACKET_ENCRYPT_CHUNK	(64 * 1024)
+#define PACKET_INTERACTIVE_MAX	512
+
+/* zlib memory use with default parameters, see zconf.h */
+#define PACKET_DEFLATE_MEM \
+	((1 << (MAX_WBITS + 2)) + (1 << (8 + 9)) + 6 * 1024)
+#define PACKET_INFLATE_MEM \
+	((1 << MAX_WBITS) + 7 * 1024)
+
 struct packet_state {
 	u_int32_t seqnr;
 	u_int32_t packets;
@@ -139,6 +172,15 @@ struct session_state {
 	int compression_in_failures;
 	int compression_out_failures;
 
+	/*
+	 * Outgoing compression level.  When the connection goes idle the
+	 * deflate state is released after a sync flush and restarted as a
+	 * raw deflate stream with the next packet.
+	 */
+	int compression_out_level;
+	int compression_out_release;
+	int compression_out_idle;
+
 	/*
 	 * Flag indicating whether packet compression/decompression is
 	 * enabled.
@@ -199,6 +241,19 @@ struct session_state {
 	int cipher_warning_done;
 
 	TAILQ_HEAD(, packet) outgoing;
+
+	/* Plaintext packets waiting for encryption, by priority class */
+	TAILQ_HEAD(, packet) prio[PACKET_PRIO_MAX];
+	size_t prio_bytes;
+
+	/* Transport socket tuning, see ssh_packet_tune_socket() */
+	int tcp_cork, corked_now;
+	int notsent_lowat;
+	int sndbuf, rcvbuf;
+	u_int64_t writes, writes_blocked, corked;
+
+	/* libcrypto scratch space for this connection, see ssh_packet_bn_ctx */
+	BN_CTX *bn_ctx;
 };
 
 struct ssh *
@@ -206,6 +261,7 @@ ssh_alloc_session_state(void)
 {
 	struct ssh *ssh;
 	struct session_state *state;
+	u_int i;
 
 	if ((ssh = calloc(1, sizeof(*ssh))) == NULL ||
 	    (ssh->state = state = calloc(1, sizeof(*state))) == NULL) {
@@ -224,6 +280,8 @@ ssh_alloc_session_state(void)
 		    (state->incoming_packet = sshbuf_new()) == NULL)
 			goto fail;
 		TAILQ_INIT(&state->outgoing);
+		for (i = 0; i < PACKET_PRIO_MAX; i++)
+			TAILQ_INIT(&state->prio[i]);
 		TAILQ_INIT(&ssh->private_keys);
 		TAILQ_INIT(&ssh->public_keys);
 		state->p_send.packets = state->p_read.packets = 0;
@@ -381,6 +439,21 @@ ssh_packet_get_bytes(struct ssh *ssh, u_int64_t *ibytes, u_int64_t *obytes)
 		*obytes = ssh->state->p_send.bytes;
 }
 
+/* Returns the socket write counters that ssh_packet_close() logs */
+void
+ssh_packet_get_write_stats(struct ssh *ssh, u_int64_t *writes,
+    u_int64_t *blocked, u_int64_t *corked)
+{
+	if (writes)
+		*writes = ssh->state->writes;
+	if (blocked)
+		*blocked = ssh->state->writes_blocked;
+	if (corked)
+		*corked = ssh->state->corked;
+}
+
+static int resume_compression_out(struct ssh *);
+
 /* Serialise compression state into a blob for privsep */
 static int
 ssh_packet_get_compress_state(struct sshbuf *m, struct ssh *ssh)
@@ -389,6 +462,9 @@ ssh_packet_get_compress_state(struct sshbuf *m, struct ssh *ssh)
 	struct sshbuf *b;
 	int r;
 
+	if (state->compression_out_idle &&
+	    (r = resume_compression_out(ssh)) != 0)
+		return r;
 	if ((b = sshbuf_new()) == NULL)
 		return SSH_ERR_ALLOC_FAIL;
 	if (state->compression_in_started) {
@@ -505,6 +581,22 @@ ssh_packet_get_connection_out(struct ssh *ssh)
 	return ssh->state->connection_out;
 }
 
+/*
+ * Returns a BN_CTX that lives as long as the connection, so that encoding
+ * and decoding EC points does not allocate one every time.  NULL if it
+ * could not be allocated, which libcrypto treats as "allocate your own".
+ */
+
+BN_CTX *
+ssh_packet_bn_ctx(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+
+	if (state->bn_ctx == NULL)
+		state->bn_ctx = BN_CTX_new();
+	return state->bn_ctx;
+}
+
 /*
  * Returns the IP-address of the remote host as a string.  The returned
  * string must not be freed.
@@ -529,12 +621,20 @@ void
 ssh_packet_close(struct ssh *ssh)
 {
 	struct session_state *state = ssh->state;
+	struct packet *p;
 	int r;
-	u_int mode;
+	u_int mode, i;
 
 	if (!state->initialized)
 		return;
 	state->initialized = 0;
+	if (state->writes != 0)
+		debug("socket: %llu writes, %llu blocked, %llu corked; "
+		    "sndbuf %d rcvbuf %d notsent_lowat %d",
+		    (unsigned long long)state->writes,
+		    (unsigned long long)state->writes_blocked,
+		    (unsigned long long)state->corked,
+		    state->sndbuf, state->rcvbuf, state->notsent_lowat);
 	if (state->connection_in == state->connection_out) {
 		shutdown(state->connection_out, SHUT_RDWR);
 		close(state->connection_out);
@@ -546,6 +646,17 @@ ssh_packet_close(struct ssh *ssh)
 	sshbuf_free(state->output);
 	sshbuf_free(state->outgoing_packet);
 	sshbuf_free(state->incoming_packet);
+	if (state->bn_ctx != NULL) {
+		BN_CTX_free(state->bn_ctx);
+		state->bn_ctx = NULL;
+	}
+	for (i = 0; i < PACKET_PRIO_MAX; i++) {
+		while ((p = TAILQ_FIRST(&state->prio[i])) != NULL) {
+			TAILQ_REMOVE(&state->prio[i], p, next);
+			sshbuf_free(p->payload);
+			free(p);
+		}
+	}
 	for (mode = 0; mode < MODE_MAX; mode++)
 		kex_free_newkeys(state->newkeys[mode]);
 	if (state->compression_buffer) {
@@ -558,7 +669,8 @@ ssh_packet_close(struct ssh *ssh)
 		    		(unsigned long long)stream->total_out,
 		    		stream->total_in == 0 ? 0.0 :
 		    		(double) stream->total_out / stream->total_in);
-			if (state->compression_out_failures == 0)
+			if (state->compression_out_failures == 0 &&
+			    !state->compression_out_idle)
 				deflateEnd(stream);
 		}
 		if (state->compression_in_started) {
@@ -621,11 +733,15 @@ start_compression_out(struct ssh *ssh, int level)
 	if (level < 1 || level > 9)
 		return SSH_ERR_INVALID_ARGUMENT;
 	debug("Enabling compression at level %d.", level);
-	if (ssh->state->compression_out_started == 1)
+	if (ssh->state->compression_out_started == 1 &&
+	    !ssh->state->compression_out_idle)
 		deflateEnd(&ssh->state->compression_out_stream);
+	ssh->state->compression_out_idle = 0;
+	ssh->state->compression_out_release = 0;
 	switch (deflateInit(&ssh->state->compression_out_stream, level)) {
 	case Z_OK:
 		ssh->state->compression_out_started = 1;
+		ssh->state->compression_out_level = level;
 		break;
 	case Z_MEM_ERROR:
 		return SSH_ERR_ALLOC_FAIL;
@@ -667,12 +783,35 @@ ssh_packet_start_compression(struct ssh *ssh, int level)
 	return 0;
 }
 
+/*
+ * Restart compression after an idle period.  The previous stream ended
+ * with a sync flush on a byte boundary, and the peer never sees the end
+ * of the zlib stream, so raw deflate output continues it seamlessly.
+ */
+static int
+resume_compression_out(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+
+	switch (deflateInit2(&state->compression_out_stream,
+	    state->compression_out_level, Z_DEFLATED, -MAX_WBITS, 8,
+	    Z_DEFAULT_STRATEGY)) {
+	case Z_OK:
+		state->compression_out_idle = 0;
+		return 0;
+	case Z_MEM_ERROR:
+		return SSH_ERR_ALLOC_FAIL;
+	default:
+		return SSH_ERR_INTERNAL_ERROR;
+	}
+}
+
 /* XXX remove need for separate compression buffer */
 static int
 compress_buffer(struct ssh *ssh, struct sshbuf *in, struct sshbuf *out)
 {
 	u_char buf[4096];
-	int r, status;
+	int r, status, flush;
 
 	if (ssh->state->compression_out_started != 1)
 		return SSH_ERR_INTERNAL_ERROR;
@@ -681,6 +820,12 @@ compress_buffer(struct ssh *ssh, struct sshbuf *in, struct sshbuf *out)
 	if (sshbuf_len(in) == 0)
 		return 0;
 
+	if (ssh->state->compression_out_idle &&
+	    (r = resume_compression_out(ssh)) != 0)
+		return r;
+	flush = ssh->state->compression_out_release ?
+	    Z_SYNC_FLUSH : Z_PARTIAL_FLUSH;
+
 	/* Input is the contents of the input buffer. */
 	ssh->state->compression_out_stream.next_in = sshbuf_ptr(in);
 	ssh->state->compression_out_stream.avail_in = sshbuf_len(in);
@@ -692,8 +837,7 @@ compress_buffer(struct ssh *ssh, struct sshbuf *in, struct sshbuf *out)
 		ssh->state->compression_out_stream.avail_out = sizeof(buf);
 
 		/* Compress as much data into the buffer as possible. */
-		status = deflate(&ssh->state->compression_out_stream,
-		    Z_PARTIAL_FLUSH);
+		status = deflate(&ssh->state->compression_out_stream, flush);
 		switch (status) {
 		case Z_MEM_ERROR:
 			return SSH_ERR_ALLOC_FAIL;
@@ -709,6 +853,11 @@ compress_buffer(struct ssh *ssh, struct sshbuf *in, struct sshbuf *out)
 			return SSH_ERR_INVALID_FORMAT;
 		}
 	} while (ssh->state->compression_out_stream.avail_out == 0);
+	if (ssh->state->compression_out_release) {
+		deflateEnd(&ssh->state->compression_out_stream);
+		ssh->state->compression_out_release = 0;
+		ssh->state->compression_out_idle = 1;
+	}
 	return 0;
 }
 
@@ -1201,6 +1350,7 @@ ssh_packet_send2_wrapped(struct ssh *ssh)
 	POKE_U32(cp, packet_length);
 	cp[4] = padlen;
 	DBG(debug("send: len %d (includes padlen %d)", packet_length+4, padlen));
+	SSH_PROBE3(packet__send, type, packet_length + 4, state->p_send.seqnr);
 
 	/* compute MAC over seqnr and packet(length fields, payload, padding) */
 	if (mac && mac->enabled) {
@@ -1247,6 +1397,132 @@ ssh_packet_send2_wrapped(struct ssh *ssh)
 	return r;
 }
 
+/* Returns the recipient channel of a channel packet or -1 */
+static int64_t
+packet_channel(struct sshbuf *b)
+{
+	u_char *cp = sshbuf_ptr(b);
+
+	if (sshbuf_len(b) < 10)
+		return -1;
+	return PEEK_U32(cp + 6);
+}
+
+/*
+ * Queue the plaintext packet in state->outgoing_packet for late
+ * encryption.  Packets of one channel must not overtake each other, so a
+ * channel packet that would be interactive goes to the bulk class while
+ * bulk data for the same channel is still queued.
+ */
+static int
+ssh_packet_enqueue_prio(struct ssh *ssh, u_char type)
+{
+	struct session_state *state = ssh->state;
+	struct packet *p;
+	size_t len = sshbuf_len(state->outgoing_packet);
+	int64_t channel;
+	int prio;
+
+	switch (type) {
+	case SSH2_MSG_CHANNEL_DATA:
+	case SSH2_MSG_CHANNEL_EXTENDED_DATA:
+	case SSH2_MSG_CHANNEL_EOF:
+	case SSH2_MSG_CHANNEL_CLOSE:
+	case SSH2_MSG_CHANNEL_REQUEST:
+		prio = PACKET_PRIO_BULK;
+		if (len - 6 > PACKET_INTERACTIVE_MAX)
+			break;
+		prio = PACKET_PRIO_INTERACTIVE;
+		channel = packet_channel(state->outgoing_packet);
+		TAILQ_FOREACH(p, &state->prio[PACKET_PRIO_BULK], next) {
+			if (p->type >= SSH2_MSG_CHANNEL_DATA &&
+			    p->type <= SSH2_MSG_CHANNEL_REQUEST &&
+			    packet_channel(p->payload) == channel) {
+				prio = PACKET_PRIO_BULK;
+				break;
+			}
+		}
+		break;
+	case SSH2_MSG_GLOBAL_REQUEST:
+	case SSH2_MSG_REQUEST_SUCCESS:
+	case SSH2_MSG_REQUEST_FAILURE:
+	case SSH2_MSG_CHANNEL_OPEN:
+	case SSH2_MSG_CHANNEL_OPEN_CONFIRMATION:
+	case SSH2_MSG_CHANNEL_OPEN_FAILURE:
+	case SSH2_MSG_CHANNEL_WINDOW_ADJUST:
+	case SSH2_MSG_CHANNEL_SUCCESS:
+	case SSH2_MSG_CHANNEL_FAILURE:
+		prio = PACKET_PRIO_CONTROL;
+		break;
+	default:
+		prio = PACKET_PRIO_BULK;
+		break;
+	}
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	p->type = type;
+	p->payload = state->outgoing_packet;
+	if ((state->outgoing_packet = sshbuf_new()) == NULL) {
+		state->outgoing_packet = p->payload;
+		free(p);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	TAILQ_INSERT_TAIL(&state->prio[prio], p, next);
+	state->prio_bytes += len;
+	return 0;
+}
+
+/*
+ * Encrypt queued packets, highest priority first, into the output buffer
+ * until it holds at least PACKET_ENCRYPT_CHUNK bytes, or until the queues
+ * are empty if 'all' is set.  Sequence numbers are assigned here, so they
+ * follow the order in which packets go out.
+ */
+int
+ssh_packet_encrypt_queued(struct ssh *ssh, int all)
+{
+	struct session_state *state = ssh->state;
+	struct packet *p;
+	struct sshbuf *b;
+	u_int i;
+	int r;
+
+	for (i = 0; i < PACKET_PRIO_MAX; i++) {
+		while ((p = TAILQ_FIRST(&state->prio[i])) != NULL) {
+			if (!all &&
+			    sshbuf_len(state->output) >= PACKET_ENCRYPT_CHUNK)
+				return 0;
+			TAILQ_REMOVE(&state->prio[i], p, next);
+			state->prio_bytes -= sshbuf_len(p->payload);
+			b = state->outgoing_packet;
+			state->outgoing_packet = p->payload;
+			r = ssh_packet_send2_wrapped(ssh);
+			state->outgoing_packet = b;
+			sshbuf_free(p->payload);
+			free(p);
+			if (r != 0)
+				return r;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Connection layer packets are queued by priority.  Transport and
+ * authentication packets are sent in order, after everything queued.
+ */
+static int
+ssh_packet_schedule(struct ssh *ssh, u_char type)
+{
+	int r;
+
+	if (type >= SSH2_MSG_CONNECTION_MIN)
+		return ssh_packet_enqueue_prio(ssh, type);
+	if ((r = ssh_packet_encrypt_queued(ssh, 1)) != 0)
+		return r;
+	return ssh_packet_send2_wrapped(ssh);
+}
+
 int
 ssh_packet_send2(struct ssh *ssh)
 {
@@ -1282,7 +1558,7 @@ ssh_packet_send2(struct ssh *ssh)
 	if (type == SSH2_MSG_KEXINIT)
 		state->rekeying = 1;
 
-	if ((r = ssh_packet_send2_wrapped(ssh)) != 0)
+	if ((r = ssh_packet_schedule(ssh, type)) != 0)
 		return r;
 
 	/* after a NEWKEYS message we can send the complete queue */
@@ -1295,7 +1571,7 @@ ssh_packet_send2(struct ssh *ssh)
 			state->outgoing_packet = p->payload;
 			TAILQ_REMOVE(&state->outgoing, p, next);
 			free(p);
-			if ((r = ssh_packet_send2_wrapped(ssh)) != 0)
+			if ((r = ssh_packet_schedule(ssh, type)) != 0)
 				return r;
 		}
 	}
@@ -1605,7 +1881,7 @@ ssh_packet_read_poll2(struct ssh *ssh, u_char *typep, u_int32_t *seqnr_p)
 		cp = sshbuf_ptr(state->incoming_packet);
 		state->packlen = PEEK_U32(cp);
 		if (state->packlen < 1 + 4 ||
-		    state->packlen > PACKET_MAX_SIZE) {
+		    state->packlen > PACKET_MAX_IN(state)) {
 #ifdef PACKET_DEBUG
 			fprintf(stderr, "input: \n");
 			sshbuf_dump(state->input, stderr);
@@ -1660,10 +1936,12 @@ ssh_packet_read_poll2(struct ssh *ssh, u_char *typep, u_int32_t *seqnr_p)
 		if (timingsafe_bcmp(macbuf, sshbuf_ptr(state->input),
 		    mac->mac_len) != 0) {
 			logit("Corrupted MAC on input.");
-			if (need > PACKET_MAX_SIZE)
+			if (need > PACKET_MAX_IN(state))
 				return SSH_ERR_INTERNAL_ERROR;
+			/* large packets are already past the discard length */
 			return ssh_packet_start_discard(ssh, enc, mac,
-			    state->packlen, PACKET_MAX_SIZE - need);
+			    state->packlen, need > PACKET_MAX_SIZE ?
+			    0 : PACKET_MAX_SIZE - need);
 		}
 				
 		DBG(debug("MAC #%d ok", state->p_read.seqnr));
@@ -1717,6 +1995,8 @@ ssh_packet_read_poll2(struct ssh *ssh, u_char *typep, u_int32_t *seqnr_p)
 	if (*typep < SSH2_MSG_MIN || *typep >= SSH2_MSG_LOCAL_MIN)
 		ssh_packet_disconnect(ssh,
 		    "Invalid ssh2 packet type: %d", *typep);
+	SSH_PROBE3(packet__recv, *typep, state->packlen + 4,
+	    state->p_read.seqnr - 1);
 	if (*typep == SSH2_MSG_NEWKEYS)
 		r = ssh_set_newkeys(ssh, MODE_IN);
 	else if (*typep == SSH2_MSG_USERAUTH_SUCCESS && !state->server_side)
@@ -2045,28 +2325,69 @@ ssh_packet_disconnect(struct ssh *ssh, const char *fmt,...)
 	cleanup_exit(255);
 }
 
-/* Checks if there is any buffered output, and tries to write some of the output. */
+/*
+ * Checks if there is any buffered output, and tries to write some of the
+ * output.  Queued packets are encrypted a chunk at a time for as long as
+ * the connection accepts everything written.
+ */
+
+static void
+ssh_packet_set_cork(struct ssh *ssh, int on)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+	int fd = ssh->state->connection_out;
+#ifdef TCP_CORK
+	if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1)
+#else
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on)) == -1)
+#endif
+		debug2("%s: setsockopt %d: %.100s", __func__, on,
+		    strerror(errno));
+#endif
+}
 
 void
 ssh_packet_write_poll(struct ssh *ssh)
 {
 	struct session_state *state = ssh->state;
-	int len = sshbuf_len(state->output);
-	int cont, r;
-
-	if (len > 0) {
+	int len, cont, r;
+
+	/* cork the socket while the pending output takes more than one write */
+	if (state->tcp_cork && !state->corked_now && state->prio_bytes +
+	    sshbuf_len(state->output) > PACKET_ENCRYPT_CHUNK) {
+		ssh_packet_set_cork(ssh, 1);
+		state->corked_now = 1;
+		state->corked++;
+	}
+	for (;;) {
+		if ((r = ssh_packet_encrypt_queued(ssh, 0)) != 0)
+			fatal("%s: %s", __func__, ssh_err(r));
+		if ((len = sshbuf_len(state->output)) == 0)
+			break;
 		cont = 0;
+		state->writes++;
 		len = roaming_write(state->connection_out,
 		    sshbuf_ptr(state->output), len, &cont);
 		if (len == -1) {
-			if (errno == EINTR || errno == EAGAIN)
-				return;
+			if (errno == EINTR || errno == EAGAIN) {
+				state->writes_blocked++;
+				break;
+			}
 			fatal("Write failed: %.100s", strerror(errno));
 		}
 		if (len == 0 && !cont)
 			fatal("Write connection closed");
 		if ((r = sshbuf_consume(state->output, len)) != 0)
 			fatal("%s: %s", __func__, ssh_err(r));
+		if (sshbuf_len(state->output) != 0) {
+			state->writes_blocked++;
+			break;
+		}
+	}
+	/* a blocked or partial write keeps it corked until the queue drains */
+	if (state->corked_now && !ssh_packet_have_data_to_write(ssh)) {
+		ssh_packet_set_cork(ssh, 0);
+		state->corked_now = 0;
 	}
 }
 
@@ -2130,7 +2451,16 @@ ssh_packet_write_wait(struct ssh *ssh)
 int
 ssh_packet_have_data_to_write(struct ssh *ssh)
 {
-	return sshbuf_len(ssh->state->output) != 0;
+	return sshbuf_len(ssh->state->output) != 0 ||
+	    ssh->state->prio_bytes != 0;
+}
+
+/* Returns the number of bytes buffered or queued for the connection. */
+
+size_t
+ssh_packet_output_pending(struct ssh *ssh)
+{
+	return sshbuf_len(ssh->state->output) + ssh->state->prio_bytes;
 }
 
 /* Returns true if there is not too much data to write to the connection. */
@@ -2138,10 +2468,77 @@ ssh_packet_have_data_to_write(struct ssh *ssh)
 int
 ssh_packet_not_very_much_data_to_write(struct ssh *ssh)
 {
+	size_t len = sshbuf_len(ssh->state->output) + ssh->state->prio_bytes;
+
 	if (ssh->state->interactive_mode)
-		return sshbuf_len(ssh->state->output) < 16384;
+		return len < 16384;
 	else
-		return sshbuf_len(ssh->state->output) < 128 * 1024;
+		return len < 128 * 1024;
+}
+
+/*
+ * Releases memory an idle connection does not need: buffers that grew
+ * during a burst are shrunk and outgoing compression is paused (the
+ * deflate state is the bulk of a compressed connection's footprint).
+ * Pausing compression sends an SSH2_MSG_IGNORE carrying the sync flush.
+ */
+int
+ssh_packet_idle(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+	Comp *comp = NULL;
+	int r;
+
+	if (state->newkeys[MODE_OUT] != NULL)
+		comp = &state->newkeys[MODE_OUT]->comp;
+	if (compat20 && comp != NULL && comp->enabled && !state->rekeying &&
+	    state->compression_out_started && !state->compression_out_idle &&
+	    state->compression_out_failures == 0) {
+		state->compression_out_release = 1;
+		if ((r = sshpkt_start(ssh, SSH2_MSG_IGNORE)) != 0 ||
+		    (r = sshpkt_put_string(ssh, NULL, 0)) != 0 ||
+		    (r = sshpkt_send(ssh)) != 0)
+			return r;
+	}
+	if ((r = sshbuf_shrink(state->input)) != 0 ||
+	    (r = sshbuf_shrink(state->output)) != 0 ||
+	    (r = sshbuf_shrink(state->incoming_packet)) != 0 ||
+	    (r = sshbuf_shrink(state->outgoing_packet)) != 0)
+		return r;
+	if (state->compression_buffer != NULL)
+		sshbuf_reset(state->compression_buffer);
+	return 0;
+}
+
+/*
+ * Returns an estimate of the memory held by the packet layer of this
+ * connection, including buffers, queued packets and zlib state.
+ */
+size_t
+ssh_packet_get_memory(struct ssh *ssh)
+{
+	struct session_state *state = ssh->state;
+	struct packet *p;
+	size_t len;
+	u_int i;
+
+	len = sizeof(*ssh) + sizeof(*state) +
+	    sshbuf_allocated(state->input) +
+	    sshbuf_allocated(state->output) +
+	    sshbuf_allocated(state->outgoing_packet) +
+	    sshbuf_allocated(state->incoming_packet);
+	if (state->compression_buffer != NULL)
+		len += sshbuf_allocated(state->compression_buffer);
+	if (state->compression_out_started && !state->compression_out_idle)
+		len += PACKET_DEFLATE_MEM;
+	if (state->compression_in_started)
+		len += PACKET_INFLATE_MEM;
+	TAILQ_FOREACH(p, &state->outgoing, next)
+		len += sizeof(*p) + sshbuf_allocated(p->payload);
+	for (i = 0; i < PACKET_PRIO_MAX; i++)
+		TAILQ_FOREACH(p, &state->prio[i], next)
+			len += sizeof(*p) + sshbuf_allocated(p->payload);
+	return len;
 }
 
 void
@@ -2167,6 +2564,62 @@ ssh_packet_set_tos(struct ssh *ssh, int tos)
 	}
 }
 
+/*
+ * Tunes the transport socket.  notsent_lowat limits how much written but
+ * unsent data the kernel holds (TCP_NOTSENT_LOWAT), so outgoing packets
+ * wait in the priority queues instead, where interactive packets can
+ * still overtake bulk data.  With cork set, TCP_CORK/TCP_NOPUSH is set
+ * when more than one encryption chunk is pending and cleared once all
+ * output has been written, to avoid partial segments.  bufsize sets
+ * SO_SNDBUF and SO_RCVBUF.  Zero values leave the kernel defaults.
+ */
+void
+ssh_packet_tune_socket(struct ssh *ssh, int notsent_lowat, int cork,
+    int bufsize)
+{
+	struct session_state *state = ssh->state;
+	socklen_t len;
+
+	if (!ssh_packet_connection_is_on_socket(ssh))
+		return;
+	state->tcp_cork = cork;
+#ifdef TCP_NOTSENT_LOWAT
+	if (notsent_lowat > 0) {
+		debug3("%s: set TCP_NOTSENT_LOWAT %d", __func__, notsent_lowat);
+		if (setsockopt(state->connection_out, IPPROTO_TCP,
+		    TCP_NOTSENT_LOWAT, &notsent_lowat,
+		    sizeof(notsent_lowat)) == -1)
+			error("setsockopt TCP_NOTSENT_LOWAT %d: %.100s",
+			    notsent_lowat, strerror(errno));
+		else
+			state->notsent_lowat = notsent_lowat;
+	}
+#else
+	if (notsent_lowat > 0)
+		debug("%s: TCP_NOTSENT_LOWAT not supported", __func__);
+#endif
+	if (bufsize > 0) {
+		debug3("%s: set SO_SNDBUF/SO_RCVBUF %d", __func__, bufsize);
+		if (setsockopt(state->connection_out, SOL_SOCKET, SO_SNDBUF,
+		    &bufsize, sizeof(bufsize)) == -1)
+			error("setsockopt SO_SNDBUF %d: %.100s",
+			    bufsize, strerror(errno));
+		if (setsockopt(state->connection_in, SOL_SOCKET, SO_RCVBUF,
+		    &bufsize, sizeof(bufsize)) == -1)
+			error("setsockopt SO_RCVBUF %d: %.100s",
+			    bufsize, strerror(errno));
+	}
+	/* record what the kernel actually uses */
+	len = sizeof(state->sndbuf);
+	if (getsockopt(state->connection_out, SOL_SOCKET, SO_SNDBUF,
+	    &state->sndbuf, &len) == -1)
+		state->sndbuf = -1;
+	len = sizeof(state->rcvbuf);
+	if (getsockopt(state->connection_in, SOL_SOCKET, SO_RCVBUF,
+	    &state->rcvbuf, &len) == -1)
+		state->rcvbuf = -1;
+}
+
 /* Informs that the current session is interactive.  Sets IP flags for that. */
 
 void
@@ -2197,6 +2650,12 @@ ssh_packet_is_interactive(struct ssh *ssh)
 	return ssh->state->interactive_mode;
 }
 
+/*
+ * Sets the maximum packet size.  For SSH2, sizes above the 32KB default
+ * enable large-packet mode: session and tcp channels opened afterwards
+ * advertise the larger maximum, and incoming packets up to this size are
+ * accepted.  The peer only sends such packets if it does the same.
+ */
 int
 ssh_packet_set_maxsize(struct ssh *ssh, u_int s)
 {
@@ -2207,7 +2666,7 @@ ssh_packet_set_maxsize(struct ssh *ssh, u_int s)
 		    state->max_packet_size, s);
 		return -1;
 	}
-	if (s < 4 * 1024 || s > 1024 * 1024) {
+	if (s < 4 * 1024 || s > (compat20 ? PACKET_MAX_SIZE : 1024 * 1024)) {
 		logit("packet_set_maxsize: bad size %d", s);
 		return -1;
 	}
@@ -2467,6 +2926,9 @@ ssh_packet_get_state(struct ssh *ssh, struct sshbuf *m)
 	size_t slen, rlen;
 	int r, ssh1cipher;
 
+	/* the peer expects the sequence numbers of what we already sent */
+	if ((r = ssh_packet_encrypt_queued(ssh, 1)) != 0)
+		return r;
 	if (!compat20) {
 		ssh1cipher = cipher_get_number(state->receive_context.cipher);
 		slen = cipher_get_keyiv_len(&state->send_context);
@@ -2706,6 +3168,127 @@ ssh_packet_set_state(struct ssh *ssh, struct sshbuf *m)
 	return 0;
 }
 
+/*
+ * Connection handoff: serialise everything needed to resume an SSH2
+ * connection in another process.  This is the privsep packet state plus
+ * the state privsep does not need: queued outgoing packets, a partially
+ * decrypted incoming packet and the flags ssh_packet_set_state() assumes.
+ *
+ * A connection can only be handed off between key exchanges or while we
+ * wait for the peer's KEXINIT, and not while compression is enabled:
+ * neither ephemeral kex secrets nor zlib streams can be moved to another
+ * address space.
+ */
+int
+ssh_packet_get_handoff_state(struct ssh *ssh, struct sshbuf *m)
+{
+	struct session_state *state = ssh->state;
+	struct packet *p;
+	struct sshbuf *b;
+	u_int mode, nqueued = 0;
+	int r;
+
+	if (!compat20 || ssh->kex == NULL || state->packet_discard)
+		return SSH_ERR_INVALID_ARGUMENT;
+	for (mode = 0; mode < MODE_MAX; mode++) {
+		if (state->newkeys[mode] == NULL)
+			return SSH_ERR_KEX_IN_PROGRESS;
+		if (state->newkeys[mode]->comp.enabled)
+			return SSH_ERR_INVALID_ARGUMENT;
+	}
+	if (!ssh->kex->done && sshbuf_len(ssh->kex->peer) != 0)
+		return SSH_ERR_KEX_IN_PROGRESS;
+
+	if ((b = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = ssh_packet_get_state(ssh, b)) != 0 ||
+	    (r = sshbuf_put_stringb(m, b)) != 0)
+		goto out;
+	TAILQ_FOREACH(p, &state->outgoing, next)
+		nqueued++;
+	if ((r = sshbuf_put_u32(m, ssh->compat)) != 0 ||
+	    (r = sshbuf_put_u32(m, ssh->kex->server)) != 0 ||
+	    (r = sshbuf_put_u32(m, ssh->kex->done)) != 0 ||
+	    (r = sshbuf_put_u32(m, state->after_authentication)) != 0 ||
+	    (r = sshbuf_put_u32(m, state->rekeying)) != 0 ||
+	    (r = sshbuf_put_u32(m, state->max_packet_size)) != 0 ||
+	    (r = sshbuf_put_u32(m, state->packlen)) != 0)
+		goto out;
+	/* first block of the current input packet is already decrypted */
+	if (state->packlen != 0)
+		r = sshbuf_put_stringb(m, state->incoming_packet);
+	else
+		r = sshbuf_put_string(m, NULL, 0);
+	if (r != 0 || (r = sshbuf_put_u32(m, nqueued)) != 0)
+		goto out;
+	TAILQ_FOREACH(p, &state->outgoing, next) {
+		if ((r = sshbuf_put_u8(m, p->type)) != 0 ||
+		    (r = sshbuf_put_stringb(m, p->payload)) != 0)
+			goto out;
+	}
+	r = 0;
+ out:
+	sshbuf_free(b);
+	return r;
+}
+
+/* Resume a connection from a ssh_packet_get_handoff_state() blob */
+int
+ssh_packet_set_handoff_state(struct ssh *ssh, struct sshbuf *m)
+{
+	struct session_state *state = ssh->state;
+	struct packet *p;
+	struct sshbuf *b;
+	u_int compat, server, done, authenticated, rekeying, nqueued, i;
+	int r;
+
+	if (!compat20)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((b = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = sshbuf_get_stringb(m, b)) != 0 ||
+	    (r = ssh_packet_set_state(ssh, b)) != 0)
+		goto out;
+	if ((r = sshbuf_get_u32(m, &compat)) != 0 ||
+	    (r = sshbuf_get_u32(m, &server)) != 0 ||
+	    (r = sshbuf_get_u32(m, &done)) != 0 ||
+	    (r = sshbuf_get_u32(m, &authenticated)) != 0 ||
+	    (r = sshbuf_get_u32(m, &rekeying)) != 0 ||
+	    (r = sshbuf_get_u32(m, &state->max_packet_size)) != 0 ||
+	    (r = sshbuf_get_u32(m, &state->packlen)) != 0)
+		goto out;
+	ssh->compat = compat;
+	ssh->kex->server = state->server_side = server;
+	ssh->kex->done = done;
+	state->after_authentication = authenticated;
+	state->rekeying = rekeying;
+	sshbuf_reset(state->incoming_packet);
+	if ((r = sshbuf_get_stringb(m, state->incoming_packet)) != 0 ||
+	    (r = sshbuf_get_u32(m, &nqueued)) != 0)
+		goto out;
+	for (i = 0; i < nqueued; i++) {
+		if ((p = calloc(1, sizeof(*p))) == NULL ||
+		    (p->payload = sshbuf_new()) == NULL) {
+			free(p);
+			r = SSH_ERR_ALLOC_FAIL;
+			goto out;
+		}
+		TAILQ_INSERT_TAIL(&state->outgoing, p, next);
+		if ((r = sshbuf_get_u8(m, &p->type)) != 0 ||
+		    (r = sshbuf_get_stringb(m, p->payload)) != 0)
+			goto out;
+	}
+	if (sshbuf_len(m) != 0) {
+		r = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	debug3("%s: resumed with %u queued packets", __func__, nqueued);
+	r = 0;
+ out:
+	sshbuf_free(b);
+	return r;
+}
+
 /* NEW API */
 
 /* put data to the outgoing packet */
@@ -2749,7 +3332,8 @@ sshpkt_put_cstring(struct ssh *ssh, const void *v)
 int
 sshpkt_put_ec(struct ssh *ssh, const EC_POINT *v, const EC_GROUP *g)
 {
-	return sshbuf_put_ec(ssh->state->outgoing_packet, v, g);
+	return sshbuf_put_ec_ctx(ssh->state->outgoing_packet, v, g,
+	    ssh_packet_bn_ctx(ssh));
 }
 
 int
@@ -2805,7 +3389,8 @@ sshpkt_get_cstring(struct ssh *ssh, char **valp, size_t *lenp)
 int
 sshpkt_get_ec(struct ssh *ssh, EC_POINT *v, const EC_GROUP *g)
 {
-	return sshbuf_get_ec(ssh->state->incoming_packet, v, g);
+	return sshbuf_get_ec_ctx(ssh->state->incoming_packet, v, g,
+	    ssh_packet_bn_ctx(ssh));
 }
 
 int
@@ -34,7 +34,12 @@
 struct key_entry {
 	TAILQ_ENTRY(key_entry) next;
 	struct sshkey *key;
+	u_char *blob;		/* cached wire encoding, see ssh_ctx_new() */
+	u_int bloblen;
 };
+TAILQ_HEAD(key_entries, key_entry);
+
+struct ssh_ctx;
 
 struct session_state;	/* private session data */
 
@@ -68,8 +73,11 @@ struct ssh {
 	int compat;
 
 	/* Lists for private and public keys */
-	TAILQ_HEAD(, key_entry) private_keys;
-	TAILQ_HEAD(, key_entry) public_keys;
+	struct key_entries private_keys;
+	struct key_entries public_keys;
+
+	/* Shared context the connection was created from, if any */
+	struct ssh_ctx *ctx;
 };
 
 struct ssh *ssh_alloc_session_state(void);
@@ -82,11 +90,13 @@ void     ssh_packet_set_nonblocking(struct ssh *);
 int      ssh_packet_get_connection_in(struct ssh *);
 int      ssh_packet_get_connection_out(struct ssh *);
 void     ssh_packet_close(struct ssh *);
+BN_CTX	*ssh_packet_bn_ctx(struct ssh *);
 void	 ssh_packet_set_encryption_key(struct ssh *, const u_char *, u_int, int);
 void     ssh_packet_set_protocol_flags(struct ssh *, u_int);
 u_int	 ssh_packet_get_protocol_flags(struct ssh *);
 int      ssh_packet_start_compression(struct ssh *, int);
 void	 ssh_packet_set_tos(struct ssh *, int);
+void	 ssh_packet_tune_socket(struct ssh *, int, int, int);
 void     ssh_packet_set_interactive(struct ssh *, int, int, int);
 int      ssh_packet_is_interactive(struct ssh *);
 void     ssh_packet_set_server(struct ssh *);
@@ -106,6 +116,7 @@ void     ssh_packet_send(struct ssh *);
 int	 ssh_packet_send1(struct ssh *);
 int	 ssh_packet_send2_wrapped(struct ssh *);
 int	 ssh_packet_send2(struct ssh *);
+int	 ssh_packet_encrypt_queued(struct ssh *, int);
 
 int      ssh_packet_read(struct ssh *);
 void     ssh_packet_read_expect(struct ssh *, int type);
@@ -130,6 +141,8 @@ void     ssh_packet_send_debug(struct ssh *, const char *fmt, ...) __attribute__
 
 int	 ssh_set_newkeys(struct ssh *, int mode);
 void	 ssh_packet_get_bytes(struct ssh *, u_int64_t *, u_int64_t *);
+void	 ssh_packet_get_write_stats(struct ssh *, u_int64_t *, u_int64_t *,
+    u_int64_t *);
 
 typedef void *(ssh_packet_comp_alloc_func)(void *, u_int, u_int);
 typedef void (ssh_packet_comp_free_func)(void *, void *);
@@ -139,7 +152,10 @@ void	 ssh_packet_set_compress_hooks(struct ssh *, void *,
 void     ssh_packet_write_poll(struct ssh *);
 void     ssh_packet_write_wait(struct ssh *);
 int      ssh_packet_have_data_to_write(struct ssh *);
+size_t	 ssh_packet_output_pending(struct ssh *);
 int      ssh_packet_not_very_much_data_to_write(struct ssh *);
+int	 ssh_packet_idle(struct ssh *);
+size_t	 ssh_packet_get_memory(struct ssh *);
 
 int	 ssh_packet_connection_is_on_socket(struct ssh *);
 int	 ssh_packet_remaining(struct ssh *);
@@ -156,6 +172,8 @@ u_int	 ssh_packet_get_maxsize(struct ssh *);
 
 int	 ssh_packet_get_state(struct ssh *, struct sshbuf *);
 int	 ssh_packet_set_state(struct ssh *, struct sshbuf *);
+int	 ssh_packet_get_handoff_state(struct ssh *, struct sshbuf *);
+int	 ssh_packet_set_handoff_state(struct ssh *, struct sshbuf *);
 
 const char *ssh_remote_ipaddr(struct ssh *);
 
@@ -261,8 +279,14 @@ void     packet_set_connection(int, int);
 	ssh_packet_have_data_to_write(active_state)
 #define packet_not_very_much_data_to_write() \
 	ssh_packet_not_very_much_data_to_write(active_state)
+#define packet_idle() \
+	ssh_packet_idle(active_state)
+#define packet_get_memory() \
+	ssh_packet_get_memory(active_state)
 #define packet_set_interactive(interactive, qos_interactive, qos_bulk) \
 	ssh_packet_set_interactive(active_state, (interactive), (qos_interactive), (qos_bulk))
+#define packet_tune_socket(lowat, cork, bufsize) \
+	ssh_packet_tune_socket(active_state, (lowat), (cork), (bufsize))
 #define packet_is_interactive() \
 	ssh_packet_is_interactive(active_state)
 #define packet_set_maxsize(s) \
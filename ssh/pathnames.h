@@ -33,6 +33,7 @@
 #define _PATH_HOST_KEY_FILE		SSHDIR "/ssh_host_key"
 #define _PATH_HOST_DSA_KEY_FILE		SSHDIR "/ssh_host_dsa_key"
 #define _PATH_HOST_ECDSA_KEY_FILE	SSHDIR "/ssh_host_ecdsa_key"
+#define _PATH_HOST_ED25519_KEY_FILE	SSHDIR "/ssh_host_ed25519_key"
 #define _PATH_HOST_RSA_KEY_FILE		SSHDIR "/ssh_host_rsa_key"
 #define _PATH_DH_MODULI			ETCDIR "/moduli"
 /* Backwards compatibility */
@@ -68,6 +69,7 @@
 #define _PATH_SSH_CLIENT_IDENTITY	".ssh/identity"
 #define _PATH_SSH_CLIENT_ID_DSA		".ssh/id_dsa"
 #define _PATH_SSH_CLIENT_ID_ECDSA	".ssh/id_ecdsa"
+#define _PATH_SSH_CLIENT_ID_ED25519	".ssh/id_ed25519"
 #define _PATH_SSH_CLIENT_ID_RSA		".ssh/id_rsa"
 
 /*
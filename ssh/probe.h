@@ -0,0 +1,40 @@
+/* $OpenBSD$ */
+/*
+ * Static tracepoints (USDT) for the packet, cipher, kex, channel and
+ * sshbuf hot paths.
+ *
+ * Probes are compiled in only when SSH_PROBES is defined and otherwise
+ * expand to nothing.  When enabled they use the <sys/sdt.h> DTRACE_PROBEn
+ * macros, which emit a single nop plus an ELF note per site, so a probe
+ * that is not attached costs nothing measurable and survives inlining.
+ * All probes belong to the "libssh" provider; see probes/README for the
+ * list of probes and their arguments.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#ifdef SSH_PROBES
+#include <sys/sdt.h>
+
+#define SSH_PROBE0(name) \
+	DTRACE_PROBE(libssh, name)
+#define SSH_PROBE1(name, a) \
+	DTRACE_PROBE1(libssh, name, a)
+#define SSH_PROBE2(name, a, b) \
+	DTRACE_PROBE2(libssh, name, a, b)
+#define SSH_PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(libssh, name, a, b, c)
+#define SSH_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(libssh, name, a, b, c, d)
+#else
+#define SSH_PROBE0(name)
+#define SSH_PROBE1(name, a)
+#define SSH_PROBE2(name, a, b)
+#define SSH_PROBE3(name, a, b, c)
+#define SSH_PROBE4(name, a, b, c, d)
+#endif /* SSH_PROBES */
+
+#endif /* PROBE_H */
@@ -132,6 +132,8 @@ typedef enum {
 	oTunnel, oTunnelDevice, oLocalCommand, oPermitLocalCommand,
 	oVisualHostKey, oUseRoaming, oZeroKnowledgePasswordAuthentication,
 	oKexAlgorithms, oIPQoS, oRequestTTY,
+	oTCPNotSentLowat, oTCPCork, oSocketBufferSize, oKnownHostsIndex,
+	oRevokedHostKeys,
 	oDeprecated, oUnsupported
 } OpCodes;
 
@@ -243,6 +245,11 @@ static struct {
 	{ "kexalgorithms", oKexAlgorithms },
 	{ "ipqos", oIPQoS },
 	{ "requesttty", oRequestTTY },
+	{ "tcpnotsentlowat", oTCPNotSentLowat },
+	{ "tcpcork", oTCPCork },
+	{ "socketbuffersize", oSocketBufferSize },
+	{ "knownhostsindex", oKnownHostsIndex },
+	{ "revokedhostkeys", oRevokedHostKeys },
 
 	{ NULL, oBadOption }
 };
@@ -1016,10 +1023,42 @@ parse_int:
 		}
 		break;
 
+	case oTCPCork:
+		intptr = &options->tcp_cork;
+		goto parse_flag;
+
+	case oTCPNotSentLowat:
+	case oSocketBufferSize:
+		intptr = opcode == oTCPNotSentLowat ?
+		    &options->tcp_notsent_lowat : &options->socket_buffer_size;
+		arg = strdelim(&s);
+		if (!arg || *arg == '\0')
+			fatal("%.200s line %d: Missing argument.",
+			    filename, linenum);
+		if (strcmp(arg, "none") == 0)
+			value = 0;
+		else if (opcode == oSocketBufferSize &&
+		    strcmp(arg, "auto") == 0)
+			value = SSH_SOCKBUF_AUTO;
+		else if ((value = atoi(arg)) <= 0)
+			fatal("%.200s line %d: Bad number '%s'.",
+			    filename, linenum, arg);
+		if (*activep && *intptr == -1)
+			*intptr = value;
+		break;
+
 	case oUseRoaming:
 		intptr = &options->use_roaming;
 		goto parse_flag;
 
+	case oKnownHostsIndex:
+		intptr = &options->known_hosts_index;
+		goto parse_flag;
+
+	case oRevokedHostKeys:
+		charptr = &options->revoked_host_keys;
+		goto parse_string;
+
 	case oRequestTTY:
 		arg = strdelim(&s);
 		if (!arg || *arg == '\0')
@@ -1198,7 +1237,12 @@ initialize_options(Options * options)
 	options->zero_knowledge_password_authentication = -1;
 	options->ip_qos_interactive = -1;
 	options->ip_qos_bulk = -1;
+	options->tcp_notsent_lowat = -1;
+	options->tcp_cork = -1;
+	options->socket_buffer_size = -1;
 	options->request_tty = -1;
+	options->known_hosts_index = -1;
+	options->revoked_host_keys = NULL;
 }
 
 /*
@@ -1300,6 +1344,12 @@ fill_default_options(Options * options)
 			    xmalloc(len);
 			snprintf(options->identity_files[options->num_identity_files++],
 			    len, "~/%.100s", _PATH_SSH_CLIENT_ID_ECDSA);
+
+			len = 2 + strlen(_PATH_SSH_CLIENT_ID_ED25519) + 1;
+			options->identity_files[options->num_identity_files] =
+			    xmalloc(len);
+			snprintf(options->identity_files[options->num_identity_files++],
+			    len, "~/%.100s", _PATH_SSH_CLIENT_ID_ED25519);
 		}
 	}
 	if (options->escape_char == -1)
@@ -1360,13 +1410,22 @@ fill_default_options(Options * options)
 		options->ip_qos_interactive = IPTOS_LOWDELAY;
 	if (options->ip_qos_bulk == -1)
 		options->ip_qos_bulk = IPTOS_THROUGHPUT;
+	if (options->tcp_notsent_lowat == -1)
+		options->tcp_notsent_lowat = 0;
+	if (options->tcp_cork == -1)
+		options->tcp_cork = 0;
+	if (options->socket_buffer_size == -1)
+		options->socket_buffer_size = 0;
 	if (options->request_tty == -1)
 		options->request_tty = REQUEST_TTY_AUTO;
+	if (options->known_hosts_index == -1)
+		options->known_hosts_index = 0;
 	/* options->local_command should not be set by default */
 	/* options->proxy_command should not be set by default */
 	/* options->user will be set in the main program if appropriate */
 	/* options->hostname will be set in the main program if appropriate */
 	/* options->host_key_alias should not be set by default */
+	/* options->revoked_host_keys should not be set by default */
 	/* options->preferred_authentications will be set in ssh */
 }
 
@@ -63,6 +63,9 @@ typedef struct {
 	int     tcp_keep_alive;	/* Set SO_KEEPALIVE. */
 	int	ip_qos_interactive;	/* IP ToS/DSCP/class for interactive */
 	int	ip_qos_bulk;		/* IP ToS/DSCP/class for bulk traffic */
+	int	tcp_notsent_lowat;	/* TCP_NOTSENT_LOWAT, 0 = none */
+	int	tcp_cork;		/* Cork socket while writing bulk */
+	int	socket_buffer_size;	/* SO_SNDBUF/SO_RCVBUF, 0 = none */
 	LogLevel log_level;	/* Level for logging. */
 
 	int     port;		/* Port to connect. */
@@ -123,6 +126,8 @@ typedef struct {
 	int     control_persist_timeout; /* ControlPersist timeout (seconds) */
 
 	int	hash_known_hosts;
+	int	known_hosts_index;	/* use known_hosts sidecar indexes */
+	char	*revoked_host_keys;	/* KRL or list of revoked host keys */
 
 	int	tun_open;	/* tun(4) */
 	int     tun_local;	/* force tun device (optional) */
@@ -107,6 +107,7 @@ initialize_server_options(ServerOptions *options)
 	options->ciphers = NULL;
 	options->macs = NULL;
 	options->kex_algorithms = NULL;
+	options->kex_key_pool = -1;
 	options->protocol = SSH_PROTO_UNKNOWN;
 	options->gateway_ports = -1;
 	options->num_subsystems = 0;
@@ -131,6 +132,9 @@ initialize_server_options(ServerOptions *options)
 	options->authorized_principals_file = NULL;
 	options->ip_qos_interactive = -1;
 	options->ip_qos_bulk = -1;
+	options->tcp_notsent_lowat = -1;
+	options->tcp_cork = -1;
+	options->socket_buffer_size = -1;
 }
 
 void
@@ -150,6 +154,8 @@ fill_default_server_options(ServerOptions *options)
 			    _PATH_HOST_DSA_KEY_FILE;
 			options->host_key_files[options->num_host_key_files++] =
 			    _PATH_HOST_ECDSA_KEY_FILE;
+			options->host_key_files[options->num_host_key_files++] =
+			    _PATH_HOST_ED25519_KEY_FILE;
 		}
 	}
 	/* No certificates by default */
@@ -263,6 +269,14 @@ fill_default_server_options(ServerOptions *options)
 		options->ip_qos_interactive = IPTOS_LOWDELAY;
 	if (options->ip_qos_bulk == -1)
 		options->ip_qos_bulk = IPTOS_THROUGHPUT;
+	if (options->tcp_notsent_lowat == -1)
+		options->tcp_notsent_lowat = 0;
+	if (options->kex_key_pool == -1)
+		options->kex_key_pool = 0;
+	if (options->tcp_cork == -1)
+		options->tcp_cork = 0;
+	if (options->socket_buffer_size == -1)
+		options->socket_buffer_size = 0;
 
 	/* Turn privilege separation on by default */
 	if (use_privsep == -1)
@@ -296,7 +310,8 @@ typedef enum {
 	sUsePrivilegeSeparation, sAllowAgentForwarding,
 	sZeroKnowledgePasswordAuthentication, sHostCertificate,
 	sRevokedKeys, sTrustedUserCAKeys, sAuthorizedPrincipalsFile,
-	sKexAlgorithms, sIPQoS,
+	sKexAlgorithms, sKexKeyPool, sIPQoS,
+	sTCPNotSentLowat, sTCPCork, sSocketBufferSize,
 	sDeprecated, sUnsupported
 } ServerOpCodes;
 
@@ -408,7 +423,11 @@ static struct {
 	{ "trustedusercakeys", sTrustedUserCAKeys, SSHCFG_ALL },
 	{ "authorizedprincipalsfile", sAuthorizedPrincipalsFile, SSHCFG_ALL },
 	{ "kexalgorithms", sKexAlgorithms, SSHCFG_GLOBAL },
+	{ "kexkeypool", sKexKeyPool, SSHCFG_GLOBAL },
 	{ "ipqos", sIPQoS, SSHCFG_ALL },
+	{ "tcpnotsentlowat", sTCPNotSentLowat, SSHCFG_GLOBAL },
+	{ "tcpcork", sTCPCork, SSHCFG_GLOBAL },
+	{ "socketbuffersize", sSocketBufferSize, SSHCFG_GLOBAL },
 	{ NULL, sBadOption, 0 }
 };
 
@@ -1183,6 +1202,10 @@ process_server_config_line(ServerOptions *options, char *line,
 		intptr = &options->max_sessions;
 		goto parse_int;
 
+	case sKexKeyPool:
+		intptr = &options->kex_key_pool;
+		goto parse_int;
+
 	case sBanner:
 		charptr = &options->banner;
 		goto parse_filename;
@@ -1350,6 +1373,30 @@ process_server_config_line(ServerOptions *options, char *line,
 		}
 		break;
 
+	case sTCPCork:
+		intptr = &options->tcp_cork;
+		goto parse_flag;
+
+	case sTCPNotSentLowat:
+	case sSocketBufferSize:
+		intptr = opcode == sTCPNotSentLowat ?
+		    &options->tcp_notsent_lowat : &options->socket_buffer_size;
+		arg = strdelim(&cp);
+		if (!arg || *arg == '\0')
+			fatal("%s line %d: missing argument.",
+			    filename, linenum);
+		if (strcmp(arg, "none") == 0)
+			value = 0;
+		else if (opcode == sSocketBufferSize &&
+		    strcmp(arg, "auto") == 0)
+			value = SSH_SOCKBUF_AUTO;
+		else if ((value = atoi(arg)) <= 0)
+			fatal("%s line %d: Bad number '%s'.",
+			    filename, linenum, arg);
+		if (*activep && *intptr == -1)
+			*intptr = value;
+		break;
+
 	case sDeprecated:
 		logit("%s line %d: Deprecated option %s",
 		    filename, linenum, arg);
@@ -1649,6 +1696,7 @@ dump_config(ServerOptions *o)
 	dump_cfg_int(sX11DisplayOffset, o->x11_display_offset);
 	dump_cfg_int(sMaxAuthTries, o->max_authtries);
 	dump_cfg_int(sMaxSessions, o->max_sessions);
+	dump_cfg_int(sKexKeyPool, o->kex_key_pool);
 	dump_cfg_int(sClientAliveInterval, o->client_alive_interval);
 	dump_cfg_int(sClientAliveCountMax, o->client_alive_count_max);
 
@@ -1744,5 +1792,12 @@ dump_config(ServerOptions *o)
 	printf("ipqos %s ", iptos2str(o->ip_qos_interactive));
 	printf("%s\n", iptos2str(o->ip_qos_bulk));
 
+	dump_cfg_int(sTCPNotSentLowat, o->tcp_notsent_lowat);
+	dump_cfg_fmtint(sTCPCork, o->tcp_cork);
+	if (o->socket_buffer_size == SSH_SOCKBUF_AUTO)
+		dump_cfg_string(sSocketBufferSize, "auto");
+	else
+		dump_cfg_int(sSocketBufferSize, o->socket_buffer_size);
+
 	channel_print_adm_permitted_opens();
 }
@@ -78,9 +78,13 @@ typedef struct {
 	int     tcp_keep_alive;	/* If true, set SO_KEEPALIVE. */
 	int	ip_qos_interactive;	/* IP ToS/DSCP/class for interactive */
 	int	ip_qos_bulk;		/* IP ToS/DSCP/class for bulk traffic */
+	int	tcp_notsent_lowat;	/* TCP_NOTSENT_LOWAT, 0 = none */
+	int	tcp_cork;		/* Cork socket while writing bulk */
+	int	socket_buffer_size;	/* SO_SNDBUF/SO_RCVBUF, 0 = none */
 	char   *ciphers;	/* Supported SSH2 ciphers. */
 	char   *macs;		/* Supported SSH2 macs. */
 	char   *kex_algorithms;	/* SSH2 kex methods in order of preference. */
+	int	kex_key_pool;	/* Precomputed ephemeral keys per kex method. */
 	int	protocol;	/* Supported protocol versions. */
 	int     gateway_ports;	/* If true, allow remote connects to forwarded ports. */
 	SyslogFacility log_facility;	/* Facility for system logging. */
@@ -103,6 +103,10 @@ static int connection_out;	/* Connection to client (output). */
 static int connection_closed = 0;	/* Connection to client closed. */
 static u_int buffer_high;	/* "Soft" max buffer size. */
 static int no_more_sessions = 0; /* Disallow further sessions. */
+static int idle_pending = 1;	/* Activity since memory was last released. */
+
+/* Release buffer and compression memory after this much idle time. */
+#define SERVER_IDLE_MSEC	(10 * 1000)
 
 /*
  * This SIGCHLD kludge is used to detect when the child exits.  The server
@@ -263,6 +267,25 @@ client_alive_check(void)
 	packet_send();
 }
 
+/*
+ * Release memory the connection holds after a burst of activity.
+ */
+static void
+server_idle(void)
+{
+	size_t before, after;
+	int r;
+
+	before = packet_get_memory() + channel_get_memory();
+	if ((r = packet_idle()) != 0)
+		fatal("%s: %s", __func__, ssh_err(r));
+	channel_shrink_all();
+	after = packet_get_memory() + channel_get_memory();
+	debug2("%s: connection memory %zu -> %zu bytes", __func__,
+	    before, after);
+	idle_pending = 0;
+}
+
 /*
  * Sleep in select() until we can do something.  This will initialize the
  * select masks.  Upon return, the masks will indicate which descriptors
@@ -276,6 +299,7 @@ wait_until_can_do_something(fd_set **readsetp, fd_set **writesetp, int *maxfdp,
 	struct timeval tv, *tvp;
 	int ret;
 	int client_alive_scheduled = 0;
+	int idle_scheduled = 0;
 
 	/*
 	 * if using client_alive, set the max timeout accordingly,
@@ -342,6 +366,17 @@ wait_until_can_do_something(fd_set **readsetp, fd_set **writesetp, int *maxfdp,
 		if (max_time_milliseconds == 0 || client_alive_scheduled)
 			max_time_milliseconds = 100;
 
+	/*
+	 * After activity, wake up once the connection went idle to release
+	 * memory.  This postpones a pending client alive check once.
+	 */
+	if (compat20 && idle_pending && (max_time_milliseconds == 0 ||
+	    max_time_milliseconds > SERVER_IDLE_MSEC)) {
+		max_time_milliseconds = SERVER_IDLE_MSEC;
+		client_alive_scheduled = 0;
+		idle_scheduled = 1;
+	}
+
 	if (max_time_milliseconds == 0)
 		tvp = NULL;
 	else {
@@ -360,6 +395,10 @@ wait_until_can_do_something(fd_set **readsetp, fd_set **writesetp, int *maxfdp,
 			error("select: %.100s", strerror(errno));
 	} else if (ret == 0 && client_alive_scheduled)
 		client_alive_check();
+	else if (ret == 0 && idle_scheduled)
+		server_idle();
+	else if (ret > 0)
+		idle_pending = 1;
 
 	notify_done(*readsetp);
 }
@@ -0,0 +1,219 @@
+/* $OpenBSD$ */
+/*
+ * Worker threads making host key signatures for the server side of the
+ * key exchange.
+ *
+ * The host key signature is the most expensive step of a server's key
+ * exchange, an RSA signature in particular.  An event loop serving many
+ * connections signs on its own thread, so a burst of new connections
+ * queues up behind the signatures while other cores sit idle.  The pool
+ * moves them to a fixed set of worker threads behind a bounded queue;
+ * a full queue is reported to the caller, which then signs inline and
+ * so throttles itself instead of queueing without limit.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+
+#include "key.h"
+#include "signpool.h"
+#include "log.h"
+#include "err.h"
+
+#define SIGNPOOL_WORKERS_MAX	256
+
+struct sign_job {
+	const struct sshkey *key;
+	u_char	*data;
+	u_int	datalen;
+	u_int	compat;
+	u_int64_t queued;		/* usec */
+	sign_pool_cb *cb;
+	void	*arg;
+	TAILQ_ENTRY(sign_job) next;
+};
+
+struct sign_pool {
+	pthread_mutex_t lock;		/* protects everything below */
+	pthread_cond_t cond;
+	TAILQ_HEAD(, sign_job) queue;
+	u_int	maxqueue;
+	int	stop;
+	pthread_t *workers;
+	u_int	nworkers;
+	struct sign_pool_stats stats;
+};
+
+static u_int64_t
+signpool_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		fatal("%s: clock_gettime: %s", __func__, strerror(errno));
+	return (u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *
+signpool_worker(void *arg)
+{
+	struct sign_pool *p = arg;
+	struct sign_job *job;
+	u_int64_t start, wait;
+	u_char *sig;
+	u_int slen;
+	int r;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (TAILQ_EMPTY(&p->queue) && !p->stop)
+			pthread_cond_wait(&p->cond, &p->lock);
+		/* drain the queue before stopping */
+		if ((job = TAILQ_FIRST(&p->queue)) == NULL)
+			break;
+		TAILQ_REMOVE(&p->queue, job, next);
+		p->stats.depth--;
+		pthread_mutex_unlock(&p->lock);
+
+		start = signpool_now();
+		sig = NULL;
+		slen = 0;
+		r = sshkey_sign(job->key, &sig, &slen, job->data,
+		    job->datalen, job->compat);
+		wait = start - job->queued;
+
+		pthread_mutex_lock(&p->lock);
+		p->stats.completed++;
+		p->stats.wait_usec += wait;
+		p->stats.wait_max_usec = MAX(p->stats.wait_max_usec, wait);
+		p->stats.sign_usec += signpool_now() - start;
+		pthread_mutex_unlock(&p->lock);
+
+		job->cb(r, sig, slen, job->arg);
+		free(job->data);
+		free(job);
+		pthread_mutex_lock(&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+int
+sign_pool_new(struct sign_pool **pp, u_int nworkers, u_int maxqueue)
+{
+	struct sign_pool *p;
+	long ncpu;
+	int r;
+
+	*pp = NULL;
+	if (maxqueue == 0)
+		return SSH_ERR_INVALID_ARGUMENT;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	if (CRYPTO_get_locking_callback() == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+#endif
+	if (nworkers == 0)
+		nworkers = (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ?
+		    ncpu : 1;
+	nworkers = MIN(nworkers, SIGNPOOL_WORKERS_MAX);
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((p->workers = calloc(nworkers, sizeof(*p->workers))) == NULL) {
+		free(p);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	TAILQ_INIT(&p->queue);
+	p->maxqueue = maxqueue;
+	for (; p->nworkers < nworkers; p->nworkers++) {
+		if ((r = pthread_create(&p->workers[p->nworkers], NULL,
+		    signpool_worker, p)) != 0) {
+			error("%s: pthread_create: %s", __func__, strerror(r));
+			sign_pool_free(p);
+			return SSH_ERR_SYSTEM_ERROR;
+		}
+	}
+	debug("%s: %u workers, queue %u", __func__, nworkers, maxqueue);
+	*pp = p;
+	return 0;
+}
+
+void
+sign_pool_free(struct sign_pool *p)
+{
+	u_int i;
+
+	if (p == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->nworkers; i++)
+		pthread_join(p->workers[i], NULL);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p->workers);
+	free(p);
+}
+
+int
+sign_pool_submit(struct sign_pool *p, const struct sshkey *key,
+    const u_char *data, size_t datalen, u_int compat,
+    sign_pool_cb *cb, void *arg)
+{
+	struct sign_job *job;
+
+	if (key == NULL || cb == NULL || datalen > UINT_MAX)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((job = calloc(1, sizeof(*job))) == NULL ||
+	    (job->data = malloc(datalen)) == NULL) {
+		free(job);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	memcpy(job->data, data, datalen);
+	job->datalen = datalen;
+	job->key = key;
+	job->compat = compat;
+	job->cb = cb;
+	job->arg = arg;
+	job->queued = signpool_now();
+
+	pthread_mutex_lock(&p->lock);
+	if (p->stop || p->stats.depth >= p->maxqueue) {
+		p->stats.rejected++;
+		pthread_mutex_unlock(&p->lock);
+		free(job->data);
+		free(job);
+		return SSH_ERR_QUEUE_FULL;
+	}
+	TAILQ_INSERT_TAIL(&p->queue, job, next);
+	p->stats.submitted++;
+	p->stats.depth++;
+	p->stats.depth_max = MAX(p->stats.depth_max, p->stats.depth);
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	return 0;
+}
+
+void
+sign_pool_get_stats(struct sign_pool *p, struct sign_pool_stats *stats)
+{
+	pthread_mutex_lock(&p->lock);
+	*stats = p->stats;
+	pthread_mutex_unlock(&p->lock);
+}
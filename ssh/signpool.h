@@ -0,0 +1,61 @@
+/* $OpenBSD$ */
+/*
+ * Worker threads making host key signatures for the server side of the
+ * key exchange.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef SIGNPOOL_H
+#define SIGNPOOL_H
+
+#include <sys/types.h>
+
+struct sshkey;
+struct sign_pool;
+
+struct sign_pool_stats {
+	u_int64_t	submitted;
+	u_int64_t	completed;
+	u_int64_t	rejected;	/* submitted to a full queue */
+	u_int64_t	wait_usec;	/* total time spent queued */
+	u_int64_t	wait_max_usec;
+	u_int64_t	sign_usec;	/* total time spent in sshkey_sign() */
+	u_int		depth;		/* requests currently queued */
+	u_int		depth_max;
+};
+
+/*
+ * called on a worker thread once a request has been signed: 'r' is the
+ * result of sshkey_sign(), the signature is allocated with malloc and
+ * owned by the callback.
+ */
+typedef void sign_pool_cb(int r, u_char *sig, u_int siglen, void *arg);
+
+/*
+ * sign_pool_new() starts 'nworkers' threads (0: one per online CPU)
+ * serving a queue of at most 'maxqueue' requests.  with libcrypto
+ * before 1.1 the application must have installed the locking callbacks,
+ * e.g. with ssh_crypto_thread_init().
+ */
+int	sign_pool_new(struct sign_pool **, u_int nworkers, u_int maxqueue);
+
+/*
+ * sign_pool_free() completes the queued requests, calling their
+ * callbacks, then stops the workers and releases the pool.
+ */
+void	sign_pool_free(struct sign_pool *);
+
+/*
+ * sign_pool_submit() queues a signature of 'data' with 'key'.  the data
+ * is copied, the key must stay valid until the callback has been called.
+ * returns SSH_ERR_QUEUE_FULL if the queue is full, in which case the
+ * caller should sign itself.
+ */
+int	sign_pool_submit(struct sign_pool *, const struct sshkey *key,
+    const u_char *data, size_t datalen, u_int compat,
+    sign_pool_cb *cb, void *arg);
+
+void	sign_pool_get_stats(struct sign_pool *, struct sign_pool_stats *);
+
+#endif
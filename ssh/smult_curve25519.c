@@ -0,0 +1,90 @@
+/* $OpenBSD$ */
+/*
+ * X25519 (RFC 7748) scalar multiplication on curve25519.
+ *
+ * A Montgomery ladder over the u-coordinate: one conditional swap, five
+ * multiplications, four squarings and a multiplication by (A - 2) / 4
+ * per scalar bit, all independent of the bit's value.  Nothing is
+ * allocated and the state on the stack is cleared before returning.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "fe25519.h"
+#include "crypto_api.h"
+
+#define CURVE25519_A24	121665		/* (486662 - 2) / 4 */
+
+int
+crypto_scalarmult_curve25519(u_char q[CURVE25519_SIZE],
+    const u_char n[CURVE25519_SIZE], const u_char p[CURVE25519_SIZE])
+{
+	fe25519 x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d;
+	u_char k[CURVE25519_SIZE];
+	u_int bit, swap = 0;
+	int pos;
+
+	memcpy(k, n, sizeof(k));
+	k[0] &= 248;
+	k[31] &= 127;
+	k[31] |= 64;
+
+	fe25519_frombytes(x1, p);
+	fe25519_1(x2);
+	fe25519_0(z2);
+	fe25519_copy(x3, x1);
+	fe25519_1(z3);
+
+	for (pos = 254; pos >= 0; pos--) {
+		bit = (k[pos / 8] >> (pos & 7)) & 1;
+		swap ^= bit;
+		fe25519_cswap(x2, x3, swap);
+		fe25519_cswap(z2, z3, swap);
+		swap = bit;
+
+		fe25519_add(a, x2, z2);
+		fe25519_sq(aa, a);
+		fe25519_sub(b, x2, z2);
+		fe25519_sq(bb, b);
+		fe25519_sub(e, aa, bb);
+		fe25519_add(c, x3, z3);
+		fe25519_sub(d, x3, z3);
+		fe25519_mul(d, d, a);			/* DA */
+		fe25519_mul(c, c, b);			/* CB */
+		fe25519_add(x3, d, c);
+		fe25519_sq(x3, x3);
+		fe25519_sub(z3, d, c);
+		fe25519_sq(z3, z3);
+		fe25519_mul(z3, z3, x1);
+		fe25519_mul(x2, aa, bb);
+		fe25519_mul_small(z2, e, CURVE25519_A24);
+		fe25519_add(z2, z2, aa);
+		fe25519_mul(z2, z2, e);
+	}
+	fe25519_cswap(x2, x3, swap);
+	fe25519_cswap(z2, z3, swap);
+
+	fe25519_invert(z2, z2);
+	fe25519_mul(x2, x2, z2);
+	fe25519_tobytes(q, x2);
+
+	bzero(k, sizeof(k));
+	bzero(x2, sizeof(x2));
+	bzero(z2, sizeof(z2));
+	bzero(x3, sizeof(x3));
+	bzero(z3, sizeof(z3));
+	return 0;
+}
+
+int
+crypto_scalarmult_curve25519_base(u_char q[CURVE25519_SIZE],
+    const u_char n[CURVE25519_SIZE])
+{
+	static const u_char basepoint[CURVE25519_SIZE] = { 9 };
+
+	return crypto_scalarmult_curve25519(q, n, basepoint);
+}
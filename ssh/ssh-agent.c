@@ -606,6 +606,37 @@ process_add_identity(SocketEntry *e, int version)
 			buffer_get_bignum2(&e->request, k->rsa->p);
 			buffer_get_bignum2(&e->request, k->rsa->q);
 			break;
+		case KEY_ED25519:
+			if ((k = sshkey_new_private(type)) == NULL)
+				fatal("%s: sshkey_new_private failed",
+				    __func__);
+			k->ed25519_pk = buffer_get_string(&e->request, &len);
+			if (len != ED25519_PK_SIZE)
+				fatal("%s: bad ED25519 public key", __func__);
+			k->ed25519_sk = buffer_get_string(&e->request, &len);
+			if (len != ED25519_SK_SIZE ||
+			    memcmp(k->ed25519_pk, k->ed25519_sk +
+			    ED25519_SEED_SIZE, ED25519_PK_SIZE) != 0)
+				fatal("%s: bad ED25519 private key", __func__);
+			break;
+		case KEY_ED25519_CERT:
+			cert = buffer_get_string(&e->request, &len);
+			if ((r = sshkey_from_blob(cert, len, &k)) != 0)
+				fatal("Certificate parse failed: %s",
+				    ssh_err(r));
+			xfree(cert);
+			cert = buffer_get_string(&e->request, &len);
+			if (len != ED25519_PK_SIZE ||
+			    memcmp(cert, k->ed25519_pk, ED25519_PK_SIZE) != 0)
+				fatal("%s: ED25519 certificate key mismatch",
+				    __func__);
+			xfree(cert);
+			k->ed25519_sk = buffer_get_string(&e->request, &len);
+			if (len != ED25519_SK_SIZE ||
+			    memcmp(k->ed25519_pk, k->ed25519_sk +
+			    ED25519_SEED_SIZE, ED25519_PK_SIZE) != 0)
+				fatal("%s: bad ED25519 private key", __func__);
+			break;
 		default:
 			xfree(type_name);
 			buffer_clear(&e->request);
@@ -654,6 +685,9 @@ process_add_identity(SocketEntry *e, int version)
 	if ((id = lookup_identity(k, version)) == NULL) {
 		id = xcalloc(1, sizeof(Identity));
 		id->key = k;
+		/* Identities are serialised for every request */
+		if ((r = sshkey_memoise(k)) != 0)
+			debug("%s: sshkey_memoise: %s", __func__, ssh_err(r));
 		TAILQ_INSERT_TAIL(&tab->idlist, id, next);
 		/* Increment the number of identities. */
 		tab->nentries++;
@@ -0,0 +1,110 @@
+/* $OpenBSD$ */
+/*
+ * Ed25519 signatures in the SSH wire format:
+ *
+ *	string	"ssh-ed25519"
+ *	string	signature (64 bytes, R || S of RFC 8032)
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshbuf.h"
+#include "err.h"
+#define SSHKEY_INTERNAL
+#include "key.h"
+
+/* ARGSUSED */
+int
+ssh_ed25519_sign(const struct sshkey *key, u_char **sigp, u_int *lenp,
+    const u_char *data, u_int datalen, u_int compat)
+{
+	u_char sig[ED25519_SIG_SIZE];
+	struct sshbuf *b = NULL;
+	size_t len;
+	int ret = SSH_ERR_INTERNAL_ERROR;
+
+	if (key == NULL || key->ed25519_sk == NULL ||
+	    sshkey_type_plain(key->type) != KEY_ED25519)
+		return SSH_ERR_INVALID_ARGUMENT;
+
+	crypto_sign_ed25519(sig, data, datalen, key->ed25519_sk);
+
+	if ((b = sshbuf_new()) == NULL) {
+		ret = SSH_ERR_ALLOC_FAIL;
+		goto out;
+	}
+	if ((ret = sshbuf_put_cstring(b, "ssh-ed25519")) != 0 ||
+	    (ret = sshbuf_put_string(b, sig, sizeof(sig))) != 0)
+		goto out;
+	len = sshbuf_len(b);
+	if (lenp != NULL)
+		*lenp = len;
+	if (sigp != NULL) {
+		if ((*sigp = malloc(len)) == NULL) {
+			ret = SSH_ERR_ALLOC_FAIL;
+			goto out;
+		}
+		memcpy(*sigp, sshbuf_ptr(b), len);
+	}
+	ret = 0;
+ out:
+	if (b != NULL)
+		sshbuf_free(b);
+	bzero(sig, sizeof(sig));
+	return ret;
+}
+
+/* ARGSUSED */
+int
+ssh_ed25519_verify(const struct sshkey *key,
+    const u_char *signature, u_int signaturelen,
+    const u_char *data, u_int datalen, u_int compat)
+{
+	struct sshbuf *b = NULL;
+	char *ktype = NULL;
+	const u_char *sigblob;
+	size_t len;
+	int ret = SSH_ERR_INTERNAL_ERROR;
+
+	if (key == NULL || key->ed25519_pk == NULL ||
+	    sshkey_type_plain(key->type) != KEY_ED25519)
+		return SSH_ERR_INVALID_ARGUMENT;
+
+	if ((b = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((ret = sshbuf_put(b, signature, signaturelen)) != 0)
+		goto out;
+	if (sshbuf_get_cstring(b, &ktype, NULL) != 0 ||
+	    sshbuf_get_string_direct(b, &sigblob, &len) != 0) {
+		ret = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	if (strcmp("ssh-ed25519", ktype) != 0) {
+		ret = SSH_ERR_KEY_TYPE_MISMATCH;
+		goto out;
+	}
+	if (sshbuf_len(b) != 0) {
+		ret = SSH_ERR_UNEXPECTED_TRAILING_DATA;
+		goto out;
+	}
+	if (len != ED25519_SIG_SIZE) {
+		ret = SSH_ERR_INVALID_FORMAT;
+		goto out;
+	}
+	if (crypto_sign_ed25519_verify(sigblob, data, datalen,
+	    key->ed25519_pk) != 0) {
+		ret = SSH_ERR_SIGNATURE_INVALID;
+		goto out;
+	}
+	ret = 0;
+ out:
+	if (b != NULL)
+		sshbuf_free(b);
+	free(ktype);
+	return ret;
+}
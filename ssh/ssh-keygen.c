@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pwd.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,9 @@
 #include "misc.h"
 #include "match.h"
 #include "hostfile.h"
+#include "hostindex.h"
+#include "krl.h"
+#include "batchpool.h"
 #include "dns.h"
 #include "ssh2.h"
 #include "err.h"
@@ -143,6 +147,12 @@ char *key_type_name = NULL;
 /* Load key from this PKCS#11 provider */
 char *pkcs11provider = NULL;
 
+/* Flag indicating that we want to process a batch manifest on stdin */
+int batch_mode = 0;
+
+/* Number of worker threads for -H, -l and -U, 0 for one per CPU */
+u_int batch_threads = 0;
+
 /* argv0 */
 extern char *__progname;
 
@@ -161,6 +171,8 @@ type_bits_valid(int type, u_int32_t *bitsp)
 		fprintf(stderr, "unknown key type %s\n", key_type_name);
 		exit(1);
 	}
+	if (type == KEY_ED25519)
+		return;		/* the key size is fixed */
 	if (*bitsp == 0) {
 		if (type == KEY_DSA)
 			*bitsp = DEFAULT_BITS_DSA;
@@ -206,6 +218,10 @@ ask_filename(struct passwd *pw, const char *prompt)
 		case KEY_ECDSA:
 			name = _PATH_SSH_CLIENT_ID_ECDSA;
 			break;
+		case KEY_ED25519_CERT:
+		case KEY_ED25519:
+			name = _PATH_SSH_CLIENT_ID_ED25519;
+			break;
 		case KEY_RSA_CERT:
 		case KEY_RSA_CERT_V00:
 		case KEY_RSA:
@@ -735,13 +751,249 @@ do_download(struct passwd *pw)
 #endif /* ENABLE_PKCS11 */
 }
 
+/*
+ * Known hosts hashing (-H) and fingerprinting of key lists (-l) process
+ * every line on its own.  The main thread reads the file in chunks of
+ * lines and writes the results; -j worker threads parse, hash and format
+ * the chunks.  Output stays in input order and at most STREAM_WINDOW
+ * chunks are in flight, so memory does not grow with the file.
+ */
+#define STREAM_CHUNK_LINES	256
+#define STREAM_WINDOW		64
+
+struct stream_chunk {
+	struct sshbuf	*in;		/* line number, too long flag, line */
+	struct sshbuf	*out;		/* output text */
+	struct sshbuf	*msgs;		/* diagnostics: u8 is_error, string */
+	u_int		 nlines;
+	int		 invalid;
+	int		 unhashed;	/* left host names unhashed */
+	u_long		 nkeys;
+};
+
+/* Processes one line of a chunk, on a worker thread */
+typedef void stream_line_fn(struct stream_chunk *, u_long num, char *line);
+
+struct stream_ctx {
+	stream_line_fn	*fn;
+	int		 toolong_invalid;
+	FILE		*out;
+	int		 invalid;
+	int		 unhashed;
+	u_long		 nkeys;
+};
+
+static struct stream_chunk *
+stream_chunk_new(void)
+{
+	struct stream_chunk *c;
+
+	c = xcalloc(1, sizeof(*c));
+	if ((c->in = sshbuf_new()) == NULL ||
+	    (c->out = sshbuf_new()) == NULL ||
+	    (c->msgs = sshbuf_new()) == NULL)
+		fatal("%s: sshbuf_new failed", __func__);
+	return c;
+}
+
+/* Queues a diagnostic; the main thread logs or prints it in order */
+static void
+stream_msg(struct stream_chunk *c, int is_error, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+static void
+stream_msg(struct stream_chunk *c, int is_error, const char *fmt, ...)
+{
+	va_list args;
+	char msg[1024];
+	int r;
+
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	if ((r = sshbuf_put_u8(c->msgs, is_error)) != 0 ||
+	    (r = sshbuf_put_cstring(c->msgs, msg)) != 0)
+		fatal("%s: buffer error: %s", __func__, ssh_err(r));
+}
+
+static void
+stream_work(void *arg, void *ctxarg)
+{
+	struct stream_chunk *c = arg;
+	struct stream_ctx *ctx = ctxarg;
+	u_int32_t num;
+	u_char toolong;
+	char *line;
+	int r;
+
+	while (sshbuf_len(c->in) > 0) {
+		if ((r = sshbuf_get_u32(c->in, &num)) != 0 ||
+		    (r = sshbuf_get_u8(c->in, &toolong)) != 0 ||
+		    (r = sshbuf_get_cstring(c->in, &line, NULL)) != 0)
+			fatal("%s: buffer error: %s", __func__, ssh_err(r));
+		if (toolong) {
+			stream_msg(c, 1, "line %u too long: %.40s...", num, line);
+			if (ctx->toolong_invalid)
+				c->invalid = 1;
+		} else
+			ctx->fn(c, num, line);
+		xfree(line);
+	}
+}
+
+static void
+stream_done(void *arg, void *ctxarg)
+{
+	struct stream_chunk *c = arg;
+	struct stream_ctx *ctx = ctxarg;
+	u_char is_error;
+	char *msg;
+	int r;
+
+	if (sshbuf_len(c->msgs) > 0)
+		fflush(ctx->out);
+	while (sshbuf_len(c->msgs) > 0) {
+		if ((r = sshbuf_get_u8(c->msgs, &is_error)) != 0 ||
+		    (r = sshbuf_get_cstring(c->msgs, &msg, NULL)) != 0)
+			fatal("%s: buffer error: %s", __func__, ssh_err(r));
+		if (is_error)
+			error("%s", msg);
+		else
+			fprintf(stderr, "%s\n", msg);
+		xfree(msg);
+	}
+	if (fwrite(sshbuf_ptr(c->out), 1, sshbuf_len(c->out), ctx->out) !=
+	    sshbuf_len(c->out))
+		fatal("write: %s", strerror(errno));
+	ctx->invalid |= c->invalid;
+	ctx->unhashed |= c->unhashed;
+	ctx->nkeys += c->nkeys;
+	sshbuf_free(c->in);
+	sshbuf_free(c->out);
+	sshbuf_free(c->msgs);
+	xfree(c);
+}
+
+/* Runs 'ctx->fn' over the lines of 'in' on the worker threads */
+static void
+stream_lines(FILE *in, struct stream_ctx *ctx)
+{
+	struct batch_pool *pool;
+	struct stream_chunk *c = NULL;
+	char line[16*1024], *cp;
+	int r, skip = 0;
+	u_int num = 0;
+
+	if ((r = batch_pool_new(&pool, batch_threads, STREAM_WINDOW,
+	    stream_work, stream_done, ctx)) != 0)
+		fatal("%s: batch_pool_new: %s", __func__, ssh_err(r));
+	while (fgets(line, sizeof(line), in)) {
+		if (c == NULL)
+			c = stream_chunk_new();
+		if ((cp = strchr(line, '\n')) == NULL) {
+			r = sshbuf_put_u32(c->in, num + 1);
+			if (r == 0)
+				r = sshbuf_put_u8(c->in, 1);
+			if (r == 0)
+				r = sshbuf_put_cstring(c->in, line);
+			skip = 1;
+		} else {
+			num++;
+			if (skip) {
+				skip = 0;
+				continue;
+			}
+			*cp = '\0';
+			r = sshbuf_put_u32(c->in, num);
+			if (r == 0)
+				r = sshbuf_put_u8(c->in, 0);
+			if (r == 0)
+				r = sshbuf_put_cstring(c->in, line);
+		}
+		if (r != 0)
+			fatal("%s: buffer error: %s", __func__, ssh_err(r));
+		if (++c->nlines >= STREAM_CHUNK_LINES) {
+			batch_pool_submit(pool, c);
+			c = NULL;
+		}
+	}
+	if (ferror(in))
+		fatal("read: %s", strerror(errno));
+	if (c != NULL)
+		batch_pool_submit(pool, c);
+	batch_pool_free(pool);
+	if (fflush(ctx->out) != 0)
+		fatal("write: %s", strerror(errno));
+}
+
+/* Formats the fingerprint of a line of a public key file (-l) */
+static void
+fingerprint_line(struct stream_chunk *c, u_long num, char *line)
+{
+	struct sshkey *public;
+	char *comment = NULL, *cp, *ep, *fp, *ra;
+	enum sshkey_fp_rep rep;
+	enum sshkey_fp_type fptype;
+	int i, r;
+
+	fptype = print_bubblebabble ? SSH_FP_SHA1 : SSH_FP_MD5;
+	rep =    print_bubblebabble ? SSH_FP_BUBBLEBABBLE : SSH_FP_HEX;
+
+	/* Skip leading whitespace, empty and comment lines. */
+	for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	if (!*cp || *cp == '\n' || *cp == '#')
+		return;
+	i = strtol(cp, &ep, 10);
+	if (i == 0 || ep == NULL || (*ep != ' ' && *ep != '\t')) {
+		int quoted = 0;
+		comment = cp;
+		for (; *cp && (quoted || (*cp != ' ' &&
+		    *cp != '\t')); cp++) {
+			if (*cp == '\\' && cp[1] == '"')
+				cp++;	/* Skip both */
+			else if (*cp == '"')
+				quoted = !quoted;
+		}
+		if (!*cp)
+			return;
+		*cp++ = '\0';
+	}
+	ep = cp;
+	if ((public = sshkey_new(KEY_RSA1)) == NULL)
+		fatal("sshkey_new failed");
+	if ((r = sshkey_read(public, &cp)) != 0) {
+		cp = ep;
+		sshkey_free(public);
+		if ((public = sshkey_new(KEY_UNSPEC)) == NULL)
+			fatal("sshkey_new failed");
+		if ((r = sshkey_read(public, &cp)) != 0) {
+			sshkey_free(public);
+			return;
+		}
+	}
+	comment = *cp ? cp : comment;
+	fp = sshkey_fingerprint(public, fptype, rep);
+	ra = sshkey_fingerprint(public, SSH_FP_MD5, SSH_FP_RANDOMART);
+	if ((r = sshbuf_putf(c->out, "%u %s %s (%s)\n", sshkey_size(public),
+	    fp, comment ? comment : "no comment", sshkey_type(public))) != 0 ||
+	    (log_level >= SYSLOG_LEVEL_VERBOSE &&
+	    (r = sshbuf_putf(c->out, "%s\n", ra)) != 0))
+		fatal("%s: buffer error: %s", __func__, ssh_err(r));
+	xfree(ra);
+	xfree(fp);
+	sshkey_free(public);
+	c->nkeys++;
+}
+
 static void
 do_fingerprint(struct passwd *pw)
 {
 	FILE *f;
 	struct sshkey *public;
-	char *comment = NULL, *cp, *ep, line[16*1024], *fp, *ra;
-	int r, i, skip = 0, num = 0, invalid = 1;
+	struct stream_ctx ctx;
+	char *comment = NULL, *fp, *ra;
+	int r;
 	enum sshkey_fp_rep rep;
 	enum sshkey_fp_type fptype;
 	struct stat st;
@@ -779,68 +1031,13 @@ do_fingerprint(struct passwd *pw)
 	if ((f = fopen(identity_file, "r")) == NULL)
 		fatal("%s: %s: %s", __progname, identity_file, strerror(errno));
 
-	while (fgets(line, sizeof(line), f)) {
-		if ((cp = strchr(line, '\n')) == NULL) {
-			error("line %d too long: %.40s...",
-			    num + 1, line);
-			skip = 1;
-			continue;
-		}
-		num++;
-		if (skip) {
-			skip = 0;
-			continue;
-		}
-		*cp = '\0';
-
-		/* Skip leading whitespace, empty and comment lines. */
-		for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
-			;
-		if (!*cp || *cp == '\n' || *cp == '#')
-			continue;
-		i = strtol(cp, &ep, 10);
-		if (i == 0 || ep == NULL || (*ep != ' ' && *ep != '\t')) {
-			int quoted = 0;
-			comment = cp;
-			for (; *cp && (quoted || (*cp != ' ' &&
-			    *cp != '\t')); cp++) {
-				if (*cp == '\\' && cp[1] == '"')
-					cp++;	/* Skip both */
-				else if (*cp == '"')
-					quoted = !quoted;
-			}
-			if (!*cp)
-				continue;
-			*cp++ = '\0';
-		}
-		ep = cp;
-		if ((public = sshkey_new(KEY_RSA1)) == NULL)
-			fatal("sshkey_new failed");
-		if ((r = sshkey_read(public, &cp)) != 0) {
-			cp = ep;
-			sshkey_free(public);
-			if ((public = sshkey_new(KEY_UNSPEC)) == NULL)
-				fatal("sshkey_new failed");
-			if ((r = sshkey_read(public, &cp)) != 0) {
-				sshkey_free(public);
-				continue;
-			}
-		}
-		comment = *cp ? cp : comment;
-		fp = sshkey_fingerprint(public, fptype, rep);
-		ra = sshkey_fingerprint(public, SSH_FP_MD5, SSH_FP_RANDOMART);
-		printf("%u %s %s (%s)\n", sshkey_size(public), fp,
-		    comment ? comment : "no comment", sshkey_type(public));
-		if (log_level >= SYSLOG_LEVEL_VERBOSE)
-			printf("%s\n", ra);
-		xfree(ra);
-		xfree(fp);
-		sshkey_free(public);
-		invalid = 0;
-	}
+	bzero(&ctx, sizeof(ctx));
+	ctx.fn = fingerprint_line;
+	ctx.out = stdout;
+	stream_lines(f, &ctx);
 	fclose(f);
 
-	if (invalid) {
+	if (ctx.nkeys == 0) {
 		printf("%s is not a public key file.\n", identity_file);
 		exit(1);
 	}
@@ -859,6 +1056,7 @@ do_gen_all_hostkeys(struct passwd *pw)
 		{ "rsa", "RSA" ,_PATH_HOST_RSA_KEY_FILE },
 		{ "dsa", "DSA", _PATH_HOST_DSA_KEY_FILE },
 		{ "ecdsa", "ECDSA",_PATH_HOST_ECDSA_KEY_FILE },
+		{ "ed25519", "ED25519",_PATH_HOST_ED25519_KEY_FILE },
 		{ NULL, NULL, NULL }
 	};
 
@@ -972,15 +1170,111 @@ printhost(FILE *f, const char *name, struct sshkey *public, int ca, int hash)
 	}
 }
 
+/* Thread-safe printhost() for hashing, appending to 'b' */
+static void
+format_host(struct sshbuf *b, const char *name, const struct sshkey *public,
+    int ca, int hash)
+{
+	char hashed[1024];
+	int r;
+
+	if (hash && (name = host_hash_r(name, NULL, 0, hashed,
+	    sizeof(hashed))) == NULL)
+		fatal("hash_host failed");
+	if ((r = sshbuf_putf(b, "%s%s%s ", ca ? CA_MARKER : "",
+	    ca ? " " : "", name)) != 0 ||
+	    (r = sshkey_format_text(public, b)) != 0 ||
+	    (r = sshbuf_put_u8(b, '\n')) != 0)
+		fatal("key_write failed: %s", ssh_err(r));
+}
+
+/* Hashes the host names of a known_hosts line (-H) */
+static void
+hash_line(struct stream_chunk *c, u_long num, char *line)
+{
+	struct sshkey *pub;
+	char *cp, *cp2, *kp, *kp2;
+	int ca, r;
+
+	/* Skip leading whitespace, empty and comment lines. */
+	for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
+		;
+	if (!*cp || *cp == '\n' || *cp == '#') {
+		if ((r = sshbuf_putf(c->out, "%s\n", cp)) != 0)
+			fatal("%s: buffer error: %s", __func__, ssh_err(r));
+		return;
+	}
+	/* Check whether this is a CA key */
+	if (strncasecmp(cp, CA_MARKER, sizeof(CA_MARKER) - 1) == 0 &&
+	    (cp[sizeof(CA_MARKER) - 1] == ' ' ||
+	    cp[sizeof(CA_MARKER) - 1] == '\t')) {
+		ca = 1;
+		cp += sizeof(CA_MARKER);
+	} else
+		ca = 0;
+
+	/* Find the end of the host name portion. */
+	for (kp = cp; *kp && *kp != ' ' && *kp != '\t'; kp++)
+		;
+
+	if (*kp == '\0' || *(kp + 1) == '\0') {
+		stream_msg(c, 1, "line %lu missing key: %.40s...", num, line);
+		c->invalid = 1;
+		return;
+	}
+	*kp++ = '\0';
+	kp2 = kp;
+
+	if ((pub = sshkey_new(KEY_RSA1)) == NULL)
+		fatal("sshkey_new failed");
+	if ((r = sshkey_read(pub, &kp)) != 0) {
+		kp = kp2;
+		sshkey_free(pub);
+		if ((pub = sshkey_new(KEY_UNSPEC)) == NULL)
+			fatal("sshkey_new failed");
+		if ((r = sshkey_read(pub, &kp)) != 0) {
+			stream_msg(c, 1, "line %lu invalid key: %.40s...",
+			    num, line);
+			sshkey_free(pub);
+			c->invalid = 1;
+			return;
+		}
+	}
+
+	if (*cp == HASH_DELIM)
+		format_host(c->out, cp, pub, ca, 0);
+	else {
+		for (cp2 = strsep(&cp, ","); cp2 != NULL && *cp2 != '\0';
+		    cp2 = strsep(&cp, ",")) {
+			if (ca) {
+				stream_msg(c, 0, "Warning: ignoring CA key "
+				    "for host: %.64s", cp2);
+				format_host(c->out, cp2, pub, ca, 0);
+			} else if (strcspn(cp2, "*?!") != strlen(cp2)) {
+				stream_msg(c, 0, "Warning: ignoring host name "
+				    "with metacharacters: %.64s", cp2);
+				format_host(c->out, cp2, pub, ca, 0);
+			} else
+				format_host(c->out, cp2, pub, ca, 1);
+		}
+		c->unhashed = 1;
+	}
+	sshkey_free(pub);
+}
+
 static void
 do_known_hosts(struct passwd *pw, const char *name)
 {
 	FILE *in, *out = stdout;
 	struct sshkey *pub;
+	struct stream_ctx ctx;
+	struct hostindex_match *matches = NULL;
+	size_t nmatches = 0, nextmatch = 0;
+	off_t offset;
 	char *cp, *cp2, *kp, *kp2;
 	char line[16*1024], tmp[MAXPATHLEN], old[MAXPATHLEN];
 	int c, skip = 0, inplace = 0, num = 0, invalid = 0, has_unhashed = 0;
-	int ca, r;
+	int ca, r, use_index = 0, candidate = 1;
 
 	if (!have_identity) {
 		cp = tilde_expand_filename(_PATH_SSH_USER_HOSTFILE, pw->pw_uid);
@@ -993,6 +1287,16 @@ do_known_hosts(struct passwd *pw, const char *name)
 	if ((in = fopen(identity_file, "r")) == NULL)
 		fatal("%s: %s: %s", __progname, identity_file, strerror(errno));
 
+	/* An existing index narrows down the lines that may match */
+	if (find_host || delete_host) {
+		if ((r = hostindex_lookup(in, identity_file, name, 0,
+		    &matches, &nmatches)) == 0)
+			use_index = 1;
+		else
+			debug("%s: no index: %s", identity_file, ssh_err(r));
+		rewind(in);
+	}
+
 	/*
 	 * Find hosts goes to stdout, hash and deletions happen in-place
 	 * A corner case is ssh-keygen -HF foo, which should go to stdout
@@ -1014,7 +1318,41 @@ do_known_hosts(struct passwd *pw, const char *name)
 		inplace = 1;
 	}
 
-	while (fgets(line, sizeof(line), in)) {
+	if (hash_hosts && !find_host && !delete_host && !print_fingerprint) {
+		/* Plain hashing needs no state across lines */
+		bzero(&ctx, sizeof(ctx));
+		ctx.fn = hash_line;
+		ctx.toolong_invalid = 1;
+		ctx.out = out;
+		stream_lines(in, &ctx);
+		invalid = ctx.invalid;
+		has_unhashed = ctx.unhashed;
+		goto done;
+	}
+
+	for (;;) {
+		if (use_index && find_host) {
+			/* Only the candidate lines need to be read */
+			if (nextmatch >= nmatches)
+				break;
+			if (fseeko(in, matches[nextmatch].offset,
+			    SEEK_SET) == -1)
+				fatal("fseeko: %s", strerror(errno));
+			num = matches[nextmatch++].line - 1;
+			skip = 0;
+		}
+		if ((offset = ftello(in)) == -1)
+			fatal("ftello: %s", strerror(errno));
+		if (fgets(line, sizeof(line), in) == NULL)
+			break;
+		if (use_index && delete_host) {
+			/* Lines the index rules out cannot match */
+			while (nextmatch < nmatches &&
+			    matches[nextmatch].offset < offset)
+				nextmatch++;
+			candidate = nextmatch < nmatches &&
+			    matches[nextmatch].offset == offset;
+		}
 		if ((cp = strchr(line, '\n')) == NULL) {
 			error("line %d too long: %.40s...", num + 1, line);
 			skip = 1;
@@ -1076,14 +1414,15 @@ do_known_hosts(struct passwd *pw, const char *name)
 
 		if (*cp == HASH_DELIM) {
 			if (find_host || delete_host) {
-				cp2 = host_hash(name, cp, strlen(cp));
-				if (cp2 == NULL) {
+				cp2 = candidate ?
+				    host_hash(name, cp, strlen(cp)) : NULL;
+				if (candidate && cp2 == NULL) {
 					error("line %d: invalid hashed "
 					    "name: %.64s...", num, line);
 					invalid = 1;
 					continue;
 				}
-				c = (strcmp(cp2, cp) == 0);
+				c = (cp2 != NULL && strcmp(cp2, cp) == 0);
 				if (find_host && c) {
 					printf("# Host %s found: "
 					    "line %d type %s%s\n", name,
@@ -1097,7 +1436,7 @@ do_known_hosts(struct passwd *pw, const char *name)
 				printhost(out, cp, pub, ca, 0);
 		} else {
 			if (find_host || delete_host) {
-				c = (match_hostname(name, cp,
+				c = (candidate && match_hostname(name, cp,
 				    strlen(cp)) == 1);
 				if (find_host && c) {
 					printf("# Host %s found: "
@@ -1133,7 +1472,9 @@ do_known_hosts(struct passwd *pw, const char *name)
 		}
 		sshkey_free(pub);
 	}
+ done:
 	fclose(in);
+	free(matches);
 
 	if (invalid) {
 		fprintf(stderr, "%s is not a valid known_hosts file.\n",
@@ -1520,36 +1861,34 @@ load_pkcs11_key(char *path)
 #endif /* ENABLE_PKCS11 */
 }
 
-static void
-do_ca_sign(struct passwd *pw, int argc, char **argv)
+/* Returns whether -t asks for legacy (v00) certificates */
+static int
+cert_type_is_legacy(void)
 {
-	int r, i, fd;
-	u_int n;
-	struct sshkey *ca, *public;
-	char *otmp, *tmp, *cp, *out, *comment, **plist = NULL;
-	FILE *f;
-	int v00 = 0; /* legacy keys */
-
-	if (key_type_name != NULL) {
-		switch (sshkey_type_from_name(key_type_name)) {
-		case KEY_RSA_CERT_V00:
-		case KEY_DSA_CERT_V00:
-			v00 = 1;
-			break;
-		case KEY_UNSPEC:
-			if (strcasecmp(key_type_name, "v00") == 0) {
-				v00 = 1;
-				break;
-			} else if (strcasecmp(key_type_name, "v01") == 0)
-				break;
-			/* FALLTHROUGH */
-		default:
-			fprintf(stderr, "unknown key type %s\n", key_type_name);
-			exit(1);
-		}
+	if (key_type_name == NULL)
+		return 0;
+	switch (sshkey_type_from_name(key_type_name)) {
+	case KEY_RSA_CERT_V00:
+	case KEY_DSA_CERT_V00:
+		return 1;
+	case KEY_UNSPEC:
+		if (strcasecmp(key_type_name, "v00") == 0)
+			return 1;
+		else if (strcasecmp(key_type_name, "v01") == 0)
+			return 0;
+		/* FALLTHROUGH */
+	default:
+		fprintf(stderr, "unknown key type %s\n", key_type_name);
+		exit(1);
 	}
+}
+
+static struct sshkey *
+load_ca_key(struct passwd *pw)
+{
+	struct sshkey *ca;
+	char *tmp;
 
-	pkcs11_init(1);
 	tmp = tilde_expand_filename(ca_key_path, pw->pw_uid);
 	if (pkcs11provider != NULL) {
 		if ((ca = load_pkcs11_key(tmp)) == NULL)
@@ -1557,56 +1896,100 @@ do_ca_sign(struct passwd *pw, int argc, char **argv)
 	} else
 		ca = load_identity(tmp);
 	xfree(tmp);
+	return ca;
+}
 
-	for (i = 0; i < argc; i++) {
-		/* Split list of principals */
-		n = 0;
-		if (cert_principals != NULL) {
-			otmp = tmp = xstrdup(cert_principals);
-			plist = NULL;
-			for (; (cp = strsep(&tmp, ",")) != NULL; n++) {
-				plist = xrealloc(plist, n + 1, sizeof(*plist));
-				if (*(plist[n] = xstrdup(cp)) == '\0')
-					fatal("Empty principal name");
-			}
-			xfree(otmp);
+/* Splits a comma-separated list of principals */
+static u_int
+split_principals(const char *principals, char ***plistp)
+{
+	char *otmp, *tmp, *cp, **plist = NULL;
+	u_int n = 0;
+
+	if (principals != NULL) {
+		otmp = tmp = xstrdup(principals);
+		for (; (cp = strsep(&tmp, ",")) != NULL; n++) {
+			plist = xrealloc(plist, n + 1, sizeof(*plist));
+			if (*(plist[n] = xstrdup(cp)) == '\0')
+				fatal("Empty principal name");
 		}
+		xfree(otmp);
+	}
+	*plistp = plist;
+	return n;
+}
+
+/*
+ * Turns 'public' into a certificate signed by 'ca', with the certificate
+ * options given on the command line.  The certificate takes the list of
+ * principals, which is freed on failure.
+ */
+static int
+certify_key(struct sshkey *public, struct sshkey *ca, int v00,
+    const char *key_id, char **plist, u_int n, u_int64_t serial,
+    u_int64_t valid_from, u_int64_t valid_to)
+{
+	u_int i;
+	int r;
+
+	if ((r = sshkey_to_certified(public, v00)) != 0) {
+		for (i = 0; i < n; i++)
+			xfree(plist[i]);
+		if (plist != NULL)
+			xfree(plist);
+		return r;
+	}
+	public->cert->type = cert_key_type;
+	public->cert->serial = serial;
+	public->cert->key_id = xstrdup(key_id);
+	public->cert->nprincipals = n;
+	public->cert->principals = plist;
+	public->cert->valid_after = valid_from;
+	public->cert->valid_before = valid_to;
+	if (v00) {
+		prepare_options_buf(public->cert->critical,
+		    OPTIONS_CRITICAL|OPTIONS_EXTENSIONS);
+	} else {
+		prepare_options_buf(public->cert->critical,
+		    OPTIONS_CRITICAL);
+		prepare_options_buf(public->cert->extensions,
+		    OPTIONS_EXTENSIONS);
+	}
+	if ((r = sshkey_from_private(ca,
+	    &public->cert->signature_key)) != 0)
+		return r;
+	return sshkey_certify(public, ca);
+}
+
+static void
+do_ca_sign(struct passwd *pw, int argc, char **argv)
+{
+	int r, i, fd;
+	u_int n;
+	struct sshkey *ca, *public;
+	char *tmp, *cp, *out, *comment, **plist;
+	FILE *f;
+	int v00 = cert_type_is_legacy(); /* legacy keys */
+
+	pkcs11_init(1);
+	ca = load_ca_key(pw);
+
+	for (i = 0; i < argc; i++) {
+		n = split_principals(cert_principals, &plist);
 	
 		tmp = tilde_expand_filename(argv[i], pw->pw_uid);
 		if ((r = sshkey_load_public(tmp, &public, &comment)) != 0)
 			fatal("%s: unable to open \"%s\": %s",
 			    __func__, tmp, ssh_err(r));
 		if (public->type != KEY_RSA && public->type != KEY_DSA &&
-		    public->type != KEY_ECDSA)
+		    public->type != KEY_ECDSA && public->type != KEY_ED25519)
 			fatal("%s: key \"%s\" type %s cannot be certified",
 			    __func__, tmp, sshkey_type(public));
 
-		/* Prepare certificate to sign */
-		if ((r = sshkey_to_certified(public, v00)) != 0)
-			fatal("Could not upgrade key %s to certificate: %s",
-			    tmp, ssh_err(r));
-		public->cert->type = cert_key_type;
-		public->cert->serial = (u_int64_t)cert_serial;
-		public->cert->key_id = xstrdup(cert_key_id);
-		public->cert->nprincipals = n;
-		public->cert->principals = plist;
-		public->cert->valid_after = cert_valid_from;
-		public->cert->valid_before = cert_valid_to;
-		if (v00) {
-			prepare_options_buf(public->cert->critical,
-			    OPTIONS_CRITICAL|OPTIONS_EXTENSIONS);
-		} else {
-			prepare_options_buf(public->cert->critical,
-			    OPTIONS_CRITICAL);
-			prepare_options_buf(public->cert->extensions,
-			    OPTIONS_EXTENSIONS);
-		}
-		if ((r = sshkey_from_private(ca,
-		    &public->cert->signature_key)) != 0)
-			fatal("key_from_private (ca key): %s", ssh_err(r));
-
-		if (sshkey_certify(public, ca) != 0)
-			fatal("Couldn't not certify key %s", tmp);
+		if ((r = certify_key(public, ca, v00, cert_key_id, plist, n,
+		    (u_int64_t)cert_serial, cert_valid_from,
+		    cert_valid_to)) != 0)
+			fatal("Couldn't certify key %s: %s", tmp, ssh_err(r));
 
 		if ((cp = strrchr(tmp, '.')) != NULL && strcmp(cp, ".pub") == 0)
 			*cp = '\0';
@@ -1690,7 +2073,7 @@ parse_absolute_time(const char *s)
 }
 
 static void
-parse_cert_times(char *timespec)
+parse_cert_times(char *timespec, u_int64_t *fromp, u_int64_t *top)
 {
 	char *from, *to;
 	time_t now = time(NULL);
@@ -1700,12 +2083,12 @@ parse_cert_times(char *timespec)
 	if (*timespec == '+' && strchr(timespec, ':') == NULL) {
 		if ((secs = convtime(timespec + 1)) == -1)
 			fatal("Invalid relative certificate life %s", timespec);
-		cert_valid_to = now + secs;
+		*top = now + secs;
 		/*
 		 * Backdate certificate one minute to avoid problems on hosts
 		 * with poorly-synchronised clocks.
 		 */
-		cert_valid_from = ((now - 59)/ 60) * 60;
+		*fromp = ((now - 59)/ 60) * 60;
 		return;
 	}
 
@@ -1721,16 +2104,16 @@ parse_cert_times(char *timespec)
 	*to++ = '\0';
 
 	if (*from == '-' || *from == '+')
-		cert_valid_from = parse_relative_time(from, now);
+		*fromp = parse_relative_time(from, now);
 	else
-		cert_valid_from = parse_absolute_time(from);
+		*fromp = parse_absolute_time(from);
 
 	if (*to == '-' || *to == '+')
-		cert_valid_to = parse_relative_time(to, cert_valid_from);
+		*top = parse_relative_time(to, *fromp);
 	else
-		cert_valid_to = parse_absolute_time(to);
+		*top = parse_absolute_time(to);
 
-	if (cert_valid_to <= cert_valid_from)
+	if (*top <= *fromp)
 		fatal("Empty certificate validity interval");
 	xfree(from);
 }
@@ -1890,6 +2273,499 @@ do_show_cert(struct passwd *pw)
 	exit(0);
 }
 
+static void
+load_krl_ca(struct passwd *pw, struct sshkey **cap)
+{
+	char *tmp;
+	int r;
+
+	if (*cap != NULL || ca_key_path == NULL)
+		return;
+	tmp = tilde_expand_filename(ca_key_path, pw->pw_uid);
+	if ((r = sshkey_load_public(tmp, cap, NULL)) != 0)
+		fatal("Cannot load CA public key %s: %s", tmp, ssh_err(r));
+	xfree(tmp);
+}
+
+/*
+ * Adds the revocations in a text file to 'krl'.  Each line is either a
+ * public key, optionally prefixed by "key:", or "serial: lo[-hi]" to
+ * revoke certificates issued by the CA key given with -s.
+ */
+static void
+update_krl_from_file(struct passwd *pw, const char *file,
+    struct sshkey **cap, struct sshkrl_build *krl)
+{
+	char line[16*1024], *cp, *ep;
+	unsigned long long lo, hi;
+	u_long linenum = 0;
+	struct sshkey *key;
+	FILE *f;
+	int r;
+
+	if (strcmp(file, "-") == 0)
+		f = stdin;
+	else if ((f = fopen(file, "r")) == NULL)
+		fatal("%s: %s: %s", __progname, file, strerror(errno));
+	while (read_keyfile_line(f, file, line, sizeof(line),
+	    &linenum) != -1) {
+		cp = line + strspn(line, " \t");
+		cp[strcspn(cp, "\r\n")] = '\0';
+		if (*cp == '\0' || *cp == '#')
+			continue;
+		if (strncasecmp(cp, "serial:", 7) == 0) {
+			load_krl_ca(pw, cap);
+			if (*cap == NULL)
+				fatal("%s:%lu: revoking serials requires a "
+				    "CA key (-s)", file, linenum);
+			cp += 7 + strspn(cp + 7, " \t");
+			errno = 0;
+			lo = hi = strtoull(cp, &ep, 0);
+			if (*ep == '-')
+				hi = strtoull(ep + 1, &ep, 0);
+			if (ep == cp || *ep != '\0' || errno == ERANGE ||
+			    lo > hi)
+				fatal("%s:%lu: invalid serial \"%s\"",
+				    file, linenum, cp);
+			if ((r = sshkrl_build_revoke_serials(krl, *cap,
+			    lo, hi)) != 0)
+				fatal("%s: revoke serials: %s", __func__,
+				    ssh_err(r));
+			continue;
+		}
+		if (strncasecmp(cp, "key:", 4) == 0)
+			cp += 4 + strspn(cp + 4, " \t");
+		if ((key = sshkey_new(KEY_UNSPEC)) == NULL)
+			fatal("%s: sshkey_new failed", __func__);
+		if (sshkey_read(key, &cp) != 0)
+			fatal("%s:%lu: invalid key", file, linenum);
+		if ((r = sshkrl_build_revoke_key(krl, key)) != 0)
+			fatal("%s: revoke key: %s", __func__, ssh_err(r));
+		sshkey_free(key);
+	}
+	if (f != stdin)
+		fclose(f);
+}
+
+static void
+do_gen_krl(struct passwd *pw, int argc, char **argv)
+{
+	struct sshkrl_build *krl;
+	struct sshkey *ca = NULL;
+	struct sshbuf *b;
+	FILE *f;
+	int i, r;
+
+	if (!have_identity)
+		fatal("KRL generation requires an output file (-f)");
+	if (argc < 1)
+		fatal("No revocation files specified");
+	if ((krl = sshkrl_build_new()) == NULL ||
+	    (b = sshbuf_new()) == NULL)
+		fatal("%s: allocation failed", __func__);
+	sshkrl_build_set_version(krl, cert_serial);
+	for (i = 0; i < argc; i++)
+		update_krl_from_file(pw, argv[i], &ca, krl);
+	if ((r = sshkrl_build_serialise(krl, b)) != 0)
+		fatal("Couldn't generate KRL: %s", ssh_err(r));
+	if ((f = fopen(identity_file, "w")) == NULL)
+		fatal("%s: %s: %s", __progname, identity_file,
+		    strerror(errno));
+	if (fwrite(sshbuf_ptr(b), 1, sshbuf_len(b), f) != sshbuf_len(b) ||
+	    fclose(f) != 0)
+		fatal("write %s: %s", identity_file, strerror(errno));
+	sshbuf_free(b);
+	sshkrl_build_free(krl);
+	if (ca != NULL)
+		sshkey_free(ca);
+	exit(0);
+}
+
+static void
+do_check_krl(struct passwd *pw, int argc, char **argv)
+{
+	struct sshkrl *krl;
+	struct sshkey *key;
+	char *tmp;
+	int i, r, ret = 0;
+
+	if (!have_identity)
+		fatal("KRL checking requires an input file (-f)");
+	if ((r = sshkrl_load(identity_file, &krl)) != 0)
+		fatal("Cannot load KRL %s: %s", identity_file, ssh_err(r));
+	for (i = 0; i < argc; i++) {
+		tmp = tilde_expand_filename(argv[i], pw->pw_uid);
+		if ((r = sshkey_load_public(tmp, &key, NULL)) != 0)
+			fatal("Cannot load public key %s: %s",
+			    tmp, ssh_err(r));
+		r = sshkrl_check_key(krl, key);
+		if (r != 0 && r != SSH_ERR_KEY_REVOKED)
+			fatal("%s: %s", tmp, ssh_err(r));
+		printf("%s: %s\n", tmp, r == 0 ? "ok" : "REVOKED");
+		if (r != 0)
+			ret = 1;
+		sshkey_free(key);
+		xfree(tmp);
+	}
+	sshkrl_free(krl);
+	exit(ret);
+}
+
+/*
+ * Batch key generation and certificate signing (-U).  Every line of the
+ * manifest read from standard input is one of
+ *
+ *	generate path type [bits]
+ *	sign public_key key_id [principals [validity [serial]]]
+ *
+ * where "-" leaves principals or validity at their -n and -V values.
+ * Signed certificates without a serial are numbered consecutively from
+ * the -z serial.  The manifest is parsed on the main thread; the keys
+ * are generated or signed by -j worker threads and every output file is
+ * written to a temporary file that then replaces it.
+ */
+#define BATCH_GENERATE	1
+#define BATCH_SIGN	2
+#define BATCH_WINDOW	1024	/* manifest lines in flight */
+
+struct batch_item {
+	int		 op;
+	u_long		 linenum;
+	char		*path;		/* key to generate or to sign */
+	int		 type;		/* of a generated key */
+	u_int32_t	 bits;
+	char		*key_id;	/* of a certificate */
+	char		*principals;
+	char		**plist;
+	u_int		 nprincipals;
+	u_int64_t	 serial, valid_from, valid_to;
+	char		*out;		/* certificate written */
+	const char	*failed;	/* what failed, or NULL */
+	int		 r;
+	int		 errnum;	/* errno for SSH_ERR_SYSTEM_ERROR */
+};
+
+struct batch_ctx {
+	struct sshkey	*ca;
+	int		 v00;
+	const char	*comment;	/* of generated keys */
+	const char	*passphrase;
+	u_long		 nok, nfailed;
+};
+
+/*
+ * Output files are written to a temporary file next to them, which is
+ * then renamed over them, so that they are never seen partially written.
+ */
+static int
+batch_tmpfile(const char *path, char **tmpp)
+{
+	int fd;
+
+	xasprintf(tmpp, "%s.XXXXXXXXXX", path);
+	if ((fd = mkstemp(*tmpp)) == -1) {
+		xfree(*tmpp);
+		*tmpp = NULL;
+	}
+	return fd;
+}
+
+static int
+batch_commit(char *tmp, const char *path, int r)
+{
+	int oerrno;
+
+	if (r == 0 && rename(tmp, path) == -1)
+		r = SSH_ERR_SYSTEM_ERROR;
+	if (r != 0) {
+		oerrno = errno;
+		unlink(tmp);
+		errno = oerrno;
+	}
+	xfree(tmp);
+	return r;
+}
+
+static int
+batch_write_public(const char *path, const struct sshkey *key,
+    const char *comment)
+{
+	char *tmp;
+	FILE *f;
+	int fd, r;
+
+	if ((fd = batch_tmpfile(path, &tmp)) == -1)
+		return SSH_ERR_SYSTEM_ERROR;
+	if (fchmod(fd, 0644) == -1 || (f = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		return batch_commit(tmp, path, SSH_ERR_SYSTEM_ERROR);
+	}
+	if ((r = sshkey_write(key, f)) == 0 && fprintf(f, " %s\n", comment) < 0)
+		r = SSH_ERR_SYSTEM_ERROR;
+	if (fclose(f) != 0 && r == 0)
+		r = SSH_ERR_SYSTEM_ERROR;
+	return batch_commit(tmp, path, r);
+}
+
+static int
+batch_write_private(const char *path, struct sshkey *key,
+    const char *passphrase, const char *comment)
+{
+	char *tmp;
+	int fd;
+
+	if ((fd = batch_tmpfile(path, &tmp)) == -1)
+		return SSH_ERR_SYSTEM_ERROR;
+	close(fd);
+	return batch_commit(tmp, path,
+	    sshkey_save_private(key, tmp, passphrase, comment));
+}
+
+static void
+batch_generate(struct batch_item *item, struct batch_ctx *ctx)
+{
+	struct sshkey *private = NULL, *public = NULL;
+	char *pubpath;
+
+	xasprintf(&pubpath, "%s.pub", item->path);
+	if ((item->r = sshkey_generate(item->type, item->bits,
+	    &private)) != 0)
+		item->failed = "generate key";
+	else if ((item->r = sshkey_from_private(private, &public)) != 0)
+		item->failed = "public key";
+	else if ((item->r = batch_write_private(item->path, private,
+	    ctx->passphrase, ctx->comment)) != 0)
+		item->failed = "save private key";
+	else if ((item->r = batch_write_public(pubpath, public,
+	    ctx->comment)) != 0)
+		item->failed = "save public key";
+	sshkey_free(private);
+	sshkey_free(public);
+	xfree(pubpath);
+}
+
+static void
+batch_sign(struct batch_item *item, struct batch_ctx *ctx)
+{
+	struct sshkey *public = NULL;
+	char *comment = NULL, *cp;
+
+	if ((cp = strrchr(item->path, '.')) != NULL && strcmp(cp, ".pub") == 0)
+		xasprintf(&item->out, "%.*s-cert.pub",
+		    (int)(cp - item->path), item->path);
+	else
+		xasprintf(&item->out, "%s-cert.pub", item->path);
+	if ((item->r = sshkey_load_public(item->path, &public,
+	    &comment)) != 0) {
+		item->failed = "load public key";
+		goto out;
+	}
+	/* The certificate takes the principals */
+	item->r = certify_key(public, ctx->ca, ctx->v00, item->key_id,
+	    item->plist, item->nprincipals, item->serial, item->valid_from,
+	    item->valid_to);
+	item->plist = NULL;
+	item->nprincipals = 0;
+	if (item->r != 0) {
+		item->failed = "certify key";
+		goto out;
+	}
+	if ((item->r = batch_write_public(item->out, public, comment)) != 0)
+		item->failed = "save certificate";
+ out:
+	if (comment != NULL)
+		xfree(comment);
+	sshkey_free(public);
+}
+
+/* Runs on a worker thread */
+static void
+batch_work(void *arg, void *ctxarg)
+{
+	struct batch_item *item = arg;
+
+	if (item->op == BATCH_GENERATE)
+		batch_generate(item, ctxarg);
+	else
+		batch_sign(item, ctxarg);
+	if (item->r == SSH_ERR_SYSTEM_ERROR)
+		item->errnum = errno;
+}
+
+/* Runs on the main thread, in manifest order */
+static void
+batch_done(void *arg, void *ctxarg)
+{
+	struct batch_item *item = arg;
+	struct batch_ctx *ctx = ctxarg;
+	u_int i;
+
+	if (item->failed != NULL) {
+		error("line %lu: %s: %s: %s", item->linenum, item->path,
+		    item->failed, item->r == SSH_ERR_SYSTEM_ERROR ?
+		    strerror(item->errnum) : ssh_err(item->r));
+		ctx->nfailed++;
+	} else if (item->op == BATCH_GENERATE) {
+		if (!quiet)
+			logit("Generated %s", item->path);
+		ctx->nok++;
+	} else {
+		if (!quiet)
+			logit("Signed %s: id \"%s\" serial %llu%s%s valid %s",
+			    item->out, item->key_id,
+			    (unsigned long long)item->serial,
+			    item->principals != NULL ? " for " : "",
+			    item->principals != NULL ? item->principals : "",
+			    fmt_validity(item->valid_from, item->valid_to));
+		ctx->nok++;
+	}
+	xfree(item->path);
+	if (item->key_id != NULL)
+		xfree(item->key_id);
+	if (item->principals != NULL)
+		xfree(item->principals);
+	for (i = 0; i < item->nprincipals; i++)
+		xfree(item->plist[i]);
+	if (item->plist != NULL)
+		xfree(item->plist);
+	if (item->out != NULL)
+		xfree(item->out);
+	xfree(item);
+}
+
+/* Returns the next field of a manifest line, or NULL */
+static char *
+batch_field(char **linep)
+{
+	char *cp;
+
+	while ((cp = strsep(linep, " \t")) != NULL && *cp == '\0')
+		;
+	return cp;
+}
+
+/* Parses one manifest line, exiting on errors */
+static struct batch_item *
+batch_parse(struct passwd *pw, char *line, u_long linenum,
+    u_int64_t *next_serial)
+{
+	struct batch_item *item;
+	char *op, *cp;
+	const char *errstr;
+
+	op = batch_field(&line);
+	if ((cp = batch_field(&line)) == NULL)
+		fatal("line %lu: missing path", linenum);
+	item = xcalloc(1, sizeof(*item));
+	item->linenum = linenum;
+	item->path = tilde_expand_filename(cp, pw->pw_uid);
+	if (strcmp(op, "generate") == 0) {
+		item->op = BATCH_GENERATE;
+		if ((cp = batch_field(&line)) == NULL)
+			fatal("line %lu: missing key type", linenum);
+		if ((item->type = sshkey_type_from_name(cp)) == KEY_UNSPEC)
+			fatal("line %lu: unknown key type %s", linenum, cp);
+		item->bits = bits;
+		if ((cp = batch_field(&line)) != NULL) {
+			item->bits = (u_int32_t)strtonum(cp, 256, 32768,
+			    &errstr);
+			if (errstr)
+				fatal("line %lu: bits has bad value %s (%s)",
+				    linenum, cp, errstr);
+		}
+		type_bits_valid(item->type, &item->bits);
+	} else if (strcmp(op, "sign") == 0) {
+		item->op = BATCH_SIGN;
+		if ((cp = batch_field(&line)) == NULL)
+			fatal("line %lu: missing key id", linenum);
+		item->key_id = xstrdup(cp);
+		if ((cp = batch_field(&line)) != NULL && strcmp(cp, "-") != 0)
+			item->principals = xstrdup(cp);
+		else if (cert_principals != NULL)
+			item->principals = xstrdup(cert_principals);
+		item->nprincipals = split_principals(item->principals,
+		    &item->plist);
+		item->valid_from = cert_valid_from;
+		item->valid_to = cert_valid_to;
+		if ((cp = batch_field(&line)) != NULL && strcmp(cp, "-") != 0)
+			parse_cert_times(cp, &item->valid_from,
+			    &item->valid_to);
+		if ((cp = batch_field(&line)) != NULL) {
+			/* Decimal and in the range of -z */
+			item->serial = strtonum(cp, 0, LLONG_MAX, &errstr);
+			if (errstr)
+				fatal("line %lu: invalid serial \"%s\" (%s)",
+				    linenum, cp, errstr);
+		} else
+			item->serial = (*next_serial)++;
+	} else
+		fatal("line %lu: unknown operation \"%s\"", linenum, op);
+	if ((cp = batch_field(&line)) != NULL)
+		fatal("line %lu: trailing \"%s\"", linenum, cp);
+	return item;
+}
+
+static void
+do_batch(struct passwd *pw)
+{
+	struct batch_pool *pool;
+	struct batch_ctx ctx;
+	struct batch_item *item;
+	char line[8192], *cp, comment[1024];
+	u_long linenum = 0;
+	u_int64_t next_serial = (u_int64_t)cert_serial;
+	u_int nthreads = batch_threads;
+	int r;
+
+	bzero(&ctx, sizeof(ctx));
+	if (ca_key_path != NULL) {
+		ctx.v00 = cert_type_is_legacy();
+		pkcs11_init(1);
+		ctx.ca = load_ca_key(pw);
+		/* The PKCS#11 provider may not be used from several threads */
+		if (pkcs11provider != NULL)
+			nthreads = 1;
+		/* Memoise the key before the workers share it */
+		if ((r = sshkey_memoise(ctx.ca)) != 0)
+			fatal("%s: sshkey_memoise: %s", __func__, ssh_err(r));
+	}
+	if (identity_comment != NULL)
+		strlcpy(comment, identity_comment, sizeof(comment));
+	else
+		snprintf(comment, sizeof(comment), "%s@%s", pw->pw_name,
+		    hostname);
+	ctx.comment = comment;
+	ctx.passphrase = identity_new_passphrase != NULL ?
+	    identity_new_passphrase : "";
+	arc4random_stir();
+
+	if ((r = batch_pool_new(&pool, nthreads, BATCH_WINDOW,
+	    batch_work, batch_done, &ctx)) != 0)
+		fatal("%s: batch_pool_new: %s", __func__, ssh_err(r));
+	while (read_keyfile_line(stdin, "(stdin)", line, sizeof(line),
+	    &linenum) != -1) {
+		cp = line + strspn(line, " \t");
+		cp[strcspn(cp, "\r\n")] = '\0';
+		if (*cp == '\0' || *cp == '#')
+			continue;
+		item = batch_parse(pw, cp, linenum, &next_serial);
+		if (item->op == BATCH_SIGN && ctx.ca == NULL)
+			fatal("line %lu: signing requires a CA key (-s)",
+			    linenum);
+		batch_pool_submit(pool, item);
+	}
+	batch_pool_free(pool);
+
+	if (ctx.ca != NULL) {
+		sshkey_free(ctx.ca);
+		pkcs11_terminate();
+	}
+	if (!quiet)
+		logit("%lu keys processed, %lu failed", ctx.nok + ctx.nfailed,
+		    ctx.nfailed);
+	exit(ctx.nfailed == 0 ? 0 : 1);
+}
+
 static void
 usage(void)
 {
@@ -1913,7 +2789,9 @@ usage(void)
 	fprintf(stderr, "  -h          Generate host certificate instead of a user certificate.\n");
 	fprintf(stderr, "  -I key_id   Key identifier to include in certificate.\n");
 	fprintf(stderr, "  -i          Import foreign format to OpenSSH key file.\n");
+	fprintf(stderr, "  -j threads  Number of threads for -H, -l and -U.\n");
 	fprintf(stderr, "  -K checkpt  Write checkpoints to this file.\n");
+	fprintf(stderr, "  -k          Generate a key revocation list.\n");
 	fprintf(stderr, "  -L          Print the contents of a certificate.\n");
 	fprintf(stderr, "  -l          Show fingerprint of key file.\n");
 	fprintf(stderr, "  -M memory   Amount of memory (MB) to use for generating DH-GEX moduli.\n");
@@ -1923,6 +2801,7 @@ usage(void)
 	fprintf(stderr, "  -O option   Specify a certificate option.\n");
 	fprintf(stderr, "  -P phrase   Provide old passphrase.\n");
 	fprintf(stderr, "  -p          Change passphrase of private key file.\n");
+	fprintf(stderr, "  -Q          Check keys against a key revocation list.\n");
 	fprintf(stderr, "  -q          Quiet.\n");
 	fprintf(stderr, "  -R hostname Remove host from known_hosts file.\n");
 	fprintf(stderr, "  -r hostname Print DNS resource record.\n");
@@ -1930,6 +2809,7 @@ usage(void)
 	fprintf(stderr, "  -s ca_key   Certify keys with CA key.\n");
 	fprintf(stderr, "  -T file     Screen candidates for DH-GEX moduli.\n");
 	fprintf(stderr, "  -t type     Specify type of key to create.\n");
+	fprintf(stderr, "  -U          Generate or certify keys listed on standard input.\n");
 	fprintf(stderr, "  -V from:to  Specify certificate validity interval.\n");
 	fprintf(stderr, "  -v          Verbose.\n");
 	fprintf(stderr, "  -W gen      Generator to use for generating DH-GEX moduli.\n");
@@ -1954,7 +2834,7 @@ main(int argc, char **argv)
 	int r, opt, type, fd;
 	u_int32_t memory = 0, generator_wanted = 0, trials = 100;
 	int do_gen_candidates = 0, do_screen_candidates = 0;
-	int gen_all_hostkeys = 0;
+	int gen_all_hostkeys = 0, gen_krl = 0, check_krl = 0;
 	BIGNUM *start = NULL;
 	FILE *f;
 	const char *errstr;
@@ -1979,8 +2859,8 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
-	while ((opt = getopt(argc, argv, "AegiqpclBHLhvxXyF:b:f:t:D:I:K:P:m:N:n:"
-	    "O:C:r:g:R:T:G:M:S:s:a:V:W:z:")) != -1) {
+	while ((opt = getopt(argc, argv, "AegikqpclBHLhQUvxXyF:b:f:t:D:I:K:P:m:N:n:"
+	    "O:C:r:g:R:T:G:M:S:s:a:V:W:j:z:")) != -1) {
 		switch (opt) {
 		case 'A':
 			gen_all_hostkeys = 1;
@@ -2001,6 +2881,21 @@ main(int argc, char **argv)
 		case 'I':
 			cert_key_id = optarg;
 			break;
+		case 'k':
+			gen_krl = 1;
+			break;
+		case 'Q':
+			check_krl = 1;
+			break;
+		case 'U':
+			batch_mode = 1;
+			break;
+		case 'j':
+			batch_threads = (u_int)strtonum(optarg, 0, 256, &errstr);
+			if (errstr)
+				fatal("Invalid number of threads: %s (%s)",
+				    optarg, errstr);
+			break;
 		case 'R':
 			delete_host = 1;
 			rr_hostname = optarg;
@@ -2141,7 +3036,8 @@ main(int argc, char **argv)
 				fatal("Invalid start point.");
 			break;
 		case 'V':
-			parse_cert_times(optarg);
+			parse_cert_times(optarg, &cert_valid_from,
+			    &cert_valid_to);
 			break;
 		case 'z':
 			cert_serial = strtonum(optarg, 0, LLONG_MAX, &errstr);
@@ -2160,6 +3056,17 @@ main(int argc, char **argv)
 	argv += optind;
 	argc -= optind;
 
+	if (gen_krl)
+		do_gen_krl(pw, argc, argv);
+	if (check_krl)
+		do_check_krl(pw, argc, argv);
+	if (batch_mode) {
+		if (argc > 0) {
+			printf("Too many arguments.\n");
+			usage();
+		}
+		do_batch(pw);
+	}
 	if (ca_key_path != NULL) {
 		if (argc < 1) {
 			printf("Too few arguments.\n");
@@ -107,9 +107,12 @@ pkcs11_rsa_private_encrypt(int flen, const u_char *from, u_char *to, RSA *rsa,
 
 	if (padding != RSA_PKCS1_PADDING)
 		return (-1);
+	bzero(&key, sizeof(key));
 	key.type = KEY_RSA;
 	key.rsa = rsa;
-	if ((r = sshkey_to_blob(&key, &blob, &blen)) != 0) {
+	r = sshkey_to_blob(&key, &blob, &blen);
+	sshkey_memo_clear(&key);
+	if (r != 0) {
 		error("%s: sshkey_to_blob: %s", __func__, ssh_err(r));
 		return -1;
 	}
@@ -69,6 +69,7 @@ int foreground;
 int dump_packets;
 
 #define BUFSZ 16*1024
+#define KEY_INTERN_SIZE 64
 struct sshkey *hostkey, *known_hostkey;
 
 int
@@ -483,6 +484,9 @@ main(int argc, char **argv)
 	    NULL)) != 0)
 		fatal("sshkey_load_public: %s: %s", known_hostkey_file,
 		    ssh_err(r));
+	/* All sessions see the same server host keys */
+	if ((r = sshkey_intern_init(KEY_INTERN_SIZE)) != 0)
+		fatal("sshkey_intern_init: %s", ssh_err(r));
 	if (!foreground)
 		daemon(0, 0);
 	event_init();
@@ -779,6 +779,12 @@ main(int ac, char **av)
 		    (char *)NULL);
 		xfree(cp);
 	}
+	if (options.revoked_host_keys != NULL) {
+		cp = tilde_expand_filename(options.revoked_host_keys,
+		    original_real_uid);
+		xfree(options.revoked_host_keys);
+		options.revoked_host_keys = cp;
+	}
 	if (muxclient_command != 0 && options.control_path == NULL)
 		fatal("No ControlPath specified for \"-O\" command");
 	if (options.control_path != NULL)
@@ -812,7 +818,7 @@ main(int ac, char **av)
 	sensitive_data.external_keysign = 0;
 	if (options.rhosts_rsa_authentication ||
 	    options.hostbased_authentication) {
-		sensitive_data.nkeys = 7;
+		sensitive_data.nkeys = 9;
 		sensitive_data.keys = xcalloc(sensitive_data.nkeys,
 		    sizeof(struct sshkey));
 
@@ -833,23 +839,28 @@ main(int ac, char **av)
 		L_KEY(KEY_RSA1, _PATH_HOST_KEY_FILE, 0);
 		L_KEYCERT(KEY_DSA, _PATH_HOST_DSA_KEY_FILE, 1);
 		L_KEYCERT(KEY_ECDSA, _PATH_HOST_ECDSA_KEY_FILE, 2);
-		L_KEYCERT(KEY_RSA, _PATH_HOST_RSA_KEY_FILE, 3);
-		L_KEY(KEY_DSA, _PATH_HOST_DSA_KEY_FILE, 4);
-		L_KEY(KEY_ECDSA, _PATH_HOST_ECDSA_KEY_FILE, 5);
-		L_KEY(KEY_RSA, _PATH_HOST_RSA_KEY_FILE, 6);
+		L_KEYCERT(KEY_ED25519, _PATH_HOST_ED25519_KEY_FILE, 3);
+		L_KEYCERT(KEY_RSA, _PATH_HOST_RSA_KEY_FILE, 4);
+		L_KEY(KEY_DSA, _PATH_HOST_DSA_KEY_FILE, 5);
+		L_KEY(KEY_ECDSA, _PATH_HOST_ECDSA_KEY_FILE, 6);
+		L_KEY(KEY_ED25519, _PATH_HOST_ED25519_KEY_FILE, 7);
+		L_KEY(KEY_RSA, _PATH_HOST_RSA_KEY_FILE, 8);
 		PRIV_END;
 
 		if (options.hostbased_authentication == 1 &&
 		    sensitive_data.keys[0] == NULL &&
-		    sensitive_data.keys[4] == NULL &&
 		    sensitive_data.keys[5] == NULL &&
-		    sensitive_data.keys[6] == NULL) {
+		    sensitive_data.keys[6] == NULL &&
+		    sensitive_data.keys[7] == NULL &&
+		    sensitive_data.keys[8] == NULL) {
 			L_CERT(_PATH_HOST_DSA_KEY_FILE, 1);
 			L_CERT(_PATH_HOST_ECDSA_KEY_FILE, 2);
-			L_CERT(_PATH_HOST_RSA_KEY_FILE, 3);
-			L_PUBKEY(_PATH_HOST_DSA_KEY_FILE, 4);
-			L_PUBKEY(_PATH_HOST_ECDSA_KEY_FILE, 5);
-			L_PUBKEY(_PATH_HOST_RSA_KEY_FILE, 6);
+			L_CERT(_PATH_HOST_ED25519_KEY_FILE, 3);
+			L_CERT(_PATH_HOST_RSA_KEY_FILE, 4);
+			L_PUBKEY(_PATH_HOST_DSA_KEY_FILE, 5);
+			L_PUBKEY(_PATH_HOST_ECDSA_KEY_FILE, 6);
+			L_PUBKEY(_PATH_HOST_ED25519_KEY_FILE, 7);
+			L_PUBKEY(_PATH_HOST_RSA_KEY_FILE, 8);
 			sensitive_data.external_keysign = 1;
 		}
 	}
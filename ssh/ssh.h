@@ -83,6 +83,9 @@
 /* Used to identify ``EscapeChar none'' */
 #define SSH_ESCAPECHAR_NONE		-2
 
+/* Used to identify ``SocketBufferSize auto'' */
+#define SSH_SOCKBUF_AUTO		-2
+
 /*
  * unprivileged user when UsePrivilegeSeparation=yes;
  * sshd will change its privileges to this user and its
@@ -1,3 +1,6 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include "ssh1.h" /* For SSH_MSG_NONE */
 #include "ssh_api.h"
 #include "compat.h"
@@ -10,16 +13,43 @@
 #include "version.h"
 #include "myproposal.h"
 #include "err.h"
+#include "atomicio.h"
+#include "monitor_fdpass.h"
 
 #include <string.h>
+#include <unistd.h>
 
+void	_ssh_init_library(void);
+void	_ssh_set_kex_callbacks(struct ssh *);
 int	_ssh_exchange_banner(struct ssh *);
 int	_ssh_send_banner(struct ssh *, char **);
 int	_ssh_read_banner(struct ssh *, char **);
-int	_ssh_order_hostkeyalgs(struct ssh *);
+int	_ssh_order_hostkeyalgs(struct sshbuf *, struct key_entries *);
+int	_ssh_add_hostkey(struct key_entries *, struct key_entries *, int,
+    struct sshkey *);
+void	_ssh_free_hostkeys(struct key_entries *, struct key_entries *, int);
 int	_ssh_verify_host_key(struct sshkey *, struct ssh *);
 struct sshkey *_ssh_host_public_key(int, struct ssh *);
 struct sshkey *_ssh_host_private_key(int, struct ssh *);
+int	_ssh_host_key_blob(struct sshkey *, u_char **, u_int *, struct ssh *);
+
+/*
+ * configuration shared by the connections created with ssh_init_ctx().
+ * it is read-only once the first connection exists, so it can be
+ * shared between threads; only the reference count changes.
+ */
+struct ssh_ctx {
+	u_int refcount;
+	int server;
+	int frozen;
+	struct sshbuf *proposal;	/* as given to ssh_ctx_new() */
+	struct sshbuf *kexinit;		/* host key algorithms ordered */
+	struct key_entries private_keys;
+	struct key_entries public_keys;
+	int (*verify_host_key)(struct sshkey *, struct ssh *);
+	int (*sign_host_key)(struct sshkey *, u_char **, u_int *,
+	    const u_char *, u_int, struct ssh *);
+};
 
 /*
  * stubs for the server side implementation of kex.
@@ -54,14 +84,9 @@ ssh_init(struct ssh **sshp, int is_server, struct kex_params *kex_params)
 {
 	struct ssh *ssh;
 	char **proposal;
-	static int called;
 	int r;
 
-	if (!called) {
-		OpenSSL_add_all_algorithms();
-		called = 1;
-	}
-
+	_ssh_init_library();
 	ssh = ssh_packet_set_connection(NULL, -1, -1);
 	if (is_server)
 		ssh_packet_set_server(ssh);
@@ -73,22 +98,119 @@ ssh_init(struct ssh **sshp, int is_server, struct kex_params *kex_params)
 		return r;
 	}
 	ssh->kex->server = is_server;
-	if (is_server) {
-		ssh->kex->kex[KEX_DH_GRP1_SHA1] = kexdh_server;
-		ssh->kex->kex[KEX_DH_GRP14_SHA1] = kexdh_server;
-		ssh->kex->kex[KEX_DH_GEX_SHA1] = kexgex_server;
-		ssh->kex->kex[KEX_DH_GEX_SHA256] = kexgex_server;
-		ssh->kex->kex[KEX_ECDH_SHA2] = kexecdh_server;
-		ssh->kex->load_host_public_key=&_ssh_host_public_key;
-		ssh->kex->load_host_private_key=&_ssh_host_private_key;
-	} else {
-		ssh->kex->kex[KEX_DH_GRP1_SHA1] = kexdh_client;
-		ssh->kex->kex[KEX_DH_GRP14_SHA1] = kexdh_client;
-		ssh->kex->kex[KEX_DH_GEX_SHA1] = kexgex_client;
-		ssh->kex->kex[KEX_DH_GEX_SHA256] = kexgex_client;
-		ssh->kex->kex[KEX_ECDH_SHA2] = kexecdh_client;
-		ssh->kex->verify_host_key =&_ssh_verify_host_key;
+	_ssh_set_kex_callbacks(ssh);
+	*sshp = ssh;
+	return 0;
+}
+
+int
+ssh_ctx_new(struct ssh_ctx **ctxp, int is_server,
+    struct kex_params *kex_params)
+{
+	struct ssh_ctx *ctx;
+	char **proposal;
+	int r;
+
+	*ctxp = NULL;
+	_ssh_init_library();
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	ctx->refcount = 1;
+	ctx->server = is_server;
+	TAILQ_INIT(&ctx->private_keys);
+	TAILQ_INIT(&ctx->public_keys);
+	proposal = kex_params ? kex_params->proposal : myproposal;
+	if ((ctx->proposal = sshbuf_new()) == NULL ||
+	    (ctx->kexinit = sshbuf_new()) == NULL) {
+		r = SSH_ERR_ALLOC_FAIL;
+		goto out;
 	}
+	if ((r = kex_prop2buf(ctx->proposal, proposal)) != 0 ||
+	    (r = sshbuf_putb(ctx->kexinit, ctx->proposal)) != 0)
+		goto out;
+	*ctxp = ctx;
+	ctx = NULL;
+ out:
+	ssh_ctx_free(ctx);
+	return r;
+}
+
+void
+ssh_ctx_free(struct ssh_ctx *ctx)
+{
+	if (ctx == NULL || __sync_sub_and_fetch(&ctx->refcount, 1) != 0)
+		return;
+	_ssh_free_hostkeys(&ctx->private_keys, &ctx->public_keys,
+	    ctx->server);
+	sshbuf_free(ctx->proposal);
+	sshbuf_free(ctx->kexinit);
+	free(ctx);
+}
+
+int
+ssh_ctx_add_hostkey(struct ssh_ctx *ctx, struct sshkey *key)
+{
+	struct key_entry *k;
+	int r;
+
+	if (ctx->frozen)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if ((r = _ssh_add_hostkey(&ctx->private_keys, &ctx->public_keys,
+	    ctx->server, key)) != 0)
+		return r;
+	/* every KEX reply sends the public key */
+	if (ctx->server) {
+		k = TAILQ_LAST(&ctx->public_keys, key_entries);
+		if ((r = sshkey_to_blob(k->key, &k->blob, &k->bloblen)) != 0)
+			return r;
+	}
+	/* reorder the algorithms once instead of for every connection */
+	sshbuf_reset(ctx->kexinit);
+	if ((r = sshbuf_putb(ctx->kexinit, ctx->proposal)) != 0)
+		return r;
+	return _ssh_order_hostkeyalgs(ctx->kexinit, &ctx->public_keys);
+}
+
+int
+ssh_ctx_set_verify_host_key_callback(struct ssh_ctx *ctx,
+    int (*cb)(struct sshkey *, struct ssh *))
+{
+	if (cb == NULL || ctx->frozen)
+		return SSH_ERR_INVALID_ARGUMENT;
+	ctx->verify_host_key = cb;
+	return 0;
+}
+
+int
+ssh_ctx_set_sign_host_key_callback(struct ssh_ctx *ctx,
+    int (*cb)(struct sshkey *, u_char **, u_int *, const u_char *, u_int,
+    struct ssh *))
+{
+	if (cb == NULL || ctx->frozen || !ctx->server)
+		return SSH_ERR_INVALID_ARGUMENT;
+	ctx->sign_host_key = cb;
+	return 0;
+}
+
+int
+ssh_init_ctx(struct ssh **sshp, struct ssh_ctx *ctx)
+{
+	struct ssh *ssh;
+	int r;
+
+	*sshp = NULL;
+	ssh = ssh_packet_set_connection(NULL, -1, -1);
+	if (ctx->server)
+		ssh_packet_set_server(ssh);
+	if ((r = kex_new_from_buf(ssh, ctx->kexinit, &ssh->kex)) != 0) {
+		ssh_free(ssh);
+		return r;
+	}
+	ssh->kex->server = ctx->server;
+	ctx->frozen = 1;
+	__sync_add_and_fetch(&ctx->refcount, 1);
+	ssh->ctx = ctx;
+	_ssh_set_kex_callbacks(ssh);
 	*sshp = ssh;
 	return 0;
 }
@@ -97,23 +219,11 @@ void
 ssh_free(struct ssh *ssh)
 {
 	u_int mode;
-	struct key_entry *k;
 
 	ssh_packet_close(ssh);
-	/*
-	 * we've only created the public keys variants in case we
-	 * are a acting as a server.
-	 */
-	while ((k = TAILQ_FIRST(&ssh->public_keys)) != NULL) {
-		TAILQ_REMOVE(&ssh->public_keys, k, next);
-		if (ssh->kex && ssh->kex->server)
-			sshkey_free(k->key);
-		free(k);
-	}
-	while ((k = TAILQ_FIRST(&ssh->private_keys)) != NULL) {
-		TAILQ_REMOVE(&ssh->private_keys, k, next);
-		free(k);
-	}
+	_ssh_free_hostkeys(&ssh->private_keys, &ssh->public_keys,
+	    ssh->kex && ssh->kex->server);
+	ssh_ctx_free(ssh->ctx);
 	if (ssh->kex)
 		kex_free(ssh->kex);
 	for (mode = 0; mode < MODE_MAX; mode++) {
@@ -139,36 +249,8 @@ ssh_get_app_data(struct ssh *ssh)
 int
 ssh_add_hostkey(struct ssh *ssh, struct sshkey *key)
 {
-	struct sshkey *pubkey = NULL;
-	struct key_entry *k = NULL, *k_prv = NULL;
-	int r;
-
-	if (ssh->kex->server) {
-		if ((r = sshkey_from_private(key, &pubkey)) != 0)
-			return r;
-		if ((k = malloc(sizeof(*k))) == NULL ||
-		    (k_prv = malloc(sizeof(*k_prv))) == NULL) {
-			if (k)
-				free(k);
-			sshkey_free(pubkey);
-			return SSH_ERR_ALLOC_FAIL;
-		}
-		k_prv->key = key;
-		TAILQ_INSERT_TAIL(&ssh->private_keys, k_prv, next);
-
-		/* add the public key, too */
-		k->key = pubkey;
-		TAILQ_INSERT_TAIL(&ssh->public_keys, k, next);
-		r = 0;
-	} else {
-		if ((k = malloc(sizeof(*k))) == NULL)
-			return SSH_ERR_ALLOC_FAIL;
-		k->key = key;
-		TAILQ_INSERT_TAIL(&ssh->public_keys, k, next);
-		r = 0;
-	}
-
-	return r;
+	return _ssh_add_hostkey(&ssh->private_keys, &ssh->public_keys,
+	    ssh->kex->server, key);
 }
 
 int
@@ -183,6 +265,124 @@ ssh_set_verify_host_key_callback(struct ssh *ssh,
 	return 0;
 }
 
+int
+ssh_set_sign_host_key_callback(struct ssh *ssh,
+    int (*cb)(struct sshkey *, u_char **, u_int *, const u_char *, u_int,
+    struct ssh *))
+{
+	if (cb == NULL || ssh->kex == NULL || !ssh->kex->server)
+		return SSH_ERR_INVALID_ARGUMENT;
+
+	ssh->kex->sign_host_key = cb;
+
+	return 0;
+}
+
+int
+ssh_kex_resume(struct ssh *ssh, int result, const u_char *sig, size_t siglen)
+{
+	return kex_resume(ssh, result, sig, siglen);
+}
+
+int
+ssh_kex_pending(struct ssh *ssh)
+{
+	return ssh->kex != NULL && ssh->kex->pending != NULL;
+}
+
+int
+ssh_kex_pending_sign(struct ssh *ssh, struct sshkey **keyp,
+    const u_char **datap, size_t *datalenp)
+{
+	if (ssh->kex == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	return kex_pending_sign(ssh, keyp, datap, datalenp);
+}
+
+int
+ssh_set_kex_keypool(struct ssh *ssh, struct kex_keypool *pool)
+{
+	if (ssh->kex == NULL || !ssh->kex->server)
+		return SSH_ERR_INVALID_ARGUMENT;
+
+	ssh->kex->keypool = pool;
+
+	return 0;
+}
+
+int
+ssh_handoff_send(struct ssh *ssh, int sock, int fd)
+{
+	struct sshbuf *m;
+	u_char buf[4];
+	int r;
+
+	if ((m = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = ssh_packet_get_handoff_state(ssh, m)) != 0)
+		goto out;
+	POKE_U32(buf, sshbuf_len(m));
+	if (atomicio(vwrite, sock, buf, sizeof(buf)) != sizeof(buf) ||
+	    atomicio(vwrite, sock, sshbuf_ptr(m), sshbuf_len(m)) !=
+	    sshbuf_len(m) ||
+	    mm_send_fd(sock, fd) == -1) {
+		r = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	}
+	debug("%s: handed off connection on fd %d", __func__, fd);
+	r = 0;
+ out:
+	sshbuf_free(m);		/* contains key material */
+	return r;
+}
+
+int
+ssh_handoff_receive(struct ssh **sshp, int *fdp, int sock)
+{
+	struct ssh *ssh = NULL;
+	struct sshbuf *m;
+	u_char buf[4], *cp;
+	u_int32_t len;
+	int fd = -1, r;
+
+	*sshp = NULL;
+	*fdp = -1;
+	if (atomicio(read, sock, buf, sizeof(buf)) != sizeof(buf))
+		return SSH_ERR_SYSTEM_ERROR;
+	if ((len = PEEK_U32(buf)) > SSHBUF_SIZE_MAX)
+		return SSH_ERR_INVALID_FORMAT;
+	if ((m = sshbuf_new()) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = sshbuf_reserve(m, len, &cp)) != 0)
+		goto out;
+	if (atomicio(read, sock, cp, len) != len ||
+	    (fd = mm_receive_fd(sock)) == -1) {
+		r = SSH_ERR_SYSTEM_ERROR;
+		goto out;
+	}
+
+	_ssh_init_library();
+	ssh = ssh_packet_set_connection(NULL, -1, -1);
+	enable_compat20();
+	if ((r = ssh_packet_set_handoff_state(ssh, m)) != 0)
+		goto out;
+	_ssh_set_kex_callbacks(ssh);
+	kex_reset_dispatch(ssh);
+	debug("%s: resumed connection on fd %d", __func__, fd);
+	*sshp = ssh;
+	*fdp = fd;
+	ssh = NULL;
+	fd = -1;
+	r = 0;
+ out:
+	sshbuf_free(m);
+	if (ssh != NULL)
+		ssh_free(ssh);
+	if (fd != -1)
+		close(fd);
+	return r;
+}
+
 int
 ssh_input_append(struct ssh *ssh, const char *data, size_t len)
 {
@@ -204,6 +404,9 @@ ssh_packet_next(struct ssh *ssh, u_char *typep)
 	if (ssh->kex->client_version_string == NULL ||
 	    ssh->kex->server_version_string == NULL)
 		return _ssh_exchange_banner(ssh);
+	/* parked until ssh_kex_resume() */
+	if (ssh->kex->pending != NULL)
+		return 0;
 	/*
 	 * If we enough data and a dispatch function then
 	 * call the function and get the next packet.
@@ -221,6 +424,11 @@ ssh_packet_next(struct ssh *ssh, u_char *typep)
 		if (type > 0 && type < DISPATCH_MAX &&
 		    type >= SSH2_MSG_KEXINIT && type <= SSH2_MSG_TRANSPORT_MAX &&
 		    ssh->dispatch[type] != NULL) {
+			if (ssh->skip_packets) {
+				debug2("skipped packet (type %u)", type);
+				ssh->skip_packets--;
+				continue;
+			}
 			if ((r = (*ssh->dispatch[type])(type, seqnr, ssh)) != 0)
 				return r;
 		} else {
@@ -253,6 +461,10 @@ ssh_output_ptr(struct ssh *ssh, size_t *len)
 {
 	struct sshbuf *output = ssh_packet_get_output(ssh);
 
+	if (ssh_packet_encrypt_queued(ssh, 0) != 0) {
+		*len = 0;
+		return NULL;
+	}
 	*len = sshbuf_len(output);
 	return (sshbuf_ptr(output));
 }
@@ -275,6 +487,116 @@ ssh_input_space(struct ssh *ssh, size_t len)
 	return (0 == sshbuf_check_reserve(ssh_packet_get_input(ssh), len));
 }
 
+void
+_ssh_init_library(void)
+{
+	static int called;
+
+	if (!called) {
+		OpenSSL_add_all_algorithms();
+		called = 1;
+	}
+}
+
+/* install the kex methods and host key callbacks for our role */
+void
+_ssh_set_kex_callbacks(struct ssh *ssh)
+{
+	if (ssh->kex->server) {
+		ssh->kex->kex[KEX_DH_GRP1_SHA1] = kexdh_server;
+		ssh->kex->kex[KEX_DH_GRP14_SHA1] = kexdh_server;
+		ssh->kex->kex[KEX_DH_GEX_SHA1] = kexgex_server;
+		ssh->kex->kex[KEX_DH_GEX_SHA256] = kexgex_server;
+		ssh->kex->kex[KEX_ECDH_SHA2] = kexecdh_server;
+		ssh->kex->kex[KEX_C25519_SHA256] = kexc25519_server;
+		ssh->kex->load_host_public_key=&_ssh_host_public_key;
+		ssh->kex->load_host_private_key=&_ssh_host_private_key;
+		ssh->kex->host_key_blob=&_ssh_host_key_blob;
+		if (ssh->ctx != NULL && ssh->ctx->sign_host_key != NULL)
+			ssh->kex->sign_host_key = ssh->ctx->sign_host_key;
+	} else {
+		ssh->kex->kex[KEX_DH_GRP1_SHA1] = kexdh_client;
+		ssh->kex->kex[KEX_DH_GRP14_SHA1] = kexdh_client;
+		ssh->kex->kex[KEX_DH_GEX_SHA1] = kexgex_client;
+		ssh->kex->kex[KEX_DH_GEX_SHA256] = kexgex_client;
+		ssh->kex->kex[KEX_ECDH_SHA2] = kexecdh_client;
+		ssh->kex->kex[KEX_C25519_SHA256] = kexc25519_client;
+		if (ssh->ctx != NULL && ssh->ctx->verify_host_key != NULL)
+			ssh->kex->verify_host_key = ssh->ctx->verify_host_key;
+		else
+			ssh->kex->verify_host_key =&_ssh_verify_host_key;
+	}
+}
+
+/* add a host key; servers keep a public copy of every private key */
+int
+_ssh_add_hostkey(struct key_entries *private_keys,
+    struct key_entries *public_keys, int server, struct sshkey *key)
+{
+	struct sshkey *pubkey = NULL;
+	struct key_entry *k = NULL, *k_prv = NULL;
+	int r;
+
+	/*
+	 * every key exchange serialises the host keys, and the keys of a
+	 * ssh_ctx are shared by connections on several threads: see key.h
+	 */
+	if ((r = sshkey_memoise(key)) != 0)
+		return r;
+	if (server) {
+		if ((r = sshkey_from_private(key, &pubkey)) != 0 ||
+		    (r = sshkey_memoise(pubkey)) != 0) {
+			sshkey_free(pubkey);
+			return r;
+		}
+		if ((k = calloc(1, sizeof(*k))) == NULL ||
+		    (k_prv = calloc(1, sizeof(*k_prv))) == NULL) {
+			if (k)
+				free(k);
+			sshkey_free(pubkey);
+			return SSH_ERR_ALLOC_FAIL;
+		}
+		k_prv->key = key;
+		TAILQ_INSERT_TAIL(private_keys, k_prv, next);
+
+		/* add the public key, too */
+		k->key = pubkey;
+		TAILQ_INSERT_TAIL(public_keys, k, next);
+		r = 0;
+	} else {
+		if ((k = calloc(1, sizeof(*k))) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		k->key = key;
+		TAILQ_INSERT_TAIL(public_keys, k, next);
+		r = 0;
+	}
+
+	return r;
+}
+
+void
+_ssh_free_hostkeys(struct key_entries *private_keys,
+    struct key_entries *public_keys, int server)
+{
+	struct key_entry *k;
+
+	/*
+	 * we've only created the public keys variants in case we
+	 * are a acting as a server.
+	 */
+	while ((k = TAILQ_FIRST(public_keys)) != NULL) {
+		TAILQ_REMOVE(public_keys, k, next);
+		if (server)
+			sshkey_free(k->key);
+		free(k->blob);
+		free(k);
+	}
+	while ((k = TAILQ_FIRST(private_keys)) != NULL) {
+		TAILQ_REMOVE(private_keys, k, next);
+		free(k);
+	}
+}
+
 /* Read other side's version identification. */
 int
 _ssh_read_banner(struct ssh *ssh, char **bannerp)
@@ -380,32 +702,34 @@ _ssh_exchange_banner(struct ssh *ssh)
 		    kex->client_version_string == NULL)
 			r = _ssh_read_banner(ssh, &kex->client_version_string);
 	} else {
-		if (kex->server_version_string == NULL)
-			r = _ssh_read_banner(ssh, &kex->server_version_string);
-		if (r == 0 &&
-		    kex->server_version_string != NULL &&
-		    kex->client_version_string == NULL)
+		if (kex->client_version_string == NULL)
 			r = _ssh_send_banner(ssh, &kex->client_version_string);
+		if (r == 0 && kex->server_version_string == NULL)
+			r = _ssh_read_banner(ssh, &kex->server_version_string);
 	}
 	if (r != 0)
 		return r;
-	/* start initial kex as soon as we have exchanged the banners */
-	if (kex->server_version_string != NULL &&
-	    kex->client_version_string != NULL) {
-		if ((r = _ssh_order_hostkeyalgs(ssh)) != 0 ||
-		    (r = kex_send_kexinit(ssh)) != 0)
-			return r;
-	}
-	return 0;
+	/*
+	 * start initial kex as soon as the server has seen both banners.
+	 * the client does not wait for the server's banner: it sends its
+	 * KEXINIT and a guess at the first kex packet right after its own.
+	 */
+	if (kex->client_version_string == NULL ||
+	    (kex->flags & KEX_INIT_SENT))
+		return 0;
+	/* a shared context has ordered them already */
+	if (ssh->ctx == NULL && (r = _ssh_order_hostkeyalgs(kex->my,
+	    &ssh->public_keys)) != 0)
+		return r;
+	return kex_send_kexinit_guess(ssh);
 }
 
-struct sshkey *
-_ssh_host_public_key(int type, struct ssh *ssh)
+static struct sshkey *
+_ssh_find_host_key(int type, struct key_entries *keys)
 {
 	struct key_entry *k;
 
-	debug3("%s: need %d", __func__, type);
-	TAILQ_FOREACH(k, &ssh->public_keys, next) {
+	TAILQ_FOREACH(k, keys, next) {
 		debug3("%s: check %s", __func__, sshkey_type(k->key));
 		if (k->key->type == type)
 			return (k->key);
@@ -413,18 +737,49 @@ _ssh_host_public_key(int type, struct ssh *ssh)
 	return (NULL);
 }
 
+/* keys added to the connection take precedence over the shared ones */
+struct sshkey *
+_ssh_host_public_key(int type, struct ssh *ssh)
+{
+	struct sshkey *key;
+
+	debug3("%s: need %d", __func__, type);
+	if ((key = _ssh_find_host_key(type, &ssh->public_keys)) == NULL &&
+	    ssh->ctx != NULL)
+		key = _ssh_find_host_key(type, &ssh->ctx->public_keys);
+	return (key);
+}
+
 struct sshkey *
 _ssh_host_private_key(int type, struct ssh *ssh)
 {
-	struct key_entry *k;
+	struct sshkey *key;
 
 	debug3("%s: need %d", __func__, type);
-	TAILQ_FOREACH(k, &ssh->private_keys, next) {
-		debug3("%s: check %s", __func__, sshkey_type(k->key));
-		if (k->key->type == type)
-			return (k->key);
+	if ((key = _ssh_find_host_key(type, &ssh->private_keys)) == NULL &&
+	    ssh->ctx != NULL)
+		key = _ssh_find_host_key(type, &ssh->ctx->private_keys);
+	return (key);
+}
+
+int
+_ssh_host_key_blob(struct sshkey *key, u_char **blobp, u_int *lenp,
+    struct ssh *ssh)
+{
+	struct key_entry *k;
+
+	if (ssh->ctx == NULL)
+		return sshkey_to_blob(key, blobp, lenp);
+	TAILQ_FOREACH(k, &ssh->ctx->public_keys, next) {
+		if (k->key != key || k->blob == NULL)
+			continue;
+		if ((*blobp = malloc(k->bloblen)) == NULL)
+			return SSH_ERR_ALLOC_FAIL;
+		memcpy(*blobp, k->blob, k->bloblen);
+		*lenp = k->bloblen;
+		return 0;
 	}
-	return (NULL);
+	return sshkey_to_blob(key, blobp, lenp);
 }
 
 int
@@ -438,12 +793,19 @@ _ssh_verify_host_key(struct sshkey *hostkey, struct ssh *ssh)
 		if (sshkey_equal_public(hostkey, k->key))
 			return (0);	/* ok */
 	}
+	if (ssh->ctx == NULL)
+		return (-1);	/* failed */
+	TAILQ_FOREACH(k, &ssh->ctx->public_keys, next) {
+		debug3("%s: check %s", __func__, sshkey_type(k->key));
+		if (sshkey_equal_public(hostkey, k->key))
+			return (0);	/* ok */
+	}
 	return (-1);	/* failed */
 }
 
 /* offer hostkey algorithms in kexinit depending on registered keys */
 int
-_ssh_order_hostkeyalgs(struct ssh *ssh)
+_ssh_order_hostkeyalgs(struct sshbuf *my, struct key_entries *public_keys)
 {
 	struct key_entry *k;
 	char *orig, *avail, *oavail = NULL, *alg, *replace = NULL;
@@ -451,8 +813,8 @@ _ssh_order_hostkeyalgs(struct ssh *ssh)
 	size_t maxlen;
 	int ktype, r;
 
-	/* XXX we de-serialize ssh->kex->my, modify it, and change it */
-	if ((r = kex_buf2prop(ssh->kex->my, NULL, &proposal)) != 0)
+	/* XXX we de-serialize the kexinit, modify it, and change it */
+	if ((r = kex_buf2prop(my, NULL, &proposal)) != 0)
 		return r;
 	orig = proposal[PROPOSAL_SERVER_HOST_KEY_ALGS];
 	if ((oavail = avail = strdup(orig)) == NULL) {
@@ -468,7 +830,7 @@ _ssh_order_hostkeyalgs(struct ssh *ssh)
 	while ((alg = strsep(&avail, ",")) && *alg != '\0') {
 		if ((ktype = sshkey_type_from_name(alg)) == KEY_UNSPEC)
 			continue;
-		TAILQ_FOREACH(k, &ssh->public_keys, next) {
+		TAILQ_FOREACH(k, public_keys, next) {
 			if (k->key->type == ktype ||
 			    (sshkey_is_cert(k->key) && k->key->type ==
 			    sshkey_type_plain(ktype))) {
@@ -480,12 +842,12 @@ _ssh_order_hostkeyalgs(struct ssh *ssh)
 		}
 	}
 	if (*replace != '\0') {
-		debug2("%s: orig/%d    %s", __func__, ssh->kex->server, orig);
-		debug2("%s: replace/%d %s", __func__, ssh->kex->server, replace);
+		debug2("%s: orig    %s", __func__, orig);
+		debug2("%s: replace %s", __func__, replace);
 		free(orig);
 		proposal[PROPOSAL_SERVER_HOST_KEY_ALGS] = replace;
 		replace = NULL;	/* owned by proposal */
-		r = kex_prop2buf(ssh->kex->my, proposal);
+		r = kex_prop2buf(my, proposal);
 	}
  out:
 	if (oavail)
@@ -36,6 +36,32 @@ void	ssh_free(struct ssh *);
 void	ssh_set_app_data(struct ssh *, void *);
 void	*ssh_get_app_data(struct ssh *);
 
+/*
+ * ssh_ctx_new() creates a context holding configuration that many
+ * connections share: the key exchange proposal, the host keys and the
+ * host key verification callback. connections created from it with
+ * ssh_init_ctx() reference it instead of serialising the proposal,
+ * copying the host keys and ordering the host key algorithms each.
+ * the context becomes read-only once the first connection has been
+ * created from it and is reference counted, so it may be released with
+ * ssh_ctx_free() while its connections are still in use, also from
+ * other threads.
+ */
+int	ssh_ctx_new(struct ssh_ctx **, int is_server,
+    struct kex_params *kex_params);
+int	ssh_ctx_add_hostkey(struct ssh_ctx *, struct sshkey *key);
+int	ssh_ctx_set_verify_host_key_callback(struct ssh_ctx *,
+    int (*cb)(struct sshkey *, struct ssh *));
+int	ssh_ctx_set_sign_host_key_callback(struct ssh_ctx *,
+    int (*cb)(struct sshkey *, u_char **, u_int *, const u_char *, u_int,
+    struct ssh *));
+void	ssh_ctx_free(struct ssh_ctx *);
+
+/*
+ * ssh_init_ctx() creates a ssh connection object from a shared context.
+ */
+int	ssh_init_ctx(struct ssh **, struct ssh_ctx *);
+
 /*
  * ssh_add_hostkey() registers a private/public hostkey for an ssh
  * connection.
@@ -50,11 +76,83 @@ int	ssh_add_hostkey(struct ssh *ssh, struct sshkey *key);
  * ssh_set_verify_host_key_callback() registers a callback function
  * which should be called instead of the default verification. The
  * function given must return 0 if the hostkey is ok, -1 if the
- * verification has failed.
+ * verification has failed, or SSH_ERR_KEX_PENDING if the answer is
+ * passed to ssh_kex_resume() later.  any other value, such as an
+ * SSH_ERR_* code, rejects the key.
+ * once the application has enabled key interning with sshkey_intern_init()
+ * the key may be shared with other connections: it must not be modified,
+ * and a copy made with sshkey_from_private() is needed to keep it.
+ * interning is not thread-safe, so it is only for applications that run
+ * all their connections on one thread.
  */
 int	ssh_set_verify_host_key_callback(struct ssh *ssh,
     int (*cb)(struct sshkey *, struct ssh *));
 
+/*
+ * ssh_set_sign_host_key_callback() registers a callback that a server
+ * uses instead of sshkey_sign() to sign the exchange hash with its
+ * private host key. it either returns the signature in sigp/lenp
+ * (allocated with malloc) or returns SSH_ERR_KEX_PENDING and passes the
+ * signature to ssh_kex_resume() later; 'data' is only valid during the
+ * call, see ssh_kex_pending_sign(). sign_pool_submit() (signpool.h)
+ * makes the signature on a worker thread.
+ */
+int	ssh_set_sign_host_key_callback(struct ssh *ssh,
+    int (*cb)(struct sshkey *, u_char **sigp, u_int *lenp,
+    const u_char *data, u_int datalen, struct ssh *));
+
+/*
+ * while a host key callback is pending the connection is parked:
+ * ssh_packet_next() returns no packets and no key exchange messages
+ * are sent. ssh_kex_resume() completes the operation: 'result' is 0 if
+ * the host key has been accepted or the signature in 'sig' has been
+ * made, an error code otherwise. it must be called from the thread that
+ * uses the connection; on error the connection should be closed.
+ * ssh_kex_pending() returns 1 while the connection waits.
+ */
+int	ssh_kex_resume(struct ssh *ssh, int result, const u_char *sig,
+    size_t siglen);
+int	ssh_kex_pending(struct ssh *ssh);
+
+/*
+ * ssh_kex_pending_sign() returns the host key and the data to sign while
+ * a server waits for its signature; both stay valid until
+ * ssh_kex_resume() is called or the connection is freed.
+ */
+int	ssh_kex_pending_sign(struct ssh *ssh, struct sshkey **keyp,
+    const u_char **datap, size_t *datalenp);
+
+/*
+ * ssh_set_kex_keypool() lets a server take its ephemeral DH and ECDH
+ * keys from a pool created with kex_keypool_new() (see kexpool.h)
+ * instead of generating them during the key exchange. the pool is not
+ * owned by the connection, must outlive it and must not be used by
+ * other threads at the same time.
+ */
+int	ssh_set_kex_keypool(struct ssh *ssh, struct kex_keypool *pool);
+
+/*
+ * ssh_handoff_send() transfers an established connection to another
+ * process: the connection state, including buffered input and output
+ * and packets queued during a key exchange, is written to the unix
+ * domain socket 'sock', followed by the transport file descriptor 'fd'
+ * (passed with SCM_RIGHTS).
+ * the handoff fails with SSH_ERR_KEX_IN_PROGRESS if a key exchange is
+ * running (retry once it has finished) and cannot be done while
+ * compression is enabled.
+ * on success the caller should stop using 'ssh' and 'fd', then release
+ * them with ssh_free() and close().
+ */
+int	ssh_handoff_send(struct ssh *ssh, int sock, int fd);
+
+/*
+ * ssh_handoff_receive() resumes a connection sent with ssh_handoff_send()
+ * and returns it together with its transport file descriptor.
+ * host keys, a custom host key verification callback and app data are
+ * not transferred and must be registered again before the next rekey.
+ */
+int	ssh_handoff_receive(struct ssh **sshp, int *fdp, int sock);
+
 /*
  * ssh_packet_next() advances to the next input packet and returns
  * the packet type in typep.
@@ -107,6 +205,9 @@ int	ssh_output_space(struct ssh *ssh, size_t len);
  * current output byte-stream. the bytes need to be sent over the
  * network. the number of bytes that have been successfully sent can
  * be removed from the output byte-stream with ssh_output_consume().
+ * channel packets are encrypted in priority order only when they are
+ * retrieved here, so more output may follow after everything returned
+ * has been consumed.
  */
 void	*ssh_output_ptr(struct ssh *ssh, size_t *len);
 
@@ -0,0 +1,1151 @@
+/* $OpenBSD$ */
+/*
+ * Event-driven engine for many ssh_api connections.
+ *
+ * Every event loop ("shard") runs on its own thread and owns a set of
+ * connections and an edge triggered epoll (kqueue on BSD) descriptor.
+ * An iteration first reads every socket that became readable and
+ * dispatches its packets, then writes the output of every connection
+ * that produced some, so all packets generated while servicing a batch
+ * of ready connections leave with one write per socket.  Input is read
+ * through a per-shard buffer so idle connections keep small buffers.
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ssh1.h" /* For SSH_MSG_NONE */
+#include "ssh_api.h"
+#include "ssh_engine.h"
+#include "cryptothread.h"
+#include "kexpool.h"
+#include "signpool.h"
+#include "packet.h"
+#include "misc.h"
+#include "log.h"
+#include "err.h"
+
+#define ENGINE_SHARDS_MAX	256
+#define ENGINE_EVENTS		256		/* events per poll */
+#define ENGINE_READ_SIZE	(64 * 1024)
+#define ENGINE_READ_BUDGET	(256 * 1024)	/* per connection and pass */
+#define ENGINE_LOWAT		(256 * 1024)
+#define ENGINE_HIWAT		(1024 * 1024)
+#define ENGINE_KEYPOOL_BATCH	4		/* keys generated per idle pass */
+
+/* connection flags */
+#define CONN_READABLE	0x0001	/* socket may have input */
+#define CONN_WRITABLE	0x0002	/* socket may accept output */
+#define CONN_PAUSED	0x0004
+#define CONN_BLOCKED	0x0008	/* output above the high watermark */
+#define CONN_CLOSING	0x0010	/* close once the output is written */
+#define CONN_DEAD	0x0020
+#define CONN_READY	0x0040	/* on the shard's ready list */
+#define CONN_FLUSH	0x0080	/* on the shard's flush list */
+#define CONN_SIGNING	0x0100	/* host key signature on the sign pool */
+
+struct ssh_engine_timer {
+	u_int64_t when, seq;
+	u_int idx;				/* position in the heap */
+	struct ssh_engine_conn *conn;
+	void (*cb)(struct ssh_engine_conn *, void *);
+	void *arg;
+	TAILQ_ENTRY(ssh_engine_timer) next;	/* per connection */
+};
+
+struct ssh_engine_conn {
+	struct engine_shard *shard;
+	struct ssh *ssh;
+	int fd;
+	int flags;
+	void *arg;
+	TAILQ_ENTRY(ssh_engine_conn) entry;	/* incoming, conns or dead */
+	TAILQ_ENTRY(ssh_engine_conn) ready_entry;
+	TAILQ_ENTRY(ssh_engine_conn) flush_entry;
+	TAILQ_HEAD(, ssh_engine_timer) timers;
+};
+TAILQ_HEAD(engine_conns, ssh_engine_conn);
+
+/* a signature made by the sign pool, on its way back to the shard */
+struct engine_signature {
+	struct ssh_engine_conn *conn;
+	int r;
+	u_char *sig;
+	u_int siglen;
+	TAILQ_ENTRY(engine_signature) next;
+};
+
+struct engine_shard {
+	struct ssh_engine *engine;
+	int id;
+	int pollfd;
+	int wakeup[2];
+	pthread_t thread;
+	pthread_mutex_t lock;		/* protects incoming, signatures, shared */
+	struct engine_conns incoming;
+	TAILQ_HEAD(, engine_signature) signatures;
+	struct engine_conns conns, ready, flush, dead;
+	u_int nready;
+	struct ssh_engine_timer **timers;	/* min-heap */
+	u_int ntimers, timers_alloc;
+	u_int64_t timer_seq;
+	struct kex_keypool *keypool;
+	int keypool_failed;
+	struct ssh_engine_stats stats;		/* owned by the shard thread */
+	struct ssh_engine_stats shared;		/* copy for other threads */
+	u_char buf[ENGINE_READ_SIZE];
+};
+
+struct ssh_engine {
+	struct ssh_engine_callbacks cb;
+	struct engine_shard *shards;
+	u_int nshards;
+	u_int next_shard;
+	pthread_mutex_t lock;			/* protects next_shard */
+	size_t lowat, hiwat;
+	struct sign_pool *signpool;
+	volatile sig_atomic_t stop;
+	int error;
+};
+
+void	_ssh_init_library(void);
+
+static void engine_conn_close(struct ssh_engine_conn *, int);
+static void engine_signatures(struct engine_shard *);
+
+static u_int64_t
+engine_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		fatal("%s: clock_gettime: %s", __func__, strerror(errno));
+	return (u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* poll backend */
+
+static int
+engine_poll_create(void)
+{
+#ifdef __linux__
+	return epoll_create1(EPOLL_CLOEXEC);
+#else
+	return kqueue();
+#endif
+}
+
+/* register 'fd' edge triggered; 'udata' is NULL for the wakeup pipe */
+static int
+engine_poll_add(struct engine_shard *sh, int fd, void *udata, int output)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET | (output ? EPOLLOUT : 0);
+	ev.data.ptr = udata;
+	return epoll_ctl(sh->pollfd, EPOLL_CTL_ADD, fd, &ev);
+#else
+	struct kevent ev[2];
+
+	EV_SET(&ev[0], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, udata);
+	EV_SET(&ev[1], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, udata);
+	return kevent(sh->pollfd, ev, output ? 2 : 1, NULL, 0, NULL);
+#endif
+}
+
+static void
+engine_poll_del(struct engine_shard *sh, int fd)
+{
+#ifdef __linux__
+	(void)epoll_ctl(sh->pollfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	/* kqueue drops the filters when the descriptor is closed */
+}
+
+static void
+engine_ready(struct ssh_engine_conn *c)
+{
+	struct engine_shard *sh = c->shard;
+
+	if (c->flags & (CONN_READY | CONN_DEAD))
+		return;
+	c->flags |= CONN_READY;
+	TAILQ_INSERT_TAIL(&sh->ready, c, ready_entry);
+	sh->nready++;
+}
+
+static void
+engine_unready(struct ssh_engine_conn *c)
+{
+	struct engine_shard *sh = c->shard;
+
+	if ((c->flags & CONN_READY) == 0)
+		return;
+	c->flags &= ~CONN_READY;
+	TAILQ_REMOVE(&sh->ready, c, ready_entry);
+	sh->nready--;
+}
+
+static void
+engine_flush_later(struct ssh_engine_conn *c)
+{
+	if (c->flags & (CONN_FLUSH | CONN_DEAD))
+		return;
+	c->flags |= CONN_FLUSH;
+	TAILQ_INSERT_TAIL(&c->shard->flush, c, flush_entry);
+}
+
+static void
+engine_wake(struct engine_shard *sh)
+{
+	while (write(sh->wakeup[1], "", 1) == -1 && errno == EINTR)
+		;
+}
+
+/* parks the signature until engine_sign() hands it to the sign pool */
+static int
+engine_defer_sign(struct sshkey *key, u_char **sigp, u_int *lenp,
+    const u_char *data, u_int datalen, struct ssh *ssh)
+{
+	return SSH_ERR_KEX_PENDING;
+}
+
+/*
+ * pick up connections added by ssh_engine_add() and signatures made
+ * by the sign pool
+ */
+static void
+engine_incoming(struct engine_shard *sh)
+{
+	struct engine_conns new;
+	struct ssh_engine_conn *c;
+
+	while (read(sh->wakeup[0], sh->buf, sizeof(sh->buf)) > 0)
+		;
+	engine_signatures(sh);
+	TAILQ_INIT(&new);
+	pthread_mutex_lock(&sh->lock);
+	while ((c = TAILQ_FIRST(&sh->incoming)) != NULL) {
+		TAILQ_REMOVE(&sh->incoming, c, entry);
+		TAILQ_INSERT_TAIL(&new, c, entry);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	while ((c = TAILQ_FIRST(&new)) != NULL) {
+		TAILQ_REMOVE(&new, c, entry);
+		TAILQ_INSERT_TAIL(&sh->conns, c, entry);
+		sh->stats.conns++;
+		if (sh->keypool != NULL && c->ssh->kex != NULL &&
+		    c->ssh->kex->server && c->ssh->kex->keypool == NULL)
+			c->ssh->kex->keypool = sh->keypool;
+		if (sh->engine->signpool != NULL && c->ssh->kex != NULL &&
+		    c->ssh->kex->server && c->ssh->kex->sign_host_key == NULL)
+			c->ssh->kex->sign_host_key = engine_defer_sign;
+		if (engine_poll_add(sh, c->fd, c, 1) == -1) {
+			error("%s: fd %d: %s", __func__, c->fd,
+			    strerror(errno));
+			engine_conn_close(c, SSH_ERR_SYSTEM_ERROR);
+			continue;
+		}
+		/* the server sends its banner right away */
+		engine_ready(c);
+	}
+}
+
+static void
+engine_event(struct engine_shard *sh, void *udata, int readable,
+    int writable)
+{
+	struct ssh_engine_conn *c = udata;
+
+	if (c == NULL) {
+		engine_incoming(sh);
+		return;
+	}
+	if (writable) {
+		c->flags |= CONN_WRITABLE;
+		engine_flush_later(c);
+	}
+	if (readable) {
+		c->flags |= CONN_READABLE;
+		engine_ready(c);
+	}
+}
+
+static int
+engine_poll(struct engine_shard *sh, int timeout)
+{
+	int i, n;
+#ifdef __linux__
+	struct epoll_event ev[ENGINE_EVENTS];
+
+	if ((n = epoll_wait(sh->pollfd, ev, ENGINE_EVENTS, timeout)) == -1) {
+		if (errno == EINTR)
+			return 0;
+		error("%s: epoll_wait: %s", __func__, strerror(errno));
+		return SSH_ERR_SYSTEM_ERROR;
+	}
+	for (i = 0; i < n; i++)
+		engine_event(sh, ev[i].data.ptr,
+		    ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP),
+		    ev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP));
+#else
+	struct kevent ev[ENGINE_EVENTS];
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		tsp = &ts;
+	}
+	if ((n = kevent(sh->pollfd, NULL, 0, ev, ENGINE_EVENTS, tsp)) == -1) {
+		if (errno == EINTR)
+			return 0;
+		error("%s: kevent: %s", __func__, strerror(errno));
+		return SSH_ERR_SYSTEM_ERROR;
+	}
+	for (i = 0; i < n; i++)
+		engine_event(sh, ev[i].udata,
+		    ev[i].filter == EVFILT_READ,
+		    ev[i].filter == EVFILT_WRITE);
+#endif
+	sh->stats.polls++;
+	sh->stats.events += n;
+	return 0;
+}
+
+/* timers */
+
+static int
+timer_before(struct ssh_engine_timer *a, struct ssh_engine_timer *b)
+{
+	if (a->when != b->when)
+		return a->when < b->when;
+	return a->seq < b->seq;
+}
+
+static void
+engine_timer_up(struct engine_shard *sh, u_int i)
+{
+	struct ssh_engine_timer *t = sh->timers[i];
+	u_int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!timer_before(t, sh->timers[parent]))
+			break;
+		sh->timers[i] = sh->timers[parent];
+		sh->timers[i]->idx = i;
+		i = parent;
+	}
+	sh->timers[i] = t;
+	t->idx = i;
+}
+
+static void
+engine_timer_down(struct engine_shard *sh, u_int i)
+{
+	struct ssh_engine_timer *t = sh->timers[i];
+	u_int child;
+
+	while ((child = 2 * i + 1) < sh->ntimers) {
+		if (child + 1 < sh->ntimers &&
+		    timer_before(sh->timers[child + 1], sh->timers[child]))
+			child++;
+		if (!timer_before(sh->timers[child], t))
+			break;
+		sh->timers[i] = sh->timers[child];
+		sh->timers[i]->idx = i;
+		i = child;
+	}
+	sh->timers[i] = t;
+	t->idx = i;
+}
+
+static void
+engine_timer_free(struct ssh_engine_timer *t)
+{
+	struct ssh_engine_conn *c = t->conn;
+	struct engine_shard *sh = c->shard;
+	struct ssh_engine_timer *last;
+	u_int i = t->idx;
+
+	last = sh->timers[--sh->ntimers];
+	if (i != sh->ntimers) {
+		sh->timers[i] = last;
+		last->idx = i;
+		engine_timer_down(sh, i);
+		engine_timer_up(sh, last->idx);
+	}
+	TAILQ_REMOVE(&c->timers, t, next);
+	free(t);
+}
+
+/*
+ * Runs the expired timers and returns the time until the next one in
+ * milliseconds, or -1 if none is pending.  Timers armed by the callbacks
+ * run in the next pass at the earliest.
+ */
+static int
+engine_timers(struct engine_shard *sh)
+{
+	struct ssh_engine_timer *t;
+	struct ssh_engine_conn *c;
+	void (*cb)(struct ssh_engine_conn *, void *);
+	void *arg;
+	u_int64_t now, seq = sh->timer_seq;
+
+	if (sh->ntimers == 0)
+		return -1;
+	now = engine_now();
+	while (sh->ntimers > 0) {
+		t = sh->timers[0];
+		if (t->when > now)
+			return MIN(t->when - now, INT_MAX);
+		if (t->seq >= seq)
+			return 0;
+		c = t->conn;
+		cb = t->cb;
+		arg = t->arg;
+		engine_timer_free(t);
+		cb(c, arg);
+	}
+	return -1;
+}
+
+/* connections */
+
+static void
+engine_conn_close(struct ssh_engine_conn *c, int r)
+{
+	struct engine_shard *sh = c->shard;
+	struct ssh_engine *e = sh->engine;
+	struct ssh_engine_timer *t;
+
+	if (c->flags & CONN_DEAD)
+		return;
+	engine_unready(c);
+	if (c->flags & CONN_FLUSH)
+		TAILQ_REMOVE(&sh->flush, c, flush_entry);
+	c->flags = (c->flags & ~CONN_FLUSH) | CONN_DEAD;
+	while ((t = TAILQ_FIRST(&c->timers)) != NULL)
+		engine_timer_free(t);
+	engine_poll_del(sh, c->fd);
+	TAILQ_REMOVE(&sh->conns, c, entry);
+	TAILQ_INSERT_TAIL(&sh->dead, c, entry);
+	sh->stats.conns--;
+	if (r != 0 && r != SSH_ERR_CONN_CLOSED)
+		debug("%s: fd %d: %s", __func__, c->fd, ssh_err(r));
+	if (e->cb.closed != NULL)
+		e->cb.closed(c, r, c->arg);
+}
+
+/*
+ * free the connections closed during this pass, except those whose host
+ * key is still used by the sign pool
+ */
+static void
+engine_reap(struct engine_shard *sh)
+{
+	struct ssh_engine_conn *c, *next;
+
+	for (c = TAILQ_FIRST(&sh->dead); c != NULL; c = next) {
+		next = TAILQ_NEXT(c, entry);
+		if (c->flags & CONN_SIGNING)
+			continue;
+		TAILQ_REMOVE(&sh->dead, c, entry);
+		close(c->fd);
+		ssh_free(c->ssh);
+		free(c);
+	}
+}
+
+static void
+engine_watermarks(struct ssh_engine_conn *c)
+{
+	struct ssh_engine *e = c->shard->engine;
+	size_t pending = ssh_packet_output_pending(c->ssh);
+
+	if ((c->flags & CONN_BLOCKED) == 0 && pending > e->hiwat) {
+		c->flags |= CONN_BLOCKED;
+		if (e->cb.output != NULL)
+			e->cb.output(c, 1, c->arg);
+	} else if ((c->flags & CONN_BLOCKED) && pending <= e->lowat) {
+		c->flags &= ~CONN_BLOCKED;
+		if (e->cb.output != NULL)
+			e->cb.output(c, 0, c->arg);
+	}
+}
+
+/* read until the socket would block or the budget is used up */
+static int
+engine_read(struct ssh_engine_conn *c)
+{
+	struct engine_shard *sh = c->shard;
+	size_t budget = ENGINE_READ_BUDGET;
+	ssize_t len;
+	int r;
+
+	while (budget > 0) {
+		len = read(c->fd, sh->buf, sizeof(sh->buf));
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				c->flags &= ~CONN_READABLE;
+				return 0;
+			}
+			return SSH_ERR_SYSTEM_ERROR;
+		}
+		if (len == 0)
+			return SSH_ERR_CONN_CLOSED;
+		if ((r = ssh_input_append(c->ssh, (char *)sh->buf, len)) != 0)
+			return r;
+		sh->stats.bytes_in += len;
+		budget -= MIN(budget, (size_t)len);
+	}
+	return 0;
+}
+
+static int
+engine_banner_done(struct ssh *ssh)
+{
+	return ssh->kex->client_version_string != NULL &&
+	    ssh->kex->server_version_string != NULL;
+}
+
+/* called by a sign pool worker */
+static void
+engine_signed(int r, u_char *sig, u_int siglen, void *arg)
+{
+	struct engine_signature *s = arg;
+	struct engine_shard *sh = s->conn->shard;
+
+	s->r = r;
+	s->sig = sig;
+	s->siglen = siglen;
+	pthread_mutex_lock(&sh->lock);
+	TAILQ_INSERT_TAIL(&sh->signatures, s, next);
+	pthread_mutex_unlock(&sh->lock);
+	engine_wake(sh);
+}
+
+/* resume the connections whose signatures have been made */
+static void
+engine_signatures(struct engine_shard *sh)
+{
+	TAILQ_HEAD(, engine_signature) done;
+	struct engine_signature *s;
+	struct ssh_engine_conn *c;
+
+	TAILQ_INIT(&done);
+	pthread_mutex_lock(&sh->lock);
+	while ((s = TAILQ_FIRST(&sh->signatures)) != NULL) {
+		TAILQ_REMOVE(&sh->signatures, s, next);
+		TAILQ_INSERT_TAIL(&done, s, next);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	while ((s = TAILQ_FIRST(&done)) != NULL) {
+		TAILQ_REMOVE(&done, s, next);
+		c = s->conn;
+		c->flags &= ~CONN_SIGNING;
+		if ((c->flags & CONN_DEAD) == 0)
+			ssh_engine_kex_resume(c, s->r, s->sig, s->siglen);
+		free(s->sig);
+		free(s);
+	}
+}
+
+/*
+ * hand a host key signature parked by engine_defer_sign() to the sign
+ * pool.  if its queue is full we sign here, which also slows down the
+ * intake of new connections.
+ */
+static int
+engine_sign(struct ssh_engine_conn *c)
+{
+	struct engine_signature *s;
+	struct sshkey *key;
+	const u_char *data;
+	u_char *sig;
+	size_t len;
+	u_int slen;
+	int r;
+
+	if ((c->flags & CONN_SIGNING) != 0 ||
+	    c->ssh->kex->sign_host_key != engine_defer_sign ||
+	    ssh_kex_pending_sign(c->ssh, &key, &data, &len) != 0)
+		return 0;
+	if ((s = calloc(1, sizeof(*s))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	s->conn = c;
+	if ((r = sign_pool_submit(c->shard->engine->signpool, key, data, len,
+	    c->ssh->compat, engine_signed, s)) == 0) {
+		c->flags |= CONN_SIGNING;
+		return 0;
+	}
+	free(s);
+	if (r != SSH_ERR_QUEUE_FULL)
+		return r;
+	if ((r = sshkey_sign(key, &sig, &slen, data, len,
+	    c->ssh->compat)) != 0)
+		return r;
+	r = ssh_kex_resume(c->ssh, 0, sig, slen);
+	free(sig);
+	if (r != 0)
+		return r;
+	/* dispatch what arrived while parked */
+	engine_ready(c);
+	return 0;
+}
+
+static int
+engine_dispatch(struct ssh_engine_conn *c)
+{
+	struct engine_shard *sh = c->shard;
+	u_char type, *data;
+	size_t len;
+	int banner, r;
+
+	while ((c->flags & (CONN_PAUSED | CONN_CLOSING | CONN_DEAD)) == 0) {
+		banner = engine_banner_done(c->ssh);
+		if ((r = ssh_packet_next(c->ssh, &type)) != 0)
+			return r;
+		if (type == SSH_MSG_NONE) {
+			/* the banner exchange returns before any packet */
+			if (!banner && engine_banner_done(c->ssh))
+				continue;
+			break;
+		}
+		data = ssh_packet_payload(c->ssh, &len);
+		sh->stats.packets_in++;
+		if ((r = sh->engine->cb.packet(c, type, data, len,
+		    c->arg)) != 0)
+			return r;
+	}
+	if (sh->engine->signpool != NULL && ssh_kex_pending(c->ssh))
+		return engine_sign(c);
+	return 0;
+}
+
+/* paused, closing or waiting for ssh_engine_kex_resume() */
+static int
+engine_may_read(struct ssh_engine_conn *c)
+{
+	return (c->flags & (CONN_READABLE | CONN_PAUSED | CONN_CLOSING)) ==
+	    CONN_READABLE && !ssh_kex_pending(c->ssh);
+}
+
+static void
+engine_service(struct ssh_engine_conn *c)
+{
+	int r, rr = 0;
+
+	if (engine_may_read(c))
+		rr = engine_read(c);
+	/* deliver what arrived before an EOF or error */
+	if ((r = engine_dispatch(c)) == 0)
+		r = rr;
+	if (r != 0) {
+		engine_conn_close(c, r);
+		return;
+	}
+	/* out of budget: continue in the next pass */
+	if (engine_may_read(c))
+		engine_ready(c);
+	engine_flush_later(c);
+}
+
+static int
+engine_write(struct ssh_engine_conn *c)
+{
+	struct sshbuf *output = ssh_packet_get_output(c->ssh);
+	ssize_t len;
+	int r;
+
+	while (c->flags & CONN_WRITABLE) {
+		if ((r = ssh_packet_encrypt_queued(c->ssh, 0)) != 0)
+			return r;
+		if (sshbuf_len(output) == 0)
+			break;
+		len = write(c->fd, sshbuf_ptr(output), sshbuf_len(output));
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				c->flags &= ~CONN_WRITABLE;
+				break;
+			}
+			return SSH_ERR_SYSTEM_ERROR;
+		}
+		if ((r = sshbuf_consume(output, len)) != 0)
+			return r;
+		c->shard->stats.bytes_out += len;
+	}
+	return 0;
+}
+
+static void
+engine_flush(struct ssh_engine_conn *c)
+{
+	int r;
+
+	if ((r = engine_write(c)) != 0) {
+		engine_conn_close(c, r);
+		return;
+	}
+	engine_watermarks(c);
+	if ((c->flags & (CONN_CLOSING | CONN_DEAD)) == CONN_CLOSING &&
+	    !ssh_packet_have_data_to_write(c->ssh))
+		engine_conn_close(c, 0);
+}
+
+/* publish the counters once per loop rather than locking every update */
+static void
+engine_publish_stats(struct engine_shard *sh)
+{
+	pthread_mutex_lock(&sh->lock);
+	sh->shared = sh->stats;
+	pthread_mutex_unlock(&sh->lock);
+}
+
+static void *
+engine_loop(void *arg)
+{
+	struct engine_shard *sh = arg;
+	struct ssh_engine *e = sh->engine;
+	struct ssh_engine_conn *c;
+	u_int n;
+	int r, timeout, refill;
+
+	debug2("%s: shard %d running", __func__, sh->id);
+	while (!e->stop) {
+		timeout = engine_timers(sh);
+		refill = sh->keypool != NULL && !sh->keypool_failed &&
+		    kex_keypool_missing(sh->keypool) > 0;
+		if (!TAILQ_EMPTY(&sh->ready) || !TAILQ_EMPTY(&sh->flush) ||
+		    refill)
+			timeout = 0;
+		if ((r = engine_poll(sh, timeout)) != 0) {
+			e->error = r;
+			ssh_engine_stop(e);
+			break;
+		}
+		/* nothing to do: refill the key pool */
+		if (refill && TAILQ_EMPTY(&sh->ready) &&
+		    (r = kex_keypool_fill(sh->keypool,
+		    ENGINE_KEYPOOL_BATCH)) < 0) {
+			/* connections may still hold the pool */
+			error("%s: shard %d: keypool: %s", __func__,
+			    sh->id, ssh_err(r));
+			sh->keypool_failed = 1;
+		}
+		/* read and dispatch everything that is ready first ... */
+		for (n = sh->nready; n > 0 &&
+		    (c = TAILQ_FIRST(&sh->ready)) != NULL; n--) {
+			engine_unready(c);
+			engine_service(c);
+		}
+		/* ... then write what it produced, one batch per socket */
+		while ((c = TAILQ_FIRST(&sh->flush)) != NULL) {
+			TAILQ_REMOVE(&sh->flush, c, flush_entry);
+			c->flags &= ~CONN_FLUSH;
+			engine_flush(c);
+		}
+		engine_reap(sh);
+		engine_publish_stats(sh);
+	}
+	engine_publish_stats(sh);
+	debug2("%s: shard %d stopped", __func__, sh->id);
+	return NULL;
+}
+
+/* API */
+
+int
+ssh_engine_new(struct ssh_engine **ep, u_int nthreads,
+    const struct ssh_engine_callbacks *cb)
+{
+	struct ssh_engine *e;
+	struct engine_shard *sh;
+	long ncpu;
+	u_int i;
+	int r;
+
+	*ep = NULL;
+	if (cb == NULL || cb->packet == NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if (nthreads == 0)
+		nthreads = (ncpu = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ?
+		    ncpu : 1;
+	nthreads = MIN(nthreads, ENGINE_SHARDS_MAX);
+	if ((e = calloc(1, sizeof(*e))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((e->shards = calloc(nthreads, sizeof(*e->shards))) == NULL) {
+		free(e);
+		return SSH_ERR_ALLOC_FAIL;
+	}
+	e->cb = *cb;
+	e->lowat = ENGINE_LOWAT;
+	e->hiwat = ENGINE_HIWAT;
+	pthread_mutex_init(&e->lock, NULL);
+	for (i = 0; i < nthreads; i++) {
+		sh = &e->shards[i];
+		sh->engine = e;
+		sh->id = i;
+		sh->wakeup[0] = sh->wakeup[1] = -1;
+		TAILQ_INIT(&sh->incoming);
+		TAILQ_INIT(&sh->signatures);
+		TAILQ_INIT(&sh->conns);
+		TAILQ_INIT(&sh->ready);
+		TAILQ_INIT(&sh->flush);
+		TAILQ_INIT(&sh->dead);
+		pthread_mutex_init(&sh->lock, NULL);
+		e->nshards++;
+		if ((sh->pollfd = engine_poll_create()) == -1 ||
+		    pipe(sh->wakeup) == -1 ||
+		    set_nonblock(sh->wakeup[0]) == -1 ||
+		    set_nonblock(sh->wakeup[1]) == -1 ||
+		    engine_poll_add(sh, sh->wakeup[0], NULL, 0) == -1) {
+			error("%s: shard %u: %s", __func__, i,
+			    strerror(errno));
+			r = SSH_ERR_SYSTEM_ERROR;
+			goto fail;
+		}
+	}
+	_ssh_init_library();
+	if (nthreads > 1 && (r = ssh_crypto_thread_init()) != 0)
+		goto fail;
+	debug("%s: %u shards", __func__, nthreads);
+	*ep = e;
+	return 0;
+ fail:
+	ssh_engine_free(e);
+	return r;
+}
+
+void
+ssh_engine_free(struct ssh_engine *e)
+{
+	struct engine_shard *sh;
+	struct ssh_engine_conn *c;
+	struct engine_signature *s;
+	u_int i;
+
+	if (e == NULL)
+		return;
+	/* completes the queued signatures */
+	sign_pool_free(e->signpool);
+	for (i = 0; i < e->nshards; i++) {
+		sh = &e->shards[i];
+		while ((s = TAILQ_FIRST(&sh->signatures)) != NULL) {
+			TAILQ_REMOVE(&sh->signatures, s, next);
+			s->conn->flags &= ~CONN_SIGNING;
+			free(s->sig);
+			free(s);
+		}
+		/* connections the loop has not picked up yet */
+		while ((c = TAILQ_FIRST(&sh->incoming)) != NULL) {
+			TAILQ_REMOVE(&sh->incoming, c, entry);
+			TAILQ_INSERT_TAIL(&sh->conns, c, entry);
+			sh->stats.conns++;
+		}
+		while ((c = TAILQ_FIRST(&sh->conns)) != NULL)
+			engine_conn_close(c, 0);
+		engine_reap(sh);
+		kex_keypool_free(sh->keypool);
+		free(sh->timers);
+		if (sh->pollfd != -1)
+			close(sh->pollfd);
+		if (sh->wakeup[0] != -1)
+			close(sh->wakeup[0]);
+		if (sh->wakeup[1] != -1)
+			close(sh->wakeup[1]);
+		pthread_mutex_destroy(&sh->lock);
+	}
+	pthread_mutex_destroy(&e->lock);
+	free(e->shards);
+	free(e);
+}
+
+void
+ssh_engine_set_watermarks(struct ssh_engine *e, size_t low, size_t high)
+{
+	e->lowat = MIN(low, high);
+	e->hiwat = high;
+}
+
+int
+ssh_engine_set_keypool(struct ssh_engine *e, u_int size, const char *kexalgs)
+{
+	struct engine_shard *sh;
+	u_int i;
+	int r;
+
+	for (i = 0; i < e->nshards; i++) {
+		sh = &e->shards[i];
+		if (sh->keypool != NULL)
+			return SSH_ERR_INVALID_ARGUMENT;
+		if ((r = kex_keypool_new(&sh->keypool, size)) != 0 ||
+		    (r = kex_keypool_want(sh->keypool, kexalgs)) != 0)
+			return r;
+	}
+	return 0;
+}
+
+int
+ssh_engine_set_signpool(struct ssh_engine *e, u_int nworkers, u_int maxqueue)
+{
+	int r;
+
+	if (e->signpool != NULL)
+		return SSH_ERR_INVALID_ARGUMENT;
+	/* the workers use libcrypto even with a single shard */
+	if ((r = ssh_crypto_thread_init()) != 0)
+		return r;
+	return sign_pool_new(&e->signpool, nworkers, maxqueue);
+}
+
+int
+ssh_engine_add(struct ssh_engine *e, struct ssh *ssh, int fd, int shard,
+    void *arg, struct ssh_engine_conn **cp)
+{
+	struct ssh_engine_conn *c;
+	struct engine_shard *sh;
+
+	if (cp != NULL)
+		*cp = NULL;
+	if (ssh == NULL || fd < 0)
+		return SSH_ERR_INVALID_ARGUMENT;
+	if (set_nonblock(fd) == -1)
+		return SSH_ERR_SYSTEM_ERROR;
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if (shard < 0) {
+		pthread_mutex_lock(&e->lock);
+		shard = e->next_shard++ % e->nshards;
+		pthread_mutex_unlock(&e->lock);
+	}
+	sh = &e->shards[shard % e->nshards];
+	c->shard = sh;
+	c->ssh = ssh;
+	c->fd = fd;
+	c->arg = arg;
+	c->flags = CONN_READABLE | CONN_WRITABLE;
+	TAILQ_INIT(&c->timers);
+	pthread_mutex_lock(&sh->lock);
+	TAILQ_INSERT_TAIL(&sh->incoming, c, entry);
+	pthread_mutex_unlock(&sh->lock);
+	engine_wake(sh);
+	if (cp != NULL)
+		*cp = c;
+	return 0;
+}
+
+int
+ssh_engine_run(struct ssh_engine *e)
+{
+	u_int i, started;
+	int r = 0, err;
+
+	for (started = 1; started < e->nshards; started++) {
+		if ((err = pthread_create(&e->shards[started].thread, NULL,
+		    engine_loop, &e->shards[started])) != 0) {
+			error("%s: pthread_create: %s", __func__,
+			    strerror(err));
+			r = SSH_ERR_SYSTEM_ERROR;
+			ssh_engine_stop(e);
+			break;
+		}
+	}
+	if (r == 0)
+		engine_loop(&e->shards[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(e->shards[i].thread, NULL);
+	if (r == 0)
+		r = e->error;
+	e->stop = 0;
+	e->error = 0;
+	return r;
+}
+
+void
+ssh_engine_stop(struct ssh_engine *e)
+{
+	int save_errno = errno;
+	u_int i;
+
+	e->stop = 1;
+	for (i = 0; i < e->nshards; i++)
+		engine_wake(&e->shards[i]);
+	errno = save_errno;
+}
+
+void
+ssh_engine_get_stats(struct ssh_engine *e, struct ssh_engine_stats *stats)
+{
+	struct engine_shard *sh;
+	struct ssh_engine_stats s;
+	u_int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < e->nshards; i++) {
+		sh = &e->shards[i];
+		pthread_mutex_lock(&sh->lock);
+		s = sh->shared;
+		pthread_mutex_unlock(&sh->lock);
+		stats->conns += s.conns;
+		stats->polls += s.polls;
+		stats->events += s.events;
+		stats->packets_in += s.packets_in;
+		stats->packets_out += s.packets_out;
+		stats->bytes_in += s.bytes_in;
+		stats->bytes_out += s.bytes_out;
+	}
+}
+
+void
+ssh_engine_get_sign_stats(struct ssh_engine *e, struct sign_pool_stats *stats)
+{
+	if (e->signpool == NULL)
+		memset(stats, 0, sizeof(*stats));
+	else
+		sign_pool_get_stats(e->signpool, stats);
+}
+
+struct ssh *
+ssh_engine_conn_ssh(struct ssh_engine_conn *c)
+{
+	return c->ssh;
+}
+
+int
+ssh_engine_conn_shard(struct ssh_engine_conn *c)
+{
+	return c->shard->id;
+}
+
+void
+ssh_engine_conn_set_arg(struct ssh_engine_conn *c, void *arg)
+{
+	c->arg = arg;
+}
+
+int
+ssh_engine_send(struct ssh_engine_conn *c, u_char type, const u_char *data,
+    size_t len)
+{
+	int r;
+
+	if (c->flags & (CONN_CLOSING | CONN_DEAD))
+		return SSH_ERR_CONN_CLOSED;
+	if ((r = ssh_packet_put(c->ssh, type, (const char *)data, len)) != 0)
+		return r;
+	c->shard->stats.packets_out++;
+	engine_flush_later(c);
+	engine_watermarks(c);
+	return 0;
+}
+
+size_t
+ssh_engine_pending(struct ssh_engine_conn *c)
+{
+	return ssh_packet_output_pending(c->ssh);
+}
+
+void
+ssh_engine_pause(struct ssh_engine_conn *c, int pause)
+{
+	if (pause) {
+		c->flags |= CONN_PAUSED;
+		return;
+	}
+	c->flags &= ~CONN_PAUSED;
+	/* input may be buffered and the edge has been consumed already */
+	engine_ready(c);
+}
+
+void
+ssh_engine_close(struct ssh_engine_conn *c)
+{
+	if (c->flags & CONN_DEAD)
+		return;
+	c->flags |= CONN_CLOSING;
+	engine_flush_later(c);
+}
+
+int
+ssh_engine_kex_resume(struct ssh_engine_conn *c, int result,
+    const u_char *sig, size_t siglen)
+{
+	int r;
+
+	if ((c->flags & CONN_DEAD) != 0)
+		return SSH_ERR_CONN_CLOSED;
+	if ((r = ssh_kex_resume(c->ssh, result, sig, siglen)) != 0) {
+		engine_conn_close(c, r);
+		return r;
+	}
+	/* dispatch what arrived while parked and send the reply */
+	engine_ready(c);
+	engine_flush_later(c);
+	return 0;
+}
+
+struct ssh_engine_timer *
+ssh_engine_timer_add(struct ssh_engine_conn *c, u_int msec,
+    void (*cb)(struct ssh_engine_conn *, void *), void *arg)
+{
+	struct engine_shard *sh = c->shard;
+	struct ssh_engine_timer *t, **tmp;
+	u_int n;
+
+	if (c->flags & CONN_DEAD)
+		return NULL;
+	if (sh->ntimers == sh->timers_alloc) {
+		n = sh->timers_alloc ? sh->timers_alloc * 2 : 64;
+		if (n > SIZE_MAX / sizeof(*tmp) ||
+		    (tmp = realloc(sh->timers, n * sizeof(*tmp))) == NULL)
+			return NULL;
+		sh->timers = tmp;
+		sh->timers_alloc = n;
+	}
+	if ((t = calloc(1, sizeof(*t))) == NULL)
+		return NULL;
+	t->when = engine_now() + msec;
+	t->seq = sh->timer_seq++;
+	t->conn = c;
+	t->cb = cb;
+	t->arg = arg;
+	TAILQ_INSERT_TAIL(&c->timers, t, next);
+	sh->timers[sh->ntimers++] = t;
+	engine_timer_up(sh, sh->ntimers - 1);
+	return t;
+}
+
+void
+ssh_engine_timer_cancel(struct ssh_engine_timer *t)
+{
+	if (t != NULL)
+		engine_timer_free(t);
+}
@@ -0,0 +1,182 @@
+/* $OpenBSD$ */
+/*
+ * Event-driven engine for many ssh_api connections.
+ *
+ * Placed in the public domain
+ */
+
+#ifndef SSH_ENGINE_H
+#define SSH_ENGINE_H
+
+#include <sys/types.h>
+
+struct ssh;
+struct ssh_engine;
+struct ssh_engine_conn;
+struct ssh_engine_timer;
+struct sign_pool_stats;
+
+/*
+ * callbacks are invoked on the thread that runs the connection's shard.
+ * a connection may only be used from callbacks running on its own shard;
+ * connections that need to talk to each other (e.g. both ends of a
+ * proxied session) should be added to the same shard.
+ */
+struct ssh_engine_callbacks {
+	/*
+	 * a packet that is not handled by the transport layer has been
+	 * received. the payload is valid until the callback returns.
+	 * returning an error closes the connection.
+	 */
+	int	(*packet)(struct ssh_engine_conn *, u_char type,
+		    const u_char *data, size_t len, void *arg);
+	/*
+	 * optional: the output pending for the connection has grown above
+	 * the high watermark (blocked != 0) or drained below the low
+	 * watermark again (blocked == 0). used to stop reading from
+	 * whatever produces the data, see ssh_engine_pause().
+	 */
+	void	(*output)(struct ssh_engine_conn *, int blocked, void *arg);
+	/*
+	 * the connection has been closed: r is 0 after ssh_engine_close()
+	 * or ssh_engine_free(), SSH_ERR_CONN_CLOSED if the peer closed the
+	 * socket, otherwise the error that terminated it. the ssh state,
+	 * the socket and all timers are released after the callback returns.
+	 */
+	void	(*closed)(struct ssh_engine_conn *, int r, void *arg);
+};
+
+struct ssh_engine_stats {
+	u_int64_t	conns;		/* connections currently open */
+	u_int64_t	polls;		/* calls to epoll_wait/kevent */
+	u_int64_t	events;		/* readiness events returned */
+	u_int64_t	packets_in;
+	u_int64_t	packets_out;
+	u_int64_t	bytes_in;
+	u_int64_t	bytes_out;
+};
+
+/*
+ * ssh_engine_new() creates an engine with 'nthreads' event loops, each
+ * owning a shard of the connections. 0 runs one loop per online CPU.
+ */
+int	ssh_engine_new(struct ssh_engine **, u_int nthreads,
+    const struct ssh_engine_callbacks *);
+
+/*
+ * ssh_engine_free() closes all remaining connections and releases the
+ * engine. it must not be called while ssh_engine_run() is running.
+ */
+void	ssh_engine_free(struct ssh_engine *);
+
+/*
+ * ssh_engine_set_watermarks() sets the pending output levels at which
+ * the output callback fires. the defaults are 256KB and 1MB.
+ */
+void	ssh_engine_set_watermarks(struct ssh_engine *, size_t low, size_t high);
+
+/*
+ * ssh_engine_set_keypool() gives every event loop a pool of up to 'size'
+ * ephemeral keys for each DH/ECDH method in 'kexalgs', see kexpool.h.
+ * the pools are refilled while the loops are idle and used by all server
+ * connections that have no pool of their own.  it must be called before
+ * ssh_engine_run().
+ */
+int	ssh_engine_set_keypool(struct ssh_engine *, u_int size,
+    const char *kexalgs);
+
+/*
+ * ssh_engine_set_signpool() moves the host key signatures of server
+ * connections without a sign_host_key callback to 'nworkers' threads
+ * (0: one per online CPU), see signpool.h.  a connection waiting for
+ * its signature is not read.  when more than 'maxqueue' signatures are
+ * waiting the event loop signs itself.  it must be called before
+ * ssh_engine_add().
+ */
+int	ssh_engine_set_signpool(struct ssh_engine *, u_int nworkers,
+    u_int maxqueue);
+
+/*
+ * ssh_engine_add() hands a connection created with ssh_init() and its
+ * connected socket to the engine, which owns both from now on.
+ * 'shard' selects the event loop (modulo the number of loops), -1 picks
+ * one round robin. may be called from any thread, including callbacks.
+ * writes to a closed peer raise SIGPIPE, which the application should
+ * ignore.
+ */
+int	ssh_engine_add(struct ssh_engine *, struct ssh *, int fd, int shard,
+    void *arg, struct ssh_engine_conn **);
+
+/*
+ * ssh_engine_run() runs the event loops, the first one on the calling
+ * thread, until ssh_engine_stop() is called.
+ */
+int	ssh_engine_run(struct ssh_engine *);
+
+/*
+ * ssh_engine_stop() makes ssh_engine_run() return. it may be called from
+ * any thread and from signal handlers.
+ */
+void	ssh_engine_stop(struct ssh_engine *);
+
+/*
+ * ssh_engine_get_stats() sums the counters of all shards.  it may be
+ * called from any thread; each shard updates what it reports once per
+ * pass of its event loop.
+ */
+void	ssh_engine_get_stats(struct ssh_engine *, struct ssh_engine_stats *);
+
+/* queue depth and latency of the sign pool, all zero without one */
+void	ssh_engine_get_sign_stats(struct ssh_engine *,
+    struct sign_pool_stats *);
+
+/*
+ * per connection functions, to be used from callbacks running on the
+ * connection's shard or before ssh_engine_run() is called.
+ */
+struct ssh *ssh_engine_conn_ssh(struct ssh_engine_conn *);
+int	ssh_engine_conn_shard(struct ssh_engine_conn *);
+void	ssh_engine_conn_set_arg(struct ssh_engine_conn *, void *);
+
+/*
+ * ssh_engine_send() queues a packet; output is written in one batch
+ * once all ready connections of the shard have been serviced.
+ */
+int	ssh_engine_send(struct ssh_engine_conn *, u_char type,
+    const u_char *data, size_t len);
+
+/* ssh_engine_pending() returns the number of output bytes not yet sent */
+size_t	ssh_engine_pending(struct ssh_engine_conn *);
+
+/*
+ * ssh_engine_pause() stops (pause != 0) or resumes reading and
+ * dispatching input for the connection. output is still written.
+ */
+void	ssh_engine_pause(struct ssh_engine_conn *, int pause);
+
+/*
+ * ssh_engine_close() closes the connection once its pending output has
+ * been written. no more packets are delivered.
+ */
+void	ssh_engine_close(struct ssh_engine_conn *);
+
+/*
+ * ssh_engine_kex_resume() completes a host key verification or signature
+ * that a callback set with ssh_set_verify_host_key_callback() or
+ * ssh_set_sign_host_key_callback() left pending, see ssh_kex_resume().
+ * the connection is not read while it waits. on error the connection
+ * is closed.
+ */
+int	ssh_engine_kex_resume(struct ssh_engine_conn *, int result,
+    const u_char *sig, size_t siglen);
+
+/*
+ * ssh_engine_timer_add() calls 'cb' on the connection's shard after
+ * 'msec' milliseconds. the timer is freed before the callback runs and
+ * when the connection closes; the handle is only valid until then.
+ */
+struct ssh_engine_timer *ssh_engine_timer_add(struct ssh_engine_conn *,
+    u_int msec, void (*cb)(struct ssh_engine_conn *, void *), void *arg);
+void	ssh_engine_timer_cancel(struct ssh_engine_timer *);
+
+#endif
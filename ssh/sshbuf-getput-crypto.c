@@ -81,6 +81,13 @@ sshbuf_get_bignum1(struct sshbuf *buf, BIGNUM *v)
 
 int
 sshbuf_get_ec(struct sshbuf *buf, EC_POINT *v, const EC_GROUP *g)
+{
+	return sshbuf_get_ec_ctx(buf, v, g, NULL);
+}
+
+int
+sshbuf_get_ec_ctx(struct sshbuf *buf, EC_POINT *v, const EC_GROUP *g,
+    BN_CTX *bn_ctx)
 {
 	const u_char *d;
 	size_t len;
@@ -93,7 +100,7 @@ sshbuf_get_ec(struct sshbuf *buf, EC_POINT *v, const EC_GROUP *g)
 		return SSH_ERR_ECPOINT_TOO_LARGE;
 	/* Only handle uncompressed points */
 	if (*d != POINT_CONVERSION_UNCOMPRESSED ||
-	    EC_POINT_oct2point(g, v, d, len, NULL) != 1)
+	    EC_POINT_oct2point(g, v, d, len, bn_ctx) != 1)
 		return SSH_ERR_INVALID_FORMAT;
 	/* Skip string */
 	if (sshbuf_get_string_direct(buf, NULL, NULL) != 0) {
@@ -116,8 +123,10 @@ sshbuf_get_eckey(struct sshbuf *buf, EC_KEY *v)
 		SSHBUF_DBG(("SSH_ERR_ALLOC_FAIL"));
 		return SSH_ERR_ALLOC_FAIL;
 	}
-	if ((r = sshbuf_get_ec(buf, pt, EC_KEY_get0_group(v))) < 0)
+	if ((r = sshbuf_get_ec(buf, pt, EC_KEY_get0_group(v))) < 0) {
+		EC_POINT_free(pt);
 		return r;
+	}
 	if (EC_KEY_set_public_key(v, pt) != 1) {
 		buf->off = ooff;
 		EC_POINT_free(pt);
@@ -130,22 +139,25 @@ sshbuf_get_eckey(struct sshbuf *buf, EC_KEY *v)
 int
 sshbuf_put_bignum2(struct sshbuf *buf, const BIGNUM *v)
 {
-	u_char d[SSHBUF_MAX_BIGNUM + 1];
-	int len = BN_num_bytes(v), prepend = 0, r;
+	u_char *dp;
+	int len_bits = BN_num_bits(v), len, prepend, r;
 
-	if (len < 0 || len > SSHBUF_MAX_BIGNUM)
+	len = (len_bits + 7) / 8;
+	if (len_bits < 0 || len > SSHBUF_MAX_BIGNUM)
 		return SSH_ERR_INVALID_ARGUMENT;
-	*d = '\0';
-	if (BN_bn2bin(v, d + 1) != len)
-		return SSH_ERR_INTERNAL_ERROR; /* Shouldn't happen */
 	/* If MSB is set, prepend a \0 */
-	if (len > 0 && (d[1] & 0x80) != 0)
-		prepend = 1;
-	if ((r = sshbuf_put_string(buf, d + 1 - prepend, len + prepend)) < 0) {
-		bzero(d, sizeof(d));
+	prepend = len_bits > 0 && (len_bits % 8) == 0;
+	/* Serialise in place rather than through a temporary */
+	if ((r = sshbuf_reserve(buf, 4 + prepend + len, &dp)) < 0)
 		return r;
+	POKE_U32(dp, prepend + len);
+	if (prepend)
+		dp[4] = '\0';
+	if (BN_bn2bin(v, dp + 4 + prepend) != len) {
+		SSHBUF_DBG(("SSH_ERR_INTERNAL_ERROR"));
+		SSHBUF_ABORT();
+		return SSH_ERR_INTERNAL_ERROR; /* Shouldn't happen */
 	}
-	bzero(d, sizeof(d));
 	return 0;
 }
 
@@ -154,46 +166,48 @@ sshbuf_put_bignum1(struct sshbuf *buf, const BIGNUM *v)
 {
 	int r, len_bits = BN_num_bits(v);
 	size_t len_bytes = (len_bits + 7) / 8;
-	u_char d[SSHBUF_MAX_BIGNUM], *dp;
+	u_char *dp;
 
 	if (len_bits < 0 || len_bytes > SSHBUF_MAX_BIGNUM)
 		return SSH_ERR_INVALID_ARGUMENT;
-	if (BN_bn2bin(v, d) != (int)len_bytes)
-		return SSH_ERR_INTERNAL_ERROR; /* Shouldn't happen */
-	if ((r = sshbuf_reserve(buf, len_bytes + 2, &dp)) < 0) {
-		bzero(d, sizeof(d));
+	if ((r = sshbuf_reserve(buf, len_bytes + 2, &dp)) < 0)
 		return r;
-	}
 	POKE_U16(dp, len_bits);
-	memcpy(dp + 2, d, len_bytes);
-	bzero(d, sizeof(d));
+	if (BN_bn2bin(v, dp + 2) != (int)len_bytes) {
+		SSHBUF_DBG(("SSH_ERR_INTERNAL_ERROR"));
+		SSHBUF_ABORT();
+		return SSH_ERR_INTERNAL_ERROR; /* Shouldn't happen */
+	}
 	return 0;
 }
 
 int
 sshbuf_put_ec(struct sshbuf *buf, const EC_POINT *v, const EC_GROUP *g)
 {
-	u_char d[SSHBUF_MAX_ECPOINT];
-	BN_CTX *bn_ctx;
+	return sshbuf_put_ec_ctx(buf, v, g, NULL);
+}
+
+int
+sshbuf_put_ec_ctx(struct sshbuf *buf, const EC_POINT *v, const EC_GROUP *g,
+    BN_CTX *bn_ctx)
+{
+	u_char *dp;
 	size_t len;
-	int ret;
+	int r;
 
-	if ((bn_ctx = BN_CTX_new()) == NULL)
-		return SSH_ERR_ALLOC_FAIL;
 	if ((len = EC_POINT_point2oct(g, v, POINT_CONVERSION_UNCOMPRESSED,
-	    NULL, 0, bn_ctx)) > SSHBUF_MAX_ECPOINT) {
-		BN_CTX_free(bn_ctx);
+	    NULL, 0, bn_ctx)) == 0 || len > SSHBUF_MAX_ECPOINT)
 		return SSH_ERR_INVALID_ARGUMENT;
-	}
+	if ((r = sshbuf_reserve(buf, 4 + len, &dp)) < 0)
+		return r;
+	POKE_U32(dp, len);
 	if (EC_POINT_point2oct(g, v, POINT_CONVERSION_UNCOMPRESSED,
-	    d, len, bn_ctx) != len) {
-		BN_CTX_free(bn_ctx);
+	    dp + 4, len, bn_ctx) != len) {
+		SSHBUF_DBG(("SSH_ERR_INTERNAL_ERROR"));
+		SSHBUF_ABORT();
 		return SSH_ERR_INTERNAL_ERROR; /* Shouldn't happen */
 	}
-	BN_CTX_free(bn_ctx);
-	ret = sshbuf_put_string(buf, d, len);
-	bzero(d, len);
-	return ret;
+	return 0;
 }
 
 int
@@ -17,6 +17,7 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -24,6 +25,7 @@
 #include "err.h"
 #define SSHBUF_INTERNAL
 #include "sshbuf.h"
+#include "probe.h"
 
 static inline int
 sshbuf_check_sanity(const struct sshbuf *buf)
@@ -46,8 +48,11 @@ sshbuf_maybe_pack(struct sshbuf *buf, int force)
 {
 	SSHBUF_DBG(("force %d", force));
 	SSHBUF_TELL("pre-pack");
+	if (buf->readonly || buf->refcount > 1)
+		return;
 	if (force ||
 	    (buf->off >= SSHBUF_PACK_MIN && buf->off >= buf->size / 2)) {
+		SSH_PROBE3(sshbuf__pack, buf, buf->off, buf->size);
 		memmove(buf->d, buf->d + buf->off, buf->size - buf->off);
 		buf->size -= buf->off;
 		buf->off = 0;
@@ -65,6 +70,7 @@ sshbuf_new(void)
 	ret->alloc = SSHBUF_SIZE_INIT;
 	ret->max_size = SSHBUF_SIZE_MAX;
 	ret->freeme = 1;
+	ret->refcount = 1;
 	if ((ret->d = calloc(1, ret->alloc)) == NULL) {
 		free(ret);
 		return NULL;
@@ -78,15 +84,91 @@ sshbuf_init(struct sshbuf *ret)
 	bzero(ret, sizeof(*ret));
 	ret->alloc = SSHBUF_SIZE_INIT;
 	ret->max_size = SSHBUF_SIZE_MAX;
+	ret->refcount = 1;
 	if ((ret->d = calloc(1, ret->alloc)) == NULL)
 		ret->alloc = 0;
 }
 
+struct sshbuf *
+sshbuf_from(const void *blob, size_t len)
+{
+	struct sshbuf *ret;
+
+	if (blob == NULL || len > SSHBUF_SIZE_MAX ||
+	    (ret = calloc(sizeof(*ret), 1)) == NULL)
+		return NULL;
+	ret->alloc = ret->size = ret->max_size = len;
+	ret->readonly = 1;
+	ret->refcount = 1;
+	ret->freeme = 1;
+	ret->d = (u_char *)blob;
+	return ret;
+}
+
+static struct sshbuf *
+sshbuf_child(struct sshbuf *parent, const u_char *p, size_t len)
+{
+	struct sshbuf *ret;
+
+	/* Buffers from sshbuf_init() may go away under their children */
+	if (!parent->freeme || parent->refcount == UINT_MAX)
+		return NULL;
+	if ((ret = sshbuf_from(p, len)) == NULL)
+		return NULL;
+	parent->refcount++;
+	ret->parent = parent;
+	return ret;
+}
+
+struct sshbuf *
+sshbuf_fromb(struct sshbuf *buf)
+{
+	if (sshbuf_check_sanity(buf) != 0)
+		return NULL;
+	return sshbuf_child(buf, sshbuf_ptr(buf), sshbuf_len(buf));
+}
+
+int
+sshbuf_froms(struct sshbuf *buf, struct sshbuf **bufp)
+{
+	const u_char *p;
+	size_t len;
+	int r;
+
+	*bufp = NULL;
+	if ((r = sshbuf_peek_string_direct(buf, &p, &len)) != 0)
+		return r;
+	if ((*bufp = sshbuf_child(buf, p, len)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	if ((r = sshbuf_consume(buf, len + 4)) != 0) {
+		sshbuf_free(*bufp);
+		*bufp = NULL;
+		return r;
+	}
+	return 0;
+}
+
 void
 sshbuf_free(struct sshbuf *buf)
 {
+	struct sshbuf *parent;
 	int freeme;
 
+	/* Children still refer to our data; the last of them frees it */
+	if (buf->refcount > 1) {
+		buf->refcount--;
+		return;
+	}
+	parent = buf->parent;
+	if (buf->readonly) {
+		freeme = buf->freeme;
+		bzero(buf, sizeof(*buf));
+		if (freeme)
+			free(buf);
+		if (parent != NULL)
+			sshbuf_free(parent);
+		return;
+	}
 	if (sshbuf_check_sanity(buf) == 0)
 		bzero(buf->d, buf->alloc);
 	free(buf->d);
@@ -101,6 +183,11 @@ sshbuf_reset(struct sshbuf *buf)
 {
 	u_char *d;
 
+	if (buf->readonly || buf->refcount > 1) {
+		/* The data is not ours to clear; just appear empty */
+		buf->off = buf->size;
+		return;
+	}
 	if (sshbuf_check_sanity(buf) == 0)
 		bzero(buf->d, buf->alloc);
 	buf->off = buf->size = 0;
@@ -112,6 +199,41 @@ sshbuf_reset(struct sshbuf *buf)
 	}
 }
 
+int
+sshbuf_shrink(struct sshbuf *buf)
+{
+	size_t rlen;
+	u_char *dp;
+	int r;
+
+	if ((r = sshbuf_check_sanity(buf)) < 0)
+		return r;
+	if (buf->readonly || buf->refcount > 1)
+		return 0;
+	sshbuf_maybe_pack(buf, buf->off != 0);
+	rlen = roundup(buf->size, SSHBUF_SIZE_INC);
+	if (rlen < SSHBUF_SIZE_INIT)
+		rlen = SSHBUF_SIZE_INIT;
+	if (rlen >= buf->alloc)
+		return 0;
+	bzero(buf->d + buf->size, buf->alloc - buf->size);
+	SSHBUF_DBG(("shrink alloc %zu -> %zu", buf->alloc, rlen));
+	if ((dp = realloc(buf->d, rlen)) == NULL)
+		return SSH_ERR_ALLOC_FAIL;
+	buf->d = dp;
+	buf->alloc = rlen;
+	SSHBUF_TELL("shrunk");
+	return 0;
+}
+
+size_t
+sshbuf_allocated(const struct sshbuf *buf)
+{
+	if (sshbuf_check_sanity(buf) != 0)
+		return 0;
+	return buf->alloc;
+}
+
 size_t
 sshbuf_max_size(const struct sshbuf *buf)
 {
@@ -128,6 +250,8 @@ sshbuf_set_max_size(struct sshbuf *buf, size_t max_size)
 	SSHBUF_DBG(("set max buf = %p len = %zu", buf, max_size));
 	if ((r = sshbuf_check_sanity(buf)) < 0)
 		return r;
+	if (buf->readonly || buf->refcount > 1)
+		return SSH_ERR_BUFFER_READ_ONLY;
 	if (max_size > SSHBUF_SIZE_MAX)
 		return SSH_ERR_NO_BUFFER_SPACE;
 	/* pack and realloc if necessary */
@@ -197,6 +321,11 @@ sshbuf_reserve(struct sshbuf *buf, size_t len, u_char **dpp)
 	int r;
 
 	SSHBUF_DBG(("reserve buf = %p len = %zu", buf, len));
+	if (buf->readonly || buf->refcount > 1) {
+		if (dpp != NULL)
+			*dpp = NULL;
+		return SSH_ERR_BUFFER_READ_ONLY;
+	}
 	if ((r = sshbuf_check_reserve(buf, len)) < 0) {	/* does sanity check */
 		if (dpp != NULL)
 			*dpp = NULL;
@@ -216,6 +345,7 @@ sshbuf_reserve(struct sshbuf *buf, size_t len, u_char **dpp)
 		if (rlen > buf->max_size)
 			rlen = buf->alloc + need;
 		SSHBUF_DBG(("adjusted rlen %zu", rlen));
+		SSH_PROBE3(sshbuf__grow, buf, buf->alloc, rlen);
 		if ((dp = realloc(buf->d, rlen)) == NULL) {
 			SSHBUF_DBG(("realloc fail"));
 			if (dpp != NULL)
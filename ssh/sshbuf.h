@@ -38,6 +38,9 @@ struct sshbuf {
 	size_t max_size;	/* Maximum size of buffer */
 	size_t alloc;		/* Total bytes allocated to buf->d */
 	int freeme;		/* Kludge to support sshbuf_init */
+	int readonly;		/* Refers to external data, see sshbuf_from() */
+	u_int refcount;		/* Tracks self and number of child buffers */
+	struct sshbuf *parent;	/* If child, pointer to parent */
 };
 
 #ifndef SSHBUF_NO_DEPREACTED
@@ -56,7 +59,31 @@ void sshbuf_init(struct sshbuf *buf);
 struct sshbuf *sshbuf_new(void);
 
 /*
- * Clear and free buf
+ * Create a new, read-only sshbuf buffer that refers to the 'len' bytes
+ * at 'blob' instead of copying them.  The data must outlive the buffer.
+ * Returns pointer to buffer on success, or NULL on allocation failure.
+ */
+struct sshbuf *sshbuf_from(const void *blob, size_t len);
+
+/*
+ * Create a new, read-only sshbuf buffer that refers to the contents of
+ * 'buf'.  'buf' must have been made with sshbuf_new() or be a buffer of
+ * this kind itself; it is kept alive, and read-only, until all buffers
+ * that refer to it are freed.
+ * Returns pointer to buffer on success, or NULL on allocation failure.
+ */
+struct sshbuf *sshbuf_fromb(struct sshbuf *buf);
+
+/*
+ * Consume a string from 'buf' and return a read-only buffer that refers
+ * to its contents in '*bufp', like sshbuf_fromb().
+ * Returns 0 on success, or a negative SSH_ERR_* error code on failure.
+ */
+int	sshbuf_froms(struct sshbuf *buf, struct sshbuf **bufp);
+
+/*
+ * Clear and free buf.  Buffers that are still referred to by buffers
+ * from sshbuf_fromb() or sshbuf_froms() are freed with the last of them.
  */
 void	sshbuf_free(struct sshbuf *buf);
 
@@ -65,6 +92,18 @@ void	sshbuf_free(struct sshbuf *buf);
  */
 void	sshbuf_reset(struct sshbuf *buf);
 
+/*
+ * Release memory that buf no longer needs after it grew, keeping its
+ * contents.  Useful for long-lived buffers after a burst of data.
+ * Returns 0 on success, or a negative SSH_ERR_* error code on failure.
+ */
+int	sshbuf_shrink(struct sshbuf *buf);
+
+/*
+ * Returns the number of bytes allocated to buf's data
+ */
+size_t	sshbuf_allocated(const struct sshbuf *buf);
+
 /*
  * Return the maximum size of buf
  */
@@ -176,6 +215,16 @@ int	sshbuf_put_bignum1(struct sshbuf *buf, const BIGNUM *v);
 int	sshbuf_put_ec(struct sshbuf *buf, const EC_POINT *v, const EC_GROUP *g);
 int	sshbuf_put_eckey(struct sshbuf *buf, const EC_KEY *v);
 
+/*
+ * EC point variants that take the caller's BN_CTX for libcrypto's scratch
+ * space, so that a context kept per connection saves allocating one for
+ * every point.  A NULL bn_ctx behaves as the plain functions.
+ */
+int	sshbuf_get_ec_ctx(struct sshbuf *buf, EC_POINT *v, const EC_GROUP *g,
+	    BN_CTX *bn_ctx);
+int	sshbuf_put_ec_ctx(struct sshbuf *buf, const EC_POINT *v,
+	    const EC_GROUP *g, BN_CTX *bn_ctx);
+
 /* Dump the contents of the buffer to stderr in a human-readable format */
 void	sshbuf_dump(struct sshbuf *buf, FILE *f);
 
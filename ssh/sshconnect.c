@@ -45,12 +45,15 @@
 #include "hostfile.h"
 #include "log.h"
 #include "readconf.h"
+#include "channels.h"
 #include "atomicio.h"
 #include "misc.h"
 #include "dns.h"
 #include "roaming.h"
 #include "ssh2.h"
 #include "version.h"
+#include "authfile.h"
+#include "krl.h"
 #include "err.h"
 
 char *client_version_string = NULL;
@@ -418,6 +421,9 @@ ssh_connect(const char *host, struct sockaddr_storage * hostaddr,
 	ssh = ssh_packet_set_connection(NULL, sock, sock);
 	ssh_packet_set_timeout(ssh, options.server_alive_interval,
 	    options.server_alive_count_max);
+	ssh_packet_tune_socket(ssh, options.tcp_notsent_lowat,
+	    options.tcp_cork, options.socket_buffer_size == SSH_SOCKBUF_AUTO ?
+	    CHAN_SES_WINDOW_DEFAULT : options.socket_buffer_size);
 
 	return (ssh);
 }
@@ -715,6 +721,7 @@ check_host_key(char *hostname, struct sockaddr *hostaddr, u_short port,
 		options.check_host_ip = 0;
 
 	host_hostkeys = init_hostkeys();
+	hostkeys_use_index(host_hostkeys, options.known_hosts_index);
 	for (i = 0; i < num_user_hostfiles; i++)
 		load_hostkeys(host_hostkeys, host, user_hostfiles[i]);
 	for (i = 0; i < num_system_hostfiles; i++)
@@ -723,6 +730,7 @@ check_host_key(char *hostname, struct sockaddr *hostaddr, u_short port,
 	ip_hostkeys = NULL;
 	if (!want_cert && options.check_host_ip) {
 		ip_hostkeys = init_hostkeys();
+		hostkeys_use_index(ip_hostkeys, options.known_hosts_index);
 		for (i = 0; i < num_user_hostfiles; i++)
 			load_hostkeys(ip_hostkeys, ip, user_hostfiles[i]);
 		for (i = 0; i < num_system_hostfiles; i++)
@@ -1086,6 +1094,47 @@ fail:
 	return -1;
 }
 
+/*
+ * Checks the host key, and the CA key of a host certificate, against
+ * RevokedHostKeys.  Returns 1 if the key is revoked or the file could
+ * not be checked, 0 otherwise.
+ */
+static int
+host_key_is_revoked(struct sshkey *host_key)
+{
+	const char *path = options.revoked_host_keys;
+	struct sshkrl *krl;
+	int r;
+
+	switch ((r = sshkrl_load(path, &krl))) {
+	case 0:
+		r = sshkrl_check_key(krl, host_key);
+		sshkrl_free(krl);
+		break;
+	case SSH_ERR_KRL_BAD_MAGIC:
+		/* Not a KRL: a plain list of revoked public keys */
+		if ((r = sshkey_in_file(host_key, path, 0)) == 0 ||
+		    (sshkey_is_cert(host_key) && (r = sshkey_in_file(
+		    host_key->cert->signature_key, path, 0)) == 0))
+			r = SSH_ERR_KEY_REVOKED;
+		else if (r == SSH_ERR_KEY_NOT_FOUND)
+			r = 0;
+		break;
+	}
+	switch (r) {
+	case 0:
+		return 0;
+	case SSH_ERR_KEY_REVOKED:
+		error("WARNING: %s host key is revoked by %s",
+		    sshkey_type(host_key), path);
+		return 1;
+	default:
+		error("Error checking revoked host keys file \"%s\": %s",
+		    path, ssh_err(r));
+		return 1;
+	}
+}
+
 /* returns 0 if key verifies or -1 if key does NOT verify */
 int
 verify_host_key(char *host, struct sockaddr *hostaddr, struct sshkey *host_key)
@@ -1097,6 +1146,10 @@ verify_host_key(char *host, struct sockaddr *hostaddr, struct sshkey *host_key)
 	debug("Server host key: %s %s", sshkey_type(host_key), fp);
 	xfree(fp);
 
+	if (options.revoked_host_keys != NULL &&
+	    host_key_is_revoked(host_key))
+		return -1;
+
 	/* XXX certs are not yet supported for DNS */
 	if (!sshkey_is_cert(host_key) && options.verify_host_key_dns &&
 	    verify_host_key_dns(host, hostaddr, host_key, &flags) == 0) {
@@ -1188,7 +1241,7 @@ ssh_put_password(struct ssh *ssh, char *password)
 static int
 show_other_keys(struct hostkeys *hostkeys, struct sshkey *key)
 {
-	int type[] = { KEY_RSA1, KEY_RSA, KEY_DSA, KEY_ECDSA, -1};
+	int type[] = { KEY_RSA1, KEY_RSA, KEY_DSA, KEY_ECDSA, KEY_ED25519, -1};
 	int i, ret = 0;
 	char *fp, *ra;
 	const struct hostkey_entry *found;
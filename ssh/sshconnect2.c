@@ -107,6 +107,7 @@ order_hostkeyalgs(char *host, struct sockaddr *hostaddr, u_short port)
 	/* Find all hostkeys for this hostname */
 	get_hostfile_hostname_ipaddr(host, hostaddr, port, &hostname, NULL);
 	hostkeys = init_hostkeys();
+	hostkeys_use_index(hostkeys, options.known_hosts_index);
 	for (i = 0; i < options.num_user_hostfiles; i++)
 		load_hostkeys(hostkeys, hostname, options.user_hostfiles[i]);
 	for (i = 0; i < options.num_system_hostfiles; i++)
@@ -201,6 +202,7 @@ ssh_kex2(struct ssh *ssh, u_short port)
 	ssh->kex->kex[KEX_DH_GEX_SHA1] = kexgex_client;
 	ssh->kex->kex[KEX_DH_GEX_SHA256] = kexgex_client;
 	ssh->kex->kex[KEX_ECDH_SHA2] = kexecdh_client;
+	ssh->kex->kex[KEX_C25519_SHA256] = kexc25519_client;
 	ssh->kex->client_version_string=client_version_string;
 	ssh->kex->server_version_string=server_version_string;
 	ssh->kex->verify_host_key=&verify_host_key_callback;
@@ -82,6 +82,7 @@
 #include "cipher.h"
 #include "key.h"
 #include "kex.h"
+#include "kexpool.h"
 #include "dh.h"
 #include "myproposal.h"
 #include "authfile.h"
@@ -231,6 +232,15 @@ Buffer cfg;
 /* message to be displayed after login */
 Buffer loginmsg;
 
+/* precomputed ephemeral kex keys, see KexKeyPool */
+static struct kex_keypool *kex_keypool = NULL;
+#define KEX_KEYPOOL_BATCH	2	/* keys generated per idle select() */
+
+/* certificates whose CA signature is remembered during authentication */
+#define SSHD_CERT_CACHE_SIZE	32
+/* public keys parsed once and shared during authentication */
+#define SSHD_KEY_INTERN_SIZE	32
+
 /* Prototypes for various functions defined later in this file. */
 void destroy_sensitive_data(void);
 void demote_sensitive_data(void);
@@ -238,6 +248,16 @@ void demote_sensitive_data(void);
 static void do_ssh1_kex(void);
 static void do_ssh2_kex(void);
 
+static void
+log_cache_stats(const char *what, u_int64_t hits, u_int64_t misses)
+{
+	if (hits + misses == 0)
+		return;
+	debug("%s: %llu hits, %llu misses (%llu%% hit ratio)", what,
+	    (unsigned long long)hits, (unsigned long long)misses,
+	    (unsigned long long)(hits * 100 / (hits + misses)));
+}
+
 /*
  * Close all listening sockets
  */
@@ -635,6 +655,10 @@ privsep_preauth(Authctxt *authctxt)
 	} else if (pid != 0) {
 		debug2("Network child is on pid %ld", (long)pid);
 
+		/* the ephemeral kex keys are the child's */
+		kex_keypool_free(kex_keypool);
+		kex_keypool = NULL;
+
 		if (box != NULL)
 			ssh_sandbox_parent_preauth(box, pid);
 		pmonitor->m_pid = pid;
@@ -751,6 +775,7 @@ list_hostkey_types(void)
 		case KEY_RSA:
 		case KEY_DSA:
 		case KEY_ECDSA:
+		case KEY_ED25519:
 			if (buffer_len(&b) > 0)
 				buffer_append(&b, ",", 1);
 			p = sshkey_ssh_name(key);
@@ -767,6 +792,7 @@ list_hostkey_types(void)
 		case KEY_RSA_CERT:
 		case KEY_DSA_CERT:
 		case KEY_ECDSA_CERT:
+		case KEY_ED25519_CERT:
 			if (buffer_len(&b) > 0)
 				buffer_append(&b, ",", 1);
 			p = sshkey_ssh_name(key);
@@ -794,6 +820,7 @@ get_hostkey_by_type(int type, int need_private)
 		case KEY_RSA_CERT:
 		case KEY_DSA_CERT:
 		case KEY_ECDSA_CERT:
+		case KEY_ED25519_CERT:
 			key = sensitive_data.host_certificates[i];
 			break;
 		default:
@@ -886,9 +913,10 @@ usage(void)
 }
 
 static void
-send_rexec_state(int fd, Buffer *conf)
+send_rexec_state(int fd, Buffer *conf, struct kex_keypool *keys)
 {
-	Buffer m;
+	Buffer m, kb;
+	int r;
 
 	debug3("%s: entering fd = %d config len %d", __func__, fd,
 	    buffer_len(conf));
@@ -903,6 +931,7 @@ send_rexec_state(int fd, Buffer *conf)
 	 *	bignum	iqmp			"
 	 *	bignum	p			"
 	 *	bignum	q			"
+	 *	string	ephemeral kex keys	(see kex_keypool_to_blob)
 	 */
 	buffer_init(&m);
 	buffer_put_cstring(&m, buffer_ptr(conf));
@@ -919,6 +948,16 @@ send_rexec_state(int fd, Buffer *conf)
 	} else
 		buffer_put_int(&m, 0);
 
+	buffer_init(&kb);
+	if (keys != NULL) {
+		if ((r = kex_keypool_to_blob(keys, &kb)) != 0)
+			fatal("%s: kex_keypool_to_blob: %s", __func__,
+			    ssh_err(r));
+	} else
+		buffer_put_int(&kb, 0);
+	buffer_put_string(&m, buffer_ptr(&kb), buffer_len(&kb));
+	buffer_free(&kb);
+
 	if (ssh_msg_send(fd, 0, &m) == -1)
 		fatal("%s: ssh_msg_send failed", __func__);
 
@@ -930,7 +969,7 @@ send_rexec_state(int fd, Buffer *conf)
 static void
 recv_rexec_state(int fd, Buffer *conf)
 {
-	Buffer m;
+	Buffer m, kb;
 	char *cp;
 	u_int len;
 	int r;
@@ -965,6 +1004,14 @@ recv_rexec_state(int fd, Buffer *conf)
 		    sensitive_data.server_key->rsa)) != 0)
 			fatal("generate RSA parameters failed: %s", ssh_err(r));
 	}
+
+	buffer_init(&kb);
+	if ((r = sshbuf_get_stringb(&m, &kb)) != 0)
+		fatal("%s: buffer error: %s", __func__, ssh_err(r));
+	kex_keypool_free(kex_keypool);
+	if ((r = kex_keypool_from_blob(&kb, &kex_keypool)) != 0)
+		fatal("%s: kex_keypool_from_blob: %s", __func__, ssh_err(r));
+	buffer_free(&kb);
 	buffer_free(&m);
 
 	debug3("%s: done", __func__);
@@ -1077,11 +1124,13 @@ static void
 server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 {
 	fd_set *fdset;
-	int i, j, ret, maxfd;
+	int i, j, r, ret, maxfd;
 	int key_used = 0, startups = 0;
 	int startup_p[2] = { -1 , -1 };
 	struct sockaddr_storage from;
 	socklen_t fromlen;
+	struct kex_keypool *child_keys = NULL;
+	struct timeval tv, *tvp;
 	pid_t pid;
 
 	/* setup fd set for accept */
@@ -1113,8 +1162,16 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			if (startup_pipes[i] != -1)
 				FD_SET(startup_pipes[i], fdset);
 
-		/* Wait in select until there is a connection. */
-		ret = select(maxfd+1, fdset, NULL, NULL, NULL);
+		/*
+		 * Wait in select until there is a connection, or just
+		 * poll if there are ephemeral kex keys to precompute.
+		 */
+		tvp = NULL;
+		if (kex_keypool != NULL && kex_keypool_missing(kex_keypool)) {
+			tv.tv_sec = tv.tv_usec = 0;
+			tvp = &tv;
+		}
+		ret = select(maxfd+1, fdset, NULL, NULL, tvp);
 		if (ret < 0 && errno != EINTR)
 			error("select: %.100s", strerror(errno));
 		if (received_sigterm) {
@@ -1131,6 +1188,16 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 		}
 		if (ret < 0)
 			continue;
+		if (ret == 0) {
+			/* idle: work on the key pool */
+			if ((r = kex_keypool_fill(kex_keypool,
+			    KEX_KEYPOOL_BATCH)) < 0) {
+				error("kex_keypool_fill: %s", ssh_err(r));
+				kex_keypool_free(kex_keypool);
+				kex_keypool = NULL;
+			}
+			continue;
+		}
 
 		for (i = 0; i < options.max_startups; i++)
 			if (startup_pipes[i] != -1 &&
@@ -1209,12 +1276,22 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				pid = getpid();
 				if (rexec_flag) {
 					send_rexec_state(config_s[0],
-					    &cfg);
+					    &cfg, kex_keypool);
 					close(config_s[0]);
 				}
 				break;
 			}
 
+			/*
+			 * Every key goes to exactly one process: the
+			 * child gets one key per method, the parent
+			 * keeps the rest.
+			 */
+			if (kex_keypool != NULL &&
+			    (r = kex_keypool_split(kex_keypool, 1,
+			    &child_keys)) != 0)
+				error("kex_keypool_split: %s", ssh_err(r));
+
 			/*
 			 * Normal production daemon.  Fork, and have
 			 * the child process the connection. The
@@ -1240,6 +1317,8 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 				    log_stderr);
 				if (rexec_flag)
 					close(config_s[0]);
+				kex_keypool_free(kex_keypool);
+				kex_keypool = child_keys;
 				break;
 			}
 
@@ -1252,10 +1331,13 @@ server_accept_loop(int *sock_in, int *sock_out, int *newsock, int *config_s)
 			close(startup_p[1]);
 
 			if (rexec_flag) {
-				send_rexec_state(config_s[0], &cfg);
+				send_rexec_state(config_s[0], &cfg,
+				    child_keys);
 				close(config_s[0]);
 				close(config_s[1]);
 			}
+			kex_keypool_free(child_keys);
+			child_keys = NULL;
 
 			/*
 			 * Mark that the key has been used (it
@@ -1300,7 +1382,7 @@ main(int ac, char **av)
 	int r, remote_port;
 	char *line, *p, *cp;
 	int config_s[2] = { -1 , -1 };
-	u_int64_t ibytes, obytes;
+	u_int64_t ibytes, obytes, hits, misses;
 	mode_t new_umask;
 	struct sshkey *key;
 	Authctxt *authctxt;
@@ -1527,6 +1609,10 @@ main(int ac, char **av)
 			continue;
 		}
 		sensitive_data.host_keys[i] = key;
+		/* Every key exchange serialises the host key */
+		if ((r = sshkey_memoise(key)) != 0)
+			debug("%s: sshkey_memoise: %s",
+			    options.host_key_files[i], ssh_err(r));
 		switch (key->type) {
 		case KEY_RSA1:
 			sensitive_data.ssh1_host_key = key;
@@ -1535,6 +1621,7 @@ main(int ac, char **av)
 		case KEY_RSA:
 		case KEY_DSA:
 		case KEY_ECDSA:
+		case KEY_ED25519:
 			sensitive_data.have_ssh2_key = 1;
 			break;
 		}
@@ -1703,6 +1790,21 @@ main(int ac, char **av)
 
 		if (options.protocol & SSH_PROTO_1)
 			generate_ephemeral_server_key();
+		if ((options.protocol & SSH_PROTO_2) &&
+		    options.kex_key_pool > 0) {
+			if ((r = kex_keypool_new(&kex_keypool,
+			    options.kex_key_pool)) != 0 ||
+			    (r = kex_keypool_want(kex_keypool,
+			    options.kex_algorithms != NULL ?
+			    options.kex_algorithms : KEX_DEFAULT_KEX)) != 0)
+				fatal("kex key pool: %s", ssh_err(r));
+		}
+		/*
+		 * Without re-exec the children inherit the parsed moduli
+		 * and group exchange does not need to read the file.
+		 */
+		if ((options.protocol & SSH_PROTO_2) && !rexec_flag)
+			debug("%u DH groups loaded", dh_load_moduli());
 
 		signal(SIGHUP, sighup_handler);
 		signal(SIGCHLD, main_sigchld_handler);
@@ -1865,6 +1967,9 @@ main(int ac, char **av)
 		generate_ephemeral_server_key();
 
 	packet_set_nonblocking();
+	packet_tune_socket(options.tcp_notsent_lowat, options.tcp_cork,
+	    options.socket_buffer_size == SSH_SOCKBUF_AUTO ?
+	    CHAN_SES_WINDOW_DEFAULT : options.socket_buffer_size);
 
 	/* allocate authentication context */
 	authctxt = xcalloc(1, sizeof(*authctxt));
@@ -1876,6 +1981,19 @@ main(int ac, char **av)
 	buffer_init(&loginmsg);
 	auth_debug_reset();
 
+	/*
+	 * Each certificate is parsed several times during authentication;
+	 * only verify its CA signature once.
+	 */
+	if ((r = sshkey_cert_cache_init(SSHD_CERT_CACHE_SIZE)) != 0)
+		fatal("%s: sshkey_cert_cache_init: %s", __func__, ssh_err(r));
+	/*
+	 * Keys offered by the client are parsed again for the signature
+	 * check, in the child and in the monitor; share one copy of each.
+	 */
+	if ((r = sshkey_intern_init(SSHD_KEY_INTERN_SIZE)) != 0)
+		fatal("%s: sshkey_intern_init: %s", __func__, ssh_err(r));
+
 	if (use_privsep)
 		if (privsep_preauth(authctxt) == 1)
 			goto authenticated;
@@ -1906,6 +2024,12 @@ main(int ac, char **av)
 	alarm(0);
 	signal(SIGALRM, SIG_DFL);
 	authctxt->authenticated = 1;
+	sshkey_cert_cache_stats(&hits, &misses);
+	log_cache_stats("certificate signature cache", hits, misses);
+	sshkey_cert_cache_init(0);
+	sshkey_intern_stats(&hits, &misses);
+	log_cache_stats("interned keys", hits, misses);
+	sshkey_intern_init(0);
 	if (startup_pipe != -1) {
 		close(startup_pipe);
 		startup_pipe = -1;
@@ -2212,12 +2336,14 @@ do_ssh2_kex(void)
 	kex->kex[KEX_DH_GEX_SHA1] = kexgex_server;
 	kex->kex[KEX_DH_GEX_SHA256] = kexgex_server;
 	kex->kex[KEX_ECDH_SHA2] = kexecdh_server;
+	kex->kex[KEX_C25519_SHA256] = kexc25519_server;
 	kex->server = 1;
 	kex->client_version_string=client_version_string;
 	kex->server_version_string=server_version_string;
 	kex->load_host_public_key=&get_hostkey_public_by_type;
 	kex->load_host_private_key=&get_hostkey_private_by_type;
 	kex->host_key_index=&get_hostkey_index;
+	kex->keypool = kex_keypool;
 
 	active_state->kex = kex;
 
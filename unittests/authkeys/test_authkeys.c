@@ -0,0 +1,310 @@
+/* 	$OpenBSD$ */
+/*
+ * Regress test for the authorized_keys cache
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_helper.h"
+
+#include "err.h"
+#include "ssh.h"
+#include "ssh2.h"
+#include "sshbuf.h"
+#include "key.h"
+#include "misc.h"
+#include "authkeys.h"
+
+void authkeys_tests(void);
+
+static char dir[] = "/tmp/test_authkeys.XXXXXXXX";
+static char path[MAXPATHLEN];
+
+static void
+write_file(const char *p, const char *contents, time_t mtime)
+{
+	struct timespec ts[2];
+	FILE *f;
+
+	ASSERT_PTR_NE(f = fopen(p, "w"), NULL);
+	ASSERT_SIZE_T_EQ(fwrite(contents, 1, strlen(contents), f),
+	    strlen(contents));
+	ASSERT_INT_EQ(fclose(f), 0);
+	ts[0].tv_sec = ts[1].tv_sec = mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	ASSERT_INT_EQ(utimensat(AT_FDCWD, p, ts, 0), 0);
+}
+
+/* Returns the public key of 'k' as written in authorized_keys */
+static char *
+key_text(const struct sshkey *k)
+{
+	struct sshbuf *b;
+	char *s;
+
+	ASSERT_PTR_NE(b = sshbuf_new(), NULL);
+	ASSERT_INT_EQ(sshkey_format_text(k, b), 0);
+	ASSERT_INT_EQ(sshbuf_put_u8(b, 0), 0);
+	ASSERT_PTR_NE(s = strdup((const char *)sshbuf_ptr(b)), NULL);
+	sshbuf_free(b);
+	return s;
+}
+
+/*
+ * The loop user_key_allowed2() ran before the cache, kept as the
+ * reference.  As there, one key of type 'type' is read into for every
+ * line, so after a KEY_UNSPEC lookup only lines of the same type as the
+ * first key can match; the CA in the fixture shares that type.
+ */
+static u_int
+old_lookup(const struct sshkey *key, int type, u_long *lines,
+    char **options, u_int max)
+{
+	char line[SSH_MAX_PUBKEY_BYTES];
+	u_long linenum = 0;
+	struct sshkey *found;
+	u_int n = 0;
+	FILE *f;
+
+	ASSERT_PTR_NE(f = fopen(path, "r"), NULL);
+	ASSERT_PTR_NE(found = sshkey_new(type), NULL);
+	while (read_keyfile_line(f, path, line, sizeof(line), &linenum) != -1) {
+		char *cp, *key_options = NULL;
+
+		/* Skip leading whitespace, empty and comment lines. */
+		for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
+			;
+		if (!*cp || *cp == '\n' || *cp == '#')
+			continue;
+
+		if (sshkey_read(found, &cp) != 0) {
+			/* no key?  check if there are options for this key */
+			int quoted = 0;
+			key_options = cp;
+			for (; *cp && (quoted || (*cp != ' ' && *cp != '\t'));
+			    cp++) {
+				if (*cp == '\\' && cp[1] == '"')
+					cp++;	/* Skip both */
+				else if (*cp == '"')
+					quoted = !quoted;
+			}
+			/* Skip remaining whitespace. */
+			for (; *cp == ' ' || *cp == '\t'; cp++)
+				;
+			if (sshkey_read(found, &cp) != 0) {
+				/* still no key?  advance to next line*/
+				continue;
+			}
+		}
+		if (!sshkey_equal(found, key))
+			continue;
+		ASSERT_U_INT_LT(n, max);
+		lines[n] = linenum;
+		options[n] = NULL;
+		if (key_options != NULL)
+			ASSERT_PTR_NE(options[n] = strdup(key_options), NULL);
+		n++;
+	}
+	sshkey_free(found);
+	fclose(f);
+	return n;
+}
+
+/*
+ * Looks 'key' up in the file and checks that exactly the zero-terminated
+ * 'lines', with 'options', come back and that the old loop, reading keys
+ * of type 'type', agrees.
+ */
+static void
+check_lookup(const struct sshkey *key, int type, const u_long *lines,
+    const char * const *options)
+{
+	struct authkeys_entry **m;
+	u_long oldlines[16];
+	char *oldoptions[16];
+	u_int i, n, oldn;
+	size_t len;
+	FILE *f;
+
+	ASSERT_PTR_NE(f = fopen(path, "r"), NULL);
+	ASSERT_INT_EQ(authkeys_lookup(f, path, key, &m, &n), 0);
+	fclose(f);
+	oldn = old_lookup(key, type, oldlines, oldoptions, 16);
+	ASSERT_U_INT_EQ(n, oldn);
+	for (i = 0; i < n; i++) {
+		ASSERT_U_INT_NE(lines[i], 0);
+		ASSERT_U_INT_EQ(m[i]->linenum, lines[i]);
+		ASSERT_U_INT_EQ(oldlines[i], lines[i]);
+		ASSERT_INT_EQ(sshkey_equal(m[i]->key, key), 1);
+		if (options[i] == NULL) {
+			ASSERT_PTR_EQ(m[i]->options, NULL);
+			ASSERT_PTR_EQ(oldoptions[i], NULL);
+			continue;
+		}
+		ASSERT_STRING_EQ(m[i]->options, options[i]);
+		/*
+		 * The old loop passed the rest of the line, which
+		 * auth_parse_options() reads up to the first whitespace
+		 * outside quotes; the cache keeps just that part.
+		 */
+		ASSERT_PTR_NE(oldoptions[i], NULL);
+		len = strlen(options[i]);
+		ASSERT_INT_EQ(strncmp(oldoptions[i], options[i], len), 0);
+		free(oldoptions[i]);
+	}
+	ASSERT_U_INT_EQ(lines[n], 0);
+	free(m);
+}
+
+void
+authkeys_tests(void)
+{
+	char contents[8192], tmp[MAXPATHLEN];
+	struct sshkey *k1, *k2, *k3, *ca, *cert;
+	struct authkeys_entry **m, **m2;
+	char *k1t, *k2t, *cat, *certt;
+	struct timespec ts[2];
+	struct stat st;
+	u_int n;
+	FILE *f;
+	int fd;
+	static const u_long k1_lines[] = { 4, 6, 0 };
+	static const char * const k1_options[] = {
+		NULL, "from=\"10.0.0.1, 10.0.0.2\"\t" };
+	static const u_long k2_lines[] = { 5, 11, 0 };
+	static const char * const k2_options[] = {
+		"command=\"echo hello world\",no-pty ",
+		"command=\"echo \\\"a b\\\"\" " };
+	static const u_long ca_lines[] = { 7, 0 };
+	static const char * const ca_options[] = {
+		"cert-authority,principals=\"a b\" " };
+	static const u_long none[] = { 0 };
+	static const u_long appended[] = { 5, 11, 13, 0 };
+	static const char * const appended_options[] = {
+		"command=\"echo hello world\",no-pty ",
+		"command=\"echo \\\"a b\\\"\" ", NULL };
+	static const char * const mtime_options[] = {
+		"command=\"echo HELLO world\",no-pty ",
+		"command=\"echo \\\"a b\\\"\" ", NULL };
+	static const char * const inode_options[] = {
+		"command=\"echo HELLO WORLD\",no-pty ",
+		"command=\"echo \\\"a b\\\"\" ", NULL };
+
+	ASSERT_INT_EQ(sshkey_generate(KEY_ED25519, 256, &k1), 0);
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &k2), 0);
+	ASSERT_INT_EQ(sshkey_generate(KEY_ED25519, 256, &k3), 0);
+	ASSERT_INT_EQ(sshkey_generate(KEY_ED25519, 256, &ca), 0);
+	ASSERT_INT_EQ(sshkey_from_private(k1, &cert), 0);
+	ASSERT_INT_EQ(sshkey_to_certified(cert, 0), 0);
+	cert->cert->type = SSH2_CERT_TYPE_USER;
+	ASSERT_PTR_NE(cert->cert->key_id = strdup("authkeys"), NULL);
+	ASSERT_INT_EQ(sshkey_certify(cert, ca), 0);
+	k1t = key_text(k1);
+	k2t = key_text(k2);
+	cat = key_text(ca);
+	certt = key_text(cert);
+
+	ASSERT_PTR_NE(mkdtemp(dir), NULL);
+	snprintf(path, sizeof(path), "%s/authorized_keys", dir);
+	snprintf(tmp, sizeof(tmp), "%s/authorized_keys.new", dir);
+	snprintf(contents, sizeof(contents),
+	    "# comment\n"
+	    "\n"
+	    " \t\n"
+	    "%s user@host\n"
+	    "command=\"echo hello world\",no-pty %s\n"
+	    "from=\"10.0.0.1, 10.0.0.2\"\t%s tab\n"
+	    "cert-authority,principals=\"a b\" %s\n"
+	    "%s certificate\n"
+	    "no key on this line\n"
+	    "  \t# indented comment\n"
+	    "command=\"echo \\\"a b\\\"\" %s\n"
+	    "ssh-ed25519 AAAAinvalid\n",
+	    k1t, k2t, k1t, cat, certt, k2t);
+	write_file(path, contents, 1000000000);
+
+	TEST_START("authkeys_lookup plain keys");
+	/* Line 8 is a certificate of k1, which must not match k1 itself */
+	check_lookup(k1, k1->type, k1_lines, k1_options);
+	check_lookup(k2, k2->type, k2_lines, k2_options);
+	TEST_DONE();
+
+	TEST_START("authkeys_lookup cert-authority");
+	/* A certificate is looked up by its CA, with any key type */
+	check_lookup(ca, KEY_UNSPEC, ca_lines, ca_options);
+	TEST_DONE();
+
+	TEST_START("authkeys_lookup unknown key");
+	check_lookup(k3, k3->type, none, NULL);
+	TEST_DONE();
+
+	TEST_START("authkeys_lookup cached");
+	ASSERT_PTR_NE(f = fopen(path, "r"), NULL);
+	ASSERT_INT_EQ(authkeys_lookup(f, path, k1, &m, &n), 0);
+	ASSERT_U_INT_EQ(n, 2);
+	rewind(f);
+	ASSERT_INT_EQ(authkeys_lookup(f, path, k1, &m2, &n), 0);
+	ASSERT_U_INT_EQ(n, 2);
+	fclose(f);
+	/* The same entries come back without parsing the file again */
+	ASSERT_PTR_EQ(m2[0], m[0]);
+	ASSERT_PTR_EQ(m2[1], m[1]);
+	free(m);
+	free(m2);
+	TEST_DONE();
+
+	TEST_START("authkeys_lookup stale size");
+	strlcat(contents, k2t, sizeof(contents));
+	strlcat(contents, "\n", sizeof(contents));
+	write_file(path, contents, 1000000000);
+	check_lookup(k2, k2->type, appended, appended_options);
+	check_lookup(k1, k1->type, k1_lines, k1_options);
+	TEST_DONE();
+
+	TEST_START("authkeys_lookup stale mtime");
+	/* Same size and inode, only the modification time differs */
+	memcpy(strstr(contents, "hello"), "HELLO", 5);
+	ASSERT_INT_NE(fd = open(path, O_WRONLY), -1);
+	ASSERT_INT_EQ(pwrite(fd, contents, strlen(contents), 0),
+	    (ssize_t)strlen(contents));
+	close(fd);
+	ts[0].tv_sec = ts[1].tv_sec = 1000000001;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	ASSERT_INT_EQ(utimensat(AT_FDCWD, path, ts, 0), 0);
+	check_lookup(k2, k2->type, appended, mtime_options);
+	TEST_DONE();
+
+	TEST_START("authkeys_lookup stale inode");
+	/* Same size and modification time, but a different file */
+	ASSERT_INT_EQ(stat(path, &st), 0);
+	memcpy(strstr(contents, "world"), "WORLD", 5);
+	write_file(tmp, contents, 0);
+	ts[0] = ts[1] = st.st_mtim;
+	ASSERT_INT_EQ(utimensat(AT_FDCWD, tmp, ts, 0), 0);
+	ASSERT_INT_EQ(rename(tmp, path), 0);
+	check_lookup(k2, k2->type, appended, inode_options);
+	TEST_DONE();
+
+	authkeys_flush();
+	unlink(path);
+	rmdir(dir);
+	free(k1t);
+	free(k2t);
+	free(cat);
+	free(certt);
+	sshkey_free(k1);
+	sshkey_free(k2);
+	sshkey_free(k3);
+	sshkey_free(ca);
+	sshkey_free(cert);
+}
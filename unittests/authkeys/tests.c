@@ -0,0 +1,16 @@
+/* 	$OpenBSD$ */
+/*
+ * Regress test for the authorized_keys cache
+ *
+ * Placed in the public domain
+ */
+
+#include "test_helper.h"
+
+void authkeys_tests(void);
+
+void
+tests(void)
+{
+	authkeys_tests();
+}
@@ -0,0 +1,120 @@
+/* 	$OpenBSD$ */
+/*
+ * Regress test for the ssh-keygen batch worker pool
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_helper.h"
+#include "err.h"
+#include "batchpool.h"
+
+void batchpool_tests(void);
+
+#define NITEMS	2000
+#define WINDOW	8
+
+struct item {
+	u_int	seq;
+	int	worked;
+};
+
+struct check {
+	u_int	next;		/* sequence number done_fn expects next */
+	u_int	worked;		/* items done_fn saw already worked on */
+};
+
+static void
+work(void *arg, void *ctx)
+{
+	struct item *item = arg;
+
+	/* Finish out of order, so that completion has to reorder */
+	if ((item->seq * 7) % 5 == 0)
+		usleep(100);
+	item->worked = 1;
+}
+
+static void
+done(void *arg, void *ctx)
+{
+	struct item *item = arg;
+	struct check *check = ctx;
+
+	ASSERT_U_INT_EQ(item->seq, check->next);
+	check->next++;
+	if (item->worked)
+		check->worked++;
+	free(item);
+}
+
+static void
+run_pool(u_int nworkers, u_int window)
+{
+	struct batch_pool *pool;
+	struct check check;
+	struct item *item;
+	u_int i;
+
+	bzero(&check, sizeof(check));
+	ASSERT_INT_EQ(batch_pool_new(&pool, nworkers, window, work, done,
+	    &check), 0);
+	ASSERT_PTR_NE(pool, NULL);
+	for (i = 0; i < NITEMS; i++) {
+		item = calloc(1, sizeof(*item));
+		ASSERT_PTR_NE(item, NULL);
+		item->seq = i;
+		batch_pool_submit(pool, item);
+		/* The window bounds how many items are not yet done */
+		ASSERT_U_INT_LE(i + 1 - check.next, window);
+	}
+	batch_pool_free(pool);
+	ASSERT_U_INT_EQ(check.next, NITEMS);
+	ASSERT_U_INT_EQ(check.worked, NITEMS);
+}
+
+void
+batchpool_tests(void)
+{
+	struct batch_pool *pool;
+
+	TEST_START("batch_pool_new bad arguments");
+	ASSERT_INT_EQ(batch_pool_new(&pool, 1, 0, work, done, NULL),
+	    SSH_ERR_INVALID_ARGUMENT);
+	ASSERT_PTR_EQ(pool, NULL);
+	ASSERT_INT_EQ(batch_pool_new(&pool, 1, WINDOW, NULL, done, NULL),
+	    SSH_ERR_INVALID_ARGUMENT);
+	ASSERT_INT_EQ(batch_pool_new(&pool, 1, WINDOW, work, NULL, NULL),
+	    SSH_ERR_INVALID_ARGUMENT);
+	TEST_DONE();
+
+	TEST_START("batch_pool one worker");
+	run_pool(1, WINDOW);
+	TEST_DONE();
+
+	TEST_START("batch_pool several workers");
+	run_pool(4, WINDOW);
+	TEST_DONE();
+
+	TEST_START("batch_pool more workers than window");
+	run_pool(16, 3);
+	TEST_DONE();
+
+	TEST_START("batch_pool window of one");
+	run_pool(4, 1);
+	TEST_DONE();
+
+	TEST_START("batch_pool_free empty");
+	ASSERT_INT_EQ(batch_pool_new(&pool, 0, WINDOW, work, done, NULL), 0);
+	batch_pool_free(pool);
+	batch_pool_free(NULL);
+	TEST_DONE();
+}
@@ -0,0 +1,16 @@
+/* 	$OpenBSD$ */
+/*
+ * Regress test for the ssh-keygen batch worker pool
+ *
+ * Placed in the public domain
+ */
+
+#include "test_helper.h"
+
+void batchpool_tests(void);
+
+void
+tests(void)
+{
+	batchpool_tests();
+}
@@ -0,0 +1,301 @@
+/* 	$OpenBSD$ */
+/*
+ * Regress test for the known_hosts index
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <resolv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+#include "test_helper.h"
+#include "err.h"
+#include "hostindex.h"
+
+void hostindex_tests(void);
+
+#define KEY	" ssh-ed25519 AAAAC3NzaC1lZDI1NTE5AAAAIDummyKeyDummyKey\n"
+
+static char dir[] = "/tmp/test_hostindex.XXXXXXXX";
+static char path[MAXPATHLEN], idxpath[MAXPATHLEN];
+
+/* Returns "|1|salt|hash" for 'host', as host_hash() would. */
+static const char *
+hashed(const char *host)
+{
+	static char out[128];
+	u_char salt[SHA_DIGEST_LENGTH], mac[SHA_DIGEST_LENGTH];
+	char s64[64], m64[64];
+	u_int len;
+
+	memset(salt, 0x5a, sizeof(salt));
+	ASSERT_PTR_NE(HMAC(EVP_sha1(), salt, sizeof(salt),
+	    (const u_char *)host, strlen(host), mac, &len), NULL);
+	ASSERT_U_INT_EQ(len, sizeof(mac));
+	ASSERT_INT_GT(__b64_ntop(salt, sizeof(salt), s64, sizeof(s64)), 0);
+	ASSERT_INT_GT(__b64_ntop(mac, sizeof(mac), m64, sizeof(m64)), 0);
+	snprintf(out, sizeof(out), "|1|%s|%s", s64, m64);
+	return out;
+}
+
+static void
+write_file(const char *p, const char *contents, time_t mtime)
+{
+	struct timespec ts[2];
+	FILE *f;
+
+	ASSERT_PTR_NE(f = fopen(p, "w"), NULL);
+	ASSERT_SIZE_T_EQ(fwrite(contents, 1, strlen(contents), f),
+	    strlen(contents));
+	ASSERT_INT_EQ(fclose(f), 0);
+	ts[0].tv_sec = ts[1].tv_sec = mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	ASSERT_INT_EQ(utimensat(AT_FDCWD, p, ts, 0), 0);
+}
+
+/* Offset of the start of line 'line' (from 1) in 'contents' */
+static off_t
+line_offset(const char *contents, u_long line)
+{
+	const char *cp = contents;
+
+	while (--line > 0) {
+		cp = strchr(cp, '\n');
+		ASSERT_PTR_NE(cp, NULL);
+		cp++;
+	}
+	return cp - contents;
+}
+
+/*
+ * Looks 'host' up in the index of the file 'p', passing 'name' as its
+ * path, and checks that exactly the zero-terminated 'lines' come back.
+ */
+static void
+check_lookup_as(const char *p, const char *name, const char *contents,
+    const char *host, int create, const u_long *lines)
+{
+	struct hostindex_match *m;
+	size_t i, n;
+	FILE *f;
+
+	ASSERT_PTR_NE(f = fopen(p, "r"), NULL);
+	ASSERT_INT_EQ(hostindex_lookup(f, name, host, create, &m, &n), 0);
+	fclose(f);
+	for (i = 0; i < n; i++) {
+		ASSERT_U_INT_NE(lines[i], 0);
+		ASSERT_U_INT_EQ(m[i].line, lines[i]);
+		ASSERT_LONG_LONG_EQ(m[i].offset,
+		    line_offset(contents, lines[i]));
+	}
+	ASSERT_U_INT_EQ(lines[n], 0);
+	free(m);
+}
+
+static void
+check_lookup(const char *contents, const char *host, int create,
+    const u_long *lines)
+{
+	check_lookup_as(path, path, contents, host, create, lines);
+}
+
+static off_t
+file_size(const char *p)
+{
+	struct stat st;
+
+	ASSERT_INT_EQ(stat(p, &st), 0);
+	return st.st_size;
+}
+
+void
+hostindex_tests(void)
+{
+	char contents[4096], tmp[MAXPATHLEN], missing[MAXPATHLEN];
+	struct hostindex_match *m;
+	struct stat st, ist;
+	struct timespec ts[2];
+	size_t n;
+	off_t idxlen;
+	u_char buf[128];
+	FILE *f;
+	int fd;
+	/* Lines 4 and 8 have patterns and are always candidates */
+	static const u_long plain[] = { 2, 4, 7, 8, 0 };
+	static const u_long addr[] = { 2, 4, 8, 0 };
+	static const u_long hash[] = { 3, 4, 8, 0 };
+	static const u_long ca[] = { 4, 5, 8, 0 };
+	static const u_long mixed[] = { 4, 6, 8, 0 };
+	static const u_long none[] = { 4, 8, 0 };
+	static const u_long appended[] = { 4, 8, 9, 0 };
+
+	ASSERT_PTR_NE(mkdtemp(dir), NULL);
+	snprintf(path, sizeof(path), "%s/known_hosts", dir);
+	snprintf(idxpath, sizeof(idxpath), "%s%s", path, HOSTINDEX_SUFFIX);
+	snprintf(tmp, sizeof(tmp), "%s/known_hosts.new", dir);
+	snprintf(missing, sizeof(missing), "%s/missing/known_hosts", dir);
+	snprintf(contents, sizeof(contents),
+	    "# comment\n"
+	    "plain.example.com,10.0.0.1" KEY
+	    "%s" KEY
+	    "*.wild.example.com" KEY
+	    "@cert-authority ca.example.com" KEY
+	    "Mixed.Example.COM" KEY
+	    "@revoked plain.example.com" KEY
+	    "!neg.example.com,other.example.com" KEY,
+	    hashed("hashed.example.com"));
+	write_file(path, contents, 1000000000);
+
+	TEST_START("hostindex_lookup missing index");
+	ASSERT_PTR_NE(f = fopen(path, "r"), NULL);
+	ASSERT_INT_EQ(hostindex_lookup(f, path, "plain.example.com", 0,
+	    &m, &n), SSH_ERR_SYSTEM_ERROR);
+	ASSERT_INT_EQ(errno, ENOENT);
+	ASSERT_PTR_EQ(m, NULL);
+	ASSERT_SIZE_T_EQ(n, 0);
+	fclose(f);
+	ASSERT_INT_EQ(access(idxpath, F_OK), -1);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup create");
+	check_lookup(contents, "plain.example.com", 1, plain);
+	ASSERT_INT_EQ(access(idxpath, F_OK), 0);
+	idxlen = file_size(idxpath);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup plain");
+	check_lookup(contents, "plain.example.com", 0, plain);
+	check_lookup(contents, "10.0.0.1", 0, addr);
+	check_lookup(contents, "mixed.example.com", 0, mixed);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup hashed");
+	check_lookup(contents, "hashed.example.com", 0, hash);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup @cert-authority");
+	check_lookup(contents, "ca.example.com", 0, ca);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup wildcards only");
+	check_lookup(contents, "x.wild.example.com", 0, none);
+	check_lookup(contents, "other.example.com", 0, none);
+	check_lookup(contents, "unknown.example.com", 0, none);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup truncated index");
+	ASSERT_INT_EQ(truncate(idxpath, idxlen / 2), 0);
+	check_lookup(contents, "hashed.example.com", 0, hash);
+	ASSERT_LONG_LONG_EQ(file_size(idxpath), idxlen);
+	ASSERT_INT_EQ(truncate(idxpath, 8), 0);
+	check_lookup(contents, "hashed.example.com", 0, hash);
+	ASSERT_LONG_LONG_EQ(file_size(idxpath), idxlen);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup corrupt magic");
+	ASSERT_INT_NE(fd = open(idxpath, O_RDWR), -1);
+	ASSERT_INT_EQ(pwrite(fd, "XXXX", 4, 0), 4);
+	close(fd);
+	check_lookup(contents, "plain.example.com", 0, plain);
+	ASSERT_INT_NE(fd = open(idxpath, O_RDONLY), -1);
+	ASSERT_INT_EQ(pread(fd, buf, 4, 0), 4);
+	close(fd);
+	ASSERT_MEM_EQ(buf, "KHID", 4);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup corrupt buckets");
+	/* Every bucket, and then some, points past the end of the names */
+	ASSERT_INT_NE(fd = open(idxpath, O_RDWR), -1);
+	ASSERT_INT_EQ(pread(fd, buf, sizeof(buf), 0), sizeof(buf));
+	memset(buf + 56, 0xff, sizeof(buf) - 56);
+	ASSERT_INT_EQ(pwrite(fd, buf, sizeof(buf), 0), sizeof(buf));
+	close(fd);
+	check_lookup(contents, "plain.example.com", 0, plain);
+	check_lookup(contents, "mixed.example.com", 0, mixed);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup stale size");
+	strlcat(contents, "new.example.com" KEY, sizeof(contents));
+	write_file(path, contents, 1000000000);
+	check_lookup(contents, "new.example.com", 0, appended);
+	check_lookup(contents, "plain.example.com", 0, plain);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup stale mtime");
+	/* Same size and inode, only the modification time differs */
+	check_lookup(contents, "moved.example.com", 0, none);
+	memcpy(strstr(contents, "Mixed"), "Moved", 5);
+	ASSERT_INT_NE(fd = open(path, O_WRONLY), -1);
+	ASSERT_INT_EQ(pwrite(fd, contents, strlen(contents), 0),
+	    (ssize_t)strlen(contents));
+	close(fd);
+	ts[0].tv_sec = ts[1].tv_sec = 1000000001;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	ASSERT_INT_EQ(utimensat(AT_FDCWD, path, ts, 0), 0);
+	check_lookup(contents, "moved.example.com", 0, mixed);
+	check_lookup(contents, "mixed.example.com", 0, none);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup stale inode");
+	/* Same size and modification time, but a different file */
+	ASSERT_INT_EQ(stat(path, &st), 0);
+	memcpy(strstr(contents, "Moved"), "Mixed", 5);
+	write_file(tmp, contents, 0);
+	ts[0] = ts[1] = st.st_mtim;
+	ASSERT_INT_EQ(utimensat(AT_FDCWD, tmp, ts, 0), 0);
+	ASSERT_INT_EQ(rename(tmp, path), 0);
+	check_lookup(contents, "mixed.example.com", 0, mixed);
+	check_lookup(contents, "moved.example.com", 0, none);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup writable by others");
+	/* Such an index is neither used nor replaced */
+	ASSERT_INT_EQ(stat(idxpath, &st), 0);
+	ASSERT_INT_EQ(chmod(idxpath, 0620), 0);
+	ASSERT_PTR_NE(f = fopen(path, "r"), NULL);
+	ASSERT_INT_EQ(hostindex_lookup(f, path, "plain.example.com", 1,
+	    &m, &n), SSH_ERR_SYSTEM_ERROR);
+	ASSERT_INT_EQ(errno, EPERM);
+	ASSERT_PTR_EQ(m, NULL);
+	ASSERT_INT_EQ(chmod(idxpath, 0602), 0);
+	ASSERT_INT_EQ(hostindex_lookup(f, path, "plain.example.com", 1,
+	    &m, &n), SSH_ERR_SYSTEM_ERROR);
+	ASSERT_PTR_EQ(m, NULL);
+	fclose(f);
+	ASSERT_INT_EQ(stat(idxpath, &ist), 0);
+	ASSERT_LONG_LONG_EQ(ist.st_ino, st.st_ino);
+	ASSERT_INT_EQ(chmod(idxpath, 0600), 0);
+	check_lookup(contents, "plain.example.com", 0, plain);
+	TEST_DONE();
+
+	TEST_START("hostindex_lookup unwritable index");
+	/* The first lookup still answers, later ones fall back to a scan */
+	check_lookup_as(path, missing, contents, "plain.example.com", 1, plain);
+	ASSERT_PTR_NE(f = fopen(path, "r"), NULL);
+	ASSERT_INT_EQ(hostindex_lookup(f, missing, "plain.example.com", 1,
+	    &m, &n), SSH_ERR_SYSTEM_ERROR);
+	ASSERT_PTR_EQ(m, NULL);
+	ASSERT_SIZE_T_EQ(n, 0);
+	fclose(f);
+	/* Other files are unaffected */
+	check_lookup(contents, "plain.example.com", 0, plain);
+	TEST_DONE();
+
+	unlink(idxpath);
+	unlink(path);
+	rmdir(dir);
+}
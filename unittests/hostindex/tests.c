@@ -0,0 +1,16 @@
+/* 	$OpenBSD$ */
+/*
+ * Regress test for the known_hosts index
+ *
+ * Placed in the public domain
+ */
+
+#include "test_helper.h"
+
+void hostindex_tests(void);
+
+void
+tests(void)
+{
+	hostindex_tests();
+}
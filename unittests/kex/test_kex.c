@@ -7,17 +7,29 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "test_helper.h"
 
 #include "err.h"
 #include "ssh_api.h"
+#include "ssh_engine.h"
+#include "signpool.h"
+#include "kexpool.h"
 #include "packet.h"
 #include "myproposal.h"
+#include "crypto_api.h"
 
 void kex_tests(void);
 static int do_debug = 0;
@@ -74,9 +86,13 @@ static void
 do_kex_with_key(char *kex, int key_type, int bits)
 {
 	struct ssh *client = NULL, *server = NULL, *server2 = NULL;
+	struct ssh *server3 = NULL;
 	struct sshkey *private, *public;
 	struct sshbuf *state;
 	struct kex_params kex_params;
+	u_char type, data[4096];
+	size_t len;
+	int sp[2], fd;
 
 	TEST_START("sshkey_generate");
 	ASSERT_INT_EQ(sshkey_generate(key_type, bits, &private), 0);
@@ -115,6 +131,35 @@ do_kex_with_key(char *kex, int key_type, int bits)
 	run_kex(client, server);
 	TEST_DONE();
 
+	TEST_START("packet priority");
+	memset(data, 0, sizeof(data));
+	ASSERT_INT_EQ(ssh_packet_put(server, SSH2_MSG_CHANNEL_DATA,
+	    (char *)data, sizeof(data)), 0);
+	ASSERT_INT_EQ(ssh_packet_put(server, SSH2_MSG_CHANNEL_DATA,
+	    (char *)data, 9), 0);
+	data[3] = 1;
+	ASSERT_INT_EQ(ssh_packet_put(server, SSH2_MSG_CHANNEL_DATA,
+	    (char *)data, 9), 0);
+	ASSERT_INT_EQ(ssh_packet_put(server, SSH2_MSG_CHANNEL_WINDOW_ADJUST,
+	    (char *)data, 8), 0);
+	ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_CHANNEL_WINDOW_ADJUST);
+	/* channel 1 overtakes the bulk data, channel 0 keeps its order */
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_CHANNEL_DATA);
+	ASSERT_U_INT_EQ(ssh_packet_payload(client, &len)[3], 1);
+	ASSERT_SIZE_T_EQ(len, 9);
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_CHANNEL_DATA);
+	ASSERT_U_INT_EQ(ssh_packet_payload(client, &len)[3], 0);
+	ASSERT_SIZE_T_EQ(len, sizeof(data));
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_CHANNEL_DATA);
+	ASSERT_U_INT_EQ(ssh_packet_payload(client, &len)[3], 0);
+	ASSERT_SIZE_T_EQ(len, 9);
+	TEST_DONE();
+
 	TEST_START("ssh_packet_get_state");
 	state = sshbuf_new();
 	ASSERT_PTR_NE(state, NULL);
@@ -138,6 +183,7 @@ do_kex_with_key(char *kex, int key_type, int bits)
 	server2->kex->kex[KEX_DH_GEX_SHA1] = kexgex_server;
 	server2->kex->kex[KEX_DH_GEX_SHA256] = kexgex_server;
 	server2->kex->kex[KEX_ECDH_SHA2] = kexecdh_server;
+	server2->kex->kex[KEX_C25519_SHA256] = kexc25519_server;
 	server2->kex->load_host_public_key= server->kex->load_host_public_key;
 	server2->kex->load_host_private_key= server->kex->load_host_private_key;
 	TEST_DONE();
@@ -149,12 +195,917 @@ do_kex_with_key(char *kex, int key_type, int bits)
 	run_kex(client, server2);
 	TEST_DONE();
 
+	TEST_START("ssh_handoff");
+	ASSERT_INT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sp), 0);
+	/* leave a packet in the output buffer */
+	ASSERT_INT_EQ(ssh_packet_put(server2, SSH2_MSG_IGNORE,
+	    "\0\0\0\0", 4), 0);
+	ASSERT_INT_EQ(ssh_handoff_send(server2, sp[0], sp[1]), 0);
+	ASSERT_INT_EQ(ssh_handoff_receive(&server3, &fd, sp[1]), 0);
+	ASSERT_PTR_NE(server3, NULL);
+	ASSERT_INT_NE(fd, -1);
+	close(fd);
+	close(sp[0]);
+	close(sp[1]);
+	ASSERT_INT_EQ(server3->kex->server, 1);
+	ASSERT_INT_EQ(ssh_add_hostkey(server3, private), 0);
+	ASSERT_INT_EQ(do_send_and_receive(server3, client), 0);
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_IGNORE);
+	TEST_DONE();
+
+	TEST_START("rekeying after handoff");
+	ASSERT_INT_EQ(kex_send_kexinit(server3), 0);
+	run_kex(client, server3);
+	ASSERT_INT_EQ(kex_send_kexinit(client), 0);
+	run_kex(client, server3);
+	TEST_DONE();
+
 	TEST_START("cleanup");
 	sshkey_free(private);
 	sshkey_free(public);
 	ssh_free(client);
 	ssh_free(server);
 	ssh_free(server2);
+	ssh_free(server3);
+	TEST_DONE();
+}
+
+/*
+ * Push 'total' bytes of channel data from server to client in packets of
+ * 'psize' bytes.  Reports the throughput in verbose mode.
+ */
+static void
+do_packet_throughput(struct ssh *client, struct ssh *server, u_int psize,
+    size_t total)
+{
+	struct timeval start, end;
+	size_t sent, rcvd = 0, len;
+	double secs;
+	u_char type;
+	char *data;
+
+	data = calloc(1, psize);
+	ASSERT_PTR_NE(data, NULL);
+	gettimeofday(&start, NULL);
+	for (sent = 0; sent < total; sent += psize) {
+		ASSERT_INT_EQ(ssh_packet_put(server, SSH2_MSG_CHANNEL_DATA,
+		    data, psize), 0);
+		ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+		for (;;) {
+			ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+			if (type == 0)
+				break;
+			ASSERT_U_INT_EQ(type, SSH2_MSG_CHANNEL_DATA);
+			ssh_packet_payload(client, &len);
+			rcvd += len;
+		}
+	}
+	gettimeofday(&end, NULL);
+	ASSERT_SIZE_T_EQ(rcvd, sent);
+	secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_usec - start.tv_usec) / 1000000.0;
+	if (test_is_verbose() && secs > 0)
+		printf("%u byte packets: %.1f MB/s ", psize,
+		    rcvd / secs / (1024 * 1024));
+	free(data);
+}
+
+static void
+do_large_packets(void)
+{
+	struct ssh *client = NULL, *server = NULL;
+	struct sshkey *private, *public;
+	struct kex_params kex_params;
+	size_t total = test_is_verbose() ? 64 * 1024 * 1024 : 4 * 1024 * 1024;
+
+	TEST_START("large packets setup");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	memcpy(kex_params.proposal, myproposal, sizeof(myproposal));
+	ASSERT_INT_EQ(ssh_init(&client, 0, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_init(&server, 1, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(client, public), 0);
+	run_kex(client, server);
+	TEST_DONE();
+
+	TEST_START("default packet size throughput");
+	do_packet_throughput(client, server, 32 * 1024, total);
+	TEST_DONE();
+
+	TEST_START("ssh_packet_set_maxsize");
+	ASSERT_INT_EQ(ssh_packet_set_maxsize(client, 256 * 1024),
+	    256 * 1024);
+	ASSERT_INT_EQ(ssh_packet_set_maxsize(server, 256 * 1024),
+	    256 * 1024);
+	ASSERT_U_INT_EQ(ssh_packet_get_maxsize(client), 256 * 1024);
+	TEST_DONE();
+
+	TEST_START("large packet size throughput");
+	do_packet_throughput(client, server, 256 * 1024, total);
+	TEST_DONE();
+
+	TEST_START("large packets cleanup");
+	sshkey_free(private);
+	sshkey_free(public);
+	ssh_free(client);
+	ssh_free(server);
+	TEST_DONE();
+}
+
+static void
+do_idle(void)
+{
+	struct ssh *client = NULL, *server = NULL;
+	struct sshkey *private, *public;
+	struct kex_params kex_params;
+	size_t before, after;
+	u_char type;
+
+	TEST_START("idle setup");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	memcpy(kex_params.proposal, myproposal, sizeof(myproposal));
+	kex_params.proposal[PROPOSAL_COMP_ALGS_CTOS] = "zlib";
+	kex_params.proposal[PROPOSAL_COMP_ALGS_STOC] = "zlib";
+	ASSERT_INT_EQ(ssh_init(&client, 0, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_init(&server, 1, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(client, public), 0);
+	run_kex(client, server);
+	do_packet_throughput(client, server, 32 * 1024, 1024 * 1024);
+	TEST_DONE();
+
+	TEST_START("ssh_packet_idle");
+	before = ssh_packet_get_memory(server) + ssh_packet_get_memory(client);
+	ASSERT_INT_EQ(ssh_packet_idle(server), 0);
+	ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_IGNORE);
+	ASSERT_INT_EQ(ssh_packet_idle(server), 0);
+	ASSERT_INT_EQ(ssh_packet_idle(client), 0);
+	after = ssh_packet_get_memory(server) + ssh_packet_get_memory(client);
+	ASSERT_SIZE_T_LT(after, before);
+	if (test_is_verbose())
+		printf("idle connection pair: %zu -> %zu bytes ",
+		    before, after);
+	TEST_DONE();
+
+	TEST_START("compression after idle");
+	do_packet_throughput(client, server, 32 * 1024, 1024 * 1024);
+	ASSERT_INT_EQ(ssh_packet_idle(server), 0);
+	ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+	ASSERT_INT_EQ(ssh_packet_next(client, &type), 0);
+	ASSERT_U_INT_EQ(type, SSH2_MSG_IGNORE);
+	do_packet_throughput(client, server, 1024, 64 * 1024);
+	TEST_DONE();
+
+	TEST_START("idle cleanup");
+	sshkey_free(private);
+	sshkey_free(public);
+	ssh_free(client);
+	ssh_free(server);
+	TEST_DONE();
+}
+
+static int
+sock_is_corked(int fd)
+{
+	socklen_t len;
+	int on = 0;
+
+	len = sizeof(on);
+#if defined(TCP_CORK)
+	ASSERT_INT_EQ(getsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, &len), 0);
+#elif defined(TCP_NOPUSH)
+	ASSERT_INT_EQ(getsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &on, &len), 0);
+#endif
+	return on != 0;
+}
+
+static void
+do_cork(void)
+{
+	struct ssh *ssh = NULL;
+	struct sockaddr_in sin;
+	socklen_t len;
+	u_int64_t writes, blocked, corked;
+	char *data, buf[64 * 1024];
+	int lfd, fd, peer, bufsize = 16 * 1024, i;
+	ssize_t n;
+
+	TEST_START("cork setup");
+	/* a loopback connection with small buffers, so that writes block */
+	ASSERT_INT_NE(lfd = socket(AF_INET, SOCK_STREAM, 0), -1);
+	ASSERT_INT_EQ(setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &bufsize,
+	    sizeof(bufsize)), 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_INT_EQ(bind(lfd, (struct sockaddr *)&sin, sizeof(sin)), 0);
+	ASSERT_INT_EQ(listen(lfd, 1), 0);
+	len = sizeof(sin);
+	ASSERT_INT_EQ(getsockname(lfd, (struct sockaddr *)&sin, &len), 0);
+	ASSERT_INT_NE(fd = socket(AF_INET, SOCK_STREAM, 0), -1);
+	ASSERT_INT_EQ(connect(fd, (struct sockaddr *)&sin, sizeof(sin)), 0);
+	ASSERT_INT_NE(peer = accept(lfd, NULL, NULL), -1);
+	close(lfd);
+	ASSERT_INT_NE(fcntl(fd, F_SETFL, O_NONBLOCK), -1);
+	ASSERT_INT_EQ(ssh_init(&ssh, 0, NULL), 0);
+	ssh_packet_set_connection(ssh, fd, fd);
+	ssh_packet_tune_socket(ssh, 0, 1, bufsize);
+	ASSERT_INT_EQ(sock_is_corked(fd), 0);
+	TEST_DONE();
+
+	TEST_START("cork while writes block");
+	data = calloc(1, 32 * 1024);
+	ASSERT_PTR_NE(data, NULL);
+	for (i = 0; i < 64; i++)
+		ASSERT_INT_EQ(ssh_packet_put(ssh, SSH2_MSG_IGNORE, data,
+		    32 * 1024), 0);
+	ssh_packet_write_poll(ssh);
+	ssh_packet_get_write_stats(ssh, &writes, &blocked, &corked);
+	ASSERT_U64_EQ(corked, 1);
+	ASSERT_U64_NE(blocked, 0);
+	ASSERT_INT_NE(ssh_packet_have_data_to_write(ssh), 0);
+	ASSERT_INT_EQ(sock_is_corked(fd), 1);
+	/* a blocked flush leaves the socket corked */
+	ssh_packet_write_poll(ssh);
+	ASSERT_INT_EQ(sock_is_corked(fd), 1);
+	TEST_DONE();
+
+	TEST_START("uncork once drained");
+	while (ssh_packet_have_data_to_write(ssh)) {
+		ASSERT_INT_EQ(sock_is_corked(fd), 1);
+		ASSERT_INT_GT(n = read(peer, buf, sizeof(buf)), 0);
+		ssh_packet_write_poll(ssh);
+	}
+	ASSERT_INT_EQ(sock_is_corked(fd), 0);
+	ssh_packet_get_write_stats(ssh, &writes, &blocked, &corked);
+	ASSERT_U64_EQ(corked, 1);
+	ASSERT_U64_GT(writes, blocked);
+	TEST_DONE();
+
+	TEST_START("no cork for small flushes");
+	ASSERT_INT_EQ(ssh_packet_put(ssh, SSH2_MSG_IGNORE, data, 1024), 0);
+	ssh_packet_write_poll(ssh);
+	ssh_packet_get_write_stats(ssh, NULL, NULL, &corked);
+	ASSERT_U64_EQ(corked, 1);
+	ASSERT_INT_EQ(sock_is_corked(fd), 0);
+	TEST_DONE();
+
+	TEST_START("cork cleanup");
+	free(data);
+	ssh_free(ssh);
+	close(peer);
+	TEST_DONE();
+}
+
+static int ctx_verified;
+
+static int
+ctx_verify_host_key(struct sshkey *key, struct ssh *ssh)
+{
+	ctx_verified++;
+	return 0;
+}
+
+static void
+do_ctx(void)
+{
+	struct ssh_ctx *client_ctx, *server_ctx;
+	struct ssh *client[4], *server[4];
+	struct sshkey *private, *public, *private2;
+	u_int i;
+
+	TEST_START("ssh_ctx_new");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_generate(KEY_RSA, 1024, &private2), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	ASSERT_INT_EQ(ssh_ctx_new(&server_ctx, 1, NULL), 0);
+	ASSERT_INT_EQ(ssh_ctx_new(&client_ctx, 0, NULL), 0);
+	ASSERT_INT_EQ(ssh_ctx_add_hostkey(server_ctx, private), 0);
+	ASSERT_INT_EQ(ssh_ctx_add_hostkey(server_ctx, private2), 0);
+	ASSERT_INT_EQ(ssh_ctx_add_hostkey(client_ctx, public), 0);
+	TEST_DONE();
+
+	TEST_START("ssh_init_ctx");
+	for (i = 0; i < 4; i++) {
+		ASSERT_INT_EQ(ssh_init_ctx(&client[i], client_ctx), 0);
+		ASSERT_INT_EQ(ssh_init_ctx(&server[i], server_ctx), 0);
+		run_kex(client[i], server[i]);
+	}
+	/* read-only once in use */
+	ASSERT_INT_EQ(ssh_ctx_add_hostkey(server_ctx, private),
+	    SSH_ERR_INVALID_ARGUMENT);
+	TEST_DONE();
+
+	TEST_START("ssh_ctx_free while in use");
+	ssh_ctx_free(client_ctx);
+	ssh_ctx_free(server_ctx);
+	ASSERT_INT_EQ(kex_send_kexinit(client[0]), 0);
+	run_kex(client[0], server[0]);
+	TEST_DONE();
+
+	TEST_START("ssh_ctx verify callback");
+	ASSERT_INT_EQ(ssh_ctx_new(&client_ctx, 0, NULL), 0);
+	ASSERT_INT_EQ(ssh_ctx_set_verify_host_key_callback(client_ctx,
+	    ctx_verify_host_key), 0);
+	ssh_free(client[1]);
+	ASSERT_INT_EQ(ssh_init_ctx(&client[1], client_ctx), 0);
+	ssh_ctx_free(client_ctx);
+	ssh_free(server[1]);
+	ASSERT_INT_EQ(ssh_init(&server[1], 1, NULL), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server[1], private2), 0);
+	ctx_verified = 0;
+	run_kex(client[1], server[1]);
+	ASSERT_INT_EQ(ctx_verified, 1);
+	TEST_DONE();
+
+	TEST_START("ssh_ctx cleanup");
+	for (i = 0; i < 4; i++) {
+		ssh_free(client[i]);
+		ssh_free(server[i]);
+	}
+	sshkey_free(private);
+	sshkey_free(private2);
+	sshkey_free(public);
+	TEST_DONE();
+}
+
+static struct {
+	struct sshkey *key;
+	u_char *data;
+	u_int datalen;
+	u_int signs, verifies;
+} async_test;
+
+static int
+async_sign(struct sshkey *key, u_char **sigp, u_int *lenp,
+    const u_char *data, u_int datalen, struct ssh *ssh)
+{
+	free(async_test.data);
+	ASSERT_PTR_NE(async_test.data = malloc(datalen), NULL);
+	memcpy(async_test.data, data, datalen);
+	async_test.datalen = datalen;
+	async_test.key = key;
+	async_test.signs++;
+	return SSH_ERR_KEX_PENDING;
+}
+
+static int
+async_verify(struct sshkey *key, struct ssh *ssh)
+{
+	async_test.verifies++;
+	return SSH_ERR_KEX_PENDING;
+}
+
+/* fails without SSH_ERR_KEX_PENDING or -1, e.g. out of memory */
+static int
+error_verify(struct sshkey *key, struct ssh *ssh)
+{
+	async_test.verifies++;
+	return SSH_ERR_ALLOC_FAIL;
+}
+
+/* exchange packets until 'ssh' waits for the application */
+static void
+async_run_until_pending(struct ssh *client, struct ssh *server,
+    struct ssh *ssh)
+{
+	u_int i;
+
+	for (i = 0; i < 16 && !ssh_kex_pending(ssh); i++) {
+		ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+		ASSERT_INT_EQ(do_send_and_receive(client, server), 0);
+	}
+	ASSERT_INT_EQ(ssh_kex_pending(ssh), 1);
+}
+
+static void
+do_async(void)
+{
+	struct ssh *client, *server;
+	struct sshkey *private, *public;
+	u_char *sig;
+	u_int i, slen;
+	int r = 0;
+
+	TEST_START("async host key callbacks");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	ASSERT_INT_EQ(ssh_init(&client, 0, NULL), 0);
+	ASSERT_INT_EQ(ssh_init(&server, 1, NULL), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_set_sign_host_key_callback(client, async_sign),
+	    SSH_ERR_INVALID_ARGUMENT);
+	ASSERT_INT_EQ(ssh_set_sign_host_key_callback(server, async_sign), 0);
+	ASSERT_INT_EQ(ssh_set_verify_host_key_callback(client,
+	    async_verify), 0);
+	ASSERT_INT_EQ(ssh_kex_resume(server, 0, NULL, 0),
+	    SSH_ERR_INVALID_ARGUMENT);
+	TEST_DONE();
+
+	TEST_START("async sign");
+	bzero(&async_test, sizeof(async_test));
+	async_run_until_pending(client, server, server);
+	ASSERT_U_INT_EQ(async_test.signs, 1);
+	ASSERT_PTR_EQ(async_test.key, private);
+	/* parked: nothing moves */
+	ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+	ASSERT_INT_EQ(do_send_and_receive(client, server), 0);
+	ASSERT_INT_EQ(ssh_kex_pending(server), 1);
+	ASSERT_U_INT_EQ(async_test.verifies, 0);
+	ASSERT_INT_EQ(sshkey_sign(private, &sig, &slen, async_test.data,
+	    async_test.datalen, 0), 0);
+	ASSERT_INT_EQ(ssh_kex_resume(server, 0, sig, slen), 0);
+	ASSERT_INT_EQ(ssh_kex_pending(server), 0);
+	free(sig);
+	TEST_DONE();
+
+	TEST_START("async verify");
+	async_run_until_pending(client, server, client);
+	ASSERT_U_INT_EQ(async_test.verifies, 1);
+	ASSERT_INT_EQ(client->kex->done, 0);
+	ASSERT_INT_EQ(ssh_kex_resume(client, 0, NULL, 0), 0);
+	run_kex(client, server);
+	TEST_DONE();
+
+	TEST_START("async verify reject");
+	ASSERT_INT_EQ(kex_send_kexinit(client), 0);
+	async_run_until_pending(client, server, server);
+	ASSERT_INT_EQ(sshkey_sign(private, &sig, &slen, async_test.data,
+	    async_test.datalen, 0), 0);
+	ASSERT_INT_EQ(ssh_kex_resume(server, 0, sig, slen), 0);
+	free(sig);
+	async_run_until_pending(client, server, client);
+	ASSERT_INT_EQ(ssh_kex_resume(client, -1, NULL, 0),
+	    SSH_ERR_SIGNATURE_INVALID);
+	ASSERT_INT_EQ(ssh_kex_pending(client), 0);
+	ssh_free(client);
+	ssh_free(server);
+	TEST_DONE();
+
+	TEST_START("verify callback error rejects");
+	ASSERT_INT_EQ(ssh_init(&client, 0, NULL), 0);
+	ASSERT_INT_EQ(ssh_init(&server, 1, NULL), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_set_verify_host_key_callback(client,
+	    error_verify), 0);
+	async_test.verifies = 0;
+	for (i = 0; i < 16 && r == 0; i++) {
+		if ((r = do_send_and_receive(server, client)) == 0)
+			r = do_send_and_receive(client, server);
+	}
+	ASSERT_U_INT_EQ(async_test.verifies, 1);
+	ASSERT_INT_EQ(r, SSH_ERR_SIGNATURE_INVALID);
+	ASSERT_INT_EQ(client->kex->done, 0);
+	TEST_DONE();
+
+	TEST_START("async cleanup");
+	ssh_free(client);
+	ssh_free(server);
+	sshkey_free(private);
+	sshkey_free(public);
+	free(async_test.data);
+	TEST_DONE();
+}
+
+/* run a kex between fresh connections, return the number of round trips */
+static u_int
+guess_kex(char *ckex, char *skex, struct sshkey *private,
+    struct sshkey *public, int *guessed)
+{
+	struct ssh *client, *server;
+	struct kex_params kex_params;
+	u_int rounds;
+
+	memcpy(kex_params.proposal, myproposal, sizeof(myproposal));
+	kex_params.proposal[PROPOSAL_KEX_ALGS] = ckex;
+	ASSERT_INT_EQ(ssh_init(&client, 0, &kex_params), 0);
+	kex_params.proposal[PROPOSAL_KEX_ALGS] = skex;
+	ASSERT_INT_EQ(ssh_init(&server, 1, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(client, public), 0);
+	for (rounds = 0; !server->kex->done || !client->kex->done; rounds++) {
+		ASSERT_U_INT_LT(rounds, 16);
+		ASSERT_INT_EQ(do_send_and_receive(server, client), 0);
+		ASSERT_INT_EQ(do_send_and_receive(client, server), 0);
+	}
+	/* first_kex_packet_follows in the client's KEXINIT */
+	*guessed = sshbuf_ptr(client->kex->my)[sshbuf_len(client->kex->my) - 5];
+	/* rekeying does not guess */
+	ASSERT_INT_EQ(kex_send_kexinit(client), 0);
+	run_kex(client, server);
+	ASSERT_U8_EQ(sshbuf_ptr(client->kex->my)[
+	    sshbuf_len(client->kex->my) - 5], 0);
+	ssh_free(client);
+	ssh_free(server);
+	return rounds;
+}
+
+static void
+do_guess(void)
+{
+	struct sshkey *private, *public;
+	u_int right, wrong, none;
+	int guessed;
+
+	TEST_START("kex guess setup");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	TEST_DONE();
+
+	TEST_START("kex guess right");
+	right = guess_kex("curve25519-sha256@libssh.org,ecdh-sha2-nistp256",
+	    "curve25519-sha256@libssh.org,ecdh-sha2-nistp256", private, public,
+	    &guessed);
+	ASSERT_INT_EQ(guessed, 1);
+	TEST_DONE();
+
+	TEST_START("kex guess wrong");
+	wrong = guess_kex("curve25519-sha256@libssh.org,ecdh-sha2-nistp256",
+	    "ecdh-sha2-nistp256,curve25519-sha256@libssh.org", private, public,
+	    &guessed);
+	ASSERT_INT_EQ(guessed, 1);
+	ASSERT_U_INT_LT(right, wrong);
+	TEST_DONE();
+
+	TEST_START("kex guess not possible");
+	none = guess_kex("diffie-hellman-group14-sha1,ecdh-sha2-nistp256",
+	    "diffie-hellman-group14-sha1,ecdh-sha2-nistp256", private, public,
+	    &guessed);
+	ASSERT_INT_EQ(guessed, 0);
+	ASSERT_U_INT_LT(right, none);
+	TEST_DONE();
+
+	TEST_START("kex guess cleanup");
+	sshkey_free(private);
+	sshkey_free(public);
+	TEST_DONE();
+}
+
+static void
+keypool_kex(struct kex_keypool *pool, char *kex, struct sshkey *private,
+    struct sshkey *public)
+{
+	struct ssh *client, *server;
+	struct kex_params kex_params;
+
+	memcpy(kex_params.proposal, myproposal, sizeof(myproposal));
+	kex_params.proposal[PROPOSAL_KEX_ALGS] = kex;
+	ASSERT_INT_EQ(ssh_init(&client, 0, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_init(&server, 1, &kex_params), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+	ASSERT_INT_EQ(ssh_add_hostkey(client, public), 0);
+	ASSERT_INT_EQ(ssh_set_kex_keypool(client, pool),
+	    SSH_ERR_INVALID_ARGUMENT);
+	ASSERT_INT_EQ(ssh_set_kex_keypool(server, pool), 0);
+	run_kex(client, server);
+	ssh_free(client);
+	ssh_free(server);
+}
+
+static void
+do_keypool(void)
+{
+	struct kex_keypool *pool, *child, *child2;
+	struct kex_keypool_stats st;
+	struct sshkey *private, *public;
+	struct sshbuf *b;
+
+	TEST_START("kex_keypool_fill");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	ASSERT_INT_EQ(kex_keypool_new(&pool, 2), 0);
+	ASSERT_INT_EQ(kex_keypool_want(pool, "ecdh-sha2-nistp256,"
+	    "diffie-hellman-group-exchange-sha256,"
+	    "diffie-hellman-group14-sha1"), 0);
+	ASSERT_U_INT_EQ(kex_keypool_missing(pool), 4);
+	ASSERT_INT_EQ(kex_keypool_fill(pool, 1), 3);
+	ASSERT_INT_EQ(kex_keypool_fill(pool, 100), 0);
+	kex_keypool_get_stats(pool, &st);
+	ASSERT_U_INT_EQ(st.available, 4);
+	ASSERT_U64_EQ(st.generated, 4);
+	TEST_DONE();
+
+	TEST_START("kex_keypool ecdh and dh");
+	keypool_kex(pool, "ecdh-sha2-nistp256", private, public);
+	keypool_kex(pool, "diffie-hellman-group14-sha1", private, public);
+	keypool_kex(pool, "ecdh-sha2-nistp384", private, public);
+	kex_keypool_get_stats(pool, &st);
+	ASSERT_U64_EQ(st.hits, 2);
+	ASSERT_U64_EQ(st.misses, 1);
+	ASSERT_U_INT_EQ(st.available, 2);
+	ASSERT_U_INT_EQ(st.missing, 2);
+	TEST_DONE();
+
+	TEST_START("kex_keypool_split");
+	ASSERT_INT_EQ(kex_keypool_split(pool, 1, &child), 0);
+	kex_keypool_get_stats(pool, &st);
+	ASSERT_U_INT_EQ(st.available, 0);
+	kex_keypool_get_stats(child, &st);
+	ASSERT_U_INT_EQ(st.available, 2);
+	TEST_DONE();
+
+	TEST_START("kex_keypool blob");
+	ASSERT_PTR_NE(b = sshbuf_new(), NULL);
+	ASSERT_INT_EQ(kex_keypool_to_blob(child, b), 0);
+	kex_keypool_get_stats(child, &st);
+	ASSERT_U_INT_EQ(st.available, 0);
+	ASSERT_INT_EQ(kex_keypool_from_blob(b, &child2), 0);
+	ASSERT_SIZE_T_EQ(sshbuf_len(b), 0);
+	keypool_kex(child2, "ecdh-sha2-nistp256", private, public);
+	keypool_kex(child2, "diffie-hellman-group14-sha1", private, public);
+	kex_keypool_get_stats(child2, &st);
+	ASSERT_U64_EQ(st.hits, 2);
+	ASSERT_U_INT_EQ(st.available, 0);
+	sshbuf_free(b);
+	TEST_DONE();
+
+	TEST_START("kex_keypool_free");
+	kex_keypool_free(child2);
+	kex_keypool_free(child);
+	kex_keypool_free(pool);
+	sshkey_free(private);
+	sshkey_free(public);
+	TEST_DONE();
+}
+
+#define ENGINE_CONNS	64
+#define ENGINE_PACKETS	16
+#define ENGINE_TYPE	192
+
+static struct {
+	pthread_mutex_t lock;
+	struct ssh_engine *engine;
+	u_int closed, errors;
+} engine_test = { PTHREAD_MUTEX_INITIALIZER };
+
+/* callbacks run on several shard threads */
+static void
+engine_test_error(void)
+{
+	pthread_mutex_lock(&engine_test.lock);
+	engine_test.errors++;
+	pthread_mutex_unlock(&engine_test.lock);
+}
+
+/* the server side echoes, the client counts the echoes in 'arg' */
+static int
+engine_test_packet(struct ssh_engine_conn *c, u_char type,
+    const u_char *data, size_t len, void *arg)
+{
+	u_int *echoed = arg;
+
+	if (type != ENGINE_TYPE)
+		return SSH_ERR_INVALID_FORMAT;
+	if (echoed == NULL)
+		return ssh_engine_send(c, type, data, len);
+	if (++*echoed < ENGINE_PACKETS)
+		return ssh_engine_send(c, type, data, len);
+	ssh_engine_close(c);
+	return 0;
+}
+
+static void
+engine_test_closed(struct ssh_engine_conn *c, int r, void *arg)
+{
+	pthread_mutex_lock(&engine_test.lock);
+	/* clients close, servers see the EOF */
+	if (r != (arg != NULL ? 0 : SSH_ERR_CONN_CLOSED))
+		engine_test.errors++;
+	if (++engine_test.closed == 2 * ENGINE_CONNS)
+		ssh_engine_stop(engine_test.engine);
+	pthread_mutex_unlock(&engine_test.lock);
+}
+
+/* start sending once the initial key exchange is done */
+static void
+engine_test_start(struct ssh_engine_conn *c, void *arg)
+{
+	struct ssh *ssh = ssh_engine_conn_ssh(c);
+	u_char data[32];
+
+	if (!ssh->kex->done) {
+		if (ssh_engine_timer_add(c, 10, engine_test_start, arg) == NULL)
+			engine_test_error();
+		return;
+	}
+	memset(data, 0, sizeof(data));
+	if (ssh_engine_send(c, ENGINE_TYPE, data, sizeof(data)) != 0)
+		engine_test_error();
+}
+
+static void
+do_engine(int signpool)
+{
+	struct ssh_engine_callbacks cb;
+	struct ssh_engine_stats stats;
+	struct sign_pool_stats sstats;
+	struct ssh_engine_conn *c;
+	struct ssh *client, *server;
+	struct sshkey *private, *public;
+	u_int i, echoed[ENGINE_CONNS];
+	int sp[2];
+
+	TEST_START("ssh_engine setup");
+	signal(SIGPIPE, SIG_IGN);
+	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &private), 0);
+	ASSERT_INT_EQ(sshkey_from_private(private, &public), 0);
+	memset(&cb, 0, sizeof(cb));
+	cb.packet = engine_test_packet;
+	cb.closed = engine_test_closed;
+	ASSERT_INT_EQ(ssh_engine_new(&engine_test.engine, 2, &cb), 0);
+	if (signpool)
+		ASSERT_INT_EQ(ssh_engine_set_signpool(engine_test.engine, 2,
+		    ENGINE_CONNS / 4), 0);
+	engine_test.closed = engine_test.errors = 0;
+	for (i = 0; i < ENGINE_CONNS; i++) {
+		echoed[i] = 0;
+		ASSERT_INT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sp), 0);
+		ASSERT_INT_EQ(ssh_init(&client, 0, NULL), 0);
+		ASSERT_INT_EQ(ssh_init(&server, 1, NULL), 0);
+		ASSERT_INT_EQ(ssh_add_hostkey(server, private), 0);
+		ASSERT_INT_EQ(ssh_add_hostkey(client, public), 0);
+		ASSERT_INT_EQ(ssh_engine_add(engine_test.engine, server, sp[0],
+		    -1, NULL, NULL), 0);
+		ASSERT_INT_EQ(ssh_engine_add(engine_test.engine, client, sp[1],
+		    -1, &echoed[i], &c), 0);
+		ASSERT_PTR_NE(ssh_engine_timer_add(c, 0, engine_test_start,
+		    &echoed[i]), NULL);
+	}
+	TEST_DONE();
+
+	TEST_START("ssh_engine run");
+	ASSERT_INT_EQ(ssh_engine_run(engine_test.engine), 0);
+	ASSERT_U_INT_EQ(engine_test.closed, 2 * ENGINE_CONNS);
+	ASSERT_U_INT_EQ(engine_test.errors, 0);
+	for (i = 0; i < ENGINE_CONNS; i++)
+		ASSERT_U_INT_EQ(echoed[i], ENGINE_PACKETS);
+	ssh_engine_get_stats(engine_test.engine, &stats);
+	ASSERT_U64_EQ(stats.conns, 0);
+	ASSERT_U64_EQ(stats.packets_in, 2 * ENGINE_CONNS * ENGINE_PACKETS);
+	ASSERT_U64_EQ(stats.packets_out, 2 * ENGINE_CONNS * ENGINE_PACKETS);
+	if (test_is_verbose())
+		printf("%llu polls, %llu events ",
+		    (unsigned long long)stats.polls,
+		    (unsigned long long)stats.events);
+	ssh_engine_get_sign_stats(engine_test.engine, &sstats);
+	if (signpool) {
+		/* one signature per server, inline when the queue is full */
+		ASSERT_U64_EQ(sstats.submitted + sstats.rejected,
+		    ENGINE_CONNS);
+		ASSERT_U64_EQ(sstats.completed, sstats.submitted);
+		ASSERT_U_INT_EQ(sstats.depth, 0);
+		ASSERT_U_INT_EQ(sstats.depth_max <= ENGINE_CONNS / 4, 1);
+	} else
+		ASSERT_U64_EQ(sstats.submitted, 0);
+	TEST_DONE();
+
+	TEST_START("ssh_engine cleanup");
+	ssh_engine_free(engine_test.engine);
+	sshkey_free(private);
+	sshkey_free(public);
+	TEST_DONE();
+}
+
+/* RFC 7748 sections 5.2 and 6.1 */
+static const u_char x25519_scalar1[CURVE25519_SIZE] = {
+	0xa5, 0x46, 0xe3, 0x6b, 0xf0, 0x52, 0x7c, 0x9d,
+	0x3b, 0x16, 0x15, 0x4b, 0x82, 0x46, 0x5e, 0xdd,
+	0x62, 0x14, 0x4c, 0x0a, 0xc1, 0xfc, 0x5a, 0x18,
+	0x50, 0x6a, 0x22, 0x44, 0xba, 0x44, 0x9a, 0xc4,
+};
+
+static const u_char x25519_u1[CURVE25519_SIZE] = {
+	0xe6, 0xdb, 0x68, 0x67, 0x58, 0x30, 0x30, 0xdb,
+	0x35, 0x94, 0xc1, 0xa4, 0x24, 0xb1, 0x5f, 0x7c,
+	0x72, 0x66, 0x24, 0xec, 0x26, 0xb3, 0x35, 0x3b,
+	0x10, 0xa9, 0x03, 0xa6, 0xd0, 0xab, 0x1c, 0x4c,
+};
+
+static const u_char x25519_out1[CURVE25519_SIZE] = {
+	0xc3, 0xda, 0x55, 0x37, 0x9d, 0xe9, 0xc6, 0x90,
+	0x8e, 0x94, 0xea, 0x4d, 0xf2, 0x8d, 0x08, 0x4f,
+	0x32, 0xec, 0xcf, 0x03, 0x49, 0x1c, 0x71, 0xf7,
+	0x54, 0xb4, 0x07, 0x55, 0x77, 0xa2, 0x85, 0x52,
+};
+
+static const u_char x25519_scalar2[CURVE25519_SIZE] = {
+	0x4b, 0x66, 0xe9, 0xd4, 0xd1, 0xb4, 0x67, 0x3c,
+	0x5a, 0xd2, 0x26, 0x91, 0x95, 0x7d, 0x6a, 0xf5,
+	0xc1, 0x1b, 0x64, 0x21, 0xe0, 0xea, 0x01, 0xd4,
+	0x2c, 0xa4, 0x16, 0x9e, 0x79, 0x18, 0xba, 0x0d,
+};
+
+static const u_char x25519_u2[CURVE25519_SIZE] = {
+	0xe5, 0x21, 0x0f, 0x12, 0x78, 0x68, 0x11, 0xd3,
+	0xf4, 0xb7, 0x95, 0x9d, 0x05, 0x38, 0xae, 0x2c,
+	0x31, 0xdb, 0xe7, 0x10, 0x6f, 0xc0, 0x3c, 0x3e,
+	0xfc, 0x4c, 0xd5, 0x49, 0xc7, 0x15, 0xa4, 0x93,
+};
+
+static const u_char x25519_out2[CURVE25519_SIZE] = {
+	0x95, 0xcb, 0xde, 0x94, 0x76, 0xe8, 0x90, 0x7d,
+	0x7a, 0xad, 0xe4, 0x5c, 0xb4, 0xb8, 0x73, 0xf8,
+	0x8b, 0x59, 0x5a, 0x68, 0x79, 0x9f, 0xa1, 0x52,
+	0xe6, 0xf8, 0xf7, 0x64, 0x7a, 0xac, 0x79, 0x57,
+};
+
+static const u_char x25519_alice[CURVE25519_SIZE] = {
+	0x77, 0x07, 0x6d, 0x0a, 0x73, 0x18, 0xa5, 0x7d,
+	0x3c, 0x16, 0xc1, 0x72, 0x51, 0xb2, 0x66, 0x45,
+	0xdf, 0x4c, 0x2f, 0x87, 0xeb, 0xc0, 0x99, 0x2a,
+	0xb1, 0x77, 0xfb, 0xa5, 0x1d, 0xb9, 0x2c, 0x2a,
+};
+
+static const u_char x25519_alice_pub[CURVE25519_SIZE] = {
+	0x85, 0x20, 0xf0, 0x09, 0x89, 0x30, 0xa7, 0x54,
+	0x74, 0x8b, 0x7d, 0xdc, 0xb4, 0x3e, 0xf7, 0x5a,
+	0x0d, 0xbf, 0x3a, 0x0d, 0x26, 0x38, 0x1a, 0xf4,
+	0xeb, 0xa4, 0xa9, 0x8e, 0xaa, 0x9b, 0x4e, 0x6a,
+};
+
+static const u_char x25519_bob[CURVE25519_SIZE] = {
+	0x5d, 0xab, 0x08, 0x7e, 0x62, 0x4a, 0x8a, 0x4b,
+	0x79, 0xe1, 0x7f, 0x8b, 0x83, 0x80, 0x0e, 0xe6,
+	0x6f, 0x3b, 0xb1, 0x29, 0x26, 0x18, 0xb6, 0xfd,
+	0x1c, 0x2f, 0x8b, 0x27, 0xff, 0x88, 0xe0, 0xeb,
+};
+
+static const u_char x25519_bob_pub[CURVE25519_SIZE] = {
+	0xde, 0x9e, 0xdb, 0x7d, 0x7b, 0x7d, 0xc1, 0xb4,
+	0xd3, 0x5b, 0x61, 0xc2, 0xec, 0xe4, 0x35, 0x37,
+	0x3f, 0x83, 0x43, 0xc8, 0x5b, 0x78, 0x67, 0x4d,
+	0xad, 0xfc, 0x7e, 0x14, 0x6f, 0x88, 0x2b, 0x4f,
+};
+
+static const u_char x25519_shared[CURVE25519_SIZE] = {
+	0x4a, 0x5d, 0x9d, 0x5b, 0xa4, 0xce, 0x2d, 0xe1,
+	0x72, 0x8e, 0x3b, 0xf4, 0x80, 0x35, 0x0f, 0x25,
+	0xe0, 0x7e, 0x21, 0xc9, 0x47, 0xd1, 0x9e, 0x33,
+	0x76, 0xf0, 0x9b, 0x3c, 0x1e, 0x16, 0x17, 0x42,
+};
+
+static const u_char x25519_iter1000[CURVE25519_SIZE] = {
+	0x68, 0x4c, 0xf5, 0x9b, 0xa8, 0x33, 0x09, 0x55,
+	0x28, 0x00, 0xef, 0x56, 0x6f, 0x2f, 0x4d, 0x3c,
+	0x1c, 0x38, 0x87, 0xc4, 0x93, 0x60, 0xe3, 0x87,
+	0x5f, 0x2e, 0xb9, 0x4d, 0x99, 0x53, 0x2c, 0x51,
+};
+
+static void
+do_x25519(void)
+{
+	u_char k[CURVE25519_SIZE], u[CURVE25519_SIZE], out[CURVE25519_SIZE];
+	BIGNUM *shared;
+	u_int i;
+
+	TEST_START("x25519 vectors");
+	crypto_scalarmult_curve25519(out, x25519_scalar1, x25519_u1);
+	ASSERT_MEM_EQ(out, x25519_out1, sizeof(out));
+	crypto_scalarmult_curve25519(out, x25519_scalar2, x25519_u2);
+	ASSERT_MEM_EQ(out, x25519_out2, sizeof(out));
+	TEST_DONE();
+
+	TEST_START("x25519 iterated");
+	bzero(k, sizeof(k));
+	k[0] = 9;
+	memcpy(u, k, sizeof(u));
+	for (i = 0; i < 1000; i++) {
+		crypto_scalarmult_curve25519(out, k, u);
+		memcpy(u, k, sizeof(u));
+		memcpy(k, out, sizeof(k));
+	}
+	ASSERT_MEM_EQ(k, x25519_iter1000, sizeof(k));
+	TEST_DONE();
+
+	TEST_START("x25519 key agreement");
+	crypto_scalarmult_curve25519_base(out, x25519_alice);
+	ASSERT_MEM_EQ(out, x25519_alice_pub, sizeof(out));
+	crypto_scalarmult_curve25519_base(out, x25519_bob);
+	ASSERT_MEM_EQ(out, x25519_bob_pub, sizeof(out));
+	crypto_scalarmult_curve25519(out, x25519_alice, x25519_bob_pub);
+	ASSERT_MEM_EQ(out, x25519_shared, sizeof(out));
+	crypto_scalarmult_curve25519(out, x25519_bob, x25519_alice_pub);
+	ASSERT_MEM_EQ(out, x25519_shared, sizeof(out));
+	TEST_DONE();
+
+	TEST_START("x25519 low order point");
+	bzero(u, sizeof(u));
+	ASSERT_INT_EQ(kexc25519_shared_key(x25519_alice, u, &shared),
+	    SSH_ERR_KEY_INVALID_EC_VALUE);
+	ASSERT_PTR_EQ(shared, NULL);
+	u[0] = 1;
+	ASSERT_INT_EQ(kexc25519_shared_key(x25519_alice, u, &shared),
+	    SSH_ERR_KEY_INVALID_EC_VALUE);
+	ASSERT_INT_EQ(kexc25519_shared_key(x25519_alice, x25519_bob_pub,
+	    &shared), 0);
+	ASSERT_PTR_NE(shared, NULL);
+	ASSERT_INT_EQ(BN_num_bytes(shared), CURVE25519_SIZE);
+	BN_clear_free(shared);
 	TEST_DONE();
 }
 
@@ -169,6 +1120,8 @@ do_kex(char *kex)
 void
 kex_tests(void)
 {
+	do_x25519();
+	do_kex("curve25519-sha256@libssh.org");
 	do_kex("ecdh-sha2-nistp256");
 	do_kex("ecdh-sha2-nistp384");
 	do_kex("ecdh-sha2-nistp521");
@@ -176,4 +1129,13 @@ kex_tests(void)
 	do_kex("diffie-hellman-group-exchange-sha1");
 	do_kex("diffie-hellman-group14-sha1");
 	do_kex("diffie-hellman-group1-sha1");
+	do_large_packets();
+	do_idle();
+	do_cork();
+	do_ctx();
+	do_keypool();
+	do_async();
+	do_guess();
+	do_engine(0);
+	do_engine(1);
 }
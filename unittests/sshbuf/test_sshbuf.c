@@ -23,7 +23,7 @@ void sshbuf_tests(void);
 void
 sshbuf_tests(void)
 {
-	struct sshbuf *p1;
+	struct sshbuf *p1, *p2, *p3;
 	u_char *dp;
 	size_t sz;
 	int r;
@@ -232,4 +232,68 @@ sshbuf_tests(void)
 	ASSERT_SIZE_T_EQ(sshbuf_avail(p1), 1223);
 	sshbuf_free(p1);
 	TEST_DONE();
+
+	/* NB. uses sshbuf internals */
+	TEST_START("shrink buffer");
+	p1 = sshbuf_new();
+	ASSERT_PTR_NE(p1, NULL);
+	r = sshbuf_reserve(p1, 65536, &dp);
+	ASSERT_INT_EQ(r, 0);
+	ASSERT_PTR_NE(dp, NULL);
+	memset(dp, 0xd7, 65000);
+	memset(dp + 65000, 0x7d, 536);
+	ASSERT_INT_EQ(sshbuf_consume(p1, 65000), 0);
+	ASSERT_SIZE_T_GE(sshbuf_allocated(p1), 65536);
+	ASSERT_INT_EQ(sshbuf_shrink(p1), 0);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p1), 536);
+	ASSERT_SIZE_T_EQ(sshbuf_allocated(p1), 768);
+	ASSERT_MEM_FILLED_EQ(sshbuf_ptr(p1), 0x7d, 536);
+	ASSERT_INT_EQ(sshbuf_consume(p1, 536), 0);
+	ASSERT_INT_EQ(sshbuf_shrink(p1), 0);
+	ASSERT_SIZE_T_EQ(sshbuf_allocated(p1), SSHBUF_SIZE_INIT);
+	sshbuf_free(p1);
+	TEST_DONE();
+
+	TEST_START("read-only buffer");
+	p1 = sshbuf_from("\x00\x00\x00\x02hi!", 7);
+	ASSERT_PTR_NE(p1, NULL);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p1), 7);
+	ASSERT_INT_EQ(sshbuf_put_u8(p1, 1), SSH_ERR_BUFFER_READ_ONLY);
+	ASSERT_INT_EQ(sshbuf_set_max_size(p1, 100), SSH_ERR_BUFFER_READ_ONLY);
+	ASSERT_INT_EQ(sshbuf_froms(p1, &p2), 0);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p1), 1);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p2), 2);
+	ASSERT_MEM_EQ(sshbuf_ptr(p2), "hi", 2);
+	ASSERT_INT_EQ(sshbuf_froms(p1, &p3), SSH_ERR_MESSAGE_INCOMPLETE);
+	ASSERT_PTR_EQ(p3, NULL);
+	sshbuf_reset(p1);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p1), 0);
+	sshbuf_free(p1);
+	sshbuf_free(p2);
+	TEST_DONE();
+
+	TEST_START("child buffers");
+	p1 = sshbuf_new();
+	ASSERT_PTR_NE(p1, NULL);
+	ASSERT_INT_EQ(sshbuf_put_u32(p1, 0xdeadbeef), 0);
+	p2 = sshbuf_fromb(p1);
+	ASSERT_PTR_NE(p2, NULL);
+	ASSERT_PTR_EQ(sshbuf_ptr(p2), sshbuf_ptr(p1));
+	/* The parent may not change while the child refers to it */
+	ASSERT_INT_EQ(sshbuf_put_u8(p1, 1), SSH_ERR_BUFFER_READ_ONLY);
+	p3 = sshbuf_fromb(p2);
+	ASSERT_PTR_NE(p3, NULL);
+	sshbuf_free(p1);
+	sshbuf_free(p2);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p3), 4);
+	ASSERT_U32_EQ(PEEK_U32(sshbuf_ptr(p3)), 0xdeadbeef);
+	sshbuf_free(p3);
+	p1 = sshbuf_new();
+	ASSERT_PTR_NE(p1, NULL);
+	p2 = sshbuf_fromb(p1);
+	ASSERT_PTR_NE(p2, NULL);
+	sshbuf_free(p2);
+	ASSERT_INT_EQ(sshbuf_put_u8(p1, 1), 0);
+	sshbuf_free(p1);
+	TEST_DONE();
 }
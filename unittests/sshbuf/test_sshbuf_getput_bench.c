@@ -0,0 +1,219 @@
+/* 	$OpenBSD$ */
+/*
+ * Microbenchmarks for sshbuf.h bignum and EC point encoding
+ *
+ * Placed in the public domain
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/objects.h>
+
+#include "test_helper.h"
+#include "err.h"
+#include "sshbuf.h"
+
+#define BENCH_ROUNDS	10000
+
+void sshbuf_getput_bench_init(void);
+void sshbuf_getput_bench_tests(void);
+
+/* libcrypto allocations, counted once the hooks below are installed */
+static u_int crypto_allocs;
+static int counting;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void *
+count_malloc(size_t len, const char *file, int line)
+{
+	crypto_allocs++;
+	return malloc(len);
+}
+
+static void *
+count_realloc(void *p, size_t len, const char *file, int line)
+{
+	crypto_allocs++;
+	return realloc(p, len);
+}
+
+static void
+count_free(void *p, const char *file, int line)
+{
+	free(p);
+}
+#else
+static void *
+count_malloc(size_t len)
+{
+	crypto_allocs++;
+	return malloc(len);
+}
+
+static void *
+count_realloc(void *p, size_t len)
+{
+	crypto_allocs++;
+	return realloc(p, len);
+}
+
+static void
+count_free(void *p)
+{
+	free(p);
+}
+#endif
+
+/* Must run before libcrypto allocates anything */
+void
+sshbuf_getput_bench_init(void)
+{
+	counting = CRYPTO_set_mem_functions(count_malloc, count_realloc,
+	    count_free);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+report(const char *what, double start, u_int allocs)
+{
+	if (!test_is_verbose())
+		return;
+	printf("\n  %-28s %8.1f ns/call %6.2f allocs/call ", what,
+	    (now() - start) * 1e9 / BENCH_ROUNDS,
+	    (double)allocs / BENCH_ROUNDS);
+}
+
+void
+sshbuf_getput_bench_tests(void)
+{
+	struct sshbuf *p1;
+	BIGNUM *bn, *bn2;
+	EC_KEY *eck;
+	EC_POINT *ecp;
+	const EC_GROUP *g;
+	BN_CTX *bn_ctx;
+	u_int allocs;
+	double start;
+	int i;
+
+	/* Without the hooks the allocation counts below mean nothing */
+	TEST_START("CRYPTO_set_mem_functions");
+	ASSERT_INT_EQ(counting, 1);
+	TEST_DONE();
+
+	/* Set up, then warm up everything once, before counting */
+	p1 = sshbuf_new();
+	ASSERT_PTR_NE(p1, NULL);
+	bn = BN_new();
+	bn2 = BN_new();
+	ASSERT_PTR_NE(bn, NULL);
+	ASSERT_PTR_NE(bn2, NULL);
+	ASSERT_INT_EQ(BN_rand(bn, 4096, 0, 0), 1);
+	eck = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+	ASSERT_PTR_NE(eck, NULL);
+	ASSERT_INT_EQ(EC_KEY_generate_key(eck), 1);
+	g = EC_KEY_get0_group(eck);
+	ecp = EC_POINT_new(g);
+	ASSERT_PTR_NE(ecp, NULL);
+	bn_ctx = BN_CTX_new();
+	ASSERT_PTR_NE(bn_ctx, NULL);
+	ASSERT_INT_EQ(sshbuf_put_bignum2(p1, bn), 0);
+	ASSERT_INT_EQ(sshbuf_get_bignum2(p1, bn2), 0);
+	ASSERT_INT_EQ(sshbuf_put_ec_ctx(p1, EC_KEY_get0_public_key(eck), g,
+	    bn_ctx), 0);
+	ASSERT_INT_EQ(sshbuf_get_ec_ctx(p1, ecp, g, bn_ctx), 0);
+	ASSERT_SIZE_T_EQ(sshbuf_len(p1), 0);
+
+	TEST_START("sshbuf_put_bignum2 allocations");
+	allocs = crypto_allocs;
+	start = now();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ASSERT_INT_EQ(sshbuf_put_bignum2(p1, bn), 0);
+		ASSERT_INT_EQ(sshbuf_consume(p1, sshbuf_len(p1)), 0);
+	}
+	allocs = crypto_allocs - allocs;
+	report("sshbuf_put_bignum2 4096", start, allocs);
+	ASSERT_U_INT_EQ(allocs, 0);
+	TEST_DONE();
+
+	TEST_START("sshbuf_get_bignum2 allocations");
+	ASSERT_INT_EQ(sshbuf_put_bignum2(p1, bn), 0);
+	allocs = crypto_allocs;
+	start = now();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ASSERT_INT_EQ(sshbuf_get_bignum2(p1, bn2), 0);
+		ASSERT_INT_EQ(sshbuf_put_bignum2(p1, bn2), 0);
+	}
+	allocs = crypto_allocs - allocs;
+	report("sshbuf_get+put_bignum2 4096", start, allocs);
+	ASSERT_U_INT_EQ(allocs, 0);
+	ASSERT_INT_EQ(BN_cmp(bn, bn2), 0);
+	sshbuf_reset(p1);
+	TEST_DONE();
+
+	TEST_START("sshbuf_put_ec_ctx allocations");
+	allocs = crypto_allocs;
+	start = now();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ASSERT_INT_EQ(sshbuf_put_ec_ctx(p1,
+		    EC_KEY_get0_public_key(eck), g, bn_ctx), 0);
+		ASSERT_INT_EQ(sshbuf_consume(p1, sshbuf_len(p1)), 0);
+	}
+	allocs = crypto_allocs - allocs;
+	report("sshbuf_put_ec_ctx p256", start, allocs);
+	ASSERT_U_INT_EQ(allocs, 0);
+	TEST_DONE();
+
+	TEST_START("sshbuf_get_ec_ctx allocations");
+	ASSERT_INT_EQ(sshbuf_put_ec_ctx(p1, EC_KEY_get0_public_key(eck), g,
+	    bn_ctx), 0);
+	allocs = crypto_allocs;
+	start = now();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ASSERT_INT_EQ(sshbuf_get_ec_ctx(p1, ecp, g, bn_ctx), 0);
+		ASSERT_INT_EQ(sshbuf_put_ec_ctx(p1, ecp, g, bn_ctx), 0);
+	}
+	allocs = crypto_allocs - allocs;
+	report("sshbuf_get+put_ec_ctx p256", start, allocs);
+	ASSERT_U_INT_EQ(allocs, 0);
+	ASSERT_INT_EQ(EC_POINT_cmp(g, ecp, EC_KEY_get0_public_key(eck),
+	    bn_ctx), 0);
+	TEST_DONE();
+
+	/* For comparison: without a context, libcrypto allocates its own */
+	TEST_START("sshbuf_put_ec without context");
+	sshbuf_reset(p1);
+	allocs = crypto_allocs;
+	start = now();
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		ASSERT_INT_EQ(sshbuf_put_ec(p1, EC_KEY_get0_public_key(eck),
+		    g), 0);
+		ASSERT_INT_EQ(sshbuf_consume(p1, sshbuf_len(p1)), 0);
+	}
+	report("sshbuf_put_ec p256", start, crypto_allocs - allocs);
+	TEST_DONE();
+
+	BN_CTX_free(bn_ctx);
+	EC_POINT_free(ecp);
+	EC_KEY_free(eck);
+	BN_free(bn);
+	BN_free(bn2);
+	sshbuf_free(p1);
+}
@@ -13,14 +13,18 @@ void sshbuf_getput_crypto_tests(void);
 void sshbuf_misc_tests(void);
 void sshbuf_fuzz_tests(void);
 void sshbuf_getput_fuzz_tests(void);
+void sshbuf_getput_bench_init(void);
+void sshbuf_getput_bench_tests(void);
 
 void
 tests(void)
 {
+	sshbuf_getput_bench_init();	/* before anything uses libcrypto */
 	sshbuf_tests();
 	sshbuf_getput_basic_tests();
 	sshbuf_getput_crypto_tests();
 	sshbuf_misc_tests();
 	sshbuf_fuzz_tests();
 	sshbuf_getput_fuzz_tests();
+	sshbuf_getput_bench_tests();
 }
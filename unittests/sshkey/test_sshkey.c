@@ -20,16 +20,67 @@
 #include "test_helper.h"
 
 #include "err.h"
+#include "ssh2.h"
+#include "sshbuf.h"
 #define SSHBUF_INTERNAL 1	/* access internals for testing */
 #include "key.h"
-
+#include "krl.h"
+
+/* RFC 8032 section 7.1, TEST 1 */
+static const u_char ed25519_seed[ED25519_SEED_SIZE] = {
+	0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60,
+	0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+	0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19,
+	0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60,
+};
+static const u_char ed25519_pk[ED25519_PK_SIZE] = {
+	0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7,
+	0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+	0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25,
+	0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a,
+};
+static const u_char ed25519_sig[ED25519_SIG_SIZE] = {
+	0xe5, 0x56, 0x43, 0x00, 0xc3, 0x60, 0xac, 0x72,
+	0x90, 0x86, 0xe2, 0xcc, 0x80, 0x6e, 0x82, 0x8a,
+	0x84, 0x87, 0x7f, 0x1e, 0xb8, 0xe5, 0xd9, 0x74,
+	0xd8, 0x73, 0xe0, 0x65, 0x22, 0x49, 0x01, 0x55,
+	0x5f, 0xb8, 0x82, 0x15, 0x90, 0xa3, 0x3b, 0xac,
+	0xc6, 0x1e, 0x39, 0x70, 0x1c, 0xf9, 0xb4, 0x6b,
+	0xd2, 0x5b, 0xf5, 0xf0, 0x59, 0x5b, 0xbe, 0x24,
+	0x65, 0x51, 0x41, 0x43, 0x8e, 0x7a, 0x10, 0x0b,
+};
 
 void sshkey_tests(void);
 
+/* Turns 'k' into a user certificate signed by 'ca' */
+static void
+certify_user(struct sshkey *k, const char *key_id, const char *extension,
+    struct sshkey *ca)
+{
+	ASSERT_INT_EQ(sshkey_to_certified(k, 0), 0);
+	k->cert->type = SSH2_CERT_TYPE_USER;
+	k->cert->key_id = strdup(key_id);
+	ASSERT_PTR_NE(k->cert->key_id, NULL);
+	if (extension != NULL) {
+		ASSERT_INT_EQ(sshbuf_put_cstring(k->cert->extensions,
+		    extension), 0);
+		ASSERT_INT_EQ(sshbuf_put_string(k->cert->extensions,
+		    NULL, 0), 0);
+	}
+	ASSERT_INT_EQ(sshkey_certify(k, ca), 0);
+}
+
 void
 sshkey_tests(void)
 {
-	struct sshkey *k1, *kr, *kd, *ke;
+	struct sshkey *k1, *k2, *kr, *kd, *ke, *kf;
+	struct sshbuf *b;
+	u_char pk[ED25519_PK_SIZE], sk[ED25519_SK_SIZE];
+	u_char sig[ED25519_SIG_SIZE], *blob, *blob2, *sigblob, *fp, *fp2;
+	u_int len, len2, siglen, fplen, fplen2;
+	u_int64_t hits, misses;
+	struct sshkrl_build *kb;
+	struct sshkrl *krl;
 
 	TEST_START("new invalid");
 	k1 = sshkey_new(-42);
@@ -76,6 +127,14 @@ sshkey_tests(void)
 	sshkey_free(k1);
 	TEST_DONE();
 
+	TEST_START("new/free KEY_ED25519");
+	k1 = sshkey_new(KEY_ED25519);
+	ASSERT_PTR_NE(k1, NULL);
+	ASSERT_PTR_EQ(k1->ed25519_pk, NULL);
+	ASSERT_PTR_EQ(k1->ed25519_sk, NULL);
+	sshkey_free(k1);
+	TEST_DONE();
+
 	TEST_START("new_private KEY_RSA");
 	k1 = sshkey_new_private(KEY_RSA);
 	ASSERT_PTR_NE(k1, NULL);
@@ -147,6 +206,62 @@ sshkey_tests(void)
 	ASSERT_PTR_NE(EC_KEY_get0_private_key(ke->ecdsa), NULL);
 	TEST_DONE();
 
+	TEST_START("generate KEY_ED25519");
+	ASSERT_INT_EQ(sshkey_generate(KEY_ED25519, 0, &kf), 0);
+	ASSERT_PTR_NE(kf, NULL);
+	ASSERT_INT_EQ(kf->type, KEY_ED25519);
+	ASSERT_PTR_NE(kf->ed25519_pk, NULL);
+	ASSERT_PTR_NE(kf->ed25519_sk, NULL);
+	ASSERT_MEM_EQ(kf->ed25519_sk + ED25519_SEED_SIZE, kf->ed25519_pk,
+	    ED25519_PK_SIZE);
+	TEST_DONE();
+
+	TEST_START("ed25519 RFC 8032 test vector");
+	crypto_sign_ed25519_seed_keypair(pk, sk, ed25519_seed);
+	ASSERT_MEM_EQ(pk, ed25519_pk, sizeof(pk));
+	ASSERT_MEM_EQ(sk, ed25519_seed, sizeof(ed25519_seed));
+	crypto_sign_ed25519(sig, NULL, 0, sk);
+	ASSERT_MEM_EQ(sig, ed25519_sig, sizeof(sig));
+	ASSERT_INT_EQ(crypto_sign_ed25519_verify(sig, NULL, 0, pk), 0);
+	sig[0] ^= 1;
+	ASSERT_INT_EQ(crypto_sign_ed25519_verify(sig, NULL, 0, pk), -1);
+	TEST_DONE();
+
+	TEST_START("sign/verify KEY_ED25519");
+	ASSERT_INT_EQ(sshkey_sign(kf, &sigblob, &siglen,
+	    ed25519_seed, sizeof(ed25519_seed), 0), 0);
+	ASSERT_INT_EQ(sshkey_verify(kf, sigblob, siglen,
+	    ed25519_seed, sizeof(ed25519_seed), 0), 0);
+	ASSERT_INT_NE(sshkey_verify(kf, sigblob, siglen,
+	    ed25519_pk, sizeof(ed25519_pk), 0), 0);
+	ASSERT_INT_NE(sshkey_verify(kf, sigblob, siglen - 1,
+	    ed25519_seed, sizeof(ed25519_seed), 0), 0);
+	free(sigblob);
+	TEST_DONE();
+
+	TEST_START("to/from blob KEY_ED25519");
+	ASSERT_INT_EQ(sshkey_to_blob(kf, &blob, &len), 0);
+	ASSERT_INT_EQ(sshkey_from_blob(blob, len, &k1), 0);
+	ASSERT_INT_EQ(k1->type, KEY_ED25519);
+	ASSERT_PTR_EQ(k1->ed25519_sk, NULL);
+	ASSERT_INT_EQ(sshkey_equal(kf, k1), 1);
+	sshkey_free(k1);
+	ASSERT_INT_EQ(sshkey_from_blob(blob, len - 1, &k1),
+	    SSH_ERR_INVALID_FORMAT);
+	free(blob);
+	TEST_DONE();
+
+	TEST_START("private serialize KEY_ED25519");
+	ASSERT_PTR_NE(b = sshbuf_new(), NULL);
+	ASSERT_INT_EQ(sshkey_private_serialize(kf, b), 0);
+	ASSERT_INT_EQ(sshkey_private_deserialize(b, &k1), 0);
+	ASSERT_SIZE_T_EQ(sshbuf_len(b), 0);
+	ASSERT_INT_EQ(sshkey_equal(kf, k1), 1);
+	ASSERT_MEM_EQ(kf->ed25519_sk, k1->ed25519_sk, ED25519_SK_SIZE);
+	sshkey_free(k1);
+	sshbuf_free(b);
+	TEST_DONE();
+
 	TEST_START("demote KEY_RSA");
 	ASSERT_INT_EQ(sshkey_demote(kr, &k1), 0);
 	ASSERT_PTR_NE(k1, NULL);
@@ -193,10 +308,25 @@ sshkey_tests(void)
 	sshkey_free(k1);
 	TEST_DONE();
 
+	TEST_START("demote KEY_ED25519");
+	ASSERT_INT_EQ(sshkey_demote(kf, &k1), 0);
+	ASSERT_PTR_NE(k1, NULL);
+	ASSERT_PTR_NE(kf, k1);
+	ASSERT_INT_EQ(k1->type, KEY_ED25519);
+	ASSERT_PTR_NE(k1->ed25519_pk, NULL);
+	ASSERT_PTR_EQ(k1->ed25519_sk, NULL);
+	TEST_DONE();
+
+	TEST_START("equal KEY_ED25519/demoted KEY_ED25519");
+	ASSERT_INT_EQ(sshkey_equal(kf, k1), 1);
+	sshkey_free(k1);
+	TEST_DONE();
+
 	TEST_START("equal mismatched key types");
 	ASSERT_INT_EQ(sshkey_equal(kd, kr), 0);
 	ASSERT_INT_EQ(sshkey_equal(kd, ke), 0);
 	ASSERT_INT_EQ(sshkey_equal(kr, ke), 0);
+	ASSERT_INT_EQ(sshkey_equal(ke, kf), 0);
 	TEST_DONE();
 
 	TEST_START("equal different keys");
@@ -209,10 +339,189 @@ sshkey_tests(void)
 	ASSERT_INT_EQ(sshkey_generate(KEY_ECDSA, 256, &k1), 0);
 	ASSERT_INT_EQ(sshkey_equal(ke, k1), 0);
 	sshkey_free(k1);
+	ASSERT_INT_EQ(sshkey_generate(KEY_ED25519, 0, &k1), 0);
+	ASSERT_INT_EQ(sshkey_equal(kf, k1), 0);
+	sshkey_free(k1);
+	TEST_DONE();
+
+	TEST_START("certificate signature cache");
+	ASSERT_INT_EQ(sshkey_from_private(kf, &k1), 0);
+	certify_user(k1, "cache", NULL, ke);
+	ASSERT_INT_EQ(sshkey_to_blob(k1, &blob, &len), 0);
+	ASSERT_INT_EQ(sshkey_cert_cache_init(2), 0);
+	ASSERT_INT_EQ(sshkey_from_blob(blob, len, &k2), 0);
+	sshkey_free(k2);
+	ASSERT_INT_EQ(sshkey_from_blob(blob, len, &k2), 0);
+	ASSERT_INT_EQ(sshkey_equal(k1, k2), 1);
+	sshkey_free(k2);
+	sshkey_cert_cache_stats(&hits, &misses);
+	ASSERT_U64_EQ(hits, 1);
+	ASSERT_U64_EQ(misses, 1);
+	/* A bad signature is never taken from the cache */
+	blob[len - 1] ^= 1;
+	ASSERT_INT_NE(sshkey_from_blob(blob, len, &k2), 0);
+	sshkey_cert_cache_stats(&hits, &misses);
+	ASSERT_U64_EQ(hits, 1);
+	ASSERT_U64_EQ(misses, 2);
+	ASSERT_INT_EQ(sshkey_cert_cache_init(0), 0);
+	free(blob);
+	sshkey_free(k1);
+	TEST_DONE();
+
+	TEST_START("certificate options refer to the certificate blob");
+	ASSERT_INT_EQ(sshkey_from_private(kf, &k1), 0);
+	certify_user(k1, "views", "permit-pty", ke);
+	ASSERT_INT_EQ(sshkey_to_blob(k1, &blob, &len), 0);
+	ASSERT_INT_EQ(sshkey_from_blob(blob, len, &k2), 0);
+	free(blob);
+	ASSERT_INT_EQ(sshkey_equal(k1, k2), 1);
+	ASSERT_SIZE_T_EQ(sshbuf_len(k2->cert->extensions),
+	    sshbuf_len(k1->cert->extensions));
+	ASSERT_MEM_EQ(sshbuf_ptr(k2->cert->extensions),
+	    sshbuf_ptr(k1->cert->extensions),
+	    sshbuf_len(k1->cert->extensions));
+	ASSERT_PTR_GE(sshbuf_ptr(k2->cert->extensions),
+	    sshbuf_ptr(k2->cert->certblob));
+	ASSERT_PTR_LT(sshbuf_ptr(k2->cert->extensions),
+	    sshbuf_ptr(k2->cert->certblob) + sshbuf_len(k2->cert->certblob));
+	/* Dropping the certificate releases the blob and its views */
+	ASSERT_INT_EQ(sshkey_drop_cert(k2), 0);
+	ASSERT_INT_EQ(sshkey_equal_public(k1, k2), 1);
+	sshkey_free(k2);
+	sshkey_free(k1);
+	TEST_DONE();
+
+	TEST_START("memoised blobs and fingerprints");
+	ASSERT_INT_EQ(sshkey_from_private(kr, &k1), 0);
+	ASSERT_INT_EQ(sshkey_to_blob(k1, &blob, &len), 0);
+	/* Serialising a const key leaves it alone */
+	ASSERT_PTR_EQ(k1->memo, NULL);
+	ASSERT_INT_EQ(sshkey_memoise(k1), 0);
+	ASSERT_PTR_NE(k1->memo, NULL);
+	ASSERT_INT_EQ(sshkey_to_blob(k1, &blob2, &len2), 0);
+	ASSERT_U_INT_EQ(len, len2);
+	ASSERT_MEM_EQ(blob, blob2, len);
+	free(blob2);
+	fp = sshkey_fingerprint_raw(k1, SSH_FP_SHA1, &fplen);
+	ASSERT_PTR_NE(fp, NULL);
+	fp2 = sshkey_fingerprint_raw(k1, SSH_FP_SHA1, &fplen2);
+	ASSERT_PTR_NE(fp2, NULL);
+	ASSERT_U_INT_EQ(fplen, 20);
+	ASSERT_U_INT_EQ(fplen, fplen2);
+	ASSERT_MEM_EQ(fp, fp2, fplen);
+	free(fp2);
+	fp2 = sshkey_fingerprint_raw(k1, SSH_FP_MD5, &fplen2);
+	ASSERT_PTR_NE(fp2, NULL);
+	ASSERT_U_INT_EQ(fplen2, 16);
+	free(fp2);
+	ASSERT_INT_EQ(sshkey_to_blob(kr, &blob2, &len2), 0);
+	free(blob2);
+	ASSERT_INT_EQ(sshkey_equal_public(k1, kr), 1);
+	ASSERT_INT_EQ(sshkey_to_blob(kd, &blob2, &len2), 0);
+	free(blob2);
+	ASSERT_INT_EQ(sshkey_equal_public(k1, kd), 0);
+	/* A certificate serialises as its certificate but hashes as its key */
+	certify_user(k1, "memo", NULL, ke);
+	ASSERT_INT_EQ(sshkey_to_blob(k1, &blob2, &len2), 0);
+	ASSERT_INT_NE(len, len2);
+	free(blob2);
+	ASSERT_INT_EQ(sshkey_plain_to_blob(k1, &blob2, &len2), 0);
+	ASSERT_U_INT_EQ(len, len2);
+	ASSERT_MEM_EQ(blob, blob2, len);
+	free(blob2);
+	fp2 = sshkey_fingerprint_raw(k1, SSH_FP_SHA1, &fplen2);
+	ASSERT_PTR_NE(fp2, NULL);
+	ASSERT_MEM_EQ(fp, fp2, fplen);
+	free(fp2);
+	ASSERT_INT_EQ(sshkey_equal_public(k1, kr), 1);
+	ASSERT_INT_EQ(sshkey_drop_cert(k1), 0);
+	ASSERT_INT_EQ(sshkey_equal(k1, kr), 1);
+	free(fp);
+	free(blob);
+	sshkey_free(k1);
+	TEST_DONE();
+
+	TEST_START("key revocation list");
+	ASSERT_INT_EQ(sshkey_from_private(kf, &k1), 0);
+	certify_user(k1, "krl", NULL, ke);
+	kb = sshkrl_build_new();
+	ASSERT_PTR_NE(kb, NULL);
+	sshkrl_build_set_version(kb, 42);
+	ASSERT_INT_EQ(sshkrl_build_revoke_key(kb, kr), 0);
+	ASSERT_INT_EQ(sshkrl_build_revoke_serials(kb, ke, 10, 20), 0);
+	ASSERT_INT_EQ(sshkrl_build_revoke_serials(kb, ke, 5, 9), 0);
+	ASSERT_INT_EQ(sshkrl_build_revoke_serials(kb, ke, 30, 30), 0);
+	b = sshbuf_new();
+	ASSERT_PTR_NE(b, NULL);
+	ASSERT_INT_EQ(sshkrl_build_serialise(kb, b), 0);
+	sshkrl_build_free(kb);
+	ASSERT_INT_EQ(sshkrl_from_blob(sshbuf_ptr(b), sshbuf_len(b), &krl), 0);
+	ASSERT_U64_EQ(sshkrl_version(krl), 42);
+	ASSERT_INT_EQ(sshkrl_check_key(krl, kr), SSH_ERR_KEY_REVOKED);
+	ASSERT_INT_EQ(sshkrl_check_key(krl, kd), 0);
+	ASSERT_INT_EQ(sshkrl_check_key(krl, kf), 0);
+	k1->cert->serial = 4;
+	ASSERT_INT_EQ(sshkrl_check_key(krl, k1), 0);
+	k1->cert->serial = 5;
+	ASSERT_INT_EQ(sshkrl_check_key(krl, k1), SSH_ERR_KEY_REVOKED);
+	k1->cert->serial = 20;
+	ASSERT_INT_EQ(sshkrl_check_key(krl, k1), SSH_ERR_KEY_REVOKED);
+	k1->cert->serial = 21;
+	ASSERT_INT_EQ(sshkrl_check_key(krl, k1), 0);
+	k1->cert->serial = 30;
+	ASSERT_INT_EQ(sshkrl_check_key(krl, k1), SSH_ERR_KEY_REVOKED);
+	sshkrl_free(krl);
+	/* Truncated lists and other files are rejected */
+	ASSERT_INT_EQ(sshkrl_from_blob(sshbuf_ptr(b), sshbuf_len(b) - 1,
+	    &krl), SSH_ERR_INVALID_FORMAT);
+	ASSERT_INT_EQ(sshkrl_from_blob((const u_char *)"ssh-rsa AAAA", 12,
+	    &krl), SSH_ERR_KRL_BAD_MAGIC);
+	sshbuf_free(b);
+	sshkey_free(k1);
+	TEST_DONE();
+
+	TEST_START("interned keys");
+	ASSERT_INT_EQ(sshkey_to_blob(kr, &blob, &len), 0);
+	ASSERT_INT_EQ(sshkey_to_blob(kd, &blob2, &len2), 0);
+	/* Without a table every parse makes a new key */
+	ASSERT_INT_EQ(sshkey_from_blob_shared(blob, len, &k1), 0);
+	ASSERT_INT_EQ(sshkey_from_blob_shared(blob, len, &k2), 0);
+	ASSERT_PTR_NE(k1, k2);
+	sshkey_free(k1);
+	sshkey_free(k2);
+	ASSERT_INT_EQ(sshkey_intern_init(1), 0);
+	ASSERT_INT_EQ(sshkey_from_blob_shared(blob, len, &k1), 0);
+	ASSERT_INT_EQ(sshkey_from_blob_shared(blob, len, &k2), 0);
+	ASSERT_PTR_EQ(k1, k2);
+	ASSERT_INT_EQ(sshkey_equal(k1, kr), 1);
+	/* Shared keys may not be changed */
+	ASSERT_INT_EQ(sshkey_to_certified(k1, 0), SSH_ERR_INVALID_ARGUMENT);
+	sshkey_free(k2);
+	sshkey_intern_stats(&hits, &misses);
+	ASSERT_U64_EQ(hits, 1);
+	ASSERT_U64_EQ(misses, 1);
+	/* The next key pushes the first out, but k1 stays valid */
+	ASSERT_INT_EQ(sshkey_from_blob_shared(blob2, len2, &k2), 0);
+	ASSERT_INT_EQ(sshkey_equal(k2, kd), 1);
+	ASSERT_INT_EQ(sshkey_equal(k1, kr), 1);
+	sshkey_free(k1);
+	ASSERT_INT_EQ(sshkey_from_blob_shared(blob, len, &k1), 0);
+	sshkey_intern_stats(&hits, &misses);
+	ASSERT_U64_EQ(hits, 1);
+	ASSERT_U64_EQ(misses, 3);
+	ASSERT_INT_EQ(sshkey_intern_init(0), 0);
+	/* Keys still held outlive the table */
+	ASSERT_INT_EQ(sshkey_equal(k1, kr), 1);
+	ASSERT_INT_EQ(sshkey_equal(k2, kd), 1);
+	sshkey_free(k1);
+	sshkey_free(k2);
+	free(blob);
+	free(blob2);
 	TEST_DONE();
 
 	sshkey_free(kr);
 	sshkey_free(kd);
 	sshkey_free(ke);
+	sshkey_free(kf);
 
 }
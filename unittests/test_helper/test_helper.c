@@ -177,6 +177,12 @@ set_onerror_func(test_onerror_func_t *f, void *ctx)
 	onerror_ctx = ctx;
 }
 
+int
+test_is_verbose(void)
+{
+	return verbose_mode;
+}
+
 void
 test_done(void)
 {